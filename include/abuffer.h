@@ -0,0 +1,95 @@
+/*
+ * abuffer.h - Reference counted audio buffer descriptors
+ *
+ * Copyright (c) 2014   A. Dilly
+ *
+ * AirCat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * AirCat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ABUFFER_H
+#define _ABUFFER_H
+
+#include <stdint.h>
+
+#include "format.h"
+
+/**
+ * An audio buffer descriptor: PCM samples are passed between pipeline stages
+ * (source, resampler, cache, mixer) by reference instead of being copied in
+ * a buffer provided by the caller. Samples can be read while a reference is
+ * owned and must not be modified when buffer is shared (ref > 1).
+ */
+struct abuffer {
+	/* PCM samples (4 bytes per sample) */
+	unsigned char *data;
+	/* Count of samples in buffer and allocated size (in samples) */
+	size_t len;
+	size_t size;
+	/* Format of samples */
+	struct a_format fmt;
+	/* Reference counter */
+	int ref;
+};
+
+/**
+ * Get callback: a reference on a buffer of a maximum of size samples is
+ * returned in buffer and must be released with abuffer_unref(). Return value
+ * is same as an a_read_cb: count of samples in buffer, 0 if no data is
+ * available (no buffer is returned) and -1 at end of stream.
+ */
+typedef int (*a_get_cb)(void *user_data, struct abuffer **buffer, size_t size);
+
+/**
+ * Allocate a new buffer of size samples with a reference count of 1.
+ */
+struct abuffer *abuffer_new(size_t size);
+
+/**
+ * Take or release a reference on a buffer. Buffer is freed when last
+ * reference is released. Both are thread-safe.
+ */
+struct abuffer *abuffer_ref(struct abuffer *b);
+void abuffer_unref(struct abuffer *b);
+
+/**
+ * Get a writable buffer of at least size samples from a pool of one buffer:
+ * the buffer in pool is reused when no other stage holds a reference on it,
+ * otherwise a new one is allocated and replace it in pool.
+ */
+struct abuffer *abuffer_get_writable(struct abuffer **pool, size_t size);
+
+/**
+ * Adapters between a_read_cb and a_get_cb:
+ *  - abuffer_fill() reads samples from an a_read_cb directly in a buffer of
+ *    pool and return a reference on it, it can be used to implement an
+ *    a_get_cb for a source which decodes in a caller provided buffer,
+ *  - abuffer_read() copies samples returned by an a_get_cb in a caller
+ *    provided buffer, it can be used to implement an a_read_cb.
+ */
+int abuffer_fill(struct abuffer **pool, a_read_cb input, void *user_data,
+		 struct abuffer **buffer, size_t size);
+int abuffer_read(a_get_cb input, void *user_data, unsigned char *buffer,
+		 size_t size, struct a_format *fmt);
+
+/**
+ * Copy statistics: every stage which copies samples from a buffer to another
+ * counts it with abuffer_count_copy() (in samples) and output counts samples
+ * sent to hardware with abuffer_count_output(). abuffer_get_stats() returns
+ * both values in bytes copied and output samples since start.
+ */
+void abuffer_count_copy(size_t samples);
+void abuffer_count_output(size_t samples);
+void abuffer_get_stats(uint64_t *copied, uint64_t *output);
+
+#endif
+
@@ -19,12 +19,13 @@
 #ifndef _AVAHI_CLIENT_H
 #define _AVAHI_CLIENT_H
 
+#include "loop.h"
+
 struct avahi_handle;
 
-int avahi_open(struct avahi_handle **h);
+int avahi_open(struct avahi_handle **h, struct loop_handle *loop);
 int avahi_add_service(struct avahi_handle *h, const char *name, const char *type, unsigned int port, ...);
 int avahi_remove_service(struct avahi_handle *h, const char *name, unsigned int port);
-int avahi_loop(struct avahi_handle *h, int timeout);
 int avahi_close(struct avahi_handle *h);
 
 #endif
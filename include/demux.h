@@ -51,6 +51,7 @@ struct demux_module {
 	unsigned long (*set_pos)(struct demux *, unsigned long);
 	unsigned long (*calc_pos)(struct demux *, unsigned long, off_t *);
 	void (*close)(struct demux *);
+	int (*probe)(struct fs_file *, size_t, struct meta *, int);
 	const size_t min_buffer_size;
 };
 
@@ -63,6 +64,15 @@ int demux_open(struct demux_handle **handle, const char *uri,
 	       unsigned long *samplerate, unsigned char *channels,
 	       size_t cache_size, int use_thread);
 
+/**
+ * Probe a file for its format and metadata without opening a complete
+ * demuxer: only headers and tags are read and the embedded picture is
+ * skipped unless TAG_PICTURE is set in options.
+ * Returns an allocated meta to free with meta_free() or NULL if the format is
+ * not supported.
+ */
+struct meta *demux_probe(const char *uri, int options);
+
 /**
  * Get metadata extracted from stream.
  */
@@ -38,6 +38,8 @@ unsigned char file_get_channels(struct file_handle *h);
 
 unsigned long file_set_pos(struct file_handle *h, unsigned long pos);
 unsigned long file_get_pos(struct file_handle *h);
+/* Get latency of last seek (in us) */
+unsigned long file_get_seek_latency(struct file_handle *h);
 long file_get_length(struct file_handle *h);
 int file_get_status(struct file_handle *h);
 
@@ -0,0 +1,59 @@
+/*
+ * hls.h - An HTTP Live Streaming (HLS) client
+ *
+ * Copyright (c) 2014   A. Dilly
+ *
+ * AirCat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * AirCat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HLS_H
+#define _HLS_H
+
+#include <sys/types.h>
+
+struct hls_handle;
+
+/**
+ * Check if a content type is a HLS playlist (m3u8).
+ */
+int hls_is_playlist(const char *content_type);
+
+/**
+ * Open a HLS stream from a master or media playlist URL. When a master
+ * playlist is given, the first variant stream is played.
+ * The playlist is refreshed in background and next segments are downloaded
+ * in parallel before they are read. Audio frames (ADTS or MPEG audio) are
+ * extracted from segments (MPEG-TS or packed audio).
+ */
+int hls_open(struct hls_handle **handle, const char *url);
+
+/**
+ * Get bandwidth of played variant stream (in b/s, 0 if unknown).
+ */
+unsigned long hls_get_bandwidth(struct hls_handle *h);
+
+/**
+ * Read audio frames from stream. This function waits at most timeout ms for
+ * next segment (timeout must be lower than 1000).
+ * Returns count of bytes read, 0 if no data is available yet or -1 at end of
+ * stream.
+ */
+ssize_t hls_read_timeout(struct hls_handle *h, unsigned char *buffer,
+			 size_t size, long timeout);
+
+/**
+ * Stop all downloads and close HLS stream.
+ */
+void hls_close(struct hls_handle *h);
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * limiter.h - A look-ahead soft limiter for mixer output
+ *
+ * Copyright (c) 2014   A. Dilly
+ *
+ * AirCat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * AirCat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LIMITER_H
+#define _LIMITER_H
+
+#include <stddef.h>
+
+/**
+ * Headroom of mixer when limiter is used: streams are mixed with their volume
+ * divided by this factor, so a sum of streams doesn't saturate, and limiter
+ * applies it back as a make-up gain.
+ */
+#define LIMITER_HEADROOM 4
+
+/* Default threshold of limiter (in dBFS) */
+#define LIMITER_THRESHOLD -1.0
+
+struct limiter_handle;
+
+/**
+ * Open a new limiter for samples in pipeline format. Threshold is the maximum
+ * level of output samples (in dBFS).
+ */
+int limiter_open(struct limiter_handle **handle, unsigned long samplerate,
+		 unsigned char channels, double threshold);
+
+/**
+ * Change threshold of limiter (in dBFS).
+ */
+void limiter_set_threshold(struct limiter_handle *h, double threshold);
+
+/**
+ * Limit frames in place: input samples are attenuated by LIMITER_HEADROOM and
+ * output samples are delayed by look-ahead time of limiter.
+ */
+int limiter_process(struct limiter_handle *h, unsigned char *buffer,
+		    size_t frames);
+
+/**
+ * Clear delay line and gain of limiter.
+ */
+void limiter_reset(struct limiter_handle *h);
+
+/**
+ * Close limiter.
+ */
+void limiter_close(struct limiter_handle *h);
+
+#endif
+
@@ -0,0 +1,93 @@
+/*
+ * loop.h - A shared event loop for file descriptors and timers
+ *
+ * Copyright (c) 2014   A. Dilly
+ *
+ * AirCat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * AirCat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LOOP_H
+#define _LOOP_H
+
+/* Events on file descriptors */
+enum {
+	LOOP_READ = 1,
+	LOOP_WRITE = 2,
+	LOOP_ERROR = 4,
+	LOOP_HANGUP = 8,
+};
+
+struct loop_handle;
+struct loop_fd;
+struct loop_timer;
+
+/* Callback called with events which occured on file descriptor */
+typedef void (*loop_fd_cb)(void *user_data, int fd, int events);
+/* Callback called when timer expires */
+typedef void (*loop_timer_cb)(void *user_data);
+
+/**
+ * Open a new event loop based on epoll.
+ * All callbacks are called from thread which runs loop_run(), with loop lock
+ * held. All functions are thread-safe and can be called from callbacks: when
+ * a file descriptor or a timer is removed, its callback will not be called
+ * anymore once function returns.
+ */
+int loop_open(struct loop_handle **handle);
+
+/**
+ * Run event loop in calling thread until loop_break() is called.
+ */
+int loop_run(struct loop_handle *h);
+
+/**
+ * Stop loop_run(). This function can be called from a signal handler.
+ */
+void loop_break(struct loop_handle *h);
+
+/**
+ * Lock/unlock loop: no callback is called while loop is locked. It can be
+ * used to serialize calls to a module which is driven by loop.
+ */
+void loop_lock(struct loop_handle *h);
+void loop_unlock(struct loop_handle *h);
+
+/**
+ * Close event loop: all remaining file descriptors and timers are removed.
+ */
+void loop_close(struct loop_handle *h);
+
+/**
+ * Watch events (LOOP_READ and/or LOOP_WRITE) on a file descriptor. Errors and
+ * hangups are always reported. The file descriptor is not closed by loop.
+ */
+struct loop_fd *loop_add_fd(struct loop_handle *h, int fd, int events,
+			    loop_fd_cb cb, void *user_data);
+int loop_set_fd(struct loop_fd *f, int events);
+void loop_remove_fd(struct loop_fd *f);
+
+/**
+ * Add a timer which expires after timeout ms (a negative timeout disarms it)
+ * and then every period ms if period is not 0. A timer is never freed when
+ * it expires: it can be armed again with loop_set_timer().
+ * Armed timers are sorted in a heap (O(log n) to arm, remove or expire a
+ * timer) and loop is woken up on first expiration by a timerfd.
+ */
+struct loop_timer *loop_add_timer(struct loop_handle *h, long timeout,
+				  unsigned long period, loop_timer_cb cb,
+				  void *user_data);
+int loop_set_timer(struct loop_timer *t, long timeout, unsigned long period);
+void loop_remove_timer(struct loop_timer *t);
+
+#endif
+
@@ -0,0 +1,68 @@
+/*
+ * loudness.h - An EBU R128 loudness meter
+ *
+ * Copyright (c) 2014   A. Dilly
+ *
+ * AirCat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * AirCat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LOUDNESS_H
+#define _LOUDNESS_H
+
+#include <sys/types.h>
+
+/* Reference loudness used to calculate gains (in LUFS) */
+#define LOUDNESS_REFERENCE -18.0
+
+/* Loudness returned when no block is above absolute gate (in LUFS) */
+#define LOUDNESS_SILENCE -70.0
+
+struct loudness_handle;
+
+/**
+ * Open a new loudness meter for a PCM stream (format of decoders output).
+ */
+int loudness_open(struct loudness_handle **handle, unsigned long samplerate,
+		  unsigned char channels);
+
+/**
+ * Add PCM samples to meter: size is the count of samples (for all channels).
+ */
+void loudness_add(struct loudness_handle *h, const unsigned char *buffer,
+		  size_t size);
+
+/**
+ * Get integrated loudness of all samples added (in LUFS), as defined in
+ * EBU R128 with absolute and relative gates.
+ */
+double loudness_get(struct loudness_handle *h);
+
+/**
+ * Get gain to apply to reach reference loudness (in dB).
+ */
+static inline double loudness_gain(double loudness)
+{
+	return LOUDNESS_REFERENCE - loudness;
+}
+
+/**
+ * Decode a file with file API and get its integrated loudness (in LUFS) and
+ * its duration (in ms). Return -1 if file can't be decoded or if no sample is
+ * read during 1s.
+ */
+int loudness_scan_file(const char *uri, double *loudness,
+		       unsigned long *duration);
+
+void loudness_close(struct loudness_handle *h);
+
+#endif
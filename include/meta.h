@@ -66,6 +66,11 @@ struct meta {
 	unsigned long samplerate;
 	unsigned int channels;
 	size_t stream_offset;
+	/* Gapless info: encoder delay, padding and total samples with delay
+	 * and padding (in samples per channel, 0 if unknown) */
+	unsigned long delay;
+	unsigned long padding;
+	unsigned long samples;
 	/* Picture tag */
 	struct tag_picture picture;
 	/* Extended tags */
@@ -21,6 +21,7 @@
 
 #include "output.h"
 #include "avahi.h"
+#include "loop.h"
 #include "httpd.h"
 #include "event.h"
 #include "timer.h"
@@ -30,6 +31,7 @@
 struct module_attr {
 	struct output_handle *output;
 	struct avahi_handle *avahi;
+	struct loop_handle *loop;
 	struct event_handle *event;
 	struct timer_handle *timer;
 	struct db_handle *db;
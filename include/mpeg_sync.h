@@ -0,0 +1,81 @@
+/*
+ * mpeg_sync.h - MPEG audio (MP3) and ADTS (AAC) frame synchronization
+ *
+ * Copyright (c) 2014   A. Dilly
+ *
+ * AirCat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * AirCat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MPEG_SYNC_H
+#define _MPEG_SYNC_H
+
+#include <sys/types.h>
+
+/**
+ * Size of headers needed to parse a frame header.
+ */
+#define MP3_HEADER_SIZE 4
+#define ADTS_HEADER_SIZE 7
+
+/**
+ * Frame type to synchronize
+ */
+enum mpeg_sync_type {
+	MPEG_SYNC_MP3,	/*!< MPEG audio frame (layer I, II or III) */
+	MPEG_SYNC_ADTS	/*!< AAC frame with ADTS header */
+};
+
+/**
+ * Properties of a frame extracted from its header
+ */
+struct mpeg_frame {
+	unsigned char mpeg;		/*!< MP3: 0: MPEG 1, 1: MPEG 2,
+					     2: MPEG 2.5 / ADTS: 0: MPEG-4,
+					     1: MPEG-2 */
+	unsigned char layer;		/*!< MP3: 0: layer 1, 1: layer 2,
+					     2: layer 3 / ADTS: profile */
+	unsigned int bitrate;		/*!< Bitrate (in kb/s, 0 for ADTS) */
+	unsigned long samplerate;	/*!< Samplerate */
+	unsigned char padding;		/*!< Padding slot is used */
+	unsigned char channels;		/*!< Channel count */
+	unsigned int samples;		/*!< Samples per channel in frame */
+	unsigned int length;		/*!< Frame length (with header) */
+};
+
+/**
+ * Parse a MP3 frame header (MP3_HEADER_SIZE bytes are needed).
+ * Returns 0 if header is valid, -1 otherwise.
+ */
+int mpeg_sync_parse_mp3(const unsigned char *buffer, size_t len,
+			struct mpeg_frame *f);
+
+/**
+ * Parse an ADTS frame header (ADTS_HEADER_SIZE bytes are needed).
+ * Returns 0 if header is valid, -1 otherwise.
+ */
+int mpeg_sync_parse_adts(const unsigned char *buffer, size_t len,
+			 struct mpeg_frame *f);
+
+/**
+ * Find first frame of type in buffer. Candidates are found with memchr() and
+ * a frame is accepted only if it is followed by count - 1 frames with the
+ * same stream properties (at least one when end of buffer is reached first).
+ * Properties of first frame are copied in f if not NULL.
+ * Returns offset of frame in buffer or -1 if no frame has been found.
+ */
+ssize_t mpeg_sync_find(const unsigned char *buffer, size_t len,
+		       enum mpeg_sync_type type, int count,
+		       struct mpeg_frame *f);
+
+#endif
+
@@ -20,6 +20,7 @@
 #define _OUTPUT_H
 
 #include "format.h"
+#include "abuffer.h"
 
 #define OUTPUT_VOLUME_MAX 65535
 
@@ -33,7 +34,9 @@ enum output_stream_key {
 	/* Stream cache fill (in %) */
 	OUTPUT_STREAM_CACHE_FILLING,
 	/* Stream cache current delay (in ms) */
-	OUTPUT_STREAM_CACHE_DELAY
+	OUTPUT_STREAM_CACHE_DELAY,
+	/* Delay before next samples read from stream input are played (in us) */
+	OUTPUT_STREAM_LATENCY
 };
 
 enum stream_status {
@@ -54,15 +57,31 @@ struct output_stream_handle;
 int output_set_volume(struct output_handle *h, unsigned int volume);
 unsigned int output_get_volue(struct output_handle *h);
 
-/* Add/Remove output stream */
+/* Add/Remove output stream: stream is played in zone (NULL or unknown zone for
+ * default zone).
+ */
 struct output_stream_handle *output_add_stream(struct output_handle *h,
 					       const char *name,
+					       const char *zone,
 					       unsigned long samplerate,
 					       unsigned char channels,
 					       unsigned long cache,
 					       int use_cache_thread,
 					       a_read_cb input_callback,
 					       void *user_data);
+/* Add an output stream reading its input with buffer descriptors: samples are
+ * mixed directly from buffers returned by input when no conversion and no
+ * cache are needed.
+ */
+struct output_stream_handle *output_add_stream_get(struct output_handle *h,
+						   const char *name,
+						   const char *zone,
+						   unsigned long samplerate,
+						   unsigned char channels,
+						   unsigned long cache,
+						   int use_cache_thread,
+						   a_get_cb get_callback,
+						   void *user_data);
 void output_remove_stream(struct output_handle *h,
 			  struct output_stream_handle *s);
 
@@ -79,6 +98,10 @@ ssize_t output_write_stream(struct output_handle *h,
 			    const unsigned char *buffer, size_t size,
 			    struct a_format *fmt);
 
+/* Record PCM samples of output stream in a WAV file (NULL to stop) */
+int output_record_stream(struct output_handle *h,
+			 struct output_stream_handle *s, const char *file);
+
 /* Volume output stream control */
 int output_set_volume_stream(struct output_handle *h,
 			     struct output_stream_handle *s,
@@ -86,6 +109,10 @@ int output_set_volume_stream(struct output_handle *h,
 unsigned int output_get_volume_stream(struct output_handle *h,
 				      struct output_stream_handle *s);
 
+/* Fade output stream volume to a new volume during duration (in ms) */
+int output_fade_stream(struct output_handle *h, struct output_stream_handle *s,
+		       unsigned int volume, unsigned long duration);
+
 /* Cache stream control */
 int output_set_cache_stream(struct output_handle *h,
 			    struct output_stream_handle *s,
@@ -96,6 +123,17 @@ unsigned long output_get_status_stream(struct output_handle *h,
 				       struct output_stream_handle *s,
 				       enum output_stream_key key);
 
+/* Tap on mixed samples of a zone (NULL or unknown zone for default zone):
+ * callback is called from mixer thread with mixed frames in pipeline format
+ * and monotonic time at which first frame is played (in us). A NULL callback
+ * removes the tap.
+ */
+typedef void (*output_tap_cb)(void *user_data, const unsigned char *buffer,
+			      size_t frames, struct a_format *fmt,
+			      uint64_t time);
+int output_set_tap(struct output_handle *h, const char *zone, output_tap_cb cb,
+		   void *user_data);
+
 /* Output stream event */
 enum stream_event {
 	STREAM_EVENT_READY,	/*!< Stream is ready to play (cache is full) */
@@ -0,0 +1,66 @@
+/*
+ * recorder.h - A non-blocking stream recorder
+ *
+ * Copyright (c) 2014   A. Dilly
+ *
+ * AirCat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * AirCat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RECORDER_H
+#define _RECORDER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+struct recorder_handle;
+
+/**
+ * Open a new recorder on file (which is created or truncated) and start its
+ * writer thread. If samplerate is not 0, data are PCM samples (format of
+ * decoders output) and a WAV header is added, otherwise data are written as
+ * is (compressed stream).
+ */
+int recorder_open(struct recorder_handle **handle, const char *file,
+		  unsigned long samplerate, unsigned char channels);
+
+/**
+ * Queue size bytes to write in file. This function never blocks: data are
+ * copied in a lock-free queue and written by the writer thread. When queue is
+ * full, data are dropped.
+ * Only one thread can write to a recorder at the same time.
+ * Returns count of bytes queued.
+ */
+size_t recorder_write(struct recorder_handle *h, const unsigned char *buffer,
+		      size_t size);
+
+/**
+ * Get count of bytes written in file.
+ */
+uint64_t recorder_get_size(struct recorder_handle *h);
+
+/**
+ * Get count of bytes dropped since queue was full or disk too slow.
+ */
+uint64_t recorder_get_dropped(struct recorder_handle *h);
+
+/**
+ * Add size bytes to dropped count: data lost before reaching recorder.
+ */
+void recorder_add_dropped(struct recorder_handle *h, uint64_t size);
+
+/**
+ * Write remaining data, stop writer thread and close file.
+ */
+void recorder_close(struct recorder_handle *h);
+
+#endif
@@ -20,6 +20,7 @@
 #define _RESAMPLE_H
 
 #include "format.h"
+#include "abuffer.h"
 
 struct resample_handle;
 
@@ -27,6 +28,14 @@ int resample_open(struct resample_handle **h, unsigned long in_samplerate,
 		  unsigned char in_channels, unsigned long out_samplerate,
 		  unsigned char out_channels, a_read_cb input_callback,
 		  a_write_cb output_callback, void *user_data);
+/* Open a resampler reading its input from buffer descriptors: resample_get()
+ * returns input buffers untouched when no conversion is needed.
+ */
+int resample_open_get(struct resample_handle **h, unsigned long in_samplerate,
+		      unsigned char in_channels, unsigned long out_samplerate,
+		      unsigned char out_channels, a_get_cb input_callback,
+		      void *user_data);
+int resample_get(void *h, struct abuffer **buffer, size_t size);
 int resample_read(void *h, unsigned char *buffer, size_t size,
 		  struct a_format *fmt);
 ssize_t resample_write(void *h, const unsigned char *buffer, size_t size,
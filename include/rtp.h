@@ -18,6 +18,8 @@
 #ifndef TINY_RTP_H
 #define TINY_RTP_H
 
+#include "loop.h"
+
 /* Return code for rtp_read():
  *  - RTP_NO_PACKET: no packet is available, RTP module is filling its buffer,
  *  - RTP_LOST_PACKET: requested packet is never arrived: lost packet,
@@ -34,6 +36,11 @@ struct rtp_attr {
 	unsigned char *ip;
 	unsigned int port;
 	unsigned int rtcp_port;
+	unsigned char *group;		// Multicast group to join (4 bytes):
+					//  NULL for unicast only. Port can be
+					//  shared with other processes.
+	struct loop_handle *loop;	// Event loop which receives packets:
+					//  NULL to receive them in rtp_read().
 	/* Expected packet configuration */
 	unsigned long ssrc;		// SSRC to handle: 0 if unknown
 	unsigned int seq;		// First sequence number: 0 if unknown
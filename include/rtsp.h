@@ -18,6 +18,8 @@
 #ifndef TINY_RTSP_H
 #define TINY_RTSP_H
 
+#include "loop.h"
+
 enum {
 	RTSP_ANNOUNCE,
 	RTSP_DESCRIBE,
@@ -36,10 +38,17 @@ enum {
 struct rtsp_handle;
 struct rtsp_client;
 
-int rtsp_open(struct rtsp_handle **h, unsigned int port, unsigned int max_user,
-	      void *callback, void *read_callback, void *close_callback,
-	      void *user_data);
-int rtsp_loop(struct rtsp_handle *h, unsigned int timeout);
+/* Open a RTSP server listening on port (0 for none): user_data is passed to
+ * callbacks for clients of this port and max_user is for each port. Clients
+ * are handled by loop and callbacks are called from it.
+ */
+int rtsp_open(struct rtsp_handle **h, struct loop_handle *loop,
+	      unsigned int port, unsigned int max_user, void *callback,
+	      void *read_callback, void *close_callback, void *user_data);
+/* Listen on another port: all ports are handled by same loop */
+int rtsp_add_port(struct rtsp_handle *h, unsigned int port, void *user_data);
+/* Stop listening on a port and close its clients */
+int rtsp_remove_port(struct rtsp_handle *h, unsigned int port);
 int rtsp_close(struct rtsp_handle *h);
 
 int rtsp_create_response(struct rtsp_client *c, unsigned int code,
@@ -0,0 +1,124 @@
+/*
+ * sample.h - PCM sample formats and processing kernels
+ *
+ * Copyright (c) 2014   A. Dilly
+ *
+ * AirCat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * AirCat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SAMPLE_H
+#define _SAMPLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum sample_format {
+	SAMPLE_S16,	/*!< Signed 16-bit integer */
+	SAMPLE_S32,	/*!< Signed 32-bit integer */
+	SAMPLE_FLOAT	/*!< 32-bit float in [-1.0;1.0] */
+};
+
+/**
+ * Processing kernels for a sample format. Conversions can be done in place
+ * and len is always a count of samples (all channels).
+ */
+struct sample_ops {
+	enum sample_format format;
+	/* Size of a sample (in bytes) */
+	size_t size;
+	/* Convert from/to signed 32-bit or float samples */
+	void (*from_s32)(unsigned char *out, const unsigned char *in,
+			 size_t len);
+	void (*to_s32)(unsigned char *out, const unsigned char *in, size_t len);
+	void (*from_float)(unsigned char *out, const unsigned char *in,
+			   size_t len);
+	void (*to_float)(unsigned char *out, const unsigned char *in,
+			 size_t len);
+	/* Apply a volume (out = in * volume) */
+	void (*gain)(unsigned char *out, const unsigned char *in, size_t len,
+		     unsigned int volume);
+	/* Mix with a volume (out = out + in * volume) with saturation */
+	void (*mix)(unsigned char *out, const unsigned char *in, size_t len,
+		    unsigned int volume);
+	/* Down-mix frames in place: each output channel is the average of
+	 * input channels with same position modulo output channels.
+	 */
+	void (*down_mix)(unsigned char *buffer, size_t frames,
+			 unsigned char in_channels, unsigned char out_channels);
+	/* Up-mix frames: input channels are repeated on output channels */
+	void (*up_mix)(unsigned char *out, const unsigned char *in,
+		       size_t frames, unsigned char in_channels,
+		       unsigned char out_channels);
+};
+
+/**
+ * Get kernels for a sample format.
+ */
+const struct sample_ops *sample_get_ops(enum sample_format format);
+
+/**
+ * Get/Set format and kernels of pipeline: all decoded samples are passed in
+ * this format between decoders, resampler, cache and outputs. Only S32 and
+ * float are allowed since pipeline uses 4 bytes per sample. Format must be
+ * set at startup, before any stream is opened.
+ */
+int sample_set_format(enum sample_format format);
+enum sample_format sample_get_format(void);
+const struct sample_ops *sample_get_pipeline(void);
+
+/**
+ * Convert samples to pipeline format in place from signed 32-bit samples
+ * (used by decoders).
+ */
+void sample_from_s32(unsigned char *buffer, size_t len);
+
+/**
+ * Convert len samples from a format to another (can be done in place).
+ */
+void sample_convert(unsigned char *out, enum sample_format out_format,
+		    const unsigned char *in, enum sample_format in_format,
+		    size_t len);
+
+/**
+ * State of dither: error feedback of each channel (first channels only) and
+ * seed of noise generator.
+ */
+#define SAMPLE_DITHER_CHANNELS 8
+struct sample_dither {
+	uint32_t seed;
+	float error[SAMPLE_DITHER_CHANNELS];
+};
+
+/**
+ * Convert frames from signed 32-bit or float samples to signed 16-bit samples
+ * with a TPDF dither and a first order noise shaping, instead of truncating
+ * them (can be done in place).
+ */
+void sample_dither_s16(unsigned char *out, const unsigned char *in,
+		       enum sample_format in_format, size_t frames,
+		       unsigned char channels, struct sample_dither *d);
+
+/**
+ * Get a format from its name ("s16", "s32" or "float") or -1 if unknown, and
+ * get name of a format.
+ */
+int sample_parse_format(const char *name);
+const char *sample_format_name(enum sample_format format);
+
+/**
+ * Run kernels of all formats on host and print throughput of each.
+ */
+void sample_benchmark(void);
+
+#endif
+
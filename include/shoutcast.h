@@ -20,6 +20,7 @@
 #define _SHOUTCAST_CLIENT_H
 
 #include "format.h"
+#include "recorder.h"
 
 /**
  * Shoutcast stream type (audio codec)
@@ -60,6 +61,14 @@ struct radio_info {
 	enum shout_type type;	/*!< Stream audio codec type */
 };
 
+/**
+ * Alternative stream of a radio (same content with another bitrate)
+ */
+struct shout_variant {
+	const char *url;	/*!< Stream URL */
+	unsigned int bitrate;	/*!< Stream bitrate (in kb/s) */
+};
+
 struct shout_handle;
 
 int shoutcast_open(struct shout_handle **handle, const char *url,
@@ -80,6 +89,24 @@ enum shout_status shoutcast_get_status(struct shout_handle *h);
 
 int shoutcast_get_filling(struct shout_handle *h);
 
+unsigned long shoutcast_get_reconnects(struct shout_handle *h);
+
+unsigned long shoutcast_get_gap(struct shout_handle *h);
+
+/* Set alternative streams of radio: current bitrate is adapted to cache
+ * filling and throughput by switching stream at a frame boundary. A stream
+ * which can't be connected (or with another codec) is tried again later.
+ * Streams with unknown bitrate are ignored and adaptation is disabled when
+ * bitrate of current stream is unknown (no icy-br and none in first frame).
+ */
+int shoutcast_set_variants(struct shout_handle *h,
+			   const struct shout_variant *variants,
+			   unsigned int count);
+
+unsigned long shoutcast_get_throughput(struct shout_handle *h);
+
+unsigned long shoutcast_get_switches(struct shout_handle *h);
+
 int shoutcast_play(struct shout_handle *h);
 
 int shoutcast_pause(struct shout_handle *h);
@@ -88,8 +115,21 @@ unsigned long shoutcast_get_pause(struct shout_handle *h);
 
 unsigned long shoutcast_skip(struct shout_handle *h, unsigned long skip);
 
+unsigned long shoutcast_rewind(struct shout_handle *h, unsigned long rewind);
+
+unsigned long shoutcast_get_rewind(struct shout_handle *h);
+
+int shoutcast_set_timeshift(struct shout_handle *h, unsigned long len,
+			    const char *path);
+
 void shoutcast_reset(struct shout_handle *h);
 
+/* Set a recorder for received stream (without metadata): previous recorder
+ * is returned and can be closed safely.
+ */
+struct recorder_handle *shoutcast_set_recorder(struct shout_handle *h,
+					       struct recorder_handle *rec);
+
 int shoutcast_close(struct shout_handle *h);
 
 /* Shoutcast event */
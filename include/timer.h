@@ -37,6 +37,8 @@ enum timer_type {
 	TIMER_PERIODIC,
 	TIMER_DATE,
 	TIMER_TIME,
+	TIMER_ONE_SHUT_MS,
+	TIMER_PERIODIC_MS,
 };
 
 struct timer_handle;
@@ -52,6 +54,11 @@ typedef int (*timer_event_cb)(void *);
  *             day = 0
  * TIMER_TIME: value = minute of day since midnight (in second)
  *             day = day of week when to do event
+ * TIMER_ONE_SHUT_MS: same as TIMER_ONE_SHUT with value in ms
+ * TIMER_PERIODIC_MS: same as TIMER_PERIODIC with value in ms
+ *
+ * Delays start when event is enabled (or when timers are started) and
+ * events are called from event loop.
  */
 int timer_event_add(struct timer_handle *h, const char *name,
 		    const char *description, timer_event_cb cb, void *user_data,
@@ -27,6 +27,7 @@
 
 #include "module.h"
 #include "avahi.h"
+#include "loop.h"
 #include "rtsp.h"
 #include "dmap.h"
 #include "raop.h"
@@ -40,6 +41,7 @@
 
 #define BUFFER_SIZE 512
 #define AIRTUNES_ID_SIZE 10
+#define AIRTUNES_PORT 5000
 #define MAX_VOLUME OUTPUT_VOLUME_MAX
 
 #define AIRPORT_PRIVATE_KEY \
@@ -68,9 +70,7 @@
 "-----END RSA PRIVATE KEY-----"
 
 enum {
-	AIRTUNES_STARTING,
 	AIRTUNES_RUNNING,
-	AIRTUNES_STOPPING,
 	AIRTUNES_STOPPED
 };
 
@@ -81,6 +81,8 @@ struct airtunes_stream {
 	char id[AIRTUNES_ID_SIZE+1];
 	/* Stream name */
 	char *name;
+	/* Name of receiver which handles stream */
+	char *receiver;
 	/* Stream status */
 	unsigned long played;
 	unsigned long position;
@@ -125,25 +127,40 @@ struct airtunes_client_data {
 	struct airtunes_stream *infos;
 };
 
+struct airtunes_receiver {
+	/* Receiver configuration */
+	char *name;
+	unsigned int port;
+	char *password;
+	char *zone;
+	/* Hardware address announced */
+	unsigned char hw_addr[6];
+	/* Avahi service name: NULL if receiver is not started */
+	char *service;
+	/* Airtunes handle */
+	struct airtunes_handle *h;
+	/* Next receiver */
+	struct airtunes_receiver *next;
+};
+
 struct airtunes_handle{
+	/* Event loop */
+	struct loop_handle *loop;
 	/* Avahi client */
 	struct avahi_handle *avahi;
 	int local_avahi;
 	unsigned char hw_addr[6];
 	/* Output module */
 	struct output_handle *output;
-	/* Airtunes */
-	char *name;
-	unsigned int port;
-	char *password;
+	/* Airtunes receivers */
+	struct airtunes_receiver *receivers;
+	struct airtunes_receiver *pending;
 	int status;
-	int reload;
 	/* RSA private key */
 	RSA *rsa;
 	/* RTSP server */
 	struct rtsp_handle *rtsp;
-	/* Thread */
-	pthread_t thread;
+	/* Mutex */
 	pthread_mutex_t mutex;
 	/* Stream infos */
 	struct airtunes_stream *streams;
@@ -172,21 +189,20 @@ static int airtunes_open(struct airtunes_handle **handle,
 	h = *handle;
 
 	/* Init structure */
+	h->loop = attr->loop;
 	h->avahi = attr->avahi;
 	h->output = attr->output;
 	h->local_avahi = 0;
 	h->status = AIRTUNES_STOPPED;
-	h->reload = 0;
-	h->name = NULL;
-	h->port = 5000;
-	h->password = NULL;
+	h->receivers = NULL;
+	h->pending = NULL;
 	h->streams = NULL;
 	memcpy(h->hw_addr, buf, 6);
 
 	/* Allocate a local avahi client if no avahi has been passed */
 	if(h->avahi == NULL)
 	{
-		if(avahi_open(&h->avahi) < 0)
+		if(avahi_open(&h->avahi, h->loop) < 0)
 			return -1;
 		h->local_avahi = 1;
 	}
@@ -209,66 +225,120 @@ static int airtunes_open(struct airtunes_handle **handle,
 	return 0;
 }
 
-static void *airtunes_thread(void *user_data)
+static void airtunes_free_receiver(struct airtunes_receiver *r)
 {
-	struct airtunes_handle *h = (struct airtunes_handle*) user_data;
-	char *name;
-	int port;
-	int i;
+	if(r == NULL)
+		return;
 
-	/* Open RTSP server */
-	port = h->port;
-	if(rtsp_open(&h->rtsp, port, 2, &airtunes_request_callback, 
-		     &airtunes_read_callback, &airtunes_close_callback, h) < 0)
-	{
-		h->status = AIRTUNES_STOPPED;
-		return NULL;
-	}
+	if(r->name != NULL)
+		free(r->name);
+	if(r->password != NULL)
+		free(r->password);
+	if(r->zone != NULL)
+		free(r->zone);
+	if(r->service != NULL)
+		free(r->service);
 
-	/* Lock mutex */
-	pthread_mutex_lock(&h->mutex);
+	free(r);
+}
+
+static void airtunes_start_receiver(struct airtunes_handle *h,
+				    struct airtunes_receiver *r)
+{
+	/* Listen on receiver port */
+	if(rtsp_add_port(h->rtsp, r->port, r) != 0)
+		return;
 
 	/* Register the service with Avahi */
-	asprintf(&name, "%02x%02x%02x%02x%02x%02x@%s", h->hw_addr[0],
-		 h->hw_addr[1], h->hw_addr[2], h->hw_addr[3], h->hw_addr[4],
-		 h->hw_addr[5], h->name);
-	avahi_add_service(h->avahi, name, "_raop._tcp", h->port, "tp=TCP,UDP",
-			  "sm=false", "sv=false", "ek=1", "et=0,1", "cn=0,1",
-			  "ch=2", "ss=16", "sr=44100", "pw=false", "vn=3",
-			  "md=0,1,2", "txtvers=1", NULL);
+	asprintf(&r->service, "%02x%02x%02x%02x%02x%02x@%s", r->hw_addr[0],
+		 r->hw_addr[1], r->hw_addr[2], r->hw_addr[3], r->hw_addr[4],
+		 r->hw_addr[5], r->name);
+	avahi_add_service(h->avahi, r->service, "_raop._tcp", r->port,
+			  "tp=TCP,UDP", "sm=false", "sv=false", "ek=1",
+			  "et=0,1", "cn=0,1", "ch=2", "ss=16", "sr=44100",
+			  "pw=false", "vn=3", "md=0,1,2", "txtvers=1", NULL);
+}
 
-	/* Unlock mutex */
-	pthread_mutex_unlock(&h->mutex);
+static void airtunes_stop_receiver(struct airtunes_handle *h,
+				   struct airtunes_receiver *r)
+{
+	if(r->service == NULL)
+		return;
 
-	/* Change status of airtunes */
-	if(h->status != AIRTUNES_STOPPING)
-		h->status = AIRTUNES_RUNNING;
+	/* Remove the service */
+	avahi_remove_service(h->avahi, r->service, r->port);
+	free(r->service);
+	r->service = NULL;
 
-	/* Run RTSP server loop */
-	while(h->status != AIRTUNES_STOPPING && h->status != AIRTUNES_STOPPED)
+	/* Stop listening and close its clients */
+	rtsp_remove_port(h->rtsp, r->port);
+}
+
+static void airtunes_update_receivers(struct airtunes_handle *h)
+{
+	struct airtunes_receiver **np, **op, *n, *o, *old;
+	char *tmp;
+
+	/* Lock mutex */
+	pthread_mutex_lock(&h->mutex);
+
+	/* No new configuration */
+	if(h->pending == NULL)
 	{
-		if(rtsp_loop(h->rtsp, 1000) != 0)
-			break;
-		if(h->local_avahi)
-			avahi_loop(h->avahi, 10);
+		pthread_mutex_unlock(&h->mutex);
+		return;
 	}
-	h->status = AIRTUNES_STOPPING;
 
-	/* Remove the service */
-	avahi_remove_service(h->avahi, name, port);
-	if(h->local_avahi)
-		avahi_loop(h->avahi, 10);
+	/* Keep receivers which have same name and port in new list */
+	old = h->receivers;
+	for(np = &h->pending; *np != NULL; np = &(*np)->next)
+	{
+		n = *np;
+		for(op = &old; *op != NULL; op = &(*op)->next)
+		{
+			if((*op)->port == n->port &&
+			   strcmp((*op)->name, n->name) == 0)
+				break;
+		}
+		if(*op == NULL)
+			continue;
 
-	/* Free name */
-	free(name);
+		/* Update password and zone of running receiver */
+		o = *op;
+		*op = o->next;
+		tmp = o->password;
+		o->password = n->password;
+		n->password = tmp;
+		tmp = o->zone;
+		o->zone = n->zone;
+		n->zone = tmp;
+
+		/* Replace new receiver */
+		o->next = n->next;
+		*np = o;
+		airtunes_free_receiver(n);
+	}
+	h->receivers = h->pending;
+	h->pending = NULL;
 
-	/* Close RTSP server */
-	rtsp_close(h->rtsp);
+	/* Unlock mutex */
+	pthread_mutex_unlock(&h->mutex);
 
-	/* Change status */
-	h->status = AIRTUNES_STOPPED;
+	/* Stop and free receivers which are not in configuration anymore */
+	while(old != NULL)
+	{
+		o = old;
+		old = o->next;
+		airtunes_stop_receiver(h, o);
+		airtunes_free_receiver(o);
+	}
 
-	return NULL;
+	/* Start new receivers */
+	for(n = h->receivers; n != NULL; n = n->next)
+	{
+		if(n->service == NULL)
+			airtunes_start_receiver(h, n);
+	}
 }
 
 static int airtunes_start(struct airtunes_handle *h)
@@ -276,72 +346,155 @@ static int airtunes_start(struct airtunes_handle *h)
 	if(h->status == AIRTUNES_RUNNING)
 		return 0;
 
-	/* Start server */
-	if(pthread_create(&h->thread, NULL, airtunes_thread, h) != 0)
-	{
-		h->status = AIRTUNES_STOPPED;
+	/* Open RTSP server: ports are added for each receiver */
+	if(rtsp_open(&h->rtsp, h->loop, 0, 2, &airtunes_request_callback,
+		     &airtunes_read_callback, &airtunes_close_callback,
+		     NULL) < 0)
 		return -1;
-	}
-	h->status = AIRTUNES_STARTING;
+	h->status = AIRTUNES_RUNNING;
+
+	/* Start receivers: callbacks are called from loop */
+	loop_lock(h->loop);
+	airtunes_update_receivers(h);
+	loop_unlock(h->loop);
 
 	return 0;
 }
 
 static int airtunes_stop(struct airtunes_handle *h)
 {
-	if(h->status == AIRTUNES_STOPPING || h->status == AIRTUNES_STOPPED)
+	struct airtunes_receiver *r;
+
+	if(h->status == AIRTUNES_STOPPED)
 		return 0;
 
-	/* Stop server */
-	h->status = AIRTUNES_STOPPING;
+	/* Lock loop */
+	loop_lock(h->loop);
+
+	/* Remove the services */
+	for(r = h->receivers; r != NULL; r = r->next)
+		airtunes_stop_receiver(h, r);
+
+	/* Close RTSP server */
+	rtsp_close(h->rtsp);
+	h->status = AIRTUNES_STOPPED;
+
+	/* Unlock loop */
+	loop_unlock(h->loop);
 
 	return 0;
 }
 
+static struct airtunes_receiver *airtunes_new_receiver(
+						      struct airtunes_handle *h,
+						      const struct json *c,
+						      unsigned int port)
+{
+	struct airtunes_receiver *r;
+	const char *name = NULL;
+	const char *password = NULL;
+	const char *zone = NULL;
+	unsigned int addr;
+
+	/* Allocate receiver */
+	r = malloc(sizeof(struct airtunes_receiver));
+	if(r == NULL)
+		return NULL;
+	memset(r, 0, sizeof(struct airtunes_receiver));
+	r->h = h;
+
+	/* Parse config */
+	if(c != NULL)
+	{
+		/* Get name, port and password */
+		name = json_get_string(c, "name");
+		if(json_has_key(c, "port") && json_get_int(c, "port") > 0)
+			port = json_get_int(c, "port");
+		password = json_get_string(c, "password");
+
+		/* Get output zone */
+		zone = json_get_string(c, "zone");
+	}
+
+	/* Set values */
+	r->name = strdup(name != NULL && *name != '\0' ? name : "AirCat");
+	r->port = port;
+	if(password != NULL && *password != '\0')
+		r->password = strdup(password);
+	if(zone != NULL && *zone != '\0')
+		r->zone = strdup(zone);
+
+	/* Derive hardware address from port to get a unique one */
+	memcpy(r->hw_addr, h->hw_addr, 6);
+	addr = ((r->hw_addr[4] << 8) | r->hw_addr[5]) + port - AIRTUNES_PORT;
+	r->hw_addr[4] = addr >> 8;
+	r->hw_addr[5] = addr;
+
+	return r;
+}
+
 static int airtunes_set_config(struct airtunes_handle *h, const struct json *c)
 {
-	const char *name;
-	const char *password;
+	struct airtunes_receiver *list = NULL, **last = &list, *r;
+	struct json *receivers = NULL;
+	int i, count = 0;
 
 	if(h == NULL)
 		return -1;
 
-	/* Lock mutex */
-	pthread_mutex_lock(&h->mutex);
+	/* Get additional receivers */
+	if(c != NULL)
+	{
+		receivers = json_get(c, "receivers");
+		if(receivers != NULL)
+			count = json_array_length(receivers);
+	}
 
-	/* Free previous values */
-	if(h->name != NULL)
-		free(h->name);
-	if(h->password != NULL)
-		free(h->password);
-	h->name = NULL;
-	h->password = NULL;
+	/* Main receiver is configured from root of configuration */
+	*last = airtunes_new_receiver(h, c, AIRTUNES_PORT);
+	if(*last != NULL)
+		last = &(*last)->next;
 
-	/* Parse config */
-	if(c != NULL)
+	/* Add other receivers: default port follows main receiver port */
+	for(i = 0; i < count; i++)
 	{
-		/* Get name and password */
-		name = json_get_string(c, "name");
-		if(name != NULL)
-			h->name = strdup(name);
-		password = json_get_string(c, "password");
-		if(password != NULL && *password != '\0')
-			h->password = strdup(password);
+		*last = airtunes_new_receiver(h, json_array_get(receivers, i),
+					      (list != NULL ? list->port :
+					       AIRTUNES_PORT) + i + 1);
+		if(*last != NULL)
+			last = &(*last)->next;
 	}
 
-	/* Set default values */
-	if(h->name == NULL)
-		h->name = strdup("AirCat");
+	/* Lock mutex */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Replace previous pending configuration */
+	while(h->pending != NULL)
+	{
+		r = h->pending;
+		h->pending = r->next;
+		airtunes_free_receiver(r);
+	}
+	h->pending = list;
 
 	/* Unlock mutex */
 	pthread_mutex_unlock(&h->mutex);
 
+	/* Apply new configuration of receivers */
+	if(h->status == AIRTUNES_RUNNING)
+	{
+		loop_lock(h->loop);
+		airtunes_update_receivers(h);
+		loop_unlock(h->loop);
+	}
+
 	return 0;
 }
 
 static struct json *airtunes_get_config(struct airtunes_handle *h)
 {
-	struct json *c;
+	struct airtunes_receiver *r;
+	struct json *c, *receivers, *tmp;
 
 	c = json_new();
 	if(c == NULL)
@@ -350,9 +503,37 @@ static struct json *airtunes_get_config(struct airtunes_handle *h)
 	/* Lock mutex */
 	pthread_mutex_lock(&h->mutex);
 
-	/* Set name and password */
-	json_set_string(c, "name", h->name);
-	json_set_string(c, "password", h->password);
+	/* Get configuration not yet applied in priority */
+	r = h->pending != NULL ? h->pending : h->receivers;
+
+	/* Set name, port and password of main receiver */
+	if(r != NULL)
+	{
+		json_set_string(c, "name", r->name);
+		json_set_int(c, "port", r->port);
+		json_set_string(c, "password", r->password);
+		json_set_string(c, "zone", r->zone);
+		r = r->next;
+	}
+
+	/* Set other receivers */
+	receivers = json_new_array();
+	if(receivers != NULL)
+	{
+		for(; r != NULL; r = r->next)
+		{
+			tmp = json_new();
+			if(tmp == NULL)
+				continue;
+			json_set_string(tmp, "name", r->name);
+			json_set_int(tmp, "port", r->port);
+			json_set_string(tmp, "password", r->password);
+			json_set_string(tmp, "zone", r->zone);
+			if(json_array_add(receivers, tmp) != 0)
+				json_free(tmp);
+		}
+		json_add(c, "receivers", receivers);
+	}
 
 	/* Unlock mutex */
 	pthread_mutex_unlock(&h->mutex);
@@ -395,6 +576,8 @@ static void airtunes_free_stream(struct airtunes_stream *s)
 
 	if(s->name != NULL)
 		free(s->name);
+	if(s->receiver != NULL)
+		free(s->receiver);
 	if(s->title != NULL)
 		free(s->title);
 	if(s->artist != NULL)
@@ -440,6 +623,7 @@ static void airtunes_remove_stream(struct airtunes_handle *h,
 
 static int airtunes_close(struct airtunes_handle *h)
 {
+	struct airtunes_receiver *r;
 	struct airtunes_stream *s;
 
 	if(h == NULL)
@@ -448,9 +632,6 @@ static int airtunes_close(struct airtunes_handle *h)
 	/* Stop server */
 	airtunes_stop(h);
 
-	/* Wait end of thread */
-	pthread_join(h->thread, NULL);
-
 	/* Close Avahi client if local */
 	if(h->local_avahi)
 		avahi_close(h->avahi);
@@ -463,11 +644,19 @@ static int airtunes_close(struct airtunes_handle *h)
 		airtunes_free_stream(s);
 	}
 
-	/* Free strings */
-	if(h->name != NULL)
-		free(h->name);
-	if(h->password != NULL)
-		free(h->password);
+	/* Free receivers */
+	while(h->receivers != NULL)
+	{
+		r = h->receivers;
+		h->receivers = r->next;
+		airtunes_free_receiver(r);
+	}
+	while(h->pending != NULL)
+	{
+		r = h->pending;
+		h->pending = r->next;
+		airtunes_free_receiver(r);
+	}
 
 	/* Free RSA */
 	if(h->rsa != NULL)
@@ -574,7 +763,8 @@ static void airtunes_get_rtp_info(struct rtsp_client *c, uint16_t *seq,
 static int airtunes_request_callback(struct rtsp_client *c, int request,
 				     const char *url, void *user_data)
 {
-	struct airtunes_handle *h = (struct airtunes_handle *) user_data;
+	struct airtunes_receiver *r = (struct airtunes_receiver *) user_data;
+	struct airtunes_handle *h = r->h;
 	struct airtunes_client_data *cdata = (struct airtunes_client_data *)
 							  rtsp_get_user_data(c);
 	struct raop_attr attr;
@@ -601,21 +791,22 @@ static int airtunes_request_callback(struct rtsp_client *c, int request,
 			len = strlen(str) - (strstr(str, ".local") ? 6 : 0);
 			cdata->infos->name = strndup(str, len);
 		}
+		cdata->infos->receiver = strdup(r->name);
 	}
 
 	/* Lock mutex */
 	pthread_mutex_lock(&h->mutex);
 
 	/* Verify password */
-	if(h->password != NULL)
+	if(r->password != NULL)
 	{
 		username = rtsp_digest_auth_get_username(c);
 		if(username == NULL || rtsp_digest_auth_check(c, username, 
-							      h->password,
-							      h->name) != 0)
+							      r->password,
+							      r->name) != 0)
 		{
-			rtsp_create_digest_auth_response(c, h->name, "", 0);
-			airtunes_do_apple_response(c, h->hw_addr,
+			rtsp_create_digest_auth_response(c, r->name, "", 0);
+			airtunes_do_apple_response(c, r->hw_addr,
 						   h->rsa);
 			rtsp_add_response(c, "Server", "AirCat/1.0");
 			rtsp_add_response(c, "CSeq", rtsp_get_header(c, "CSeq",
@@ -634,7 +825,7 @@ static int airtunes_request_callback(struct rtsp_client *c, int request,
 	switch(request)
 	{
 		case RTSP_OPTIONS:
-			RESPONSE_BEGIN(c, h->hw_addr);
+			RESPONSE_BEGIN(c, r->hw_addr);
 			rtsp_add_response(c, "Public", "ANNOUNCE, SETUP, "
 						       "RECORD, PAUSE, FLUSH, "
 						       "TEARDOWN, OPTIONS, "
@@ -643,7 +834,7 @@ static int airtunes_request_callback(struct rtsp_client *c, int request,
 			break;
 		case RTSP_ANNOUNCE:
 			/* Prepare answer */
-			RESPONSE_BEGIN(c, h->hw_addr);
+			RESPONSE_BEGIN(c, r->hw_addr);
 			break;
 		case RTSP_SETUP:
 			/* Get port configuration from Transport */
@@ -674,6 +865,7 @@ static int airtunes_request_callback(struct rtsp_client *c, int request,
 			attr.aes_iv = cdata->aes_iv;
 			attr.codec = cdata->codec;
 			attr.format = cdata->format;
+			attr.loop = h->loop;
 			attr.ip = rtsp_get_ip(c);
 
 			/* Launch RAOP Server */
@@ -685,18 +877,19 @@ static int airtunes_request_callback(struct rtsp_client *c, int request,
 			cdata->channels = raop_get_channels(cdata->raop);
 
 			/* Create audio stream output */
-			cdata->stream = output_add_stream(h->output,
-							  cdata->infos->name,
-							  cdata->samplerate,
-							  cdata->channels, 0, 0,
-							  &raop_read,
-							  cdata->raop);
+			cdata->stream = output_add_stream_get(h->output,
+							     cdata->infos->name,
+							     r->zone,
+							     cdata->samplerate,
+							     cdata->channels,
+							     0, 0, &raop_get,
+							     cdata->raop);
 
 			/* Copy output stream handle in stream structure */
 			cdata->infos->stream = cdata->stream;
 
 			/* Send answer */
-			RESPONSE_BEGIN(c, h->hw_addr);
+			RESPONSE_BEGIN(c, r->hw_addr);
 			rtsp_add_response(c, "Audio-Jack-Status",
 						      "connected; type=analog");
 			snprintf(buffer, BUFFER_SIZE, "%s;server_port=%d;",
@@ -712,13 +905,13 @@ static int airtunes_request_callback(struct rtsp_client *c, int request,
 
 			/* Start stream */
 			output_play_stream(h->output, cdata->stream);
-			RESPONSE_BEGIN(c, h->hw_addr);
+			RESPONSE_BEGIN(c, r->hw_addr);
 			break;
 		case RTSP_SET_PARAMETER:
-			RESPONSE_BEGIN(c, h->hw_addr);
+			RESPONSE_BEGIN(c, r->hw_addr);
 			break;
 		case RTSP_GET_PARAMETER:
-			RESPONSE_BEGIN(c, h->hw_addr);
+			RESPONSE_BEGIN(c, r->hw_addr);
 			break;
 		case RTSP_FLUSH:
 			/* Get flush sequence number */
@@ -730,7 +923,7 @@ static int airtunes_request_callback(struct rtsp_client *c, int request,
 			raop_flush(cdata->raop, seq);
 			cdata->infos->played = 0;
 			output_play_stream(h->output, cdata->stream);
-			RESPONSE_BEGIN(c, h->hw_addr);
+			RESPONSE_BEGIN(c, r->hw_addr);
 			break;
 		case RTSP_TEARDOWN:
 			/* Stop stream */
@@ -742,7 +935,7 @@ static int airtunes_request_callback(struct rtsp_client *c, int request,
 			raop_close(cdata->raop);
 			cdata->raop = NULL;
 
-			RESPONSE_BEGIN(c, h->hw_addr);
+			RESPONSE_BEGIN(c, r->hw_addr);
 			break;
 		default:
 			return -1;
@@ -1089,7 +1282,8 @@ static int airtunes_read_callback(struct rtsp_client *c, unsigned char *buffer,
 				  size_t size, int end_of_stream,
 				  void *user_data)
 {
-	struct airtunes_handle *h = (struct airtunes_handle *) user_data;
+	struct airtunes_receiver *r = (struct airtunes_receiver *) user_data;
+	struct airtunes_handle *h = r->h;
 	struct airtunes_client_data *cdata = (struct airtunes_client_data*)
 							  rtsp_get_user_data(c);
 
@@ -1121,7 +1315,8 @@ static int airtunes_close_callback(struct rtsp_client *c, void *user_data)
 {
 	struct airtunes_client_data *cdata = (struct airtunes_client_data*)
 							  rtsp_get_user_data(c);
-	struct airtunes_handle *h = (struct airtunes_handle *) user_data;
+	struct airtunes_receiver *r = (struct airtunes_receiver *) user_data;
+	struct airtunes_handle *h = r->h;
 
 	if(cdata != NULL)
 	{
@@ -1189,6 +1384,7 @@ static int airtunes_httpd_status(void *user_data, struct httpd_req *req,
 		/* Add values to it */
 		ADD_STRING(tmp, "id", s->id);
 		ADD_STRING(tmp, "name", s->name);
+		ADD_STRING(tmp, "receiver", s->receiver);
 		ADD_STRING(tmp, "title", s->title);
 		ADD_STRING(tmp, "artist", s->artist);
 		ADD_STRING(tmp, "album", s->album);
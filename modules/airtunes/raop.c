@@ -67,6 +67,8 @@ struct raop_handle {
 	unsigned long samples;
 	/* Mutex for read() calls */
 	pthread_mutex_t mutex;
+	/* Buffer descriptor for get() calls */
+	struct abuffer *pool;
 };
 
 /* Callbacks for RTP */
@@ -208,6 +210,7 @@ int raop_open(struct raop_handle **handle, struct raop_attr *attr)
 	h->pcm_remaining = 0;
 	h->silence_remaining = 0;
 	h->samples = 352;
+	h->pool = NULL;
 
 	/* Init mutex */
 	pthread_mutex_init(&h->mutex, NULL);
@@ -243,7 +246,7 @@ int raop_open(struct raop_handle **handle, struct raop_attr *attr)
 	if(attr->transport == RAOP_TCP)
 	{
 		/* Open TCP server */
-		while(raop_tcp_open(&h->tcp, attr->port, 1) != 0)
+		while(raop_tcp_open(&h->tcp, attr->loop, attr->port) != 0)
 		{
 			attr->port++;
 			if(attr->port >= 7000)
@@ -257,6 +260,7 @@ int raop_open(struct raop_handle **handle, struct raop_attr *attr)
 		r_attr.ip = attr->ip;
 		r_attr.port = attr->port;
 		r_attr.rtcp_port = attr->control_port;
+		r_attr.loop = attr->loop;
 		r_attr.payload = 0x60;
 		r_attr.pool_packet_count = RAOP_DEFAULT_POOL * h->samplerate /
 					    h->samples / 1000;
@@ -423,6 +427,17 @@ silence:
 	return total_samples;
 }
 
+int raop_get(void *user_data, struct abuffer **buffer, size_t size)
+{
+	struct raop_handle *h = (struct raop_handle *) user_data;
+
+	if(h == NULL)
+		return -1;
+
+	/* Decode directly in a buffer passed to output */
+	return abuffer_fill(&h->pool, &raop_read, h, buffer, size);
+}
+
 unsigned long raop_get_samplerate(struct raop_handle *h)
 {
 	if(h == NULL)
@@ -482,6 +497,9 @@ int raop_close(struct raop_handle *h)
 		rtp_close(h->rtp);
 	}
 
+	/* Release buffer descriptor */
+	abuffer_unref(h->pool);
+
 	free(h);
 
 	return 0;
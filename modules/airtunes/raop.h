@@ -20,6 +20,8 @@
 #define _RAOP_SERVER_H
 
 #include "format.h"
+#include "abuffer.h"
+#include "loop.h"
 
 enum {RAOP_PCM, RAOP_ALAC, RAOP_AAC};
 enum {RAOP_TCP, RAOP_UDP};
@@ -41,6 +43,8 @@ struct raop_attr{
 	int codec;
 	/* Format string for codec parameters: provided by RTSP */
 	char *format;
+	/* Event loop which receives packets */
+	struct loop_handle *loop;
 };
 
 struct raop_handle;
@@ -49,6 +53,7 @@ int raop_open(struct raop_handle **h, struct raop_attr *attr);
 
 int raop_read(void *h, unsigned char *buffer, size_t size,
 	      struct a_format *fmt);
+int raop_get(void *h, struct abuffer **buffer, size_t size);
 
 unsigned long raop_get_samplerate(struct raop_handle *h);
 
@@ -19,6 +19,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <unistd.h>
@@ -27,16 +30,130 @@
 #include "config.h"
 #endif
 
+#include "raop_tcp.h"
+
+/* TCP stream settings:
+ *  RAOP_TCP_BUFFER_SIZE: size of reception buffer (in bytes),
+ *  RAOP_TCP_RETRY: delay before next read when buffer is full (in ms).
+ */
+#define RAOP_TCP_BUFFER_SIZE 65536
+#define RAOP_TCP_RETRY 20
+
 struct raop_tcp_handle {
+	/* Event loop */
+	struct loop_handle *loop;
 	/* TCP sockets */
-	int server_sock;	// TCP server socket
-	int client_sock;	// TCP client socket
-	/* TODO */
-	unsigned int remaining;	// Remaining bytes in a packet
-	unsigned int timeout;	// Timeout for incoming packet
+	int server_sock;		// TCP server socket
+	int client_sock;		// TCP client socket
+	struct loop_fd *server_fd;
+	struct loop_fd *client_fd;
+	struct loop_timer *retry;	// Resume reception when buffer is full
+	/* Reception buffer filled by loop */
+	unsigned char buffer[RAOP_TCP_BUFFER_SIZE];
+	size_t pos;
+	size_t len;
+	unsigned int remaining;		// Remaining bytes in a packet
+	pthread_mutex_t mutex;
 };
 
-int raop_tcp_open(struct raop_tcp_handle **handle, unsigned int port, unsigned int timeout)
+static void raop_tcp_client_cb(void *user_data, int fd, int events)
+{
+	struct raop_tcp_handle *h = user_data;
+	ssize_t len;
+
+	/* Lock buffer access */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Move data at start of buffer */
+	if(h->pos > 0)
+	{
+		memmove(h->buffer, h->buffer + h->pos, h->len - h->pos);
+		h->len -= h->pos;
+		h->pos = 0;
+	}
+
+	/* Buffer is full: retry later (errors and hangups are still reported
+	 * by loop, so connection is closed to not be woken up again)
+	 */
+	if(h->len == RAOP_TCP_BUFFER_SIZE)
+	{
+		if(events & (LOOP_ERROR | LOOP_HANGUP))
+			goto close;
+		loop_set_fd(h->client_fd, 0);
+		loop_set_timer(h->retry, RAOP_TCP_RETRY, 0);
+		goto end;
+	}
+
+	/* Read data from TCP */
+	len = read(h->client_sock, h->buffer + h->len,
+		   RAOP_TCP_BUFFER_SIZE - h->len);
+	if(len > 0)
+	{
+		h->len += len;
+		goto end;
+	}
+	if(len < 0 && (errno == EAGAIN || errno == EINTR))
+		goto end;
+
+close:
+	/* Connection closed: wait for a new client */
+	loop_remove_fd(h->client_fd);
+	close(h->client_sock);
+	h->client_fd = NULL;
+	h->client_sock = -1;
+	loop_set_fd(h->server_fd, LOOP_READ);
+
+end:
+	/* Unlock buffer access */
+	pthread_mutex_unlock(&h->mutex);
+}
+
+static void raop_tcp_retry_cb(void *user_data)
+{
+	struct raop_tcp_handle *h = user_data;
+
+	/* Resume reception */
+	if(h->client_fd != NULL)
+		loop_set_fd(h->client_fd, LOOP_READ);
+}
+
+static void raop_tcp_server_cb(void *user_data, int fd, int events)
+{
+	struct raop_tcp_handle *h = user_data;
+	struct sockaddr_in addr;
+	socklen_t client_len;
+	int sock;
+
+	/* Accept TCP connection */
+	client_len = sizeof(addr);
+	sock = accept(h->server_sock, (struct sockaddr *)&addr, &client_len);
+	if(sock < 0)
+		return;
+	fcntl(sock, F_SETFL, O_NONBLOCK);
+
+	/* Only one client is handled */
+	if(h->client_sock != -1)
+	{
+		close(sock);
+		return;
+	}
+
+	/* Receive data from loop */
+	h->client_fd = loop_add_fd(h->loop, sock, LOOP_READ,
+				   raop_tcp_client_cb, h);
+	if(h->client_fd == NULL)
+	{
+		close(sock);
+		return;
+	}
+	h->client_sock = sock;
+
+	/* Stop accepting connections */
+	loop_set_fd(h->server_fd, 0);
+}
+
+int raop_tcp_open(struct raop_tcp_handle **handle, struct loop_handle *loop,
+		  unsigned int port)
 {
 	struct raop_tcp_handle *h;
 	struct sockaddr_in addr;
@@ -49,18 +166,24 @@ int raop_tcp_open(struct raop_tcp_handle **handle, unsigned int port, unsigned i
 	h = *handle;
 
 	/* Init structure */
+	h->loop = loop;
 	h->client_sock = -1;
+	h->server_fd = NULL;
+	h->client_fd = NULL;
+	h->retry = NULL;
+	h->pos = 0;
+	h->len = 0;
 	h->remaining = 0;
-	h->timeout = timeout*1000;
+	pthread_mutex_init(&h->mutex, NULL);
 
 	/* Open TCP server */
 	if((h->server_sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-		return -1;
+		goto error;
 
 	/* Force socket to bind */
 	opt = 1;
 	if(setsockopt(h->server_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
-		return -1;
+		goto error;
 
 	/* Bind */
 	memset(&addr, 0, sizeof(addr));
@@ -68,124 +191,96 @@ int raop_tcp_open(struct raop_tcp_handle **handle, unsigned int port, unsigned i
 	addr.sin_port = htons(port);
 	addr.sin_addr.s_addr = htonl(INADDR_ANY);
 	if(bind(h->server_sock, (struct sockaddr *) &addr, sizeof(addr)) != 0)
-		return -1;
+		goto error;
 
 	/* Listen */
-	listen(h->server_sock, 1);
-
-	return 0;
-}
-
-static int raop_tcp_read_timeout(struct raop_tcp_handle *h, unsigned char *buffer, size_t size)
-{
-	struct timeval tv;
-	fd_set readfs;
-
-	FD_ZERO(&readfs);
-	FD_SET(h->client_sock, &readfs);
+	if(listen(h->server_sock, 1) != 0)
+		goto error;
 
-	tv.tv_sec = 0;
-	tv.tv_usec = h->timeout;
-
-	if(select(h->client_sock + 1, &readfs, NULL, NULL, &tv) < 0)
-		return -1;
-
-	if(FD_ISSET(h->client_sock, &readfs))
-	{
-		/* Read a packet from TCP */
-		return read(h->client_sock, buffer, size);
-	}
+	/* Add server socket and retry timer to loop */
+	h->retry = loop_add_timer(loop, -1, 0, raop_tcp_retry_cb, h);
+	h->server_fd = loop_add_fd(loop, h->server_sock, LOOP_READ,
+				   raop_tcp_server_cb, h);
+	if(h->retry == NULL || h->server_fd == NULL)
+		goto error;
 
 	return 0;
-}
 
-static int raop_tcp_accept(struct raop_tcp_handle *h)
-{
-	struct sockaddr_in addr;
-	socklen_t client_len;
-	struct timeval tv;
-	fd_set readfs;
-
-	FD_ZERO(&readfs);
-	FD_SET(h->server_sock, &readfs);
-
-	tv.tv_sec = 0;
-	tv.tv_usec = h->timeout;
-
-	if(select(h->server_sock + 1, &readfs, NULL, NULL, &tv) < 0)
-		return -1;
-
-	if(FD_ISSET(h->server_sock, &readfs))
-	{
-		/* Accept TCP connection */
-		client_len = sizeof(addr);
-		return accept(h->server_sock, (struct sockaddr *)&addr,
-			      &client_len);
-	}
-
-	return 0;
+error:
+	raop_tcp_close(h);
+	*handle = NULL;
+	return -1;
 }
 
 int raop_tcp_read(struct raop_tcp_handle *h, unsigned char *buffer, size_t size)
 {
-	unsigned char header[16];
-	int read_len;
-	int sock;
+	unsigned char *header;
+	int read_len = 0;
 
-	/* Accept a client */
-	if(h->client_sock == -1)
-	{
-		sock = raop_tcp_accept(h);
-		if(sock <= 0)
-			return 0;
-		h->client_sock = sock;
-	}
+	/* Lock buffer access */
+	pthread_mutex_lock(&h->mutex);
 
 	/* Get next packet */
 	if(h->remaining == 0)
 	{
-		read_len = raop_tcp_read_timeout(h, header, 16);
-		if(read_len <= 0)
-			return read_len;
-
 		/* Find the header */
-		while(header[0] != 0x24 || header[1] != 0x00 || header[4] != 0xF0 || header[5] != 0xFF)
+		header = h->buffer + h->pos;
+		while(h->len - h->pos >= 16 &&
+		      (header[0] != 0x24 || header[1] != 0x00 ||
+		       header[4] != 0xF0 || header[5] != 0xFF))
 		{
-			memmove(header, header+1, 15);
-			if(raop_tcp_read_timeout(h, &header[15], 1) < 0)
-				return -1;
+			h->pos++;
+			header++;
 		}
+		if(h->len - h->pos < 16)
+			goto end;
 
 		/* Get packet size */
 		h->remaining = (header[2] << 8) | header[3];
 		h->remaining -= 12;
+		h->pos += 16;
 	}
 
 	/* Read packet */
-	read_len = 0;
 	if(h->remaining > 0)
 	{
-		if(size > h->remaining)
-			size = h->remaining;
-		read_len = raop_tcp_read_timeout(h, buffer, size);
-		if(read_len <= 0)
-			return read_len;
+		read_len = h->len - h->pos;
+		if(read_len > size)
+			read_len = size;
+		if(read_len > h->remaining)
+			read_len = h->remaining;
+		memcpy(buffer, h->buffer + h->pos, read_len);
+		h->pos += read_len;
 		h->remaining -= read_len;
 	}
 
+end:
+	/* Unlock buffer access */
+	pthread_mutex_unlock(&h->mutex);
+
 	return read_len;
 }
 
 int raop_tcp_close(struct raop_tcp_handle *h)
 {
+	if(h == NULL)
+		return 0;
+
+	/* Remove sockets and timer from loop */
+	loop_remove_fd(h->client_fd);
+	loop_remove_fd(h->server_fd);
+	loop_remove_timer(h->retry);
+
 	/* Close client socket */
-	close(h->client_sock);
+	if(h->client_sock >= 0)
+		close(h->client_sock);
 
 	/* Close server socket */
-	close(h->server_sock);
+	if(h->server_sock >= 0)
+		close(h->server_sock);
 
+	pthread_mutex_destroy(&h->mutex);
 	free(h);
 
 	return 0;
 }
-
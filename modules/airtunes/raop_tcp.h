@@ -19,9 +19,13 @@
 #ifndef _RAOP_TCP_SERVER_H
 #define _RAOP_TCP_SERVER_H
 
+#include "loop.h"
+
 struct raop_tcp_handle;
 
-int raop_tcp_open(struct raop_tcp_handle **h, unsigned int port, unsigned int timeout);
+/* Data is received by loop: raop_tcp_read() never blocks */
+int raop_tcp_open(struct raop_tcp_handle **h, struct loop_handle *loop,
+		  unsigned int port);
 
 int raop_tcp_read(struct raop_tcp_handle *h, unsigned char *buffer, size_t size);
 
@@ -24,6 +24,7 @@
 #include <libgen.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <math.h>
 
 #include "files_list.h"
 #include "module.h"
@@ -33,6 +34,13 @@
 
 #define PLAYLIST_ALLOC_SIZE 32
 
+/**
+ * Gapless settings:
+ *  FILES_GAPLESS_TIME: time before end of current file when next file in
+ *                      playlist is opened (in s).
+ */
+#define FILES_GAPLESS_TIME 10
+
 /**
  * Event defines
  */
@@ -40,11 +48,29 @@
 #define FILES_EVENT_PLAYER "play"
 #define FILES_EVENT_STATUS "status"
 
+enum files_replaygain {
+	FILES_REPLAYGAIN_OFF,
+	FILES_REPLAYGAIN_TRACK,
+	FILES_REPLAYGAIN_ALBUM
+};
+
 struct files_playlist {
 	char *filename;
 	struct json *tag;
 };
 
+struct files_player {
+	/* Current and next file read by output stream */
+	struct file_handle *file;
+	struct file_handle *next;
+	/* Samples read and position of last splice (in samples) */
+	uint64_t read;
+	uint64_t splice;
+	pthread_mutex_t mutex;
+	/* Buffer descriptor in which files are decoded */
+	struct abuffer *pool;
+};
+
 struct files_handle {
 	/* Output handle */
 	struct output_handle *output;
@@ -54,11 +80,18 @@ struct files_handle {
 	struct db_handle *db;
 	/* Current file player */
 	struct file_handle *file;
+	struct files_player *player;
 	struct output_stream_handle *stream;
+	unsigned long played_off;
 	unsigned long pos;
 	/* Previous file player */
 	struct file_handle *prev_file;
+	struct files_player *prev_player;
 	struct output_stream_handle *prev_stream;
+	/* Next file opened before end of current file */
+	struct file_handle *next_file;
+	int next_attached;
+	int next_cur;
 	/* Player status */
 	int is_playing;
 	/* Playlist */
@@ -70,10 +103,19 @@ struct files_handle {
 	pthread_t thread;
 	pthread_mutex_t mutex;
 	int stop;
+	/* Loudness analysis thread: a pass is done when analyze is set and
+	 * thread is woken up with condition (both protected by mutex).
+	 */
+	pthread_t analyze_thread;
+	pthread_cond_t analyze_cond;
+	int analyze;
 	/* Configuration */
+	enum files_replaygain replaygain;
+	unsigned long crossfade;
 	char *cover_path;
 	char *mount_path;
 	char *path;
+	char *zone;
 };
 
 /* Data structure used for playlist add from database */
@@ -83,6 +125,7 @@ struct files_add_from_db_data {
 };
 
 static void *files_thread(void *user_data);
+static void *files_analyze_thread(void *user_data);
 static int files_play(struct files_handle *h, int index);
 static int files_stop(struct files_handle *h);
 static int files_set_config(struct files_handle *h, const struct json *c);
@@ -110,14 +153,24 @@ static int files_open(struct files_handle **handle, struct module_attr *attr)
 	h->db = attr->db;
 	h->file = NULL;
 	h->prev_file = NULL;
+	h->next_file = NULL;
+	h->player = NULL;
+	h->prev_player = NULL;
 	h->stream = NULL;
 	h->prev_stream = NULL;
+	h->next_attached = 0;
+	h->next_cur = -1;
+	h->played_off = 0;
 	h->is_playing = 0;
 	h->playlist_cur = -1;
 	h->stop = 0;
+	h->analyze = 1;
+	h->crossfade = 0;
+	h->replaygain = FILES_REPLAYGAIN_OFF;
 	h->cover_path = NULL;
 	h->mount_path = NULL;
 	h->path = NULL;
+	h->zone = NULL;
 
 	/* Allocate playlist */
 	h->playlist = malloc(PLAYLIST_ALLOC_SIZE *
@@ -126,38 +179,253 @@ static int files_open(struct files_handle **handle, struct module_attr *attr)
 		h->playlist_alloc = PLAYLIST_ALLOC_SIZE;
 	h->playlist_len = 0;
 
+	/* Init thread */
+	pthread_mutex_init(&h->mutex, NULL);
+	pthread_cond_init(&h->analyze_cond, NULL);
+
 	/* Set configuration */
 	files_set_config(h, attr->config);
 
 	/* Init database */
 	files_list_init(h->db, h->path);
 
-	/* Init thread */
-	pthread_mutex_init(&h->mutex, NULL);
-
 	/* Create thread */
 	if(pthread_create(&h->thread, NULL, files_thread, h) != 0)
 		return -1;
 
+	/* Create loudness analysis thread */
+	if(pthread_create(&h->analyze_thread, NULL, files_analyze_thread, h)
+	    != 0)
+	{
+		h->stop = 1;
+		pthread_join(h->thread, NULL);
+		return -1;
+	}
+
 	return 0;
 }
 
-static int files_new_player(struct files_handle *h)
+static int files_read(void *user_data, unsigned char *buffer, size_t size,
+		      struct a_format *fmt)
+{
+	struct files_player *p = user_data;
+	int samples;
+
+	/* Lock player */
+	pthread_mutex_lock(&p->mutex);
+
+	/* Read from current file */
+	samples = file_read(p->file, buffer, size, fmt);
+
+	/* Continue with next file in same stream at end of current file */
+	if(samples < 0 && p->next != NULL)
+	{
+		p->file = p->next;
+		p->next = NULL;
+		p->splice = p->read;
+		samples = file_read(p->file, buffer, size, fmt);
+	}
+
+	/* Update samples read */
+	if(samples > 0)
+		p->read += samples;
+
+	/* Unlock player */
+	pthread_mutex_unlock(&p->mutex);
+
+	return samples;
+}
+
+static int files_get(void *user_data, struct abuffer **buffer, size_t size)
+{
+	struct files_player *p = user_data;
+
+	/* Decode directly in a buffer passed to output */
+	return abuffer_fill(&p->pool, &files_read, p, buffer, size);
+}
+
+static void files_free_player(struct files_player *p)
+{
+	if(p == NULL)
+		return;
+
+	abuffer_unref(p->pool);
+	pthread_mutex_destroy(&p->mutex);
+	free(p);
+}
+
+static unsigned long files_get_played(struct files_handle *h)
+{
+	unsigned long played;
+
+	/* Get played time of current file in output stream (in s) */
+	played = output_get_status_stream(h->output, h->stream,
+					  OUTPUT_STREAM_PLAYED);
+	return played > h->played_off ? (played - h->played_off) / 1000 : 0;
+}
+
+static void files_close_next(struct files_handle *h)
+{
+	/* Detach next file from player if not yet read */
+	if(h->player != NULL && h->next_attached)
+	{
+		pthread_mutex_lock(&h->player->mutex);
+		h->player->next = NULL;
+		pthread_mutex_unlock(&h->player->mutex);
+	}
+
+	/* Close next file */
+	file_close(h->next_file);
+	h->next_file = NULL;
+	h->next_attached = 0;
+	h->next_cur = -1;
+}
+
+static void files_open_next(struct files_handle *h)
+{
+	/* Open next file in playlist */
+	h->next_cur = h->playlist_cur + 1;
+	if(file_open(&h->next_file, h->playlist[h->next_cur].filename) != 0)
+	{
+		file_close(h->next_file);
+		h->next_file = NULL;
+		return;
+	}
+
+	/* Play next file in same stream when format is the same and no
+	 * crossfade is done between files
+	 */
+	if(h->crossfade == 0 &&
+	   file_get_samplerate(h->next_file) == file_get_samplerate(h->file)
+	   && file_get_channels(h->next_file) == file_get_channels(h->file))
+	{
+		pthread_mutex_lock(&h->player->mutex);
+		h->player->next = h->next_file;
+		pthread_mutex_unlock(&h->player->mutex);
+		h->next_attached = 1;
+	}
+}
+
+static unsigned int files_get_volume(struct files_handle *h, int index)
+{
+	struct json *tag = h->playlist[index].tag;
+	double gain;
+
+	if(h->replaygain == FILES_REPLAYGAIN_OFF || tag == NULL)
+		return OUTPUT_VOLUME_MAX;
+
+	/* Get gain calculated by loudness analysis */
+	gain = json_get_double(tag, h->replaygain == FILES_REPLAYGAIN_ALBUM ?
+					      "album_gain" : "track_gain");
+
+	/* Gain is applied with stream volume: only attenuation is possible */
+	if(gain >= 0.0)
+		return OUTPUT_VOLUME_MAX;
+	return OUTPUT_VOLUME_MAX * pow(10.0, gain / 20.0);
+}
+
+static int files_check_splice(struct files_handle *h, int force)
+{
+	struct file_handle *file;
+	unsigned long splice;
+	uint64_t pos;
+
+	if(h->player == NULL || !h->next_attached)
+		return 0;
+
+	/* Get file read by player */
+	pthread_mutex_lock(&h->player->mutex);
+	file = h->player->file;
+	pos = h->player->splice;
+	pthread_mutex_unlock(&h->player->mutex);
+
+	/* Next file is not yet read */
+	if(file == h->file)
+		return 0;
+
+	/* Wait end of current file in output stream */
+	splice = pos * 1000 / file_get_samplerate(file) /
+		 file_get_channels(file);
+	if(!force && output_get_status_stream(h->output, h->stream,
+					OUTPUT_STREAM_PLAYED) < splice)
+		return 0;
+
+	/* Close current file which is not used anymore by stream */
+	file_close(h->file);
+
+	/* Next file becomes current file */
+	h->file = file;
+	h->playlist_cur = h->next_cur;
+	h->played_off = splice;
+	h->pos = 0;
+	h->next_file = NULL;
+	h->next_attached = 0;
+	h->next_cur = -1;
+
+	/* Set volume of new file */
+	output_set_volume_stream(h->output, h->stream,
+				 files_get_volume(h, h->playlist_cur));
+
+	/* Notify player update */
+	files_event_player(h);
+
+	return 1;
+}
+
+static int files_new_player(struct files_handle *h, unsigned long fade)
 {
 	unsigned long samplerate;
+	unsigned int volume;
 	unsigned char channels;
-	struct json *event;
+	struct files_player *p;
 
-	/* Start new player */
-	if(file_open(&h->file, h->playlist[h->playlist_cur].filename) != 0)
+	/* Use next file if already opened */
+	if(h->next_file != NULL && h->next_cur == h->playlist_cur)
+	{
+		h->file = h->next_file;
+		h->next_file = NULL;
+		h->next_attached = 0;
+		h->next_cur = -1;
+	}
+	else
+	{
+		/* Close next file */
+		files_close_next(h);
+
+		/* Start new player */
+		if(file_open(&h->file, h->playlist[h->playlist_cur].filename)
+		   != 0)
+		{
+			file_close(h->file);
+			h->file = NULL;
+			h->player = NULL;
+			h->stream = NULL;
+			return -1;
+		}
+	}
+
+	/* Allocate player */
+	p = malloc(sizeof(struct files_player));
+	if(p == NULL)
 	{
 		file_close(h->file);
 		h->file = NULL;
+		h->player = NULL;
 		h->stream = NULL;
 		return -1;
 	}
 
+	/* Init player */
+	p->file = h->file;
+	p->next = NULL;
+	p->read = 0;
+	p->splice = 0;
+	p->pool = NULL;
+	pthread_mutex_init(&p->mutex, NULL);
+	h->player = p;
+
 	/* Set current position to 0 */
+	h->played_off = 0;
 	h->pos = 0;
 
 	/* Get samplerate and channels */
@@ -165,24 +433,47 @@ static int files_new_player(struct files_handle *h)
 	channels = file_get_channels(h->file);
 
 	/* Open new Audio stream output and play */
-	h->stream = output_add_stream(h->output, NULL, samplerate, channels, 0,
-				      0, &file_read, h->file);
+	h->stream = output_add_stream_get(h->output, NULL, h->zone,
+					  samplerate, channels, 0, 0,
+					  &files_get, p);
+
+	/* Set volume from gain or fade in from silence */
+	volume = files_get_volume(h, h->playlist_cur);
+	if(fade > 0)
+	{
+		output_set_volume_stream(h->output, h->stream, 0);
+		output_fade_stream(h->output, h->stream, volume, fade);
+	}
+	else if(volume != OUTPUT_VOLUME_MAX)
+		output_set_volume_stream(h->output, h->stream, volume);
 	output_play_stream(h->output, h->stream);
 
 	return 0;
 }
 
-static void files_play_next(struct files_handle *h)
+static void files_play_next(struct files_handle *h, unsigned long fade)
 {
+	/* Update current file and detach next file from current player */
+	files_check_splice(h, 1);
+	if(h->player != NULL && h->next_attached)
+	{
+		pthread_mutex_lock(&h->player->mutex);
+		h->player->next = NULL;
+		pthread_mutex_unlock(&h->player->mutex);
+		h->next_attached = 0;
+	}
+
 	/* Close previous stream */
 	if(h->prev_stream != NULL)
 		output_remove_stream(h->output, h->prev_stream);
 
 	/* Close previous file */
 	file_close(h->prev_file);
+	files_free_player(h->prev_player);
 
 	/* Move current stream to previous */
 	h->prev_stream = h->stream;
+	h->prev_player = h->player;
 	h->prev_file = h->file;
 
 	/* Open next file in playlist */
@@ -193,11 +484,12 @@ static void files_play_next(struct files_handle *h)
 		{
 			h->playlist_cur = -1;
 			h->stream = NULL;
+			h->player = NULL;
 			h->file = NULL;
 			break;
 		}
 
-		if(files_new_player(h) != 0)
+		if(files_new_player(h, fade) != 0)
 			continue;
 
 		break;
@@ -209,15 +501,21 @@ static void files_play_next(struct files_handle *h)
 
 static void files_play_prev(struct files_handle *h)
 {
+	/* Update current file and close next file */
+	files_check_splice(h, 1);
+	files_close_next(h);
+
 	/* Close previous stream */
 	if(h->prev_stream != NULL)
 		output_remove_stream(h->output, h->prev_stream);
 
 	/* Close previous file */
 	file_close(h->prev_file);
+	files_free_player(h->prev_player);
 
 	/* Move current stream to previous */
 	h->prev_stream = h->stream;
+	h->prev_player = h->player;
 	h->prev_file = h->file;
 
 	/* Open next file in playlist */
@@ -228,11 +526,12 @@ static void files_play_prev(struct files_handle *h)
 		{
 			h->playlist_cur = -1;
 			h->stream = NULL;
+			h->player = NULL;
 			h->file = NULL;
 			break;
 		}
 
-		if(files_new_player(h) != 0)
+		if(files_new_player(h, 0) != 0)
 			continue;
 
 		break;
@@ -242,6 +541,24 @@ static void files_play_prev(struct files_handle *h)
 	files_event_player(h);
 }
 
+static void files_crossfade(struct files_handle *h)
+{
+	unsigned long played, end;
+
+	/* Get remaining time of current file (in ms) */
+	played = output_get_status_stream(h->output, h->stream,
+					  OUTPUT_STREAM_PLAYED);
+	played = played > h->played_off ? played - h->played_off : 0;
+	end = (file_get_length(h->file) - h->pos) * 1000;
+	end = end > played ? end - played : 0;
+
+	/* Fade out current file until its end */
+	output_fade_stream(h->output, h->stream, 0, end);
+
+	/* Start next file with a fade in */
+	files_play_next(h, h->crossfade * 1000);
+}
+
 static void *files_thread(void *user_data)
 {
 	struct files_handle *h = (struct files_handle *) user_data;
@@ -255,19 +572,44 @@ static void *files_thread(void *user_data)
 		if(h->playlist_cur != -1 &&
 		   h->playlist_cur+1 <= h->playlist_len)
 		{
+			/* Update current file when next file is played */
+			files_check_splice(h, 0);
+
 			/* Get current played from stream */
-			played = output_get_status_stream(h->output, h->stream,
-						  OUTPUT_STREAM_PLAYED) / 1000;
+			played = files_get_played(h);
+
+			/* Open next file before end of current file */
+			if(h->file != NULL && h->next_cur == -1 &&
+			   h->playlist_cur+1 < h->playlist_len &&
+			   played + h->pos + h->crossfade + FILES_GAPLESS_TIME
+						   >= file_get_length(h->file))
+			{
+				files_open_next(h);
+			}
+
+			/* Crossfade with next file */
+			if(h->file != NULL && h->crossfade > 0 &&
+			   h->playlist_cur+1 < h->playlist_len &&
+			   file_get_length(h->file) > h->crossfade * 2 &&
+			   played + h->pos + h->crossfade >=
+						      file_get_length(h->file))
+			{
+				files_crossfade(h);
+				goto unlock;
+			}
 
-			/* Check position */
-			if(h->file != NULL && 
+			/* Check position: next file is played in same stream
+			 * when attached to player
+			 */
+			if(h->file != NULL && !h->next_attached &&
 			   (played + h->pos >= file_get_length(h->file)-1
 			   || file_get_status(h->file) == FILE_EOF))
 			{
-				files_play_next(h);
+				files_play_next(h, 0);
 			}
 		}
 
+unlock:
 		/* Unlock playlist */
 		pthread_mutex_unlock(&h->mutex);
 
@@ -278,6 +620,38 @@ static void *files_thread(void *user_data)
 	return NULL;
 }
 
+static void *files_analyze_thread(void *user_data)
+{
+	struct files_handle *h = (struct files_handle *) user_data;
+
+	/* Lock analysis status */
+	pthread_mutex_lock(&h->mutex);
+
+	while(!h->stop)
+	{
+		/* Analyze loudness of new files outside of library scan: it is
+		 * only needed when ReplayGain is enabled.
+		 */
+		if(!h->analyze || h->replaygain == FILES_REPLAYGAIN_OFF)
+		{
+			/* Wait new files, configuration change or stop */
+			pthread_cond_wait(&h->analyze_cond, &h->mutex);
+			continue;
+		}
+		h->analyze = 0;
+
+		/* Analyze without lock: playback is not blocked */
+		pthread_mutex_unlock(&h->mutex);
+		files_list_analyze(h->db, &h->stop);
+		pthread_mutex_lock(&h->mutex);
+	}
+
+	/* Unlock analysis status */
+	pthread_mutex_unlock(&h->mutex);
+
+	return NULL;
+}
+
 static inline void files_free_playlist(struct files_playlist *p)
 {
 	if(p->filename != NULL)
@@ -322,6 +696,10 @@ static int files_add(struct files_handle *h, unsigned long media_id,
 	p->tag = files_list_file(h->db, h->cover_path, media_id,
 				 file_path+path_len);
 
+	/* Analyze file if added to database */
+	h->analyze = 1;
+	pthread_cond_signal(&h->analyze_cond);
+
 	/* Increment playlist len */
 	h->playlist_len++;
 
@@ -465,6 +843,10 @@ static int files_remove(struct files_handle *h, int index)
 	/* Lock playlist */
 	pthread_mutex_lock(&h->mutex);
 
+	/* Update current file and close next file */
+	files_check_splice(h, 1);
+	files_close_next(h);
+
 	/* Check if it is current file */
 	if(h->playlist_cur == index)
 	{
@@ -541,7 +923,7 @@ static int files_play(struct files_handle *h, int index)
 
 	/* Start new player */
 	h->playlist_cur = index;
-	if(files_new_player(h) != 0)
+	if(files_new_player(h, 0) != 0)
 	{
 		/* Update playlist */
 		h->playlist_cur = -1;
@@ -619,8 +1001,18 @@ static int files_stop(struct files_handle *h)
 	/* Close file */
 	file_close(h->file);
 	file_close(h->prev_file);
+	file_close(h->next_file);
 	h->file = NULL;
 	h->prev_file = NULL;
+	h->next_file = NULL;
+	h->next_attached = 0;
+	h->next_cur = -1;
+
+	/* Free players */
+	files_free_player(h->player);
+	files_free_player(h->prev_player);
+	h->player = NULL;
+	h->prev_player = NULL;
 
 	/* Rreset playlist position */
 	h->playlist_cur = -1;
@@ -650,8 +1042,10 @@ static int files_prev(struct files_handle *h)
 
 		/* Close previous file */
 		file_close(h->prev_file);
+		files_free_player(h->prev_player);
 
 		h->prev_stream = NULL;
+		h->prev_player = NULL;
 		h->prev_file = NULL;
 	}
 
@@ -669,7 +1063,7 @@ static int files_next(struct files_handle *h)
 	if(h->playlist_cur != -1 && h->playlist_cur+1 <= h->playlist_len)
 	{
 		/* Start next file in playlist */
-		files_play_next(h);
+		files_play_next(h, 0);
 
 		/* Close previous stream */
 		if(h->prev_stream != NULL)
@@ -677,8 +1071,10 @@ static int files_next(struct files_handle *h)
 
 		/* Close previous file */
 		file_close(h->prev_file);
+		files_free_player(h->prev_player);
 
 		h->prev_stream = NULL;
+		h->prev_player = NULL;
 		h->prev_file = NULL;
 	}
 
@@ -693,12 +1089,25 @@ static int files_seek(struct files_handle *h, unsigned long pos)
 	/* Lock playlist */
 	pthread_mutex_lock(&h->mutex);
 
+	/* Update current file */
+	files_check_splice(h, 1);
+
 	/* Pause stream */
 	output_pause_stream(h->output, h->stream);
 
 	/* Flush stream */
 	output_flush_stream(h->output, h->stream);
 
+	/* Reset player position */
+	if(h->player != NULL)
+	{
+		pthread_mutex_lock(&h->player->mutex);
+		h->player->read = 0;
+		h->player->splice = 0;
+		pthread_mutex_unlock(&h->player->mutex);
+	}
+	h->played_off = 0;
+
 	/* Seek and get new exact position */
 	h->pos = file_set_pos(h->file, pos);
 
@@ -734,13 +1143,15 @@ static struct json *files_json_status(struct files_handle *h, int tags)
 			 json_copy(h->playlist[h->playlist_cur].tag));
 
 	/* Get curent postion in output stream  */
-	played = output_get_status_stream(h->output, h->stream,
-					  OUTPUT_STREAM_PLAYED) / 1000;
+	played = files_get_played(h);
 	json_set_int(status, "pos", played + h->pos);
 
 	/* Add stream length */
 	json_set_int(status, "length", file_get_length(h->file));
 
+	/* Add latency of last seek (in us) */
+	json_set_int(status, "seek_latency", file_get_seek_latency(h->file));
+
 	return status;
 }
 
@@ -818,9 +1229,13 @@ static char *files_get_json_playlist(struct files_handle *h)
 
 static int files_set_config(struct files_handle *h, const struct json *c)
 {
+	enum files_replaygain mode = FILES_REPLAYGAIN_OFF;
 	const char *cover_path;
 	const char *mount_path;
+	const char *replaygain;
 	const char *path;
+	const char *zone;
+	int crossfade;
 
 	if(h == NULL)
 		return -1;
@@ -832,9 +1247,12 @@ static int files_set_config(struct files_handle *h, const struct json *c)
 		free(h->mount_path);
 	if(h->cover_path != NULL)
 		free(h->cover_path);
+	if(h->zone != NULL)
+		free(h->zone);
 	h->cover_path = NULL;
 	h->mount_path = NULL;
 	h->path = NULL;
+	h->zone = NULL;
 
 	/* Parse configuration */
 	if(c != NULL)
@@ -853,6 +1271,29 @@ static int files_set_config(struct files_handle *h, const struct json *c)
 		cover_path = json_get_string(c, "cover_path");
 		if(cover_path != NULL)
 			h->cover_path = strdup(cover_path);
+
+		/* Get crossfade length (in s) */
+		crossfade = json_get_int(c, "crossfade");
+		h->crossfade = crossfade > 0 ? crossfade : 0;
+
+		/* Get ReplayGain mode */
+		replaygain = json_get_string(c, "replaygain");
+		if(replaygain != NULL && strcmp(replaygain, "track") == 0)
+			mode = FILES_REPLAYGAIN_TRACK;
+		else if(replaygain != NULL && strcmp(replaygain, "album") == 0)
+			mode = FILES_REPLAYGAIN_ALBUM;
+
+		/* Update mode and analyze files not yet analyzed */
+		pthread_mutex_lock(&h->mutex);
+		h->replaygain = mode;
+		h->analyze = 1;
+		pthread_cond_signal(&h->analyze_cond);
+		pthread_mutex_unlock(&h->mutex);
+
+		/* Get output zone */
+		zone = json_get_string(c, "zone");
+		if(zone != NULL && *zone != '\0')
+			h->zone = strdup(zone);
 	}
 
 	/* Set default values */
@@ -868,6 +1309,7 @@ static int files_set_config(struct files_handle *h, const struct json *c)
 
 static struct json *files_get_config(struct files_handle *h)
 {
+	const char *replaygain;
 	struct json *c;
 
 	/* Create a new config */
@@ -879,6 +1321,15 @@ static struct json *files_get_config(struct files_handle *h)
 	json_set_string(c, "path", h->path);
 	json_set_string(c, "mount_path", h->mount_path);
 	json_set_string(c, "cover_path", h->cover_path);
+	json_set_int(c, "crossfade", h->crossfade);
+	if(h->replaygain == FILES_REPLAYGAIN_TRACK)
+		replaygain = "track";
+	else if(h->replaygain == FILES_REPLAYGAIN_ALBUM)
+		replaygain = "album";
+	else
+		replaygain = "off";
+	json_set_string(c, "replaygain", replaygain);
+	json_set_string(c, "zone", h->zone);
 
 	return c;
 }
@@ -891,10 +1342,15 @@ static int files_close(struct files_handle *h)
 	/* Stop playing */
 	files_stop(h);
 
-	/* Stop thread */
+	/* Stop threads */
+	pthread_mutex_lock(&h->mutex);
 	h->stop = 1;
+	pthread_cond_signal(&h->analyze_cond);
+	pthread_mutex_unlock(&h->mutex);
 	if(pthread_join(h->thread, NULL) < 0)
 		return -1;
+	pthread_join(h->analyze_thread, NULL);
+	pthread_cond_destroy(&h->analyze_cond);
 
 	/* Free playlist */
 	if(h->playlist != NULL)
@@ -910,6 +1366,8 @@ static int files_close(struct files_handle *h)
 		free(h->mount_path);
 	if(h->cover_path != NULL)
 		free(h->cover_path);
+	if(h->zone != NULL)
+		free(h->zone);
 
 	free(h);
 
@@ -1366,6 +1824,12 @@ static int files_httpd_scan(void *user_data, struct httpd_req *req,
 			*res = httpd_new_response("Scan failed", 0, 0);
 			return 500;
 		}
+
+		/* Analyze new files in background */
+		pthread_mutex_lock(&h->mutex);
+		h->analyze = 1;
+		pthread_cond_signal(&h->analyze_cond);
+		pthread_mutex_unlock(&h->mutex);
 	}
 	else
 	{
@@ -23,11 +23,13 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <math.h>
 
 #include "files_list.h"
 #include "utils.h"
 #include "json.h"
 #include "meta.h"
+#include "loudness.h"
 #include "fs.h"
 
 #define FILES_LIST_DEFAULT_COUNT 25
@@ -49,6 +51,7 @@ static int files_list_recursive_scan(struct db_handle *db,
 
 void files_list_init(struct db_handle *db, const char *path)
 {
+	struct db_query *query;
 	char *sql;
 
 	/* Prepare SQL with new tables and enable foreign keys constraint */
@@ -120,6 +123,8 @@ void files_list_init(struct db_handle *db, const char *path)
 			 " publisher TEXT,"
 			 " cover_id INTEGER,"
 			 " mtime INTEGER,"
+			 " track_gain REAL,"
+			 " album_gain REAL,"
 			 " FOREIGN KEY (path_id) REFERENCES path,"
 			 " FOREIGN KEY (artist_id) REFERENCES artist,"
 			 " FOREIGN KEY (album_id) REFERENCES album,"
@@ -133,6 +138,16 @@ void files_list_init(struct db_handle *db, const char *path)
 	db_exec(db, sql, NULL, NULL);
 	db_free(sql);
 
+	/* Add gain columns to song table of previous versions: files are
+	 * analyzed by next analysis pass since their gain is NULL.
+	 */
+	query = db_prepare(db, "SELECT track_gain FROM song LIMIT 1", -1);
+	if(query == NULL)
+		db_exec(db, "ALTER TABLE song ADD COLUMN track_gain REAL;"
+			    "ALTER TABLE song ADD COLUMN album_gain REAL",
+			NULL, NULL);
+	db_finalize(query);
+
 	/* Add default path and values */
 	sql = db_mprintf("INSERT OR REPLACE INTO media (media_id,name,path) "
 			 "VALUES (1,'Local','%q');"
@@ -381,17 +396,19 @@ end:
 #define FILES_SQL_INSERT "INSERT INTO song (file,title,artist_id,album_id," \
 			 "comment,genre_id,track,year,duration,bitrate," \
 			 "samplerate,channels,copyright,encoded,language," \
-			 "publisher,cover_id,path_id,mtime) " \
+			 "publisher,cover_id,path_id,mtime,track_gain," \
+			 "album_gain) " \
 			 "VALUES ('%q','%q','%ld','%ld','%q','%ld','%ld'," \
 			 "'%d','%ld','%d','%ld','%d','%q','%q','%q','%q'," \
-			 "'%ld','%ld', '%ld')"
+			 "'%ld','%ld', '%ld',NULL,NULL)"
 #define FILES_SQL_UPDATE "UPDATE song " \
 			 "SET file='%q',title='%q',artist_id='%ld'," \
 			 "album_id='%ld',comment='%q',genre_id='%ld'," \
 			 "track='%ld',year='%d',duration='%ld',bitrate='%d'," \
 			 "samplerate='%ld',channels='%d',copyright='%q'," \
 			 "encoded='%q',language='%q',publisher='%q'," \
-			 "cover_id='%ld',path_id='%ld',mtime='%ld'" \
+			 "cover_id='%ld',path_id='%ld',mtime='%ld'," \
+			 "track_gain=NULL,album_gain=NULL " \
 			 "WHERE id='%ld'"
 
 static int64_t files_list_update_sub_table(struct db_handle *db,
@@ -426,6 +443,50 @@ static int64_t files_list_update_sub_table(struct db_handle *db,
 	return id;
 }
 
+static void files_list_update_album_gain(struct db_handle *db,
+					 int64_t album_id)
+{
+	struct db_query *query;
+	double sum = 0.0, loudness;
+	uint64_t total = 0;
+	int64_t duration;
+	char *sql;
+
+	/* Get track gains and durations of album */
+	sql = db_mprintf("SELECT track_gain,duration FROM song "
+			 "WHERE album_id='%ld' AND track_gain IS NOT NULL",
+			 album_id);
+	if(sql == NULL)
+		return;
+	query = db_prepare(db, sql, -1);
+	db_free(sql);
+	if(query == NULL)
+		return;
+
+	/* Sum energy of tracks weighted by their duration */
+	while(db_step(query) == DB_ROW)
+	{
+		loudness = LOUDNESS_REFERENCE - db_column_double(query, 0);
+		duration = db_column_int64(query, 1);
+		if(duration <= 0)
+			duration = 1;
+		sum += pow(10.0, loudness / 10.0) * duration;
+		total += duration;
+	}
+	db_finalize(query);
+	if(total == 0)
+		return;
+
+	/* Update album gain of all tracks */
+	loudness = 10.0 * log10(sum / total);
+	sql = db_mprintf("UPDATE song SET album_gain='%f' WHERE album_id='%ld'",
+			 loudness_gain(loudness), album_id);
+	if(sql == NULL)
+		return;
+	db_exec(db, sql, NULL, NULL);
+	db_free(sql);
+}
+
 static int files_list_update_file(struct db_handle *db, const char *cover_path,
 				  const char *path, const char *file,
 				  int64_t mtime, int64_t path_id, int64_t id)
@@ -447,7 +508,9 @@ static int files_list_update_file(struct db_handle *db, const char *cover_path,
 	if(file_path == NULL)
 		return -1;
 
-	/* Get format and tag from file */
+	/* Get format and tag from file: loudness is analyzed later by
+	 * files_list_analyze() since it needs to decode all file.
+	 */
 	meta = meta_parse(file_path, TAG_PICTURE);
 	free(file_path);
 
@@ -608,6 +671,10 @@ static int files_list_update_file(struct db_handle *db, const char *cover_path,
 	/* Add file to database */
 	ret = db_exec(db, str, NULL, NULL);
 
+	/* Update album gain without changed track */
+	if(ret == 0 && album_id > 1)
+		files_list_update_album_gain(db, album_id);
+
 end:
 	/* Free SQL request */
 	if(str != NULL)
@@ -636,7 +703,7 @@ static int files_list_add_meta(struct db_handle *db, struct json *root,
 
 	/* Prepare SQL request */
 	sql = db_mprintf("SELECT id,mtime,title,artist,album,cover,genre,"
-			 "artist_id,album_id,genre_id "
+			 "artist_id,album_id,genre_id,track_gain,album_gain "
 			 "FROM song "
 			 "LEFT JOIN artist USING (artist_id) "
 			 "LEFT JOIN album USING (album_id) "
@@ -692,6 +759,14 @@ retry:
 		json_set_int64(root, "artist_id", db_column_int64(query, 7));
 		json_set_int64(root, "album_id", db_column_int64(query, 8));
 		json_set_int64(root, "genre_id", db_column_int64(query, 9));
+
+		/* Add gains if file has been analyzed */
+		if(db_column_type(query, 10) != DB_NULL)
+			json_set_double(root, "track_gain",
+					db_column_double(query, 10));
+		if(db_column_type(query, 11) != DB_NULL)
+			json_set_double(root, "album_gain",
+					db_column_double(query, 11));
 	}
 
 end:
@@ -1579,6 +1654,77 @@ static int files_list_recursive_scan(struct db_handle *db,
 	return 0;
 }
 
+int files_list_analyze(struct db_handle *db, volatile int *stop)
+{
+	struct db_query *query;
+	unsigned long duration;
+	int64_t album_id;
+	int64_t id = 0;
+	double loudness;
+	char *file_path;
+	int count = 0;
+	char *sql;
+
+	while(!*stop)
+	{
+		/* Get next file not analyzed: files which failed are skipped
+		 * until next pass.
+		 */
+		sql = db_mprintf("SELECT s.id,s.album_id,m.path,p.path,s.file "
+				 "FROM song AS s "
+				 "LEFT JOIN path AS p USING (path_id) "
+				 "LEFT JOIN media AS m USING (media_id) "
+				 "WHERE s.track_gain IS NULL AND s.id>'%ld' "
+				 "ORDER BY s.id LIMIT 1", id);
+		if(sql == NULL)
+			break;
+		query = db_prepare(db, sql, -1);
+		db_free(sql);
+		if(query == NULL)
+			break;
+		if(db_step(query) != DB_ROW)
+		{
+			db_finalize(query);
+			break;
+		}
+
+		/* Generate complete path */
+		id = db_column_int64(query, 0);
+		album_id = db_column_int64(query, 1);
+		file_path = NULL;
+		asprintf(&file_path, "%s/%s/%s", db_column_text(query, 2),
+			 db_column_text(query, 3), db_column_text(query, 4));
+		db_finalize(query);
+		if(file_path == NULL)
+			continue;
+
+		/* Analyze loudness of file: gain stays NULL on failure */
+		if(loudness_scan_file(file_path, &loudness, &duration) != 0)
+		{
+			free(file_path);
+			continue;
+		}
+		free(file_path);
+
+		/* Save track gain: album gain is same without album */
+		sql = db_mprintf("UPDATE song SET track_gain='%f',"
+				 "album_gain='%f' WHERE id='%ld'",
+				 loudness_gain(loudness),
+				 loudness_gain(loudness), id);
+		if(sql == NULL)
+			continue;
+		db_exec(db, sql, NULL, NULL);
+		db_free(sql);
+
+		/* Update album gain with new track */
+		if(album_id > 1)
+			files_list_update_album_gain(db, album_id);
+		count++;
+	}
+
+	return count;
+}
+
 int files_list_scan(struct db_handle *db, const char *cover_path,
 		    int64_t media_id, int recursive)
 {
@@ -77,6 +77,11 @@ int files_list_scan(struct db_handle *db, const char *cover_path,
 char *files_list_get_scan(void);
 int files_list_is_scanning(void);
 
+/* Analyze loudness of files not yet analyzed (until stop is set) and return
+ * count of files analyzed.
+ */
+int files_list_analyze(struct db_handle *db, volatile int *stop);
+
 /* List files with callback */
 typedef int (*files_list_fn)(void *, int64_t, const char *, int, int);
 int files_list_list(struct db_handle *db, const char *uri, files_list_fn fn,
@@ -0,0 +1,762 @@
+/*
+ * multiroom.c - A Multi-room synchronised playback module
+ *
+ * Copyright (c) 2014   A. Dilly
+ *
+ * AirCat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * AirCat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "module.h"
+#include "sample.h"
+#include "rtp.h"
+#include "multiroom_clock.h"
+
+/**
+ * Network settings:
+ *  DEFAULT_GROUP: multicast group of nodes.
+ *  DEFAULT_PORT: port of RTP stream, clock exchanges use next port.
+ *  MAX_PACKET_SIZE: maximum size of a RTP packet.
+ *  MAX_PACKET_FRAMES: maximum frames sent in a RTP packet.
+ */
+#define DEFAULT_GROUP "239.255.77.77"
+#define DEFAULT_PORT 5004
+#define MAX_PACKET_SIZE 1472
+#define MAX_PACKET_FRAMES 256
+
+/**
+ * RTP packet: a 12 bytes RTP header with payload 96 followed by leader time
+ * at which first frame is played (8), samplerate (4), channels (1), 3
+ * reserved bytes and frames in 16-bit big-endian. All values are big-endian.
+ */
+#define RTP_HEADER_SIZE 12
+#define RTP_PAYLOAD 96
+#define PAYLOAD_HEADER_SIZE 16
+
+/**
+ * Follower settings:
+ *  JITTER_PACKETS: packets kept in jitter buffer before first read.
+ *  POOL_PACKETS: packets allocated for jitter buffer.
+ *  RESYNC_THRESHOLD: error above which frames are skipped or silence is
+ *                    played instead of adjusting rate (in us).
+ *  GAP_THRESHOLD: difference with expected time above which a packet starts
+ *                 a new sequence (in us).
+ *  CORRECTION_TIME: time to correct an error by rate adjustment (in s).
+ *  MAX_DRIFT: maximum rate adjustment (ratio).
+ *  ERROR_FILTER: weight of a new measure in average error.
+ */
+#define JITTER_PACKETS 4
+#define POOL_PACKETS 128
+#define RESYNC_THRESHOLD 2000
+#define GAP_THRESHOLD 5000
+#define CORRECTION_TIME 2.0
+#define MAX_DRIFT 0.001
+#define ERROR_FILTER 0.1
+#define MAX_CHANNELS 8
+
+enum multiroom_mode {
+	MULTIROOM_NONE,
+	MULTIROOM_LEADER,
+	MULTIROOM_FOLLOWER
+};
+
+static const char *multiroom_modes[] = {
+	[MULTIROOM_NONE] = "none",
+	[MULTIROOM_LEADER] = "leader",
+	[MULTIROOM_FOLLOWER] = "follower",
+};
+
+struct multiroom_handle {
+	/* Output module */
+	struct output_handle *output;
+	/* Leader: multicast socket, RTP session and clock server */
+	int sock;
+	struct sockaddr_in addr;
+	uint32_t ssrc;
+	uint16_t seq;
+	uint32_t timestamp;
+	struct multiroom_clock_server *server;
+	/* Follower: clock, jitter buffer and output stream */
+	struct multiroom_clock *clock;
+	struct rtp_handle *rtp;
+	struct output_stream_handle *stream;
+	unsigned long samplerate;
+	unsigned char channels;
+	uint64_t latency;
+	int64_t error;
+	double error_avg;
+	int measured;
+	/* Follower: frames of last packets (float), leader time of first frame
+	 * and read position (in frames).
+	 */
+	float *frames;
+	size_t count;
+	size_t last_count;
+	double time;
+	double pos;
+	/* Config part */
+	enum multiroom_mode mode;
+	char *zone;
+	char *group;
+	unsigned int port;
+	/* Mutex for config and status */
+	pthread_mutex_t mutex;
+};
+
+static int multiroom_set_config(struct multiroom_handle *h,
+				const struct json *c);
+
+static int multiroom_open(struct multiroom_handle **handle,
+			  struct module_attr *attr)
+{
+	struct multiroom_handle *h;
+
+	/* Allocate structure */
+	*handle = malloc(sizeof(struct multiroom_handle));
+	if(*handle == NULL)
+		return -1;
+	h = *handle;
+
+	/* Init structure */
+	h->output = attr->output;
+	h->sock = -1;
+	h->server = NULL;
+	h->clock = NULL;
+	h->rtp = NULL;
+	h->stream = NULL;
+	h->samplerate = 0;
+	h->channels = 0;
+	h->latency = 0;
+	h->error = 0;
+	h->error_avg = 0;
+	h->measured = 0;
+	h->frames = NULL;
+	h->mode = MULTIROOM_NONE;
+	h->zone = NULL;
+	h->group = NULL;
+	h->port = DEFAULT_PORT;
+
+	/* Init mutex */
+	pthread_mutex_init(&h->mutex, NULL);
+
+	/* Load configuration */
+	multiroom_set_config(h, attr->config);
+
+	return 0;
+}
+
+/* Packet fields are not aligned: access them byte per byte */
+static inline unsigned char *multiroom_put_be32(unsigned char *p, uint32_t v)
+{
+	*p++ = v >> 24;
+	*p++ = v >> 16;
+	*p++ = v >> 8;
+	*p++ = v;
+	return p;
+}
+
+static inline uint32_t multiroom_get_be32(const unsigned char *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+	       ((uint32_t) p[2] << 8) | p[3];
+}
+
+static void multiroom_tap(void *user_data, const unsigned char *buffer,
+			  size_t frames, struct a_format *fmt, uint64_t time)
+{
+	struct multiroom_handle *h = user_data;
+	unsigned char packet[MAX_PACKET_SIZE];
+	int16_t samples[MAX_PACKET_SIZE / 2];
+	enum sample_format format = sample_get_format();
+	unsigned char *p;
+	size_t count, len, i;
+
+	if(fmt->channels > MAX_CHANNELS || fmt->samplerate == 0)
+		return;
+
+	/* Update format announced to followers */
+	multiroom_clock_server_set_format(h->server, fmt->samplerate,
+					  fmt->channels);
+
+	/* Frames per packet */
+	count = (MAX_PACKET_SIZE - RTP_HEADER_SIZE - PAYLOAD_HEADER_SIZE) /
+		(fmt->channels * 2);
+	if(count > MAX_PACKET_FRAMES)
+		count = MAX_PACKET_FRAMES;
+
+	while(frames > 0)
+	{
+		if(count > frames)
+			count = frames;
+		len = count * fmt->channels;
+
+		/* Prepare RTP header */
+		p = packet;
+		*p++ = 0x80;
+		*p++ = RTP_PAYLOAD;
+		*p++ = h->seq >> 8;
+		*p++ = h->seq;
+		p = multiroom_put_be32(p, h->timestamp);
+		p = multiroom_put_be32(p, h->ssrc);
+
+		/* Add time at which first frame is played and format */
+		p = multiroom_put_be32(p, time >> 32);
+		p = multiroom_put_be32(p, time);
+		p = multiroom_put_be32(p, fmt->samplerate);
+		*p++ = fmt->channels;
+		*p++ = 0;
+		*p++ = 0;
+		*p++ = 0;
+
+		/* Convert frames to 16-bit big-endian */
+		sample_convert((unsigned char *) samples, SAMPLE_S16, buffer,
+			       format, len);
+		for(i = 0; i < len; i++)
+		{
+			*p++ = (uint16_t) samples[i] >> 8;
+			*p++ = samples[i];
+		}
+
+		/* Send packet to group */
+		sendto(h->sock, packet, p - packet, 0,
+		       (struct sockaddr *) &h->addr, sizeof(h->addr));
+
+		/* Go to next packet */
+		buffer += len * 4;
+		frames -= count;
+		time += (uint64_t) count * 1000000 / fmt->samplerate;
+		h->timestamp += count;
+		h->seq++;
+	}
+}
+
+static ssize_t multiroom_fill(struct multiroom_handle *h)
+{
+	unsigned char packet[MAX_PACKET_SIZE];
+	unsigned char c = h->channels;
+	double step = 1000000.0 / h->samplerate;
+	unsigned long samplerate;
+	uint64_t time;
+	size_t drop, count, i;
+	ssize_t len;
+
+	/* Remove frames already played: frame at read position is kept for
+	 * interpolation.
+	 */
+	drop = (size_t) h->pos;
+	if(drop > h->count)
+		drop = h->count;
+	memmove(h->frames, &h->frames[drop * c],
+		(h->count - drop) * c * sizeof(float));
+	h->count -= drop;
+	h->pos -= drop;
+	h->time += drop * step;
+
+	/* Get next packet */
+	do {
+		len = rtp_read(h->rtp, packet, MAX_PACKET_SIZE);
+	} while(len == RTP_DISCARDED_PACKET);
+
+	/* Packet has been lost: replace it by silence */
+	if(len == RTP_LOST_PACKET)
+	{
+		count = h->last_count;
+		memset(&h->frames[h->count * c], 0, count * c * sizeof(float));
+		h->count += count;
+		return count;
+	}
+
+	/* Check packet */
+	if(len < PAYLOAD_HEADER_SIZE)
+		return 0;
+	time = ((uint64_t) multiroom_get_be32(packet) << 32) |
+	       multiroom_get_be32(&packet[4]);
+	samplerate = multiroom_get_be32(&packet[8]);
+	if(samplerate != h->samplerate || packet[12] != c)
+		return 0;
+	count = (len - PAYLOAD_HEADER_SIZE) / (c * 2);
+	if(count > MAX_PACKET_FRAMES)
+		count = MAX_PACKET_FRAMES;
+
+	/* A new sequence starts: drop previous frames */
+	if(fabs(time - (h->time + h->count * step)) > GAP_THRESHOLD)
+	{
+		h->count = 0;
+		h->pos = 0;
+		h->time = time;
+		h->measured = 0;
+	}
+
+	/* Convert frames to float */
+	for(i = 0; i < count * c; i++)
+		h->frames[h->count * c + i] = (int16_t) ((packet[16 + i * 2] <<
+				     8) | packet[17 + i * 2]) / 32768.0f;
+	h->count += count;
+	h->last_count = count;
+
+	return count;
+}
+
+static int multiroom_read(void *user_data, unsigned char *buffer, size_t size,
+			  struct a_format *fmt)
+{
+	struct multiroom_handle *h = user_data;
+	unsigned char c = h->channels;
+	double step = 1000000.0 / h->samplerate;
+	double ratio = 1.0, error, frac;
+	float *out = (float *) buffer;
+	size_t frames = size / c;
+	size_t n = 0, i;
+	int64_t offset;
+	uint64_t now;
+	float *a, *b;
+	int j;
+
+	/* Set format */
+	fmt->samplerate = h->samplerate;
+	fmt->channels = c;
+
+	/* Receive packets */
+	rtp_read(h->rtp, NULL, 0);
+
+	/* Clock is not synchronised */
+	if(multiroom_clock_get_offset(h->clock, &offset, NULL) != 0)
+		return 0;
+
+	/* Get first frames */
+	while(h->pos + 1 >= h->count)
+		if(multiroom_fill(h) <= 0)
+			return 0;
+
+	/* Compare local time at which next frame is played with time requested
+	 * by leader.
+	 */
+	now = multiroom_clock_now() + __atomic_load_n(&h->latency,
+						      __ATOMIC_RELAXED);
+	error = (double) now - (h->time + h->pos * step - offset);
+
+	/* Average error: measures are disturbed by scheduling of mixer */
+	if(!h->measured)
+		h->error_avg = error;
+	else
+		h->error_avg += (error - h->error_avg) * ERROR_FILTER;
+	h->measured = 1;
+	error = h->error_avg;
+	__atomic_store_n(&h->error, (int64_t) error, __ATOMIC_RELAXED);
+
+	if(error > RESYNC_THRESHOLD)
+	{
+		/* Frames are late: skip them */
+		h->pos += error / step;
+		h->error_avg = 0;
+	}
+	else if(error < -RESYNC_THRESHOLD)
+	{
+		/* Frames are early: play silence before them */
+		n = -error / step;
+		if(n > frames)
+			n = frames;
+		memset(out, 0, n * c * sizeof(float));
+		h->error_avg += n * step;
+	}
+	else
+	{
+		/* Adjust rate to correct error smoothly */
+		ratio = error / (CORRECTION_TIME * 1000000.0);
+		if(ratio > MAX_DRIFT)
+			ratio = MAX_DRIFT;
+		else if(ratio < -MAX_DRIFT)
+			ratio = -MAX_DRIFT;
+		ratio += 1.0;
+	}
+
+	/* Resample frames with linear interpolation */
+	for(; n < frames; n++, out += c)
+	{
+		/* Get next packet */
+		while(h->pos + 1 >= h->count)
+			if(multiroom_fill(h) <= 0)
+				goto end;
+
+		/* Interpolate between two frames */
+		i = (size_t) h->pos;
+		frac = h->pos - i;
+		a = &h->frames[i * c];
+		b = a + c;
+		for(j = 0; j < c; j++)
+			out[j] = a[j] + (b[j] - a[j]) * frac;
+		h->pos += ratio;
+	}
+
+end:
+	/* Convert to pipeline format */
+	sample_convert(buffer, sample_get_format(), buffer, SAMPLE_FLOAT,
+		       n * c);
+
+	return n * c;
+}
+
+static void multiroom_close_stream(struct multiroom_handle *h)
+{
+	/* Remove output stream */
+	if(h->stream != NULL)
+		output_remove_stream(h->output, h->stream);
+	h->stream = NULL;
+
+	/* Close jitter buffer */
+	if(h->rtp != NULL)
+		rtp_close(h->rtp);
+	h->rtp = NULL;
+
+	/* Free frames */
+	if(h->frames != NULL)
+		free(h->frames);
+	h->frames = NULL;
+	h->samplerate = 0;
+	h->channels = 0;
+}
+
+static int multiroom_open_stream(struct multiroom_handle *h,
+				 unsigned long samplerate,
+				 unsigned char channels)
+{
+	struct rtp_attr attr;
+	struct in_addr group;
+
+	/* Allocate frames of two packets */
+	h->frames = malloc((MAX_PACKET_FRAMES * 2 + 1) * channels *
+			   sizeof(float));
+	if(h->frames == NULL)
+		return -1;
+	h->count = 0;
+	h->last_count = 0;
+	h->time = 0;
+	h->pos = 0;
+	h->measured = 0;
+	h->samplerate = samplerate;
+	h->channels = channels;
+
+	/* Open jitter buffer on group */
+	if(inet_pton(AF_INET, h->group, &group) != 1)
+		goto error;
+	memset(&attr, 0, sizeof(struct rtp_attr));
+	attr.ip = (unsigned char *) &group;
+	attr.port = h->port;
+	attr.group = (unsigned char *) &group;
+	attr.payload = RTP_PAYLOAD;
+	attr.max_packet_size = MAX_PACKET_SIZE;
+	attr.pool_packet_count = POOL_PACKETS;
+	attr.delay_packet_count = JITTER_PACKETS;
+	if(rtp_open(&h->rtp, &attr) != 0)
+	{
+		h->rtp = NULL;
+		goto error;
+	}
+
+	/* Add a new stream without cache: samples are read when they are
+	 * played.
+	 */
+	h->stream = output_add_stream(h->output, "Multi-room", h->zone,
+				      samplerate, channels, 0, 0,
+				      &multiroom_read, h);
+	if(h->stream == NULL)
+		goto error;
+
+	/* Play stream */
+	output_play_stream(h->output, h->stream);
+
+	return 0;
+
+error:
+	multiroom_close_stream(h);
+	return -1;
+}
+
+static void multiroom_clock_event(void *user_data, unsigned long samplerate,
+				  unsigned char channels)
+{
+	struct multiroom_handle *h = user_data;
+	unsigned long latency;
+
+	/* Leader is not playing */
+	if(samplerate == 0 || channels == 0 || channels > MAX_CHANNELS)
+		return;
+
+	/* Lock handle access */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Follower is stopping */
+	if(h->mode != MULTIROOM_FOLLOWER)
+		goto end;
+
+	/* Format of leader has changed: reopen stream */
+	if(samplerate != h->samplerate || channels != h->channels)
+	{
+		multiroom_close_stream(h);
+		multiroom_open_stream(h, samplerate, channels);
+	}
+
+	/* Update latency of output */
+	if(h->stream != NULL)
+	{
+		latency = output_get_status_stream(h->output, h->stream,
+						   OUTPUT_STREAM_LATENCY);
+		__atomic_store_n(&h->latency, latency, __ATOMIC_RELAXED);
+	}
+
+end:
+	/* Unlock handle access */
+	pthread_mutex_unlock(&h->mutex);
+}
+
+static void multiroom_stop(struct multiroom_handle *h)
+{
+	struct multiroom_clock *clock;
+
+	/* Lock handle access */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Stop leader: remove tap before closing socket */
+	if(h->mode == MULTIROOM_LEADER)
+		output_set_tap(h->output, h->zone, NULL, NULL);
+	if(h->sock >= 0)
+		close(h->sock);
+	h->sock = -1;
+	multiroom_clock_server_close(h->server);
+	h->server = NULL;
+
+	/* Stop follower: stream reads clock, so it is closed first */
+	h->mode = MULTIROOM_NONE;
+	multiroom_close_stream(h);
+	clock = h->clock;
+	h->clock = NULL;
+
+	/* Unlock handle access */
+	pthread_mutex_unlock(&h->mutex);
+
+	/* Stop clock: its events are ignored since mode has changed */
+	multiroom_clock_close(clock);
+}
+
+static int multiroom_start_leader(struct multiroom_handle *h)
+{
+	int opt;
+
+	/* Prepare group address */
+	memset(&h->addr, 0, sizeof(h->addr));
+	h->addr.sin_family = AF_INET;
+	h->addr.sin_port = htons(h->port);
+	if(inet_pton(AF_INET, h->group, &h->addr.sin_addr) != 1)
+		return -1;
+
+	/* Open socket: stream is looped back to followers on same host */
+	h->sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if(h->sock < 0)
+		return -1;
+	opt = 1;
+	setsockopt(h->sock, IPPROTO_IP, IP_MULTICAST_LOOP, &opt, sizeof(opt));
+	setsockopt(h->sock, IPPROTO_IP, IP_MULTICAST_TTL, &opt, sizeof(opt));
+
+	/* Init RTP session */
+	srand(time(NULL) ^ getpid());
+	h->ssrc = rand() | 1;
+	h->seq = rand();
+	h->timestamp = rand();
+
+	/* Answer clock requests of followers */
+	if(multiroom_clock_server_open(&h->server, h->group, h->port + 1) != 0)
+		return -1;
+
+	/* Send mixed samples of zone */
+	return output_set_tap(h->output, h->zone, &multiroom_tap, h);
+}
+
+static int multiroom_set_config(struct multiroom_handle *h,
+				const struct json *c)
+{
+	enum multiroom_mode mode = MULTIROOM_NONE;
+	const char *group = NULL;
+	const char *zone = NULL;
+	const char *value;
+	unsigned int port = 0;
+	int i;
+
+	if(h == NULL)
+		return -1;
+
+	/* Parse config */
+	if(c != NULL)
+	{
+		/* Get mode */
+		value = json_get_string(c, "mode");
+		for(i = 0; value != NULL && i <= MULTIROOM_FOLLOWER; i++)
+			if(strcmp(value, multiroom_modes[i]) == 0)
+				mode = i;
+
+		/* Get output zone, multicast group and port */
+		zone = json_get_string(c, "zone");
+		group = json_get_string(c, "group");
+		port = json_get_int(c, "port");
+	}
+
+	/* Set default values */
+	if(group == NULL || *group == '\0')
+		group = DEFAULT_GROUP;
+	if(port == 0 || port > 65534)
+		port = DEFAULT_PORT;
+
+	/* Stop current mode */
+	multiroom_stop(h);
+
+	/* Lock handle access */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Update configuration */
+	if(h->zone != NULL)
+		free(h->zone);
+	h->zone = zone != NULL && *zone != '\0' ? strdup(zone) : NULL;
+	if(h->group != NULL)
+		free(h->group);
+	h->group = strdup(group);
+	h->port = port;
+	h->mode = mode;
+
+	/* Start new mode: follower opens its stream when leader format is
+	 * known.
+	 */
+	if(mode == MULTIROOM_LEADER && multiroom_start_leader(h) != 0)
+		fprintf(stderr, "Failed to start multi-room leader\n");
+	else if(mode == MULTIROOM_FOLLOWER &&
+		multiroom_clock_open(&h->clock, h->group, h->port + 1,
+				     &multiroom_clock_event, h) != 0)
+		fprintf(stderr, "Failed to start multi-room follower\n");
+
+	/* Unlock handle access */
+	pthread_mutex_unlock(&h->mutex);
+
+	return 0;
+}
+
+static struct json *multiroom_get_config(struct multiroom_handle *h)
+{
+	struct json *c;
+
+	c = json_new();
+	if(c == NULL)
+		return NULL;
+
+	/* Set mode, zone, group and port */
+	json_set_string(c, "mode", multiroom_modes[h->mode]);
+	json_set_string(c, "zone", h->zone);
+	json_set_string(c, "group", h->group);
+	json_set_int(c, "port", h->port);
+
+	return c;
+}
+
+static int multiroom_close(struct multiroom_handle *h)
+{
+	if(h == NULL)
+		return 0;
+
+	/* Stop leader or follower */
+	multiroom_stop(h);
+
+	/* Free configuration */
+	if(h->zone != NULL)
+		free(h->zone);
+	if(h->group != NULL)
+		free(h->group);
+
+	/* Free mutex */
+	pthread_mutex_destroy(&h->mutex);
+
+	free(h);
+
+	return 0;
+}
+
+static int multiroom_httpd_status(void *user_data, struct httpd_req *req,
+				  struct httpd_res **res)
+{
+	struct multiroom_handle *h = user_data;
+	struct json *root;
+	int64_t offset = 0;
+	uint64_t rtt = 0;
+	int synced;
+	char *str;
+
+	/* Create JSON object */
+	root = json_new();
+	if(root == NULL)
+		return 500;
+
+	/* Lock handle access */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Get clock of follower */
+	synced = multiroom_clock_get_offset(h->clock, &offset, &rtt) == 0;
+
+	/* Add values to it */
+	json_set_string(root, "mode", multiroom_modes[h->mode]);
+	json_set_bool(root, "synced", synced);
+	json_set_int64(root, "offset", offset);
+	json_set_int64(root, "rtt", rtt);
+	json_set_int64(root, "latency", __atomic_load_n(&h->latency,
+							__ATOMIC_RELAXED));
+	json_set_int64(root, "error", __atomic_load_n(&h->error,
+						      __ATOMIC_RELAXED));
+	json_set_int(root, "samplerate", h->samplerate);
+	json_set_int(root, "channels", h->channels);
+
+	/* Unlock handle access */
+	pthread_mutex_unlock(&h->mutex);
+
+	/* Get string from JSON object */
+	str = strdup(json_export(root));
+
+	/* Free JSON object */
+	json_free(root);
+
+	/* Create response */
+	*res = httpd_new_response(str, 1, 0);
+	return 200;
+}
+
+static struct url_table multiroom_url[] = {
+	{"/status", HTTPD_STRICT_URL, HTTPD_GET, 0, &multiroom_httpd_status},
+	{0, 0, 0}
+};
+
+struct module module_entry = {
+	.id = "multiroom",
+	.name = "Multi-room",
+	.description = "Synchronised playback across AirCat nodes of local "
+		       "network.",
+	.open = (void*) &multiroom_open,
+	.close = (void*) &multiroom_close,
+	.set_config = (void*) &multiroom_set_config,
+	.get_config = (void*) &multiroom_get_config,
+	.urls = (void*) &multiroom_url,
+};
+
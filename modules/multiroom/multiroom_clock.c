@@ -0,0 +1,464 @@
+/*
+ * multiroom_clock.c - Shared clock between multi-room nodes
+ *
+ * Copyright (c) 2014   A. Dilly
+ *
+ * AirCat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * AirCat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "multiroom_clock.h"
+
+/**
+ * Clock exchange settings:
+ *  CLOCK_INTERVAL: interval between two requests of follower (in ms).
+ *  CLOCK_TIMEOUT: maximum time to wait a response (in ms).
+ *  CLOCK_SAMPLES: count of last exchanges used to estimate offset.
+ */
+#define CLOCK_INTERVAL 250
+#define CLOCK_TIMEOUT 100
+#define CLOCK_SAMPLES 8
+
+/**
+ * Clock packets:
+ *  request: magic (4), type (1), reserved (3), t1 (8).
+ *  response: magic (4), type (1), channels (1), reserved (2), t1 (8), t2 (8),
+ *            t3 (8), samplerate (4).
+ * All values are big-endian and times are in us.
+ */
+#define CLOCK_MAGIC "ACSC"
+#define CLOCK_REQUEST 1
+#define CLOCK_RESPONSE 2
+#define CLOCK_REQUEST_SIZE 16
+#define CLOCK_RESPONSE_SIZE 36
+
+struct multiroom_clock_server {
+	/* Socket joined to group */
+	int sock;
+	/* Format of multicast stream */
+	unsigned long samplerate;
+	unsigned char channels;
+	/* Thread objects */
+	pthread_t thread;
+	int stop;
+};
+
+struct multiroom_clock_sample {
+	int64_t offset;
+	uint64_t rtt;
+};
+
+struct multiroom_clock {
+	/* Socket and address of group */
+	int sock;
+	struct sockaddr_in addr;
+	/* Last exchanges */
+	struct multiroom_clock_sample samples[CLOCK_SAMPLES];
+	unsigned int count;
+	unsigned int pos;
+	/* Current estimation */
+	int64_t offset;
+	uint64_t rtt;
+	int synced;
+	/* Format callback */
+	multiroom_clock_cb cb;
+	void *user_data;
+	/* Thread objects */
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	int stop;
+};
+
+static void *multiroom_clock_server_thread(void *user_data);
+static void *multiroom_clock_thread(void *user_data);
+
+uint64_t multiroom_clock_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void multiroom_clock_put(unsigned char *buffer, uint64_t value,
+				int size)
+{
+	while(size-- > 0)
+	{
+		buffer[size] = value & 0xFF;
+		value >>= 8;
+	}
+}
+
+static uint64_t multiroom_clock_get(const unsigned char *buffer, int size)
+{
+	uint64_t value = 0;
+	int i;
+
+	for(i = 0; i < size; i++)
+		value = (value << 8) | buffer[i];
+
+	return value;
+}
+
+int multiroom_clock_server_open(struct multiroom_clock_server **handle,
+				const char *group, unsigned int port)
+{
+	struct multiroom_clock_server *h;
+	struct sockaddr_in addr;
+	struct ip_mreq mreq;
+	int opt;
+
+	/* Allocate structure */
+	*handle = malloc(sizeof(struct multiroom_clock_server));
+	if(*handle == NULL)
+		return -1;
+	h = *handle;
+
+	/* Init structure */
+	h->samplerate = 0;
+	h->channels = 0;
+	h->stop = 0;
+
+	/* Open socket */
+	h->sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if(h->sock < 0)
+		goto error;
+
+	/* Bind on clock port */
+	opt = 1;
+	setsockopt(h->sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if(bind(h->sock, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+		goto error;
+
+	/* Join multicast group */
+	memset(&mreq, 0, sizeof(mreq));
+	if(inet_pton(AF_INET, group, &mreq.imr_multiaddr) != 1)
+		goto error;
+	mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+	if(setsockopt(h->sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+		      sizeof(mreq)) < 0)
+		goto error;
+
+	/* Create thread */
+	if(pthread_create(&h->thread, NULL, multiroom_clock_server_thread, h)
+	   != 0)
+		goto error;
+
+	return 0;
+
+error:
+	if(h->sock >= 0)
+		close(h->sock);
+	free(h);
+	*handle = NULL;
+	return -1;
+}
+
+void multiroom_clock_server_set_format(struct multiroom_clock_server *h,
+				       unsigned long samplerate,
+				       unsigned char channels)
+{
+	if(h == NULL)
+		return;
+
+	__atomic_store_n(&h->samplerate, samplerate, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->channels, channels, __ATOMIC_RELAXED);
+}
+
+static void *multiroom_clock_server_thread(void *user_data)
+{
+	struct multiroom_clock_server *h = user_data;
+	unsigned char buffer[CLOCK_RESPONSE_SIZE];
+	struct sockaddr_in addr;
+	struct pollfd pfd;
+	socklen_t len;
+	uint64_t t2;
+	ssize_t size;
+
+	pfd.fd = h->sock;
+	pfd.events = POLLIN;
+
+	while(!h->stop)
+	{
+		/* Wait a request */
+		if(poll(&pfd, 1, CLOCK_TIMEOUT) <= 0)
+			continue;
+
+		/* Get request and its receive time */
+		len = sizeof(addr);
+		size = recvfrom(h->sock, buffer, sizeof(buffer), 0,
+				(struct sockaddr *) &addr, &len);
+		t2 = multiroom_clock_now();
+		if(size != CLOCK_REQUEST_SIZE ||
+		   memcmp(buffer, CLOCK_MAGIC, 4) != 0 ||
+		   buffer[4] != CLOCK_REQUEST)
+			continue;
+
+		/* Prepare response: t1 is kept at same place */
+		buffer[4] = CLOCK_RESPONSE;
+		buffer[5] = __atomic_load_n(&h->channels, __ATOMIC_RELAXED);
+		multiroom_clock_put(&buffer[16], t2, 8);
+		multiroom_clock_put(&buffer[32],
+				    __atomic_load_n(&h->samplerate,
+						    __ATOMIC_RELAXED), 4);
+
+		/* Send response to follower with send time */
+		multiroom_clock_put(&buffer[24], multiroom_clock_now(), 8);
+		sendto(h->sock, buffer, CLOCK_RESPONSE_SIZE, 0,
+		       (struct sockaddr *) &addr, len);
+	}
+
+	return NULL;
+}
+
+void multiroom_clock_server_close(struct multiroom_clock_server *h)
+{
+	if(h == NULL)
+		return;
+
+	/* Stop thread */
+	h->stop = 1;
+	pthread_join(h->thread, NULL);
+
+	/* Close socket */
+	close(h->sock);
+
+	free(h);
+}
+
+int multiroom_clock_open(struct multiroom_clock **handle, const char *group,
+			 unsigned int port, multiroom_clock_cb cb,
+			 void *user_data)
+{
+	struct multiroom_clock *h;
+	int opt;
+
+	/* Allocate structure */
+	*handle = malloc(sizeof(struct multiroom_clock));
+	if(*handle == NULL)
+		return -1;
+	h = *handle;
+
+	/* Init structure */
+	h->count = 0;
+	h->pos = 0;
+	h->offset = 0;
+	h->rtt = 0;
+	h->synced = 0;
+	h->cb = cb;
+	h->user_data = user_data;
+	h->stop = 0;
+
+	/* Prepare group address */
+	memset(&h->addr, 0, sizeof(h->addr));
+	h->addr.sin_family = AF_INET;
+	h->addr.sin_port = htons(port);
+	if(inet_pton(AF_INET, group, &h->addr.sin_addr) != 1)
+		goto error;
+
+	/* Open socket: responses are received on an ephemeral port, so many
+	 * followers can run on same host.
+	 */
+	h->sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if(h->sock < 0)
+		goto error;
+
+	/* Send requests to leader on same host too */
+	opt = 1;
+	setsockopt(h->sock, IPPROTO_IP, IP_MULTICAST_LOOP, &opt, sizeof(opt));
+	setsockopt(h->sock, IPPROTO_IP, IP_MULTICAST_TTL, &opt, sizeof(opt));
+
+	/* Initialize mutex */
+	pthread_mutex_init(&h->mutex, NULL);
+
+	/* Create thread */
+	if(pthread_create(&h->thread, NULL, multiroom_clock_thread, h) != 0)
+	{
+		close(h->sock);
+		goto error;
+	}
+
+	return 0;
+
+error:
+	free(h);
+	*handle = NULL;
+	return -1;
+}
+
+static int multiroom_clock_exchange(struct multiroom_clock *h)
+{
+	unsigned char buffer[CLOCK_RESPONSE_SIZE];
+	struct multiroom_clock_sample *s;
+	uint64_t t1, t2, t3, t4, rtt;
+	struct pollfd pfd;
+	unsigned long samplerate;
+	unsigned char channels;
+	unsigned int i, best;
+	int timeout;
+	ssize_t size;
+
+	/* Send request */
+	memset(buffer, 0, CLOCK_REQUEST_SIZE);
+	memcpy(buffer, CLOCK_MAGIC, 4);
+	buffer[4] = CLOCK_REQUEST;
+	t1 = multiroom_clock_now();
+	multiroom_clock_put(&buffer[8], t1, 8);
+	if(sendto(h->sock, buffer, CLOCK_REQUEST_SIZE, 0,
+		  (struct sockaddr *) &h->addr, sizeof(h->addr)) < 0)
+		return -1;
+
+	/* Wait response of this request: late responses are dropped */
+	pfd.fd = h->sock;
+	pfd.events = POLLIN;
+	while(1)
+	{
+		timeout = CLOCK_TIMEOUT - (multiroom_clock_now() - t1) / 1000;
+		if(timeout <= 0 || poll(&pfd, 1, timeout) <= 0)
+			return -1;
+		size = recv(h->sock, buffer, sizeof(buffer), 0);
+		t4 = multiroom_clock_now();
+		if(size == CLOCK_RESPONSE_SIZE &&
+		   memcmp(buffer, CLOCK_MAGIC, 4) == 0 &&
+		   buffer[4] == CLOCK_RESPONSE &&
+		   multiroom_clock_get(&buffer[8], 8) == t1)
+			break;
+	}
+
+	/* Get leader times and format */
+	channels = buffer[5];
+	t2 = multiroom_clock_get(&buffer[16], 8);
+	t3 = multiroom_clock_get(&buffer[24], 8);
+	samplerate = multiroom_clock_get(&buffer[32], 4);
+	if(t3 < t2 || t4 - t1 < t3 - t2)
+		return -1;
+
+	/* Lock clock access */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Add exchange to last exchanges */
+	s = &h->samples[h->pos];
+	s->offset = ((int64_t) (t2 - t1) + (int64_t) (t3 - t4)) / 2;
+	s->rtt = (t4 - t1) - (t3 - t2);
+	h->pos = (h->pos + 1) % CLOCK_SAMPLES;
+	if(h->count < CLOCK_SAMPLES)
+		h->count++;
+
+	/* Use exchange with smallest round trip: it is the less delayed by
+	 * network and scheduling.
+	 */
+	best = 0;
+	rtt = h->samples[0].rtt;
+	for(i = 1; i < h->count; i++)
+	{
+		if(h->samples[i].rtt < rtt)
+		{
+			rtt = h->samples[i].rtt;
+			best = i;
+		}
+	}
+	h->offset = h->samples[best].offset;
+	h->rtt = rtt;
+	h->synced = 1;
+
+	/* Unlock clock access */
+	pthread_mutex_unlock(&h->mutex);
+
+	/* Notify format of leader */
+	if(h->cb != NULL)
+		h->cb(h->user_data, samplerate, channels);
+
+	return 0;
+}
+
+static void *multiroom_clock_thread(void *user_data)
+{
+	struct multiroom_clock *h = user_data;
+	uint64_t start, elapsed;
+
+	while(!h->stop)
+	{
+		/* Exchange with leader */
+		start = multiroom_clock_now();
+		multiroom_clock_exchange(h);
+
+		/* Wait next request */
+		elapsed = (multiroom_clock_now() - start) / 1000;
+		if(elapsed < CLOCK_INTERVAL)
+			usleep((CLOCK_INTERVAL - elapsed) * 1000);
+	}
+
+	return NULL;
+}
+
+int multiroom_clock_get_offset(struct multiroom_clock *h, int64_t *offset,
+			       uint64_t *rtt)
+{
+	int ret = -1;
+
+	if(h == NULL)
+		return -1;
+
+	/* Lock clock access */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Get current offset */
+	if(h->synced)
+	{
+		if(offset != NULL)
+			*offset = h->offset;
+		if(rtt != NULL)
+			*rtt = h->rtt;
+		ret = 0;
+	}
+
+	/* Unlock clock access */
+	pthread_mutex_unlock(&h->mutex);
+
+	return ret;
+}
+
+void multiroom_clock_close(struct multiroom_clock *h)
+{
+	if(h == NULL)
+		return;
+
+	/* Stop thread */
+	h->stop = 1;
+	pthread_join(h->thread, NULL);
+
+	/* Close socket */
+	close(h->sock);
+
+	/* Free mutex */
+	pthread_mutex_destroy(&h->mutex);
+
+	free(h);
+}
+
@@ -0,0 +1,69 @@
+/*
+ * multiroom_clock.h - Shared clock between multi-room nodes
+ *
+ * Copyright (c) 2014   A. Dilly
+ *
+ * AirCat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * AirCat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MULTIROOM_CLOCK_H
+#define _MULTIROOM_CLOCK_H
+
+#include <stdint.h>
+
+/**
+ * Shared clock is the monotonic clock of leader. Followers send a request on
+ * multicast group and leader answers with its receive and send times, as
+ * done by NTP: offset between both clocks is estimated from exchange with
+ * smallest round trip time among last ones.
+ */
+struct multiroom_clock_server;
+struct multiroom_clock;
+
+/* Callback called by follower after each exchange with format of leader */
+typedef void (*multiroom_clock_cb)(void *user_data, unsigned long samplerate,
+				   unsigned char channels);
+
+/**
+ * Get local monotonic time (in us).
+ */
+uint64_t multiroom_clock_now(void);
+
+/**
+ * Leader side: answer clock requests received on group and port, with
+ * format of multicast stream.
+ */
+int multiroom_clock_server_open(struct multiroom_clock_server **handle,
+				const char *group, unsigned int port);
+void multiroom_clock_server_set_format(struct multiroom_clock_server *h,
+				       unsigned long samplerate,
+				       unsigned char channels);
+void multiroom_clock_server_close(struct multiroom_clock_server *h);
+
+/**
+ * Follower side: exchange periodically with leader on group and port.
+ */
+int multiroom_clock_open(struct multiroom_clock **handle, const char *group,
+			 unsigned int port, multiroom_clock_cb cb,
+			 void *user_data);
+
+/**
+ * Get offset between leader and local clock (leader - local, in us) and round
+ * trip time of exchange used (in us). Return -1 if clock is not synchronised.
+ */
+int multiroom_clock_get_offset(struct multiroom_clock *h, int64_t *offset,
+			       uint64_t *rtt);
+void multiroom_clock_close(struct multiroom_clock *h);
+
+#endif
+
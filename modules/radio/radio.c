@@ -19,10 +19,42 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
 
 #include "module.h"
 #include "shoutcast.h"
+#include "recorder.h"
 #include "radio_list.h"
+#include "radio_health.h"
+
+/**
+ * Warm pool settings:
+ *  WARM_TIMESHIFT: time-shift buffer duration of a pre-connected radio (s).
+ */
+#define WARM_TIMESHIFT 10
+
+/**
+ * Health check settings:
+ *  HEALTH_INTERVAL: default interval between two check rounds (in min).
+ *  HEALTH_TIMER: period of timer event which starts check rounds (in s).
+ */
+#define HEALTH_INTERVAL 60
+#define HEALTH_TIMER 60
+
+/**
+ * Default path for radio recording
+ */
+#define DEFAULT_RECORD_PATH "/tmp"
+
+/**
+ * Pre-connected radio kept in warm pool
+ */
+struct radio_warm {
+	struct radio_item *radio;	/*!< Radio item */
+	struct shout_handle *shout;	/*!< Shoutcast handle (threaded) */
+	struct radio_warm *next;	/*!< Next radio in pool */
+};
 
 struct radio_handle {
 	/* Output module */
@@ -31,10 +63,24 @@ struct radio_handle {
 	/* Radio player */
 	struct shout_handle *shout;
 	struct radio_item *radio;
+	int use_thread;
+	/* Recorder of radio stream */
+	struct recorder_handle *rec;
+	/* Warm pool: pre-connected radios (most recent first) */
+	struct radio_warm *warms;
 	/* Databse: radio list */
 	struct db_handle *db;
+	/* Background radio checker */
+	struct radio_health_handle *health;
 	/* Config part */
 	unsigned long cache;
+	unsigned long timeshift;
+	char *timeshift_path;
+	unsigned long warm;
+	unsigned long health_interval;
+	unsigned long health_jobs;
+	char *record_path;
+	char *zone;
 };
 
 static int radio_stop(struct radio_handle *h);
@@ -57,17 +103,164 @@ static int radio_open(struct radio_handle **handle, struct module_attr *attr)
 	h->stream = NULL;
 	h->radio = NULL;
 	h->cache = 0;
+	h->timeshift = 0;
+	h->timeshift_path = NULL;
+	h->use_thread = 0;
+	h->warms = NULL;
+	h->warm = 0;
+	h->health = NULL;
+	h->rec = NULL;
+	h->record_path = NULL;
+	h->zone = NULL;
+
+	/* Create radio tables */
+	radio_list_init(h->db);
+
+	/* Open background radio checker */
+	radio_health_open(&h->health, h->db);
 
 	/* Load configuration */
 	radio_set_config(h, attr->config);
 
+	/* Check radios periodically */
+	if(attr->timer != NULL && h->health != NULL)
+		timer_event_add(attr->timer, "Radio health",
+				"Check radio streams in background",
+				&radio_health_timer, h->health, 1,
+				TIMER_PERIODIC, HEALTH_TIMER, 0);
+
+	return 0;
+}
+
+static void radio_warm_trim(struct radio_handle *h, unsigned long count)
+{
+	struct radio_warm **w, *tmp;
+
+	/* Go to first radio to remove */
+	for(w = &h->warms; *w != NULL && count > 0; w = &(*w)->next)
+		count--;
+
+	/* Close all remaining radios */
+	while(*w != NULL)
+	{
+		tmp = *w;
+		*w = tmp->next;
+		shoutcast_close(tmp->shout);
+		radio_free_radio_item(tmp->radio);
+		free(tmp);
+	}
+}
+
+static void radio_warm_add(struct radio_handle *h, struct radio_item *radio,
+			   struct shout_handle *shout)
+{
+	struct radio_warm *w;
+
+	/* Allocate a new pool entry */
+	w = malloc(sizeof(struct radio_warm));
+	if(w == NULL)
+	{
+		shoutcast_close(shout);
+		radio_free_radio_item(radio);
+		return;
+	}
+
+	/* Keep only a short rolling buffer */
+	shoutcast_set_timeshift(shout, WARM_TIMESHIFT, NULL);
+
+	/* Add radio to pool head */
+	w->radio = radio;
+	w->shout = shout;
+	w->next = h->warms;
+	h->warms = w;
+
+	/* Remove oldest radios */
+	radio_warm_trim(h, h->warm);
+}
+
+static struct shout_handle *radio_warm_get(struct radio_handle *h,
+					   const char *id)
+{
+	struct shout_handle *shout = NULL;
+	struct radio_warm **w, *tmp;
+
+	/* Find radio in pool */
+	for(w = &h->warms; *w != NULL; w = &(*w)->next)
+	{
+		if(strcmp((*w)->radio->id, id) != 0)
+			continue;
+
+		/* Remove from pool */
+		tmp = *w;
+		*w = tmp->next;
+		radio_free_radio_item(tmp->radio);
+
+		/* Connection has been lost */
+		if(shoutcast_get_status(tmp->shout) == SHOUT_STOPPED)
+			shoutcast_close(tmp->shout);
+		else
+			shout = tmp->shout;
+		free(tmp);
+		break;
+	}
+
+	return shout;
+}
+
+static int radio_warm(struct radio_handle *h, const char *id)
+{
+	struct radio_item *radio;
+	struct shout_handle *shout;
+	struct radio_warm *w;
+
+	if(h == NULL || id == NULL || h->warm == 0)
+		return -1;
+
+	/* Radio is playing or already in pool */
+	if(h->radio != NULL && strcmp(h->radio->id, id) == 0)
+		return 0;
+	for(w = h->warms; w != NULL; w = w->next)
+		if(strcmp(w->radio->id, id) == 0)
+			return 0;
+
+	/* Get radio item */
+	radio = radio_get_radio_item(h->db, id);
+	if(radio == NULL)
+		return -1;
+
+	/* Open radio with internal thread to keep receiving data */
+	if(shoutcast_open(&shout, radio->url, h->cache/1000, 1) != 0)
+	{
+		shoutcast_close(shout);
+		radio_free_radio_item(radio);
+		return -1;
+	}
+
+	/* Add to pool */
+	radio_warm_add(h, radio, shout);
+
 	return 0;
 }
 
+static void radio_set_variants(struct radio_handle *h)
+{
+	struct shout_variant variants[h->radio->variant_count + 1];
+	unsigned int i;
+
+	/* Adapt bitrate with alternative streams of radio */
+	for(i = 0; i < h->radio->variant_count; i++)
+	{
+		variants[i].url = h->radio->variants[i].url;
+		variants[i].bitrate = h->radio->variants[i].bitrate;
+	}
+	shoutcast_set_variants(h->shout, variants, i);
+}
+
 static int radio_play(struct radio_handle *h, const char *id)
 {
 	unsigned long samplerate;
 	unsigned char channels;
+	int warm = 0;
 
 	/* Play/pause behavior */
 	if(id == NULL || *id == '\0')
@@ -86,17 +279,45 @@ static int radio_play(struct radio_handle *h, const char *id)
 	if(h->radio == NULL)
 		return -1;
 
-	/* Open radio */
-	if(shoutcast_open(&h->shout, h->radio->url, h->cache/1000, 0) != 0)
-		return -1;
+	/* Get radio from warm pool */
+	h->shout = radio_warm_get(h, h->radio->id);
+	if(h->shout != NULL)
+	{
+		/* Go near live position: cache is already full */
+		shoutcast_play(h->shout);
+		shoutcast_skip(h->shout, shoutcast_get_pause(h->shout));
+		h->use_thread = 1;
+		warm = 1;
+	}
+	else
+	{
+		/* Open radio: a thread is needed to keep it warm later */
+		h->use_thread = h->warm > 0;
+		if(shoutcast_open(&h->shout, h->radio->url, h->cache/1000,
+				  h->use_thread) != 0)
+		{
+			shoutcast_close(h->shout);
+			h->shout = NULL;
+			return -1;
+		}
+	}
+
+	/* Set alternative streams */
+	radio_set_variants(h);
+
+	/* Set time-shift buffer */
+	if(warm || h->timeshift != 0 || h->timeshift_path != NULL)
+		shoutcast_set_timeshift(h->shout, h->timeshift,
+					h->timeshift_path);
 
 	/* Get samplerate and channels */
 	samplerate = shoutcast_get_samplerate(h->shout);
 	channels = shoutcast_get_channels(h->shout);
 
 	/* Open new Audio stream output and play */
-	h->stream = output_add_stream(h->output, NULL, samplerate, channels,
-				      0, 0, &shoutcast_read, h->shout);
+	h->stream = output_add_stream(h->output, NULL, h->zone, samplerate,
+				      channels, 0, 0, &shoutcast_read,
+				      h->shout);
 	output_play_stream(h->output, h->stream);
 
 	return 0;
@@ -120,6 +341,22 @@ static unsigned long radio_skip(struct radio_handle *h, unsigned long skip)
 	return shoutcast_skip(h->shout, skip);
 }
 
+static unsigned long radio_rewind(struct radio_handle *h,
+				  unsigned long rewind)
+{
+	if(h == NULL || h->shout == NULL)
+		return -1;
+
+	/* Rewind ms in radio stream */
+	rewind = shoutcast_rewind(h->shout, rewind);
+
+	/* Flush data already sent to output */
+	if(rewind > 0)
+		output_flush_stream(h->output, h->stream);
+
+	return rewind;
+}
+
 static void radio_reset(struct radio_handle *h)
 {
 	if(h == NULL || h->shout == NULL)
@@ -129,19 +366,67 @@ static void radio_reset(struct radio_handle *h)
 	shoutcast_reset(h->shout);
 }
 
+static int radio_record(struct radio_handle *h, int start)
+{
+	const char *ext;
+	char file[PATH_MAX];
+	char date[20];
+	time_t now;
+
+	if(h == NULL || h->shout == NULL)
+		return -1;
+
+	/* Stop current recording */
+	if(h->rec != NULL)
+	{
+		shoutcast_set_recorder(h->shout, NULL);
+		recorder_close(h->rec);
+		h->rec = NULL;
+	}
+	if(!start)
+		return 0;
+
+	/* Generate file name from radio and date */
+	ext = shoutcast_get_info(h->shout)->type == AAC_STREAM ? "aac" : "mp3";
+	now = time(NULL);
+	strftime(date, sizeof(date), "%Y%m%d-%H%M%S", localtime(&now));
+	snprintf(file, sizeof(file), "%s/radio-%s-%s.%s",
+		 h->record_path != NULL ? h->record_path : DEFAULT_RECORD_PATH,
+		 h->radio->id, date, ext);
+
+	/* Record stream as received */
+	if(recorder_open(&h->rec, file, 0, 0) != 0)
+		return -1;
+	shoutcast_set_recorder(h->shout, h->rec);
+
+	return 0;
+}
+
 static int radio_stop(struct radio_handle *h)
 {
 	if(h == NULL || h->shout == NULL)
 		return 0;
 
+	/* Stop recording */
+	radio_record(h, 0);
+
 	if(h->stream != NULL)
 		output_remove_stream(h->output, h->stream);
 
-	if(h->shout != NULL)
-		shoutcast_close(h->shout);
+	/* Keep radio connected in warm pool */
+	if(h->shout != NULL && h->radio != NULL && h->use_thread &&
+	   h->warm > 0)
+	{
+		radio_warm_add(h, h->radio, h->shout);
+	}
+	else
+	{
+		if(h->shout != NULL)
+			shoutcast_close(h->shout);
 
-	if(h->radio != NULL)
-		radio_free_radio_item(h->radio);
+		if(h->radio != NULL)
+			radio_free_radio_item(h->radio);
+	}
 
 	h->stream = NULL;
 	h->shout = NULL;
@@ -241,6 +526,28 @@ static char *radio_get_json_status(struct radio_handle *h, int add_pic)
 		/* Add pause duration */
 		json_set_int64(root, "pause", shoutcast_get_pause(h->shout));
 
+		/* Add duration available for rewind */
+		json_set_int64(root, "rewind", shoutcast_get_rewind(h->shout));
+
+		/* Add reconnections and total duration of losses */
+		json_set_int64(root, "reconnects",
+			       shoutcast_get_reconnects(h->shout));
+		json_set_int64(root, "gap", shoutcast_get_gap(h->shout));
+
+		/* Add current bitrate, throughput and bitrate switches */
+		json_set_int(root, "bitrate",
+			     shoutcast_get_info(h->shout)->bitrate);
+		json_set_int64(root, "throughput",
+			       shoutcast_get_throughput(h->shout));
+		json_set_int64(root, "switches",
+			       shoutcast_get_switches(h->shout));
+
+		/* Add recording status */
+		json_set_int(root, "recording", h->rec != NULL);
+		if(h->rec != NULL)
+			json_set_int64(root, "recorded",
+				       recorder_get_size(h->rec));
+
 		/* Free string */
 		if(str != NULL)
 			free(str);
@@ -257,20 +564,47 @@ static char *radio_get_json_status(struct radio_handle *h, int add_pic)
 
 static int radio_set_config(struct radio_handle *h, const struct json *c)
 {
-	unsigned long cache;
+	unsigned long cache, timeshift, warm;
+	unsigned long health_interval, health_jobs;
+	const char *path = NULL;
+	const char *record_path = NULL;
+	const char *zone = NULL;
 	const char *file;
+	int reload = 0;
 
 	if(h == NULL)
 		return -1;
 
 	/* Free previous values */
 	cache = 0;
+	timeshift = 0;
+	warm = 0;
+	health_interval = HEALTH_INTERVAL;
+	health_jobs = 0;
 
 	/* Parse config */
 	if(c != NULL)
 	{
 		/* Get cache size (in ms) */
 		cache = json_get_int(c, "cache");
+
+		/* Get time-shift buffer duration (in s) and file path */
+		timeshift = json_get_int(c, "timeshift");
+		path = json_get_string(c, "timeshift_path");
+
+		/* Get count of radios kept connected */
+		warm = json_get_int(c, "warm");
+
+		/* Get health check interval (in min, 0 to disable) and jobs */
+		if(json_get(c, "health_interval") != NULL)
+			health_interval = json_get_int(c, "health_interval");
+		health_jobs = json_get_int(c, "health_jobs");
+
+		/* Get path of recordings */
+		record_path = json_get_string(c, "record_path");
+
+		/* Get output zone */
+		zone = json_get_string(c, "zone");
 	}
 
 	/* Set default values */
@@ -287,6 +621,45 @@ static int radio_set_config(struct radio_handle *h, const struct json *c)
 			output_set_cache_stream(h->output, h->stream, cache);
 	}
 
+	/* Check time-shift path */
+	if((path == NULL) != (h->timeshift_path == NULL) ||
+	   (path != NULL && strcmp(path, h->timeshift_path) != 0))
+		reload = 1;
+
+	/* Reload time-shift buffer */
+	if(h->timeshift != timeshift || reload)
+	{
+		h->timeshift = timeshift;
+		if(h->timeshift_path != NULL)
+			free(h->timeshift_path);
+		h->timeshift_path = path != NULL ? strdup(path) : NULL;
+
+		/* Update time-shift buffer of current radio */
+		if(h->shout != NULL)
+			shoutcast_set_timeshift(h->shout, h->timeshift,
+						h->timeshift_path);
+	}
+
+	/* Update warm pool size */
+	h->warm = warm;
+	radio_warm_trim(h, h->warm);
+
+	/* Update health checker */
+	h->health_interval = health_interval;
+	h->health_jobs = health_jobs;
+	radio_health_set_config(h->health, health_interval, health_jobs);
+
+	/* Update record path */
+	if(h->record_path != NULL)
+		free(h->record_path);
+	h->record_path = record_path != NULL && *record_path != '\0' ?
+			 strdup(record_path) : NULL;
+
+	/* Update output zone (used by next radio) */
+	if(h->zone != NULL)
+		free(h->zone);
+	h->zone = zone != NULL && *zone != '\0' ? strdup(zone) : NULL;
+
 	return 0;
 }
 
@@ -301,6 +674,23 @@ static struct json *radio_get_config(struct radio_handle *h)
 	/* Set current cache */
 	json_set_int(c, "cache", h->cache);
 
+	/* Set time-shift buffer */
+	json_set_int(c, "timeshift", h->timeshift);
+	json_set_string(c, "timeshift_path", h->timeshift_path);
+
+	/* Set warm pool size */
+	json_set_int(c, "warm", h->warm);
+
+	/* Set health checker */
+	json_set_int(c, "health_interval", h->health_interval);
+	json_set_int(c, "health_jobs", h->health_jobs);
+
+	/* Set record path */
+	json_set_string(c, "record_path", h->record_path);
+
+	/* Set output zone */
+	json_set_string(c, "zone", h->zone);
+
 	return c;
 }
 
@@ -312,10 +702,24 @@ static int radio_close(struct radio_handle *h)
 	/* Stop radio */
 	radio_stop(h);
 
+	/* Close all pre-connected radios */
+	radio_warm_trim(h, 0);
+
+	/* Close background radio checker */
+	radio_health_close(h->health);
+
 	/* Stop and close shoutcast player */
 	if(h->shout != NULL)
 		shoutcast_close(h->shout);
 
+	/* Free time-shift and record paths */
+	if(h->timeshift_path != NULL)
+		free(h->timeshift_path);
+	if(h->record_path != NULL)
+		free(h->record_path);
+	if(h->zone != NULL)
+		free(h->zone);
+
 	free(h);
 
 	return 0;
@@ -343,6 +747,18 @@ static int radio_httpd_pause(void *user_data, struct httpd_req *req,
 	return 200;
 }
 
+static int radio_httpd_warm(void *user_data, struct httpd_req *req,
+			    struct httpd_res **res)
+{
+	struct radio_handle *h = user_data;
+
+	/* Pre-connect radio */
+	if(radio_warm(h, req->resource) != 0)
+		return 400;
+
+	return 200;
+}
+
 static int radio_httpd_skip(void *user_data, struct httpd_req *req,
 			    struct httpd_res **res)
 {
@@ -373,6 +789,50 @@ static int radio_httpd_skip(void *user_data, struct httpd_req *req,
 	return 200;
 }
 
+static int radio_httpd_rewind(void *user_data, struct httpd_req *req,
+			      struct httpd_res **res)
+{
+	struct radio_handle *h = user_data;
+	struct json *root = NULL;
+	unsigned long value;
+
+	/* Get time to rewind (in ms) */
+	value = strtoul(req->resource, NULL, 10);
+	if(value == 0)
+		return 200;
+
+	/* Create a new JSON object */
+	root = json_new();
+	if(root == NULL)
+		return 500;
+
+	/* Rewind value ms in radio stream */
+	json_set_int64(root, "rewound", radio_rewind(h, value));
+
+	/* Create HTTP response with JSON object */
+	*res = httpd_new_response((char*)json_export(root), 1, 1);
+
+	/* Free JSON object */
+	json_free(root);
+
+	return 200;
+}
+
+static int radio_httpd_record(void *user_data, struct httpd_req *req,
+			      struct httpd_res **res)
+{
+	struct radio_handle *h = user_data;
+
+	/* Start (1) or stop (0) recording */
+	if(req->resource == NULL || (*req->resource != '0' &&
+				     *req->resource != '1'))
+		return 400;
+	if(radio_record(h, *req->resource == '1') != 0)
+		return 500;
+
+	return 200;
+}
+
 static int radio_httpd_reset(void *user_data, struct httpd_req *req,
 			     struct httpd_res **res)
 {
@@ -395,6 +855,32 @@ static int radio_httpd_stop(void *user_data, struct httpd_req *req,
 	return 200;
 }
 
+static int radio_httpd_variant(void *user_data, struct httpd_req *req,
+			       struct httpd_res **res)
+{
+	struct radio_handle *h = user_data;
+	unsigned int bitrate = 0;
+	const char *url;
+	const char *value;
+	int ret;
+
+	/* Get stream URL and bitrate (in kb/s) */
+	url = httpd_get_query(req, "url");
+	value = httpd_get_query(req, "bitrate");
+	if(value != NULL)
+		bitrate = strtoul(value, NULL, 10);
+
+	/* Add (PUT) or remove (DELETE) an alternative stream */
+	if(req->method == HTTPD_PUT)
+		ret = radio_add_variant(h->db, req->resource, url, bitrate);
+	else
+		ret = radio_remove_variant(h->db, req->resource, url);
+	if(ret != 0)
+		return 400;
+
+	return 200;
+}
+
 static int radio_httpd_status(void *user_data, struct httpd_req *req,
 			      struct httpd_res **res)
 {
@@ -453,7 +939,9 @@ static int radio_httpd_list(void *user_data, struct httpd_req *req,
 			    struct httpd_res **res)
 {
 	struct radio_handle *h = user_data;
+	enum radio_list_sort sort = RADIO_LIST_SORT_NAME;
 	unsigned long page = 0, count = 0;
+	int alive_only = 0;
 	const char *value;
 	char *list = NULL;
 
@@ -467,8 +955,19 @@ static int radio_httpd_list(void *user_data, struct httpd_req *req,
 	if(value != NULL)
 		count = strtoul(value, NULL, 10);
 
+	/* Get sort order */
+	value = httpd_get_query(req, "sort");
+	if(value != NULL && strcmp(value, "health") == 0)
+		sort = RADIO_LIST_SORT_HEALTH;
+
+	/* Get only alive radios */
+	value = httpd_get_query(req, "alive");
+	if(value != NULL)
+		alive_only = strtoul(value, NULL, 10) != 0;
+
 	/* Get Radio list */
-	list = radio_get_json_list(h->db, req->resource, page, count);
+	list = radio_get_json_list(h->db, req->resource, page, count, sort,
+				   alive_only);
 	if(list == NULL)
 	{
 		*res = httpd_new_response("No radio list", 0, 0);
@@ -479,13 +978,18 @@ static int radio_httpd_list(void *user_data, struct httpd_req *req,
 	return 200;
 }
 
+#define HTTPD_PD HTTPD_PUT | HTTPD_DELETE
 static struct url_table radio_url[] = {
 	{"/category/info/", HTTPD_EXT_URL, HTTPD_GET, 0, &radio_httpd_cat_info},
 	{"/info/",          HTTPD_EXT_URL, HTTPD_GET, 0, &radio_httpd_info},
 	{"/list",           HTTPD_EXT_URL, HTTPD_GET, 0, &radio_httpd_list},
 	{"/play",           HTTPD_EXT_URL, HTTPD_PUT, 0, &radio_httpd_play},
 	{"/pause",          0,             HTTPD_PUT, 0, &radio_httpd_pause},
+	{"/warm/",          HTTPD_EXT_URL, HTTPD_PUT, 0, &radio_httpd_warm},
 	{"/skip/",          HTTPD_EXT_URL, HTTPD_PUT, 0, &radio_httpd_skip},
+	{"/rewind/",        HTTPD_EXT_URL, HTTPD_PUT, 0, &radio_httpd_rewind},
+	{"/record/",        HTTPD_EXT_URL, HTTPD_PUT, 0, &radio_httpd_record},
+	{"/variant/",       HTTPD_EXT_URL, HTTPD_PD,  0, &radio_httpd_variant},
 	{"/reset" ,         0,             HTTPD_PUT, 0, &radio_httpd_reset},
 	{"/stop",           0,             HTTPD_PUT, 0, &radio_httpd_stop},
 	{"/status",         HTTPD_EXT_URL, HTTPD_GET, 0, &radio_httpd_status},
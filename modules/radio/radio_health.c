@@ -0,0 +1,414 @@
+/*
+ * radio_health.c - Background radio stream checker of Radio module
+ *
+ * Copyright (c) 2014   A. Dilly
+ *
+ * AirCat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * AirCat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "radio_health.h"
+#include "mpeg_sync.h"
+#include "http.h"
+
+/**
+ * Check settings:
+ *  RADIO_HEALTH_BATCH: maximum count of radios checked in a round.
+ *  RADIO_HEALTH_DEFAULT_JOBS: default count of radios checked in parallel.
+ *  RADIO_HEALTH_TIMEOUT: maximum time to get first audio frames (in ms).
+ *  RADIO_HEALTH_READ_TIMEOUT: timeout of a read on stream (in ms).
+ *  RADIO_HEALTH_READ_SIZE: size of a read on stream.
+ *  RADIO_HEALTH_BUFFER_SIZE: maximum data read from stream.
+ */
+#define RADIO_HEALTH_BATCH 32
+#define RADIO_HEALTH_DEFAULT_JOBS 4
+#define RADIO_HEALTH_TIMEOUT 5000
+#define RADIO_HEALTH_READ_TIMEOUT 500
+#define RADIO_HEALTH_READ_SIZE 1024
+#define RADIO_HEALTH_BUFFER_SIZE 16384
+
+/**
+ * Result of a radio check
+ */
+struct radio_health_item {
+	long id;		/*!< Radio id */
+	char *url;		/*!< Radio stream URL */
+	int alive;		/*!< Audio frames have been received */
+	unsigned int bitrate;	/*!< Stream bitrate (in kb/s) */
+	const char *codec;	/*!< Stream codec */
+	unsigned long ttfa;	/*!< Time to first audio frames (in ms) */
+};
+
+struct radio_health_handle {
+	/* Database */
+	struct db_handle *db;
+	/* Configuration */
+	unsigned long interval;
+	unsigned int jobs;
+	time_t last_round;
+	/* Current round */
+	struct radio_health_item *items;
+	unsigned int count;
+	unsigned int next;
+	/* Round thread */
+	pthread_t thread;
+	int started;
+	int running;
+	int stop;
+	pthread_mutex_t mutex;
+};
+
+static void *radio_health_thread(void *user_data);
+
+int radio_health_open(struct radio_health_handle **handle,
+		      struct db_handle *db)
+{
+	struct radio_health_handle *h;
+
+	/* Allocate structure */
+	*handle = malloc(sizeof(struct radio_health_handle));
+	if(*handle == NULL)
+		return -1;
+	h = *handle;
+
+	/* Init structure */
+	memset(h, 0, sizeof(struct radio_health_handle));
+	h->db = db;
+	h->jobs = RADIO_HEALTH_DEFAULT_JOBS;
+	pthread_mutex_init(&h->mutex, NULL);
+
+	/* Create table */
+	db_exec(h->db, "CREATE TABLE IF NOT EXISTS radio_health ("
+		       " rad_id INTEGER PRIMARY KEY,"
+		       " alive INTEGER,"
+		       " bitrate INTEGER,"
+		       " codec TEXT,"
+		       " ttfa INTEGER,"
+		       " last_check INTEGER"
+		       ")", NULL, NULL);
+
+	return 0;
+}
+
+void radio_health_set_config(struct radio_health_handle *h,
+			     unsigned long interval, unsigned int jobs)
+{
+	if(h == NULL)
+		return;
+
+	/* Lock round access */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Update values */
+	h->interval = interval;
+	h->jobs = jobs > 0 ? jobs : RADIO_HEALTH_DEFAULT_JOBS;
+
+	/* Unlock round access */
+	pthread_mutex_unlock(&h->mutex);
+}
+
+int radio_health_timer(void *user_data)
+{
+	struct radio_health_handle *h = user_data;
+	time_t now = time(NULL);
+
+	if(h == NULL)
+		return -1;
+
+	/* Lock round access */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Check is disabled, running or not needed now */
+	if(h->interval == 0 || h->running || h->stop ||
+	   h->last_round + (time_t) h->interval * 60 > now)
+	{
+		pthread_mutex_unlock(&h->mutex);
+		return 0;
+	}
+
+	/* Release previous round thread */
+	if(h->started)
+		pthread_join(h->thread, NULL);
+	h->started = 0;
+
+	/* Start a new round: the timer thread must not be blocked */
+	h->last_round = now;
+	if(pthread_create(&h->thread, NULL, radio_health_thread, h) == 0)
+	{
+		h->started = 1;
+		h->running = 1;
+	}
+
+	/* Unlock round access */
+	pthread_mutex_unlock(&h->mutex);
+
+	return 0;
+}
+
+static void radio_health_check(struct radio_health_item *item)
+{
+	unsigned char buffer[RADIO_HEALTH_BUFFER_SIZE];
+	enum mpeg_sync_type type;
+	struct http_handle *http;
+	struct timeval start, now;
+	struct mpeg_frame frame;
+	unsigned long elapsed = 0;
+	size_t len = 0;
+	ssize_t size;
+	char *p;
+
+	/* Get start time */
+	gettimeofday(&start, NULL);
+
+	/* Open HTTP client */
+	if(http_open(&http, 1) != 0)
+		return;
+	http_set_option(http, HTTP_FOLLOW_REDIRECT, NULL, 1);
+
+	/* Connect and get header from server */
+	if(http_get(http, item->url) != 200)
+		goto end;
+
+	/* Get codec */
+	p = http_get_header(http, "content-type", 0);
+	if(p == NULL)
+		goto end;
+	if(strncmp(p, "audio/mpeg", 10) == 0)
+	{
+		type = MPEG_SYNC_MP3;
+		item->codec = "mp3";
+	}
+	else if(strncmp(p, "audio/aac", 9) == 0)
+	{
+		type = MPEG_SYNC_ADTS;
+		item->codec = "aac";
+	}
+	else
+		goto end;
+
+	/* Get bitrate */
+	p = http_get_header(http, "icy-br", 0);
+	if(p != NULL)
+		item->bitrate = strtoul(p, NULL, 10);
+
+	/* Wait for first audio frames */
+	while(len + RADIO_HEALTH_READ_SIZE <= RADIO_HEALTH_BUFFER_SIZE &&
+	      elapsed < RADIO_HEALTH_TIMEOUT)
+	{
+		/* Read next data */
+		size = http_read_timeout(http, buffer + len,
+					 RADIO_HEALTH_READ_SIZE,
+					 RADIO_HEALTH_READ_TIMEOUT);
+		if(size < 0)
+			break;
+		len += size;
+
+		/* Update elapsed time */
+		gettimeofday(&now, NULL);
+		elapsed = ((now.tv_sec - start.tv_sec) * 1000) +
+			  ((now.tv_usec - start.tv_usec) / 1000);
+
+		/* Audio frames found */
+		if(mpeg_sync_find(buffer, len, type, 2, &frame) >= 0)
+		{
+			if(item->bitrate == 0)
+				item->bitrate = frame.bitrate;
+			item->ttfa = elapsed;
+			item->alive = 1;
+			break;
+		}
+	}
+
+end:
+	/* Close HTTP client */
+	http_close(http);
+}
+
+static void *radio_health_worker(void *user_data)
+{
+	struct radio_health_handle *h = user_data;
+	struct radio_health_item *item;
+
+	while(1)
+	{
+		/* Lock round access */
+		pthread_mutex_lock(&h->mutex);
+
+		/* Get next radio to check */
+		item = NULL;
+		if(!h->stop && h->next < h->count)
+			item = &h->items[h->next++];
+
+		/* Unlock round access */
+		pthread_mutex_unlock(&h->mutex);
+
+		/* No more radio */
+		if(item == NULL)
+			break;
+
+		/* Check radio */
+		radio_health_check(item);
+	}
+
+	return NULL;
+}
+
+static void radio_health_save(struct radio_health_handle *h, time_t now)
+{
+	struct radio_health_item *item;
+	unsigned int i;
+	char *sql;
+
+	/* Save all results in one transaction */
+	db_exec(h->db, "BEGIN TRANSACTION", NULL, NULL);
+	for(i = 0; i < h->count; i++)
+	{
+		/* Not checked (stopped) */
+		if(i >= h->next)
+			break;
+		item = &h->items[i];
+
+		/* Prepare SQL */
+		sql = db_mprintf("INSERT OR REPLACE INTO radio_health "
+				 "(rad_id,alive,bitrate,codec,ttfa,last_check) "
+				 "VALUES (%ld,%d,%u,%Q,%lu,%ld)",
+				 item->id, item->alive, item->bitrate,
+				 item->codec, item->ttfa, (long) now);
+		if(sql == NULL)
+			continue;
+
+		/* Update database */
+		db_exec(h->db, sql, NULL, NULL);
+		db_free(sql);
+	}
+	db_exec(h->db, "COMMIT", NULL, NULL);
+}
+
+static void *radio_health_thread(void *user_data)
+{
+	struct radio_health_handle *h = user_data;
+	pthread_t threads[RADIO_HEALTH_BATCH];
+	struct db_query *q;
+	unsigned int count = 0;
+	unsigned int jobs, i;
+	char *sql;
+
+	/* Allocate round */
+	h->items = calloc(RADIO_HEALTH_BATCH, sizeof(struct radio_health_item));
+	if(h->items == NULL)
+		goto end;
+
+	/* Get radios with oldest results first */
+	sql = db_mprintf("SELECT r.id,r.url FROM radio_list AS r "
+			 "LEFT JOIN radio_health AS h ON h.rad_id = r.id "
+			 "ORDER BY h.last_check ASC LIMIT %d",
+			 RADIO_HEALTH_BATCH);
+	if(sql == NULL)
+		goto end;
+	q = db_prepare(h->db, sql, strlen(sql));
+	db_free(sql);
+	if(q == NULL)
+		goto end;
+
+	/* Copy radios */
+	while(count < RADIO_HEALTH_BATCH && db_step(q) == DB_ROW)
+	{
+		h->items[count].id = db_column_int64(q, 0);
+		h->items[count].url = db_column_copy_text(q, 1);
+		if(h->items[count].url != NULL)
+			count++;
+	}
+	db_finalize(q);
+
+	/* Lock round access */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Prepare round */
+	h->count = count;
+	h->next = 0;
+	jobs = h->jobs < count ? h->jobs : count;
+
+	/* Unlock round access */
+	pthread_mutex_unlock(&h->mutex);
+
+	/* Start workers */
+	for(i = 0; i < jobs; i++)
+	{
+		if(pthread_create(&threads[i], NULL, radio_health_worker, h)
+		   != 0)
+			break;
+	}
+	jobs = i;
+
+	/* Check radios in this thread if no worker is available */
+	if(jobs == 0)
+		radio_health_worker(h);
+
+	/* Wait end of workers */
+	for(i = 0; i < jobs; i++)
+		pthread_join(threads[i], NULL);
+
+	/* Save results */
+	radio_health_save(h, time(NULL));
+
+end:
+	/* Lock round access */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Free round */
+	if(h->items != NULL)
+	{
+		for(i = 0; i < count; i++)
+			free(h->items[i].url);
+		free(h->items);
+	}
+	h->items = NULL;
+	h->count = 0;
+	h->next = 0;
+	h->running = 0;
+
+	/* Unlock round access */
+	pthread_mutex_unlock(&h->mutex);
+
+	return NULL;
+}
+
+void radio_health_close(struct radio_health_handle *h)
+{
+	if(h == NULL)
+		return;
+
+	/* Lock round access */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Stop current round */
+	h->stop = 1;
+
+	/* Unlock round access */
+	pthread_mutex_unlock(&h->mutex);
+
+	/* Wait end of round: radios in progress are finished */
+	if(h->started)
+		pthread_join(h->thread, NULL);
+
+	/* Free handle */
+	pthread_mutex_destroy(&h->mutex);
+	free(h);
+}
+
@@ -0,0 +1,45 @@
+/*
+ * radio_health.h - Background radio stream checker of Radio module
+ *
+ * Copyright (c) 2014   A. Dilly
+ *
+ * AirCat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * AirCat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RADIO_HEALTH_H
+#define _RADIO_HEALTH_H
+
+#include "db.h"
+
+struct radio_health_handle;
+
+/* Create radio_health table and open checker */
+int radio_health_open(struct radio_health_handle **handle,
+		      struct db_handle *db);
+
+/* Set interval between two check rounds (in min, 0 to disable) and maximum
+ * count of radios checked in parallel.
+ */
+void radio_health_set_config(struct radio_health_handle *h,
+			     unsigned long interval, unsigned int jobs);
+
+/* Timer callback: start a check round in background if interval is elapsed.
+ * Each round checks the radios with the oldest results.
+ */
+int radio_health_timer(void *user_data);
+
+/* Stop current check round and close checker */
+void radio_health_close(struct radio_health_handle *h);
+
+#endif
+
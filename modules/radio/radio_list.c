@@ -25,6 +25,131 @@
 #include "json.h"
 
 #define RADIO_LIST_DEFAULT_COUNT 25
+#define RADIO_LIST_MAX_VARIANTS 8
+
+/* Columns and join used for radio lists (with last health check results) */
+#define RADIO_LIST_COLUMNS "r.id,r.name,r.url,r.description," \
+			   "h.alive,h.bitrate,h.codec,h.ttfa "
+#define RADIO_LIST_HEALTH "LEFT JOIN radio_health AS h ON h.rad_id = r.id "
+
+/* Create tables of radio list */
+void radio_list_init(struct db_handle *db)
+{
+	/* Alternative streams (other bitrates) of radios */
+	db_exec(db, "CREATE TABLE IF NOT EXISTS radio_variant ("
+		    " rad_id INTEGER,"
+		    " url TEXT,"
+		    " bitrate INTEGER,"
+		    " PRIMARY KEY (rad_id, url)"
+		    ")", NULL, NULL);
+}
+
+/* Add an alternative stream to a radio */
+int radio_add_variant(struct db_handle *db, const char *id, const char *url,
+		      unsigned int bitrate)
+{
+	char *sql;
+	int ret;
+
+	if(id == NULL || url == NULL || bitrate == 0)
+		return -1;
+
+	/* Prepare SQL */
+	sql = db_mprintf("INSERT OR REPLACE INTO radio_variant "
+			 "(rad_id,url,bitrate) VALUES (%ld,%Q,%u)",
+			 atol(id), url, bitrate);
+	if(sql == NULL)
+		return -1;
+
+	/* Update database */
+	ret = db_exec(db, sql, NULL, NULL);
+	db_free(sql);
+
+	return ret;
+}
+
+/* Remove an alternative stream of a radio (all if url is NULL) */
+int radio_remove_variant(struct db_handle *db, const char *id,
+			 const char *url)
+{
+	char *sql;
+	int ret;
+
+	if(id == NULL)
+		return -1;
+
+	/* Prepare SQL */
+	if(url != NULL)
+		sql = db_mprintf("DELETE FROM radio_variant "
+				 "WHERE rad_id = %ld AND url = %Q",
+				 atol(id), url);
+	else
+		sql = db_mprintf("DELETE FROM radio_variant "
+				 "WHERE rad_id = %ld", atol(id));
+	if(sql == NULL)
+		return -1;
+
+	/* Update database */
+	ret = db_exec(db, sql, NULL, NULL);
+	db_free(sql);
+
+	return ret;
+}
+
+/* Get alternative streams of a radio sorted by bitrate */
+static struct radio_variant *radio_get_variants(struct db_handle *db,
+						long id, unsigned int *count)
+{
+	struct radio_variant *variants;
+	struct db_query *q = NULL;
+	char *sql;
+	int len;
+
+	*count = 0;
+
+	/* Prepare SQL */
+	len = asprintf(&sql, "SELECT url,bitrate "
+			     "FROM radio_variant "
+			     "WHERE rad_id = %ld "
+			     "ORDER BY bitrate ASC LIMIT %d", id,
+			     RADIO_LIST_MAX_VARIANTS);
+	if(len < 0)
+		return NULL;
+
+	/* Send SQL query */
+	q = db_prepare(db, sql, len);
+	free(sql);
+	if(q == NULL)
+		return NULL;
+
+	/* Allocate streams */
+	variants = calloc(RADIO_LIST_MAX_VARIANTS,
+			  sizeof(struct radio_variant));
+	if(variants == NULL)
+		goto end;
+
+	/* Copy streams */
+	while(*count < RADIO_LIST_MAX_VARIANTS && db_step(q) == DB_ROW)
+	{
+		variants[*count].url = db_column_copy_text(q, 0);
+		variants[*count].bitrate = db_column_int(q, 1);
+		if(variants[*count].url != NULL)
+			(*count)++;
+	}
+
+	/* No alternative stream */
+	if(*count == 0)
+	{
+		free(variants);
+		variants = NULL;
+	}
+
+end:
+	/* Finalize */
+	db_finalize(q);
+
+	return variants;
+}
 
 /* Get a radio by id */
 struct radio_item *radio_get_radio_item(struct db_handle *db, const char *id)
@@ -62,6 +187,10 @@ struct radio_item *radio_get_radio_item(struct db_handle *db, const char *id)
 	radio->url = db_column_copy_text(q, 2);
 	radio->description = db_column_copy_text(q, 3);
 
+	/* Get alternative streams */
+	radio->variants = radio_get_variants(db, atol(id),
+					     &radio->variant_count);
+
 end:
 	/* Finalize */
 	db_finalize(q);
@@ -113,6 +242,8 @@ end:
 /* Free a radio item */
 void radio_free_radio_item(struct radio_item *radio)
 {
+	unsigned int i;
+
 	if(radio == NULL)
 		return;
 
@@ -124,6 +255,12 @@ void radio_free_radio_item(struct radio_item *radio)
 		free(radio->url);
 	if(radio->description != NULL)
 		free(radio->description);
+	if(radio->variants != NULL)
+	{
+		for(i = 0; i < radio->variant_count; i++)
+			free(radio->variants[i].url);
+		free(radio->variants);
+	}
 
 	free(radio);
 }
@@ -193,8 +330,10 @@ end:
 /* Get radio info */
 char *radio_get_json_radio_info(struct db_handle *db, const char *id)
 {
+	struct radio_variant *variants;
+	struct json *info, *array, *tmp;
 	struct db_query *q = NULL;
-	struct json *info;
+	unsigned int count, i;
 	char *str = NULL;
 	char *sql;
 	int len;
@@ -227,6 +366,21 @@ char *radio_get_json_radio_info(struct db_handle *db, const char *id)
 	json_set_string(info, "url", db_column_text(q, 2));
 	json_set_string(info, "description", db_column_text(q, 3));
 
+	/* Add alternative streams */
+	variants = radio_get_variants(db, atol(id), &count);
+	array = json_new_array();
+	for(i = 0; i < count; i++)
+	{
+		tmp = json_new();
+		json_set_string(tmp, "url", variants[i].url);
+		json_set_int(tmp, "bitrate", variants[i].bitrate);
+		json_array_add(array, tmp);
+		free(variants[i].url);
+	}
+	json_add(info, "variants", array);
+	if(variants != NULL)
+		free(variants);
+
 	/* Get string from JSON object */
 	str = strdup(json_export(info));
 
@@ -257,6 +411,19 @@ static int radio_to_json(void *user_data, int col_count, char **values,
 	json_set_string(tmp, "url", values[2]);
 	json_set_string(tmp, "description", values[3]);
 
+	/* Add last health check results */
+	if(values[4] != NULL)
+	{
+		json_set_int(tmp, "alive", strtol(values[4], NULL, 10));
+		if(values[5] != NULL)
+			json_set_int(tmp, "bitrate",
+				     strtol(values[5], NULL, 10));
+		if(values[6] != NULL)
+			json_set_string(tmp, "codec", values[6]);
+		if(values[7] != NULL)
+			json_set_int(tmp, "ttfa", strtol(values[7], NULL, 10));
+	}
+
 	/* Add object to array */
 	if(json_array_add(list, tmp) != 0)
 		json_free(tmp);
@@ -287,10 +454,12 @@ static int category_to_json(void *user_data, int col_count, char **values,
 }
 
 char *radio_get_json_list(struct db_handle *db, const char *id,
-			  unsigned long page, unsigned long count)
+			  unsigned long page, unsigned long count,
+			  enum radio_list_sort sort, int alive_only)
 {
 	struct json *root, *list;
 	char limit[30] = "";
+	const char *order;
 	char *str = NULL;
 	long p_id;
 	char *sql;
@@ -303,6 +472,14 @@ char *radio_get_json_list(struct db_handle *db, const char *id,
 		count = RADIO_LIST_DEFAULT_COUNT;
 	snprintf(limit, 30, "LIMIT %lu, %lu", (page-1) * count, count);
 
+	/* Prepare SQL ORDER BY for radios */
+	if(sort == RADIO_LIST_SORT_HEALTH)
+		order = "ORDER BY CASE WHEN h.alive = 1 THEN 0 "
+			"WHEN h.alive IS NULL THEN 1 ELSE 2 END, "
+			"h.ttfa ASC, r.name ASC";
+	else
+		order = "ORDER BY r.name ASC";
+
 	if(id != NULL && strcmp(id, "all") == 0)
 	{
 		/* Create radio array */
@@ -311,9 +488,12 @@ char *radio_get_json_list(struct db_handle *db, const char *id,
 			return NULL;
 
 		/* Prepare SQL */
-		len = asprintf(&sql, "SELECT id,name,url,description "
-				     "FROM radio_list "
-				     "ORDER BY name ASC %s", limit);
+		len = asprintf(&sql, "SELECT " RADIO_LIST_COLUMNS
+				     "FROM radio_list AS r "
+				     RADIO_LIST_HEALTH
+				     "%s %s %s",
+				     alive_only ? "WHERE h.alive = 1" : "",
+				     order, limit);
 
 		/* List all radios */
 		if(len > 0)
@@ -366,12 +546,15 @@ char *radio_get_json_list(struct db_handle *db, const char *id,
 			goto end;
 
 		/* Prepare SQL */
-		len = asprintf(&sql, "SELECT id,name,url,description "
+		len = asprintf(&sql, "SELECT " RADIO_LIST_COLUMNS
 				     "FROM radio_list AS r "
 				     "INNER JOIN radio_category AS rc "
 				     "ON r.id = rc.rad_id "
-				     "WHERE rc.cat_id = '%ld' "
-				     "ORDER BY name ASC %s", p_id, limit);
+				     RADIO_LIST_HEALTH
+				     "WHERE rc.cat_id = '%ld' %s "
+				     "%s %s", p_id,
+				     alive_only ? "AND h.alive = 1" : "",
+				     order, limit);
 
 		if(len < 0)
 		{
@@ -21,11 +21,19 @@
 
 #include "db.h"
 
+/* Alternative stream of a radio with another bitrate */
+struct radio_variant {
+	char *url;
+	unsigned int bitrate;
+};
+
 struct radio_item {
 	char *id;
 	char *name;
 	char *url;
 	char *description;
+	struct radio_variant *variants;
+	unsigned int variant_count;
 };
 
 struct category_item {
@@ -33,6 +41,21 @@ struct category_item {
 	char *name;
 };
 
+/* Sort order of radio lists */
+enum radio_list_sort {
+	RADIO_LIST_SORT_NAME,	/*!< Sort radios by name */
+	RADIO_LIST_SORT_HEALTH	/*!< Alive radios first, fastest to start */
+};
+
+/* Create tables of radio list */
+void radio_list_init(struct db_handle *db);
+
+/* Alternative streams */
+int radio_add_variant(struct db_handle *db, const char *id, const char *url,
+		      unsigned int bitrate);
+int radio_remove_variant(struct db_handle *db, const char *id,
+			 const char *url);
+
 /* Getters */
 struct radio_item *radio_get_radio_item(struct db_handle *db, const char *id);
 struct category_item *radio_get_category_item(struct db_handle *db,
@@ -46,7 +69,8 @@ void radio_free_category_item(struct category_item *category);
 char *radio_get_json_category_info(struct db_handle *db, const char *id);
 char *radio_get_json_radio_info(struct db_handle *db, const char *id);
 char *radio_get_json_list(struct db_handle *db, const char *id,
-			  unsigned long page, unsigned long count);
+			  unsigned long page, unsigned long count,
+			  enum radio_list_sort sort, int alive_only);
 
 #endif
 
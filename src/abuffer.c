@@ -0,0 +1,158 @@
+/*
+ * abuffer.c - Reference counted audio buffer descriptors
+ *
+ * Copyright (c) 2014   A. Dilly
+ *
+ * AirCat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * AirCat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "abuffer.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* Size of a sample (in bytes) */
+#define SAMPLE_SIZE 4
+
+/* Copy statistics (in samples) */
+static uint64_t abuffer_copied = 0;
+static uint64_t abuffer_output = 0;
+
+struct abuffer *abuffer_new(size_t size)
+{
+	struct abuffer *b;
+
+	/* Allocate descriptor and samples at once */
+	b = malloc(sizeof(struct abuffer) + size * SAMPLE_SIZE);
+	if(b == NULL)
+		return NULL;
+
+	/* Init descriptor */
+	b->data = (unsigned char *) (b + 1);
+	b->len = 0;
+	b->size = size;
+	b->fmt.samplerate = 0;
+	b->fmt.channels = 0;
+	b->ref = 1;
+
+	return b;
+}
+
+struct abuffer *abuffer_ref(struct abuffer *b)
+{
+	if(b != NULL)
+		__atomic_add_fetch(&b->ref, 1, __ATOMIC_RELAXED);
+
+	return b;
+}
+
+void abuffer_unref(struct abuffer *b)
+{
+	if(b == NULL)
+		return;
+
+	/* Free buffer with last reference */
+	if(__atomic_sub_fetch(&b->ref, 1, __ATOMIC_ACQ_REL) == 0)
+		free(b);
+}
+
+struct abuffer *abuffer_get_writable(struct abuffer **pool, size_t size)
+{
+	struct abuffer *b = *pool;
+
+	/* Reuse buffer: no other stage holds it */
+	if(b != NULL && b->size >= size &&
+	   __atomic_load_n(&b->ref, __ATOMIC_ACQUIRE) == 1)
+	{
+		b->len = 0;
+		return b;
+	}
+
+	/* Replace buffer in pool */
+	abuffer_unref(b);
+	*pool = abuffer_new(size);
+
+	return *pool;
+}
+
+int abuffer_fill(struct abuffer **pool, a_read_cb input, void *user_data,
+		 struct abuffer **buffer, size_t size)
+{
+	struct abuffer *b;
+	int samples;
+
+	/* Get a free buffer */
+	b = abuffer_get_writable(pool, size);
+	if(b == NULL)
+		return 0;
+
+	/* Read samples directly in buffer */
+	b->fmt.samplerate = 0;
+	b->fmt.channels = 0;
+	samples = input(user_data, b->data, size, &b->fmt);
+	if(samples <= 0)
+		return samples;
+	b->len = samples;
+
+	/* Return a new reference on buffer */
+	*buffer = abuffer_ref(b);
+
+	return samples;
+}
+
+int abuffer_read(a_get_cb input, void *user_data, unsigned char *buffer,
+		 size_t size, struct a_format *fmt)
+{
+	struct abuffer *b = NULL;
+	int samples;
+
+	/* Get buffer */
+	samples = input(user_data, &b, size);
+	if(samples <= 0)
+		return samples;
+
+	/* Copy samples to caller buffer */
+	memcpy(buffer, b->data, samples * SAMPLE_SIZE);
+	abuffer_count_copy(samples);
+	format_cpy(fmt, &b->fmt);
+
+	/* Release buffer */
+	abuffer_unref(b);
+
+	return samples;
+}
+
+void abuffer_count_copy(size_t samples)
+{
+	__atomic_add_fetch(&abuffer_copied, samples, __ATOMIC_RELAXED);
+}
+
+void abuffer_count_output(size_t samples)
+{
+	__atomic_add_fetch(&abuffer_output, samples, __ATOMIC_RELAXED);
+}
+
+void abuffer_get_stats(uint64_t *copied, uint64_t *output)
+{
+	if(copied != NULL)
+		*copied = __atomic_load_n(&abuffer_copied, __ATOMIC_RELAXED) *
+			  SAMPLE_SIZE;
+	if(output != NULL)
+		*output = __atomic_load_n(&abuffer_output, __ATOMIC_RELAXED);
+}
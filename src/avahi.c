@@ -26,12 +26,13 @@
 #include <avahi-client/publish.h>
 
 #include <avahi-common/alternative.h>
-#include <avahi-common/simple-watch.h>
+#include <avahi-common/watch.h>
 #include <avahi-common/malloc.h>
 #include <avahi-common/error.h>
 #include <avahi-common/timeval.h>
 
 #include "avahi.h"
+#include "loop.h"
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -49,10 +50,144 @@ struct avahi_service {
 };
 
 struct avahi_handle {
-	AvahiSimplePoll *simple_poll;
+	/* Poll API on shared event loop */
+	AvahiPoll poll;
+	struct loop_handle *loop;
 	struct avahi_service *service_list;
 };
 
+/* Watch and timeout of Avahi poll API */
+struct AvahiWatch {
+	struct loop_fd *fd;
+	AvahiWatchEvent events;
+	AvahiWatchCallback cb;
+	void *user_data;
+};
+
+struct AvahiTimeout {
+	struct loop_timer *timer;
+	AvahiTimeoutCallback cb;
+	void *user_data;
+};
+
+static void avahi_watch_cb(void *user_data, int fd, int events)
+{
+	AvahiWatch *w = user_data;
+
+	/* Convert events */
+	w->events = (events & LOOP_READ ? AVAHI_WATCH_IN : 0) |
+		    (events & LOOP_WRITE ? AVAHI_WATCH_OUT : 0) |
+		    (events & LOOP_ERROR ? AVAHI_WATCH_ERR : 0) |
+		    (events & LOOP_HANGUP ? AVAHI_WATCH_HUP : 0);
+
+	w->cb(w, fd, w->events, w->user_data);
+	w->events = 0;
+}
+
+static int avahi_watch_get_loop_events(AvahiWatchEvent events)
+{
+	return (events & AVAHI_WATCH_IN ? LOOP_READ : 0) |
+	       (events & AVAHI_WATCH_OUT ? LOOP_WRITE : 0);
+}
+
+static AvahiWatch *avahi_watch_new(const AvahiPoll *api, int fd,
+				   AvahiWatchEvent event, AvahiWatchCallback cb,
+				   void *userdata)
+{
+	struct avahi_handle *h = api->userdata;
+	AvahiWatch *w;
+
+	w = malloc(sizeof(AvahiWatch));
+	if(w == NULL)
+		return NULL;
+	w->events = 0;
+	w->cb = cb;
+	w->user_data = userdata;
+
+	/* Add file descriptor to loop */
+	w->fd = loop_add_fd(h->loop, fd, avahi_watch_get_loop_events(event),
+			    avahi_watch_cb, w);
+	if(w->fd == NULL)
+	{
+		free(w);
+		return NULL;
+	}
+
+	return w;
+}
+
+static void avahi_watch_update(AvahiWatch *w, AvahiWatchEvent event)
+{
+	loop_set_fd(w->fd, avahi_watch_get_loop_events(event));
+}
+
+static AvahiWatchEvent avahi_watch_get_events(AvahiWatch *w)
+{
+	return w->events;
+}
+
+static void avahi_watch_free(AvahiWatch *w)
+{
+	loop_remove_fd(w->fd);
+	free(w);
+}
+
+static void avahi_timeout_cb(void *user_data)
+{
+	AvahiTimeout *t = user_data;
+
+	t->cb(t, t->user_data);
+}
+
+static long avahi_timeout_get_delay(const struct timeval *tv)
+{
+	AvahiUsec age;
+
+	/* Disabled timeout */
+	if(tv == NULL)
+		return -1;
+
+	/* Convert absolute time to a delay (in ms) */
+	age = avahi_age(tv);
+	return age >= 0 ? 0 : -age / 1000;
+}
+
+static AvahiTimeout *avahi_timeout_new(const AvahiPoll *api,
+				       const struct timeval *tv,
+				       AvahiTimeoutCallback cb, void *userdata)
+{
+	struct avahi_handle *h = api->userdata;
+	AvahiTimeout *t;
+
+	t = malloc(sizeof(AvahiTimeout));
+	if(t == NULL)
+		return NULL;
+	t->cb = cb;
+	t->user_data = userdata;
+
+	/* Add timer to loop */
+	t->timer = loop_add_timer(h->loop, avahi_timeout_get_delay(tv), 0,
+				  avahi_timeout_cb, t);
+	if(t->timer == NULL)
+	{
+		free(t);
+		return NULL;
+	}
+
+	return t;
+}
+
+static void avahi_timeout_update(AvahiTimeout *t, const struct timeval *tv)
+{
+	loop_set_timer(t->timer, avahi_timeout_get_delay(tv), 0);
+}
+
+static void avahi_timeout_free(AvahiTimeout *t)
+{
+	loop_remove_timer(t->timer);
+	free(t);
+}
+
 static void avahi_entry_group_callback(AvahiEntryGroup *g, AvahiEntryGroupState state, void *userdata)
 {
 	struct avahi_service *s = (struct avahi_service *) userdata;
@@ -145,10 +280,13 @@ static void avahi_client_callback(AvahiClient *c, AvahiClientState state, void *
 	}
 }
 
-int avahi_open(struct avahi_handle **handle)
+int avahi_open(struct avahi_handle **handle, struct loop_handle *loop)
 {
 	struct avahi_handle *h;
 
+	if(loop == NULL)
+		return -1;
+
 	/* Allocate structure */
 	*handle = malloc(sizeof(struct avahi_handle));
 	if(*handle == NULL)
@@ -157,11 +295,17 @@ int avahi_open(struct avahi_handle **handle)
 
 	/* Init structure */
 	h->service_list = NULL;
-
-	/* Allocate main loop object */
-	h->simple_poll = avahi_simple_poll_new();
-	if(h == NULL)
-		return -1;
+	h->loop = loop;
+
+	/* Prepare poll API on event loop */
+	h->poll.userdata = h;
+	h->poll.watch_new = avahi_watch_new;
+	h->poll.watch_update = avahi_watch_update;
+	h->poll.watch_get_events = avahi_watch_get_events;
+	h->poll.watch_free = avahi_watch_free;
+	h->poll.timeout_new = avahi_timeout_new;
+	h->poll.timeout_update = avahi_timeout_update;
+	h->poll.timeout_free = avahi_timeout_free;
 
 	return 0;
 }
@@ -174,12 +318,18 @@ int avahi_add_service(struct avahi_handle *h, const char *name, const char *type
 	if(h == NULL)
 		return -1;
 
+	/* Lock loop: Avahi client callbacks are called from it */
+	loop_lock(h->loop);
+
 	/* Search if name is already registered with same port */
 	s = h->service_list;
 	while(s != NULL)
 	{
 		if(strcmp(s->name, name) == 0 && s->port == port)
+		{
+			loop_unlock(h->loop);
 			return -1;
+		}
 		s = s->next;
 	}
 
@@ -201,7 +351,11 @@ int avahi_add_service(struct avahi_handle *h, const char *name, const char *type
 	va_end(va);
 
 	/* Allocate a new client */
-	s->client = avahi_client_new(avahi_simple_poll_get(h->simple_poll), 0, avahi_client_callback, s, NULL);
+	s->client = avahi_client_new(&h->poll, 0, avahi_client_callback, s, NULL);
+
+	/* Unlock loop */
+	loop_unlock(h->loop);
+
 	if(s->client == NULL)
 		return -1;
 
@@ -215,6 +369,9 @@ int avahi_remove_service(struct avahi_handle *h, const char *name, unsigned int
 	if(h == NULL)
 		return -1;
 
+	/* Lock loop */
+	loop_lock(h->loop);
+
 	/* Search if service exist */
 	s = h->service_list;
 	while(s != NULL)
@@ -242,21 +399,19 @@ int avahi_remove_service(struct avahi_handle *h, const char *name, unsigned int
 
 			free(s);
 
+			/* Unlock loop */
+			loop_unlock(h->loop);
+
 			return 0;
 		}
 		s_prev = s;
 		s = s->next;
 	}
 
-	return -1;
-}
-
-int avahi_loop(struct avahi_handle *h, int timeout)
-{
-	if(h == NULL)
-		return -1;
+	/* Unlock loop */
+	loop_unlock(h->loop);
 
-	return avahi_simple_poll_iterate(h->simple_poll, timeout);
+	return -1;
 }
 
 int avahi_close(struct avahi_handle *h)
@@ -266,6 +421,9 @@ int avahi_close(struct avahi_handle *h)
 	if(h == NULL)
 		return 0;
 
+	/* Lock loop */
+	loop_lock(h->loop);
+
 	/* Stop services */
 	while(h->service_list != NULL)
 	{
@@ -287,9 +445,8 @@ int avahi_close(struct avahi_handle *h)
 		free(s);
 	}
 
-	/* Close poll */
-	if(h->simple_poll != NULL)
-		avahi_simple_poll_free(h->simple_poll);
+	/* Unlock loop */
+	loop_unlock(h->loop);
 
 	free(h);
 
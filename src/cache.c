@@ -24,6 +24,7 @@
 #include <pthread.h>
 
 #include "cache.h"
+#include "abuffer.h"
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -522,6 +523,7 @@ copy:
 		if(in_size > len)
 			in_size = len;
 		memcpy(&h->buffer[h->len*4], buffer, in_size * 4);
+		abuffer_count_copy(in_size);
 		h->len += in_size;
 		len -= in_size;
 
@@ -596,6 +598,7 @@ int cache_read(void *user_data, unsigned char *buffer, size_t size,
 		memcpy(buffer, h->buffer, size*4);
 		h->len -= size;
 		memmove(h->buffer, &h->buffer[size*4], h->len*4);
+		abuffer_count_copy(size + h->len);
 
 		/* Reduce buffer to new size */
 		if(h->new_size)
@@ -691,6 +694,7 @@ ssize_t cache_write(void *user_data, const unsigned char *buffer, size_t size,
 
 	/* Copy data to buffer */
 	memcpy(&h->buffer[h->len*4], buffer, size * 4);
+	abuffer_count_copy(size);
 	h->len += size;
 
 	/* Update format list */
@@ -24,6 +24,7 @@
 #include <neaacdec.h>
 
 #include "decoder_aac.h"
+#include "sample.h"
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -70,11 +71,8 @@ int decoder_aac_open(struct decoder **decoder, const unsigned char *dec_config,
 
 	/* Set the default object type and samplerate */
 	config = NeAACDecGetCurrentConfiguration(dec->hDec);
-#ifdef USE_FLOAT
-	config->outputFormat = FAAD_FMT_FLOAT;
-#else
-	config->outputFormat = FAAD_FMT_24BIT;
-#endif
+	config->outputFormat = sample_get_format() == SAMPLE_FLOAT ?
+					     FAAD_FMT_FLOAT : FAAD_FMT_24BIT;
 	NeAACDecSetConfiguration(dec->hDec, config);
 
 	/* PCM data remaining in output buffer */
@@ -141,11 +139,12 @@ static long decoder_aac_fill_output(struct decoder *dec,
 		 */
 		/* TODO */
 	}
-	else
-#ifdef USE_FLOAT
-		/* 32-bit wide sample (float or 32-bit fixed) */
+	else if(sample_get_format() == SAMPLE_FLOAT)
+	{
+		/* 32-bit wide sample (float) */
 		memcpy(output_buffer, &dec->pcm_buffer[pos * 4], size * 4);
-#else
+	}
+	else
 	{
 		int32_t *p_in = (int32_t*) &dec->pcm_buffer[pos*4];
 		int32_t *p_out = (int32_t*) output_buffer;
@@ -156,7 +155,6 @@ static long decoder_aac_fill_output(struct decoder *dec,
 			p_in++;
 		}
 	}
-#endif
 
 	dec->pcm_remain -= size;
 
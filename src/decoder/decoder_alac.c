@@ -28,6 +28,7 @@
 #include <stdint.h>
 
 #include "decoder_alac.h"
+#include "sample.h"
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -140,11 +141,7 @@ static long decoder_alac_fill_output(struct decoder *dec,
 				     unsigned char *output_buffer,
 				     size_t output_size)
 {
-#ifdef USE_FLOAT
-	float *p = (float*) output_buffer;
-#else
 	int32_t *p = (int32_t*) output_buffer;
-#endif 
 	unsigned long pos;
 	unsigned long size;
 	int i;
@@ -158,17 +155,15 @@ static long decoder_alac_fill_output(struct decoder *dec,
 	/* Copy samples to output buffer */
 	for(i = 0; i < size * 2; i += 2)
 	{
-#ifdef USE_FLOAT
-		*p++ = (float)((int32_t) (dec->buffer[i+1+pos] << 24) |
-				       (dec->buffer[i+pos] << 16)) / 0x7fffffff;
-#else
 		*p++ = (int32_t) (dec->buffer[i+1+pos] << 24) |
 				 (dec->buffer[i+pos] << 16);
-#endif
 	}
 
 	dec->pcm_remain -= size;
 
+	/* Convert to pipeline format */
+	sample_from_s32(output_buffer, size);
+
 	return size;
 }
 
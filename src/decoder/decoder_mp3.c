@@ -22,6 +22,7 @@
 #include <mad.h>
 
 #include "decoder_mp3.h"
+#include "sample.h"
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -95,12 +96,6 @@ int decoder_mp3_open(struct decoder **decoder, const unsigned char *config,
 	return 0;
 }
 
-#ifdef USE_FLOAT
-inline float mad_scale(mad_fixed_t sample)
-{
-	return (float) (sample / (float) (1L << MAD_F_FRACBITS));
-}
-#else
 inline int32_t mad_scale(mad_fixed_t sample)
 {
 
@@ -115,17 +110,12 @@ inline int32_t mad_scale(mad_fixed_t sample)
 
 	return (sample << 3) & 0xFFFFFF00;
 }
-#endif
 
 static long decoder_mp3_fill_output(struct decoder *dec,
 				    unsigned char *output_buffer,
 				    size_t output_size)
 {
-#ifdef USE_FLOAT
-	float *p = (float*) output_buffer;
-#else
 	int32_t *p = (int32_t*) output_buffer;
-#endif
 	unsigned short pos;
 	int i;
 
@@ -144,6 +134,9 @@ static long decoder_mp3_fill_output(struct decoder *dec,
 
 	dec->pcm_remain = dec->Synth.pcm.length - pos;
 
+	/* Convert to pipeline format */
+	sample_from_s32(output_buffer, i);
+
 	return i;
 }
 
@@ -28,6 +28,7 @@
 #include <stdint.h>
 
 #include "decoder_pcm.h"
+#include "sample.h"
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -107,27 +108,16 @@ static int decoder_pcm_parse_riff(struct decoder *dec, const char *config,
 	return 0;
 }
 
-#ifdef USE_FLOAT
-	#define CONV8(b)  (float)(FROM_8(b)) / 0x7fffffff
-	#define CONV16(b) (float)(FROM_16(b)) / 0x7fffffff
-	#define CONV24(b) (float)(FROM_24(b)) / 0x7fffffff
-	#define CONV32(b) (float)(FROM_32(b)) / 0x7fffffff
-#else
-	#define CONV8(b)  FROM_8(b)
-	#define CONV16(b) FROM_16(b)
-	#define CONV24(b) FROM_24(b)
-	#define CONV32(b) FROM_32(b)
-#endif
+#define CONV8(b)  FROM_8(b)
+#define CONV16(b) FROM_16(b)
+#define CONV24(b) FROM_24(b)
+#define CONV32(b) FROM_32(b)
 
 static long decoder_pcm_fill_output(struct decoder *dec,
 				    unsigned char *output_buffer,
 				    size_t output_size)
 {
-#ifdef USE_FLOAT
-	float *p = (float*) output_buffer;
-#else
 	int32_t *p = (int32_t*) output_buffer;
-#endif 
 	unsigned long pos;
 	unsigned long size;
 	int i;
@@ -165,6 +155,9 @@ static long decoder_pcm_fill_output(struct decoder *dec,
 
 	dec->pcm_remain -= output_size;
 
+	/* Convert to pipeline format */
+	sample_from_s32(output_buffer, output_size);
+
 	return output_size;
 }
 
@@ -56,28 +56,37 @@ struct demux_handle {
 
 static void *demux_thread(void *user_data);
 
-int demux_open(struct demux_handle **handle, const char *uri,
-	       unsigned long *samplerate, unsigned char *channels,
-	       size_t cache_size, int use_thread)
+static struct demux_module *demux_find_module(const char *uri)
 {
-	struct demux_handle *h;
-	struct demux_module *d;
-	struct fs_file *file;
-	struct stat st;
 	const char *ext;
 	int len;
 
 	/* Check file URI */
 	if(uri == NULL || (len = strlen(uri)) < 4)
-		return -1;
+		return NULL;
 
 	/* Get content type from file extension */
 	ext = &uri[len-4];
 	if(strcasecmp(ext, ".mp3") == 0)
-		d = &demux_mp3;
+		return &demux_mp3;
 	else if(strcasecmp(ext, ".m4a") == 0 || strcasecmp(ext, ".mp4") == 0)
-		d = &demux_mp4;
-	else
+		return &demux_mp4;
+
+	return NULL;
+}
+
+int demux_open(struct demux_handle **handle, const char *uri,
+	       unsigned long *samplerate, unsigned char *channels,
+	       size_t cache_size, int use_thread)
+{
+	struct demux_handle *h;
+	struct demux_module *d;
+	struct fs_file *file;
+	struct stat st;
+
+	/* Get demuxer from URI */
+	d = demux_find_module(uri);
+	if(d == NULL)
 		return -1;
 
 	/* Open file */
@@ -124,6 +133,45 @@ int demux_open(struct demux_handle **handle, const char *uri,
 	return 0;
 }
 
+struct meta *demux_probe(const char *uri, int options)
+{
+	struct demux_module *d;
+	struct fs_file *file;
+	struct meta *m;
+	struct stat st;
+	size_t file_size = 0;
+
+	/* Get demuxer from URI */
+	d = demux_find_module(uri);
+	if(d == NULL || d->probe == NULL)
+		return NULL;
+
+	/* Open file */
+	file = fs_open(uri, O_RDONLY, 0);
+	if(file == NULL)
+		return NULL;
+
+	/* Get file size */
+	if(fs_fstat(file, &st) == 0)
+		file_size = st.st_size;
+
+	/* Allocate meta */
+	m = calloc(1, sizeof(struct meta));
+	if(m == NULL)
+		goto end;
+
+	/* Probe file */
+	if(d->probe(file, file_size, m, options) != 0)
+	{
+		meta_free(m);
+		m = NULL;
+	}
+
+end:
+	fs_close(file);
+	return m;
+}
+
 struct meta *demux_get_meta(struct demux_handle *h)
 {
 	if(h == NULL || h->demux == NULL || h->module.get_meta == NULL)
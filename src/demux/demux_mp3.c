@@ -26,6 +26,7 @@
 #endif
 
 #include "demux.h"
+#include "mpeg_sync.h"
 #include "id3.h"
 
 /**
@@ -33,44 +34,16 @@
  */
 #define BUFFER_SIZE 8192
 
-unsigned int bitrates[2][3][15] = {
-	{ /* MPEG-1 */
-		{0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384,
-		 416, 448},
-		{0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320,
-		 384},
-		{0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256,
-		 320}
-	},
-	{ /* MPEG-2 LSF, MPEG-2.5 */
-		{0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224,
-		 256},
-		{0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160},
-		{0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160}
-	}
-};
-unsigned int samplerates[3][4] = {
-	{44100, 48000, 32000, 0},
-	{22050, 24000, 16000, 0},
-	{11025, 8000, 8000, 0}
-};
-
-unsigned int samples[2][3] = {
-	{384, 1152, 1152},
-	{384, 1152, 576}
-};
+/**
+ * Count of consecutive frames to check to find first frame.
+ */
+#define SYNC_FRAMES 3
 
-struct mp3_frame {
-	unsigned char mpeg; /* 0: MPEG 1, 1: MPEG 2, 2: MPEG 2.5 */
-	unsigned char layer; /* 0: layer 1, 1: layer 2, 2: layer 3 */
-	unsigned int bitrate;
-	unsigned long samplerate;
-	unsigned char padding;
-	unsigned char channels; /* 0: Mono, 1: Stereo, 2: Joint Stereo,
-				   3: Dual channel */
-	unsigned int samples;
-	unsigned int length;
-};
+/**
+ * Delay added by MP3 decoder (in samples): it is not included in encoder
+ * delay of LAME tag.
+ */
+#define DECODER_DELAY 529
 
 struct demux {
 	/* Stream length */
@@ -84,6 +57,9 @@ struct demux {
 	unsigned int nb_frame;
 	unsigned int quality;
 	unsigned char *toc;
+	/* LAME specific */
+	unsigned int enc_delay;
+	unsigned int enc_padding;
 	/* VBRI sepcific */
 	unsigned int version;
 	unsigned int delay;
@@ -96,7 +72,7 @@ struct demux {
 	unsigned long offset;
 	/* Waiting frame */
 	unsigned char waiting_header[4];
-	struct mp3_frame waiting_frame;
+	struct mpeg_frame waiting_frame;
 	off_t waiting_header_pos;
 	char waiting_header_read;
 	size_t waiting_read;
@@ -115,85 +91,14 @@ struct demux {
 	char *pic_mime;
 };
 
-static int demux_mp3_parse_header(const unsigned char *buffer,
-				  unsigned int size, struct mp3_frame *f)
-{
-	int mp;
-
-	if(size < 4)
-		return -1;
+#define READ32(b) (b += 4, (b[-4] << 24) | (b[-3] << 16) | (b[-2] << 8) | b[-1])
+#define READ16(b) (b += 2, (b[-2] << 8) | b[-1])
 
-	/* Check syncword */
-	if(buffer[0] != 0xFF || (buffer[1] & 0xE0) != 0xE0)
-		return -1;
-
-	/* Get Mpeg version */
-	f->mpeg = 3 - ((buffer[1] >> 3) & 0x03);
-	mp = f->mpeg;
-	if(f->mpeg == 2)
-		return -1;
-	if(f->mpeg == 3)
-	{
-		f->mpeg = 2;
-		mp = 1;
-	}
-
-	/* Get Layer */
-	f->layer = 3 - ((buffer[1] >> 1) & 0x03);
-	if(f->layer == 3)
-		return -1;
-
-	/* Get bitrate */
-	f->bitrate = (buffer[2] >> 4) & 0x0F;
-	if(f->bitrate == 0 || f->bitrate == 15)
-		return -1;
-	f->bitrate = bitrates[mp][f->layer][f->bitrate];
-
-	/* Get samplerate */
-	f->samplerate = (buffer[2] >> 2) & 0x03;
-	if(f->samplerate == 3)
-		return -1;
-	f->samplerate = samplerates[f->mpeg][f->samplerate];
-
-	/* Get padding */
-	f->padding = (buffer[2] >> 1) & 0x01;
-
-	/* Get channel count */
-	f->channels = ((buffer[3] >> 6) & 0x03) == 0x03 ? 1 : 2;
-
-	/* Get samples count */
-	f->samples = samples[mp][f->layer];
-
-	/* Calculate frame length */
-	if(f->layer == 0)
-	{
-		/* Layer I */
-		f->length = ((12 * f->bitrate * 1000 / f->samplerate) +
-			    f->padding) * 4;
-	}
-	else if(f->mpeg > 0 && f->layer == 2)
-	{
-		/* MPEG 2 and 2.5 in layer III */
-		f->length = (72 * f->bitrate * 1000 / f->samplerate) +
-			     f->padding;
-	}
-	else
-	{
-		/* Layer II or III */
-		f->length = (144 * f->bitrate * 1000 / f->samplerate) +
-			     f->padding;
-	}
-
-	return 0;
-}
-
-#define READ32(b) (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3]; b += 4;
-#define READ16(b) (b[0] << 8) | b[1]; b += 2;
-
-static int demux_mp3_parse_xing(struct mp3_frame *f,
+static int demux_mp3_parse_xing(struct mpeg_frame *f,
 				const unsigned char *buffer, size_t len,
 				struct demux *d)
 {
+	const unsigned char *frame = buffer;
 	unsigned int offset;
 	unsigned char flags;
 
@@ -202,7 +107,7 @@ static int demux_mp3_parse_xing(struct mp3_frame *f,
 		return -1;
 
 	/* Calculate header position */
-	offset = f->channels == 0 ?
+	offset = f->channels == 1 ?
 		(f->mpeg == 0 ? 21 : 13) : (f->mpeg == 0 ? 36 : 21);
 	if(offset + 120 > f->length)
 		return -1;
@@ -247,10 +152,19 @@ static int demux_mp3_parse_xing(struct mp3_frame *f,
 	if(flags & 0x0008)
 		d->quality  = READ32(buffer);
 
+	/* LAME tag: get encoder delay and padding */
+	if(buffer - frame + 24 <= f->length &&
+	   strncmp((char*)buffer, "LAME", 4) == 0)
+	{
+		buffer += 21;
+		d->enc_delay = (buffer[0] << 4) | (buffer[1] >> 4);
+		d->enc_padding = ((buffer[1] & 0x0F) << 8) | buffer[2];
+	}
+
 	return 0;
 }
 
-static int demux_mp3_parse_vbri(struct mp3_frame *f,
+static int demux_mp3_parse_vbri(struct mpeg_frame *f,
 				const unsigned char *buffer, size_t len,
 				struct demux *d)
 {
@@ -322,18 +236,15 @@ static int demux_mp3_parse_vbri(struct mp3_frame *f,
 	return 0;
 }
 
-#define ID3V2_SIZE(b) (((b)[0] << 21) | ((b)[1] << 14) | ((b)[2] << 7) | (b)[3])
-
 int demux_mp3_open(struct demux **demux, struct fs_file *file, size_t file_size,
 		   unsigned long *samplerate, unsigned char *channels)
 {
 	struct demux *d;
-	struct mp3_frame frame;
+	struct mpeg_frame frame;
 	unsigned char buffer[BUFFER_SIZE];
 	unsigned long id3_size = 0;
 	long first = -1;
 	ssize_t len;
-	int i;
 
 	if(file == NULL)
 		return -1;
@@ -382,27 +293,10 @@ int demux_mp3_open(struct demux **demux, struct fs_file *file, size_t file_size,
 	}
 
 	/* Sync to first frame */
-	for(i = 0; i < len - 3; i++)
-	{
-		if(buffer[i] == 0xFF && (buffer[i+1] & 0xE0) == 0xE0)
-		{
-			/* Check header */
-			if(demux_mp3_parse_header(&buffer[i], 4, &frame)
-			   != 0)
-				continue;
-
-			/* Check next frame */
-			if(i + frame.length + 2 > len ||
-			   buffer[i+frame.length] != 0xFF ||
-			   (buffer[i+frame.length+1] & 0xE0) != 0xE0)
-				continue;
-
-			first = i + id3_size;
-			break;
-		}
-	}
+	first = mpeg_sync_find(buffer, len, MPEG_SYNC_MP3, SYNC_FRAMES, &frame);
 	if(first < 0)
 		return -1;
+	first += id3_size;
 
 	/* Move to first frame */
 	fs_lseek(file, first, SEEK_SET);
@@ -418,7 +312,7 @@ int demux_mp3_open(struct demux **demux, struct fs_file *file, size_t file_size,
 		first += frame.length;
 		if(frame.length + 4 > len)
 			fs_read(file, buffer+len, frame.length-len+4);
-		demux_mp3_parse_header(buffer+frame.length, 4, &frame);
+		mpeg_sync_parse_mp3(buffer+frame.length, 4, &frame);
 	}
 
 	/* Update position of stream */
@@ -438,10 +332,20 @@ int demux_mp3_open(struct demux **demux, struct fs_file *file, size_t file_size,
 	}
 
 	/* Fill meta */
+	d->meta.type = FILE_FORMAT_MPEG;
+	d->meta.stream_offset = d->offset;
 	d->meta.samplerate = frame.samplerate;
 	d->meta.channels = frame.channels;
 	d->meta.bitrate = frame.bitrate;
 	d->meta.length = d->duration;
+	if(d->nb_frame > 0 && (d->enc_delay > 0 || d->enc_padding > 0))
+	{
+		/* Gapless info from LAME tag */
+		d->meta.samples = frame.samples * d->nb_frame;
+		d->meta.delay = d->enc_delay + DECODER_DELAY;
+		d->meta.padding = d->enc_padding > DECODER_DELAY ?
+				  d->enc_padding - DECODER_DELAY : 0;
+	}
 	d->meta.title = d->title;
 	d->meta.artist = d->artist;
 	d->meta.album = d->album;
@@ -518,8 +422,8 @@ ssize_t demux_mp3_next_frame(struct demux *d, struct demux_frame *frame,
 		}
 
 		/* Check header frame */
-		if(demux_mp3_parse_header(d->waiting_header, 4,
-					  &d->waiting_frame) != 0)
+		if(mpeg_sync_parse_mp3(d->waiting_header, 4,
+				       &d->waiting_frame) != 0)
 		{
 			/* Find next sync word in 4 bytes */
 			for(len = 1; len < 3; len++)
@@ -677,6 +581,42 @@ void demux_mp3_close(struct demux *d)
 	free(d);
 }
 
+static int demux_mp3_probe(struct fs_file *file, size_t file_size,
+			   struct meta *m, int options)
+{
+	struct demux *d = NULL;
+	unsigned long samplerate;
+	unsigned char channels;
+
+	/* Get tags from ID3v2 and complete with ID3v1 */
+	if(id3v2_parse(file, m, options) < 0)
+		return -1;
+	id3v1_parse(file, file_size, m);
+
+	/* Get stream properties from first frames */
+	fs_lseek(file, 0, SEEK_SET);
+	if(demux_mp3_open(&d, file, file_size, &samplerate, &channels) != 0)
+	{
+		demux_mp3_close(d);
+		return -1;
+	}
+
+	/* Copy properties */
+	m->type = d->meta.type;
+	m->stream_offset = d->meta.stream_offset;
+	m->samplerate = d->meta.samplerate;
+	m->channels = channels;
+	m->bitrate = d->meta.bitrate;
+	m->length = d->meta.length;
+	m->delay = d->meta.delay;
+	m->padding = d->meta.padding;
+	m->samples = d->meta.samples;
+
+	demux_mp3_close(d);
+
+	return 0;
+}
+
 struct demux_module demux_mp3 = {
 	.open = &demux_mp3_open,
 	.get_meta = &demux_mp3_get_meta,
@@ -685,5 +625,6 @@ struct demux_module demux_mp3 = {
 	.calc_pos = &demux_mp3_calc_pos,
 	.set_pos = &demux_mp3_set_pos,
 	.close = &demux_mp3_close,
+	.probe = &demux_mp3_probe,
 };
 
@@ -91,6 +91,9 @@ struct demux {
 	unsigned long num_samples;
 	/* An Mp4a track found flag */
 	int track_found;
+	/* Probe mode: sample tables are not loaded */
+	int probe;
+	int options;
 	/* Current sample/chunk */
 	unsigned int cur_sample_size;
 	unsigned long cur_sample;
@@ -594,22 +597,26 @@ static void demux_mp4_parse_track(struct demux *d)
 			/* Parse "stsd" atom */
 			is_mp4a = demux_mp4_parse_stsd(d);
 		}
-		else if(ATOM_CHECK(d->buffer, "stts") == 0 && is_mp4a)
+		else if(ATOM_CHECK(d->buffer, "stts") == 0 && is_mp4a &&
+			!d->probe)
 		{
 			/* Parse "stts" atom */
 			demux_mp4_parse_stts(d);
 		}
-		else if(ATOM_CHECK(d->buffer, "stsc") == 0 && is_mp4a)
+		else if(ATOM_CHECK(d->buffer, "stsc") == 0 && is_mp4a &&
+			!d->probe)
 		{
 			/* Parse "stsc" atom */
 			demux_mp4_parse_stsc(d);
 		}
-		else if(ATOM_CHECK(d->buffer, "stsz") == 0 && is_mp4a)
+		else if(ATOM_CHECK(d->buffer, "stsz") == 0 && is_mp4a &&
+			!d->probe)
 		{
 			/* Parse "stsz" atom */
 			demux_mp4_parse_stsz(d);
 		}
-		else if(ATOM_CHECK(d->buffer, "stco") == 0 && is_mp4a)
+		else if(ATOM_CHECK(d->buffer, "stco") == 0 && is_mp4a &&
+			!d->probe)
 		{
 			/* Parse "stco" atom */
 			demux_mp4_parse_stco(d);
@@ -721,7 +728,7 @@ static void demux_mp4_parse_gnre(struct demux *d)
 		size -= 10;
 
 		/* Check genre */
-		if(genre > 0 || genre <= ID3v1_genres_count)
+		if(genre > 0 && genre <= ID3v1_genres_count)
 		{
 			/* Free previous genre */
 			if(d->genre != NULL)
@@ -800,6 +807,54 @@ static void demux_mp4_parse_covr(struct demux *d)
 	fs_lseek(d->file, size, SEEK_CUR);
 }
 
+static void demux_mp4_parse_freeform(struct demux *d)
+{
+	unsigned long delay, padding, length;
+	unsigned long size, len, pos;
+	unsigned char *data = NULL;
+	int is_smpb = 0;
+
+	/* Get size */
+	size = ATOM_LEN(d->buffer) - 8;
+
+	/* Read all sub-atoms which must fit in buffer */
+	if(size > d->buffer_size - 1)
+	{
+		fs_lseek(d->file, size, SEEK_CUR);
+		return;
+	}
+	if(fs_read(d->file, d->buffer, size) != (ssize_t) size)
+		return;
+
+	/* Parse "mean", "name" and "data" sub-atoms */
+	for(pos = 0; pos + 16 <= size; pos += len)
+	{
+		len = ATOM_LEN(&d->buffer[pos]);
+		if(len < 16 || pos + len > size)
+			break;
+
+		/* iTunes gapless info: "iTunSMPB" */
+		if(ATOM_CHECK(&d->buffer[pos], "name") == 0)
+			is_smpb = len == 20 &&
+				  memcmp(&d->buffer[pos+12], "iTunSMPB", 8) == 0;
+		else if(ATOM_CHECK(&d->buffer[pos], "data") == 0)
+		{
+			data = &d->buffer[pos+16];
+			d->buffer[pos+len] = '\0';
+		}
+	}
+	if(!is_smpb || data == NULL)
+		return;
+
+	/* Get encoder delay, padding and original length (in samples) */
+	if(sscanf((char *) data, "%*x %lx %lx %lx", &delay, &padding,
+		  &length) != 3 || length == 0)
+		return;
+	d->meta.delay = delay;
+	d->meta.padding = padding;
+	d->meta.samples = delay + length + padding;
+}
+
 static void demux_mp4_parse_ilst(struct demux *d)
 {
 	unsigned long atom_size;
@@ -833,7 +888,10 @@ static void demux_mp4_parse_ilst(struct demux *d)
 			demux_mp4_parse_trkn(d);
 		else if(ATOM_CHECK(d->buffer, "gnre") == 0)
 			demux_mp4_parse_gnre(d);
-		else if(ATOM_CHECK(d->buffer, "covr") == 0)
+		else if(ATOM_CHECK(d->buffer, "----") == 0)
+			demux_mp4_parse_freeform(d);
+		else if(ATOM_CHECK(d->buffer, "covr") == 0 &&
+			(!d->probe || d->options & TAG_PICTURE))
 			demux_mp4_parse_covr(d);
 		else
 		{
@@ -957,62 +1015,50 @@ static void demux_mp4_parse_moov(struct demux *d)
 	fs_lseek(d->file, atom_size-count, SEEK_CUR);
 }
 
-int demux_mp4_open(struct demux **demux, struct fs_file *file, size_t file_size,
-		   unsigned long *samplerate, unsigned char *channels)
+static int demux_mp4_parse(struct demux *d)
 {
-	struct demux *d;
-	unsigned char buffer[BUFFER_SIZE];
 	unsigned long mdat_pos = 0;
 	unsigned long moov_pos = 0;
 	unsigned long count = 0;
 	unsigned long size;
 
-	if(file == NULL)
-		return -1;
-
 	/* Read 8 first bytes for first atom header */
-	if(fs_read(file, buffer, 8) != 8)
+	if(fs_read(d->file, d->buffer, 8) != 8)
 		return -1;
 
 	/* Check "ftyp" atom */
-	if(ATOM_CHECK(buffer, "ftyp") != 0)
+	if(ATOM_CHECK(d->buffer, "ftyp") != 0)
 		return -1;
-	size = ATOM_LEN(buffer);
+	size = ATOM_LEN(d->buffer);
 	count = size;
 
-	/* Allocate demux data structure */
-	*demux = malloc(sizeof(struct demux));
-	if(*demux == NULL)
-		return -1;
-	d = *demux;
-
-	/* Init demux structure */
-	memset(d, 0, sizeof(struct demux));
-	d->file = file;
-	d->buffer = buffer;
-	d->buffer_size = BUFFER_SIZE;
-	d->size = file_size;
-
 	/* Seek to next atom and get next atom header */
-	fs_lseek(file, size-8, SEEK_CUR);
+	fs_lseek(d->file, size-8, SEEK_CUR);
 
 	/* Read all atom until "mdat" */
-	while(count < file_size)
+	while(count < d->size)
 	{
 		/* Get size of sub-atom */
-		fs_read(d->file, buffer, 8);
-		size = ATOM_LEN(buffer);
+		if(fs_read(d->file, d->buffer, 8) != 8)
+			break;
+		size = ATOM_LEN(d->buffer);
+		if(size < 8)
+			break;
 
 		/* Process sub-atom */
-		if(ATOM_CHECK(buffer, "moov") == 0)
+		if(ATOM_CHECK(d->buffer, "moov") == 0)
 		{
 			/* Process "moov" */
 			demux_mp4_parse_moov(d);
 			moov_pos = count;
+
+			/* Stream data are not needed for a probe */
+			if(d->probe)
+				break;
 		}
 		else
 		{
-			if(ATOM_CHECK(buffer, "mdat") == 0)
+			if(ATOM_CHECK(d->buffer, "mdat") == 0)
 			{
 				mdat_pos = count;
 				if(moov_pos > 0)
@@ -1020,14 +1066,44 @@ int demux_mp4_open(struct demux **demux, struct fs_file *file, size_t file_size,
 			}
 
 			/* Go to next atom */
-			fs_lseek(file, size-8, SEEK_CUR);
+			fs_lseek(d->file, size-8, SEEK_CUR);
 		}
 		/* Update read bytes count */
 		count += size;
 	}
 
 	/* Check if a valid mp4 file and have found a mp4a track */
-	if(mdat_pos == 0 || d->track_found == 0)
+	if((mdat_pos == 0 && !d->probe) || moov_pos == 0 ||
+	   d->track_found == 0)
+		return -1;
+
+	return 0;
+}
+
+int demux_mp4_open(struct demux **demux, struct fs_file *file, size_t file_size,
+		   unsigned long *samplerate, unsigned char *channels)
+{
+	struct demux *d;
+	unsigned char buffer[BUFFER_SIZE];
+
+	if(file == NULL)
+		return -1;
+
+	/* Allocate demux data structure */
+	*demux = malloc(sizeof(struct demux));
+	if(*demux == NULL)
+		return -1;
+	d = *demux;
+
+	/* Init demux structure */
+	memset(d, 0, sizeof(struct demux));
+	d->file = file;
+	d->buffer = buffer;
+	d->buffer_size = BUFFER_SIZE;
+	d->size = file_size;
+
+	/* Parse atoms */
+	if(demux_mp4_parse(d) != 0)
 		return -1;
 
 	/* Go to first frame */
@@ -1042,6 +1118,7 @@ int demux_mp4_open(struct demux **demux, struct fs_file *file, size_t file_size,
 	d->cur_offset = d->stco_chunk_offset[0];
 
 	/* Fill meta */
+	d->meta.type = FILE_FORMAT_AAC;
 	d->meta.samplerate = d->mp4a_samplerate;
 	d->meta.channels = d->mp4a_channel_count;
 	d->meta.bitrate = d->esds_avg_bitrate / 1000;
@@ -1257,6 +1334,61 @@ void demux_mp4_close(struct demux *d)
 	free(d);
 }
 
+#define MOVE_MP4(d, s) do { d = s; s = NULL; } while(0)
+
+static int demux_mp4_probe(struct fs_file *file, size_t file_size,
+			   struct meta *m, int options)
+{
+	unsigned char buffer[BUFFER_SIZE];
+	struct demux *d;
+	int ret = -1;
+
+	/* Allocate demux data structure */
+	d = calloc(1, sizeof(struct demux));
+	if(d == NULL)
+		return -1;
+
+	/* Init demux structure in probe mode */
+	d->file = file;
+	d->buffer = buffer;
+	d->buffer_size = BUFFER_SIZE;
+	d->size = file_size;
+	d->probe = 1;
+	d->options = options;
+
+	/* Parse atoms until "moov" has been parsed */
+	if(demux_mp4_parse(d) != 0)
+		goto end;
+
+	/* Copy properties */
+	m->type = FILE_FORMAT_AAC;
+	m->samplerate = d->mp4a_samplerate;
+	m->channels = d->mp4a_channel_count;
+	m->bitrate = d->esds_avg_bitrate / 1000;
+	if(d->mdhd_time_scale != 0)
+		m->length = d->mdhd_duration / d->mdhd_time_scale;
+
+	/* Move tags to meta */
+	MOVE_MP4(m->title, d->title);
+	MOVE_MP4(m->artist, d->artist);
+	MOVE_MP4(m->album, d->album);
+	MOVE_MP4(m->comment, d->comment);
+	MOVE_MP4(m->genre, d->genre);
+	MOVE_MP4(m->picture.data, d->pic);
+	MOVE_MP4(m->picture.mime, d->pic_mime);
+	m->picture.size = d->pic_len;
+	m->track = d->track;
+	if(options & TAG_TOTAL_TRACK)
+		m->total_track = d->total_track;
+	if(d->year != NULL)
+		m->year = strtol(d->year, NULL, 10);
+	ret = 0;
+
+end:
+	demux_mp4_close(d);
+	return ret;
+}
+
 struct demux_module demux_mp4 = {
 	.open = &demux_mp4_open,
 	.get_meta = &demux_mp4_get_meta,
@@ -1265,5 +1397,6 @@ struct demux_module demux_mp4 = {
 	.calc_pos = &demux_mp4_calc_pos,
 	.set_pos = &demux_mp4_set_pos,
 	.close = &demux_mp4_close,
+	.probe = &demux_mp4_probe,
 };
 
@@ -16,8 +16,69 @@
  * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include "id3.h"
 
+/**
+ * Window size used to read tag: frames which fit in are parsed directly from
+ * this buffer, the others are skipped with a seek or read directly (picture).
+ */
+#define ID3V2_BUFFER_SIZE 8192
+
+/**
+ * Maximum size of a text frame: bigger frames are ignored.
+ */
+#define ID3V2_MAX_TEXT_SIZE 4096
+
+#define ID3V2_SIZE24(b) (((b)[0] << 16) | ((b)[1] << 8) | (b)[2])
+#define ID3V2_SIZE32(b) (((uint32_t) (b)[0] << 24) | ((b)[1] << 16) | \
+			 ((b)[2] << 8) | (b)[3])
+
+/* Text encodings */
+enum {
+	ID3V2_LATIN1 = 0,
+	ID3V2_UTF16 = 1,
+	ID3V2_UTF16BE = 2,
+	ID3V2_UTF8 = 3
+};
+
+/* Text frames copied as is in meta */
+static const struct {
+	const char *id;		/* ID3v2.3 and ID3v2.4 frame ID */
+	const char *id_v22;	/* ID3v2.2 frame ID */
+	int option;		/* Needed option (0 for basic tags) */
+	size_t offset;		/* Position of string in struct meta */
+} id3v2_text_frames[] = {
+	{"TIT2", "TT2", 0, offsetof(struct meta, title)},
+	{"TPE1", "TP1", 0, offsetof(struct meta, artist)},
+	{"TALB", "TAL", 0, offsetof(struct meta, album)},
+	{"TCON", "TCO", 0, offsetof(struct meta, genre)},
+	{"TCOP", "TCR", TAG_COPYRIGHT, offsetof(struct meta, copyright)},
+	{"TENC", "TEN", TAG_ENCODED, offsetof(struct meta, encoded)},
+	{"TLAN", "TLA", TAG_LANGUAGE, offsetof(struct meta, language)},
+	{"TPUB", "TPB", TAG_PUBLISHER, offsetof(struct meta, publisher)},
+	{NULL, NULL, 0, 0}
+};
+
+struct id3v2_reader {
+	struct fs_file *file;
+	unsigned long remaining;	/* Tag bytes not yet read from file */
+	size_t pos;			/* Read position in buffer */
+	size_t len;			/* Data length in buffer */
+	unsigned char buffer[ID3V2_BUFFER_SIZE];
+};
+
+
 const char *ID3v1_genres[] = {
 	"Blues", "Classic Rock", "Country", "Dance", "Disco", "Funk", "Grunge",
 	"Hip-Hop", "Jazz", "Metal", "New Age", "Oldies", "Other", "Pop", "R&B",
@@ -57,3 +118,615 @@ const char *ID3v1_genres[] = {
 };
 const int ID3v1_genres_count = sizeof(ID3v1_genres) / sizeof(char*);
 
+
+static const unsigned char *id3v2_get(struct id3v2_reader *r, size_t size)
+{
+	ssize_t len;
+	size_t count;
+
+	if(size > ID3V2_BUFFER_SIZE)
+		return NULL;
+
+	/* Refill window */
+	if(r->len - r->pos < size)
+	{
+		/* Move remaining data at beginning */
+		memmove(r->buffer, r->buffer + r->pos, r->len - r->pos);
+		r->len -= r->pos;
+		r->pos = 0;
+
+		/* Read as much tag data as possible */
+		count = ID3V2_BUFFER_SIZE - r->len;
+		if(count > r->remaining)
+			count = r->remaining;
+		while(count > 0)
+		{
+			len = fs_read(r->file, r->buffer + r->len, count);
+			if(len <= 0)
+				break;
+			r->len += len;
+			r->remaining -= len;
+			count -= len;
+		}
+
+		if(r->len < size)
+			return NULL;
+	}
+
+	/* Return data */
+	r->pos += size;
+	return r->buffer + r->pos - size;
+}
+
+static int id3v2_skip(struct id3v2_reader *r, unsigned long size)
+{
+	unsigned long left;
+
+	/* Skip in window */
+	if(r->len - r->pos >= size)
+	{
+		r->pos += size;
+		return 0;
+	}
+
+	/* Seek in file */
+	left = size - (r->len - r->pos);
+	if(left > r->remaining)
+		return -1;
+	if(fs_lseek(r->file, left, SEEK_CUR) < 0)
+		return -1;
+	r->remaining -= left;
+	r->pos = 0;
+	r->len = 0;
+
+	return 0;
+}
+
+static int id3v2_copy(struct id3v2_reader *r, unsigned char *buffer,
+		      unsigned long size)
+{
+	unsigned long count;
+	ssize_t len;
+
+	/* Copy data already in window */
+	count = r->len - r->pos;
+	if(count > size)
+		count = size;
+	memcpy(buffer, r->buffer + r->pos, count);
+	r->pos += count;
+	size -= count;
+	buffer += count;
+
+	/* Read directly the end */
+	if(size > r->remaining)
+		return -1;
+	while(size > 0)
+	{
+		len = fs_read(r->file, buffer, size);
+		if(len <= 0)
+			return -1;
+		r->remaining -= len;
+		buffer += len;
+		size -= len;
+	}
+
+	return 0;
+}
+
+static size_t id3v2_strlen(unsigned char enc, const unsigned char *buffer,
+			   size_t len)
+{
+	size_t i;
+
+	/* Find terminator: one byte or two aligned bytes for UTF-16 */
+	if(enc == ID3V2_UTF16 || enc == ID3V2_UTF16BE)
+	{
+		for(i = 0; i + 1 < len; i += 2)
+			if(buffer[i] == 0 && buffer[i+1] == 0)
+				return i;
+		return len & ~1;
+	}
+
+	for(i = 0; i < len; i++)
+		if(buffer[i] == 0)
+			return i;
+	return len;
+}
+
+static size_t id3v2_skip_string(unsigned char enc, const unsigned char *buffer,
+				size_t len)
+{
+	size_t size;
+
+	/* Get string length with its terminator */
+	size = id3v2_strlen(enc, buffer, len);
+	size += (enc == ID3V2_UTF16 || enc == ID3V2_UTF16BE) ? 2 : 1;
+
+	return size > len ? len : size;
+}
+
+static char *id3v2_to_utf8(unsigned char enc, const unsigned char *buffer,
+			   size_t len)
+{
+	unsigned long c, c2;
+	int big_endian = 1;
+	char *str, *p;
+	size_t i;
+
+	/* Get string length */
+	len = id3v2_strlen(enc, buffer, len);
+
+	/* Allocate string: 2 bytes per input byte is the worst case */
+	str = malloc(len * 2 + 1);
+	if(str == NULL)
+		return NULL;
+	p = str;
+
+	switch(enc)
+	{
+		case ID3V2_LATIN1:
+			for(i = 0; i < len; i++)
+			{
+				if(buffer[i] < 0x80)
+				{
+					*p++ = buffer[i];
+					continue;
+				}
+				*p++ = 0xC0 | (buffer[i] >> 6);
+				*p++ = 0x80 | (buffer[i] & 0x3F);
+			}
+			break;
+		case ID3V2_UTF16:
+			/* Get byte order from BOM */
+			if(len >= 2 && buffer[0] == 0xFF && buffer[1] == 0xFE)
+				big_endian = 0;
+			if(len >= 2 && ((buffer[0] == 0xFF && buffer[1] == 0xFE) ||
+			   (buffer[0] == 0xFE && buffer[1] == 0xFF)))
+			{
+				buffer += 2;
+				len -= 2;
+			}
+			/* Fall through */
+		case ID3V2_UTF16BE:
+			for(i = 0; i + 1 < len; i += 2)
+			{
+				/* Get code unit */
+				c = big_endian ? (buffer[i] << 8) | buffer[i+1] :
+						 (buffer[i+1] << 8) | buffer[i];
+
+				/* Surrogate pair */
+				if(c >= 0xD800 && c < 0xDC00 && i + 3 < len)
+				{
+					c2 = big_endian ?
+					      (buffer[i+2] << 8) | buffer[i+3] :
+					      (buffer[i+3] << 8) | buffer[i+2];
+					if(c2 >= 0xDC00 && c2 < 0xE000)
+					{
+						c = 0x10000 + ((c - 0xD800) << 10)
+						    + (c2 - 0xDC00);
+						i += 2;
+					}
+				}
+
+				/* Encode in UTF-8 */
+				if(c < 0x80)
+					*p++ = c;
+				else if(c < 0x800)
+				{
+					*p++ = 0xC0 | (c >> 6);
+					*p++ = 0x80 | (c & 0x3F);
+				}
+				else if(c < 0x10000)
+				{
+					*p++ = 0xE0 | (c >> 12);
+					*p++ = 0x80 | ((c >> 6) & 0x3F);
+					*p++ = 0x80 | (c & 0x3F);
+				}
+				else
+				{
+					*p++ = 0xF0 | (c >> 18);
+					*p++ = 0x80 | ((c >> 12) & 0x3F);
+					*p++ = 0x80 | ((c >> 6) & 0x3F);
+					*p++ = 0x80 | (c & 0x3F);
+				}
+			}
+			break;
+		case ID3V2_UTF8:
+		default:
+			memcpy(p, buffer, len);
+			p += len;
+	}
+	*p = '\0';
+
+	return str;
+}
+
+static char *id3_genre(char *str)
+{
+	char *end;
+	long idx;
+
+	/* Genre is a string */
+	if(str == NULL || (*str != '(' && !isdigit((unsigned char) *str)))
+		return str;
+
+	/* Get genre index: "(n)", "(n)Text" or "n" */
+	idx = strtol(*str == '(' ? str + 1 : str, &end, 10);
+	if(*str == '(' && *end == ')')
+		end++;
+
+	/* A refinement is present */
+	if(*end != '\0' || idx < 0 || idx >= ID3v1_genres_count)
+	{
+		if(*str == '(' && *end != '\0')
+			memmove(str, end, strlen(end) + 1);
+		return str;
+	}
+
+	/* Replace by genre name */
+	free(str);
+	return strdup(ID3v1_genres[idx]);
+}
+
+static void id3v2_parse_text(const char *id, unsigned char version,
+			     const unsigned char *data, size_t len,
+			     struct meta *m, int options)
+{
+	unsigned int track, total;
+	char **dest;
+	char *str;
+	int i;
+
+	if(len < 1)
+		return;
+
+	/* Comment: skip language and description */
+	if(strcmp(id, "COMM") == 0 || strcmp(id, "COM") == 0)
+	{
+		if(m->comment != NULL || len < 4)
+			return;
+		i = 4 + id3v2_skip_string(data[0], data + 4, len - 4);
+		m->comment = id3v2_to_utf8(data[0], data + i, len - i);
+		return;
+	}
+
+	/* Track number and total track */
+	if(strcmp(id, "TRCK") == 0 || strcmp(id, "TRK") == 0)
+	{
+		str = id3v2_to_utf8(data[0], data + 1, len - 1);
+		if(str == NULL)
+			return;
+		i = sscanf(str, "%u/%u", &track, &total);
+		if(i >= 1 && m->track == 0)
+			m->track = track;
+		if(i == 2 && options & TAG_TOTAL_TRACK && m->total_track == 0)
+			m->total_track = total;
+		free(str);
+		return;
+	}
+
+	/* Year (or recording time for ID3v2.4) */
+	if(strcmp(id, "TYER") == 0 || strcmp(id, "TYE") == 0 ||
+	   strcmp(id, "TDRC") == 0)
+	{
+		str = id3v2_to_utf8(data[0], data + 1, len - 1);
+		if(str == NULL)
+			return;
+		if(m->year == 0)
+			m->year = strtol(str, NULL, 10);
+		free(str);
+		return;
+	}
+
+	/* Other text frames */
+	for(i = 0; id3v2_text_frames[i].id != NULL; i++)
+	{
+		if(strcmp(id, version == 2 ? id3v2_text_frames[i].id_v22 :
+					     id3v2_text_frames[i].id) != 0)
+			continue;
+
+		/* Check option */
+		if(id3v2_text_frames[i].option != 0 &&
+		   !(options & id3v2_text_frames[i].option))
+			return;
+
+		/* Copy string once */
+		dest = (char **) ((char *) m + id3v2_text_frames[i].offset);
+		if(*dest != NULL)
+			return;
+		*dest = id3v2_to_utf8(data[0], data + 1, len - 1);
+
+		/* Convert genre index */
+		if(dest == &m->genre)
+			m->genre = id3_genre(m->genre);
+		return;
+	}
+}
+
+static int id3v2_is_wanted(const char *id, unsigned char version)
+{
+	int i;
+
+	for(i = 0; id3v2_text_frames[i].id != NULL; i++)
+		if(strcmp(id, version == 2 ? id3v2_text_frames[i].id_v22 :
+					     id3v2_text_frames[i].id) == 0)
+			return 1;
+
+	return strcmp(id, "COMM") == 0 || strcmp(id, "COM") == 0 ||
+	       strcmp(id, "TRCK") == 0 || strcmp(id, "TRK") == 0 ||
+	       strcmp(id, "TYER") == 0 || strcmp(id, "TYE") == 0 ||
+	       strcmp(id, "TDRC") == 0;
+}
+
+static int id3v2_parse_picture(struct id3v2_reader *r, unsigned char version,
+			       unsigned long size, struct meta *m)
+{
+	const unsigned char *data;
+	unsigned char *pic;
+	size_t len, count;
+	unsigned char enc;
+	char *mime = NULL;
+	int type;
+
+	/* Get picture header which must fit in window */
+	len = size < ID3V2_MAX_TEXT_SIZE ? size : ID3V2_MAX_TEXT_SIZE;
+	data = id3v2_get(r, len);
+	if(data == NULL)
+		return -1;
+
+	/* Get text encoding */
+	enc = data[0];
+	count = 1;
+
+	/* Get mime type */
+	if(version == 2)
+	{
+		/* ID3v2.2: 3 characters image format */
+		if(len < 5)
+			goto skip;
+		if(memcmp(data + 1, "PNG", 3) == 0)
+			mime = strdup("image/png");
+		else
+			mime = strdup("image/jpeg");
+		count += 3;
+	}
+	else
+	{
+		mime = id3v2_to_utf8(ID3V2_LATIN1, data + count, len - count);
+		count += id3v2_skip_string(ID3V2_LATIN1, data + count,
+					   len - count);
+	}
+	if(count >= len)
+		goto skip;
+
+	/* Get picture type: keep first picture, unless a front cover (3)
+	 * follows.
+	 */
+	type = data[count++];
+	if(m->picture.data != NULL && type != 3)
+		goto skip;
+
+	/* Skip description */
+	count += id3v2_skip_string(enc, data + count, len - count);
+	if(count >= size || (count == len && len < size))
+		goto skip;
+
+	/* Allocate picture */
+	pic = malloc(size - count);
+	if(pic == NULL)
+		goto skip;
+
+	/* Copy picture part already read and get the rest */
+	memcpy(pic, data + count, len - count);
+	if(id3v2_copy(r, pic + len - count, size - len) != 0)
+	{
+		free(pic);
+		free(mime);
+		return -1;
+	}
+
+	/* Replace previous picture */
+	if(m->picture.data != NULL)
+		free(m->picture.data);
+	if(m->picture.mime != NULL)
+		free(m->picture.mime);
+	m->picture.data = pic;
+	m->picture.size = size - count;
+	m->picture.mime = mime;
+
+	return 0;
+
+skip:
+	if(mime != NULL)
+		free(mime);
+	return id3v2_skip(r, size - len);
+}
+
+long id3v2_parse(struct fs_file *file, struct meta *m, int options)
+{
+	struct id3v2_reader *r;
+	const unsigned char *h;
+	unsigned long tag_size, size;
+	unsigned char tag_flags;
+	unsigned char version;
+	unsigned char flags;
+	int header_size;
+	int extra;
+	char id[5];
+	long ret;
+
+	/* Allocate reader */
+	r = malloc(sizeof(struct id3v2_reader));
+	if(r == NULL)
+		return -1;
+	r->file = file;
+	r->remaining = 10;
+	r->pos = 0;
+	r->len = 0;
+
+	/* Read tag header */
+	h = id3v2_get(r, 10);
+	if(h == NULL || memcmp(h, "ID3", 3) != 0)
+	{
+		free(r);
+		return h == NULL ? -1 : 0;
+	}
+
+	/* Get tag properties */
+	version = h[3];
+	tag_flags = h[5];
+	tag_size = ID3V2_SIZE(&h[6]);
+	ret = tag_size + 10;
+	if(version == 4 && tag_flags & 0x10)
+		ret += 10;
+	r->remaining = tag_size;
+
+	/* Unsupported version, unsynchronisation or compression (ID3v2.2) */
+	if(version < 2 || version > 4 || (version < 4 && tag_flags & 0x80) ||
+	   (version == 2 && tag_flags & 0x40))
+		goto end;
+
+	/* Skip extended header */
+	if(version > 2 && tag_flags & 0x40)
+	{
+		h = id3v2_get(r, 4);
+		if(h == NULL)
+			goto end;
+		size = version == 4 ? ID3V2_SIZE(h) - 4 : ID3V2_SIZE32(h);
+		if(id3v2_skip(r, size) != 0)
+			goto end;
+	}
+
+	/* Parse frames */
+	header_size = version == 2 ? 6 : 10;
+	while(r->remaining + (r->len - r->pos) >= header_size)
+	{
+		/* Get frame header */
+		h = id3v2_get(r, header_size);
+		if(h == NULL || h[0] == 0)
+			break;
+
+		/* Get frame ID and size */
+		if(version == 2)
+		{
+			memcpy(id, h, 3);
+			id[3] = '\0';
+			size = ID3V2_SIZE24(&h[3]);
+			flags = 0;
+		}
+		else
+		{
+			memcpy(id, h, 4);
+			id[4] = '\0';
+			size = version == 4 ? ID3V2_SIZE(&h[4]) :
+					      ID3V2_SIZE32(&h[4]);
+			flags = h[9];
+
+			/* Convert ID3v2.3 format flags to ID3v2.4 */
+			if(version == 3)
+				flags = (flags & 0x80 ? 0x08 : 0) |
+					(flags & 0x40 ? 0x04 : 0) |
+					(flags & 0x20 ? 0x40 : 0);
+		}
+		if(size == 0)
+			continue;
+
+		/* Compressed, encrypted or unsynchronised frame */
+		if(flags & 0x0E)
+		{
+			if(id3v2_skip(r, size) != 0)
+				break;
+			continue;
+		}
+
+		/* Skip grouping identity and data length indicator */
+		if(flags & 0x41)
+		{
+			extra = (flags & 0x40 ? 1 : 0) + (flags & 0x01 ? 4 : 0);
+			if(size < extra || id3v2_skip(r, extra) != 0)
+				break;
+			size -= extra;
+		}
+
+		/* Parse frame */
+		if(strcmp(id, "APIC") == 0 || strcmp(id, "PIC") == 0)
+		{
+			/* Skip picture payload if not requested */
+			if(!(options & TAG_PICTURE))
+			{
+				if(id3v2_skip(r, size) != 0)
+					break;
+				continue;
+			}
+			if(id3v2_parse_picture(r, version, size, m) != 0)
+				break;
+		}
+		else if(size <= ID3V2_MAX_TEXT_SIZE &&
+			id3v2_is_wanted(id, version))
+		{
+			h = id3v2_get(r, size);
+			if(h == NULL)
+				break;
+			id3v2_parse_text(id, version, h, size, m, options);
+		}
+		else if(id3v2_skip(r, size) != 0)
+			break;
+	}
+
+end:
+	/* Go to end of tag */
+	if(r->remaining > 0)
+		fs_lseek(file, r->remaining, SEEK_CUR);
+	if(version == 4 && tag_flags & 0x10)
+		fs_lseek(file, 10, SEEK_CUR);
+	free(r);
+
+	return ret;
+}
+
+static char *id3v1_copy(const unsigned char *buffer, size_t len)
+{
+	/* Remove trailing spaces and zeros */
+	while(len > 0 && (buffer[len-1] == ' ' || buffer[len-1] == '\0'))
+		len--;
+	if(len == 0)
+		return NULL;
+
+	return id3v2_to_utf8(ID3V2_LATIN1, buffer, len);
+}
+
+int id3v1_parse(struct fs_file *file, size_t file_size, struct meta *m)
+{
+	unsigned char buffer[128];
+	char year[5];
+
+	if(file_size < 128)
+		return -1;
+
+	/* Read tag at end of file */
+	if(fs_lseek(file, file_size - 128, SEEK_SET) < 0 ||
+	   fs_read(file, buffer, 128) != 128 || memcmp(buffer, "TAG", 3) != 0)
+		return -1;
+
+	/* Fill missing values */
+	if(m->title == NULL)
+		m->title = id3v1_copy(&buffer[3], 30);
+	if(m->artist == NULL)
+		m->artist = id3v1_copy(&buffer[33], 30);
+	if(m->album == NULL)
+		m->album = id3v1_copy(&buffer[63], 30);
+	if(m->year == 0)
+	{
+		memcpy(year, &buffer[93], 4);
+		year[4] = '\0';
+		m->year = strtol(year, NULL, 10);
+	}
+	if(m->comment == NULL)
+		m->comment = id3v1_copy(&buffer[97], buffer[125] == 0 ? 28 : 30);
+	if(m->track == 0 && buffer[125] == 0)
+		m->track = buffer[126];
+	if(m->genre == NULL && buffer[127] < ID3v1_genres_count)
+		m->genre = strdup(ID3v1_genres[buffer[127]]);
+
+	return 0;
+}
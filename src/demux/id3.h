@@ -19,8 +19,30 @@
 #ifndef _ID3_H
 #define _ID3_H
 
+#include "meta.h"
+#include "fs.h"
+
+#define ID3V2_SIZE(b) (((b)[0] << 21) | ((b)[1] << 14) | ((b)[2] << 7) | (b)[3])
+
 extern const char *ID3v1_genres[];
-const int ID3v1_genres_count;
+extern const int ID3v1_genres_count;
+
+/**
+ * Parse an ID3v2 tag at current position in file and fill meta with found
+ * values (only NULL/zero values of meta are filled). Frames are read through
+ * a small window and unneeded frames are skipped with a seek. Embedded
+ * picture is loaded only if TAG_PICTURE is set in options.
+ * At return, position in file is just after the tag.
+ * Returns complete tag size, 0 if no ID3v2 tag or -1 on read error.
+ */
+long id3v2_parse(struct fs_file *file, struct meta *m, int options);
+
+/**
+ * Parse an ID3v1 tag at end of file (last 128 bytes) and fill only NULL/zero
+ * values of meta.
+ * Returns 0 if a tag has been found, -1 otherwise.
+ */
+int id3v1_parse(struct fs_file *file, size_t file_size, struct meta *m);
 
 #endif
 
@@ -23,6 +23,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <pthread.h>
 
 #include "decoder.h"
@@ -33,6 +34,16 @@
 #include "config.h"
 #endif
 
+/**
+ * Seek settings:
+ *  WINDOW_TIME: length of last decoded samples kept after first seek to seek
+ *               again without decoding (in s).
+ *  PREROLL_TIME: time decoded and dropped before a new position when demuxer
+ *                is moved, to prime decoder (in s).
+ */
+#define WINDOW_TIME 5
+#define PREROLL_TIME 1
+
 struct file_handle {
 	/* Demuxer */
 	struct demux_handle *demux;
@@ -42,6 +53,24 @@ struct file_handle {
 	uint64_t pcm_pos;
 	unsigned long pcm_pos_off;
 	unsigned long pcm_remaining;
+	/* Gapless playback: encoder delay and padding trimming (in samples) */
+	unsigned long trim_delay;
+	uint64_t trim_skip;
+	uint64_t trim_end;
+	uint64_t dec_pos;
+	/* Decoded window: last decoded samples and position after last sample
+	 * (in samples, same position as dec_pos)
+	 */
+	unsigned char *win;
+	unsigned long win_size;
+	unsigned long win_len;
+	unsigned long win_write;
+	uint64_t win_end;
+	uint64_t replay_pos;
+	int replay;
+	/* Seek latency: time between seek and first sample returned (in us) */
+	struct timeval seek_time;
+	unsigned long seek_latency;
 	/* File properties */
 	unsigned long samplerate;
 	unsigned long channels;
@@ -81,6 +110,20 @@ int file_open(struct file_handle **handle, const char *uri)
 	h->pcm_pos = 0;
 	h->pcm_pos_off = 0;
 	h->pcm_remaining = 0;
+	h->trim_delay = 0;
+	h->trim_skip = 0;
+	h->trim_end = 0;
+	h->dec_pos = 0;
+	h->win = NULL;
+	h->win_size = 0;
+	h->win_len = 0;
+	h->win_write = 0;
+	h->win_end = 0;
+	h->replay_pos = 0;
+	h->replay = 0;
+	h->seek_time.tv_sec = 0;
+	h->seek_time.tv_usec = 0;
+	h->seek_latency = 0;
 	h->event_cb = NULL;
 	h->event_udata = NULL;
 	h->buffering = 0;
@@ -122,6 +165,15 @@ int file_open(struct file_handle **handle, const char *uri)
 		h->channels = dec_channels;
 	}
 
+	/* Trim encoder delay and padding for gapless playback */
+	if(meta->samples > meta->delay + meta->padding)
+	{
+		h->trim_delay = meta->delay * h->channels;
+		h->trim_skip = h->trim_delay;
+		h->trim_end = (uint64_t) (meta->samples - meta->padding) *
+			      h->channels;
+	}
+
 	return 0;
 }
 
@@ -143,17 +195,61 @@ unsigned char file_get_channels(struct file_handle *h)
 
 unsigned long file_set_pos(struct file_handle *h, unsigned long pos)
 {
+	unsigned long preroll;
+	unsigned long new_pos;
+	uint64_t target;
+
 	if(h == NULL)
 		return -1;
 
 	/* Lock stream access */
 	pthread_mutex_lock(&h->mutex);
 
+	/* Start seek latency measure */
+	gettimeofday(&h->seek_time, NULL);
+
+	/* Allocate decoded window: used for next seeks */
+	if(h->win == NULL && h->samplerate > 0 && h->channels > 0)
+	{
+		h->win_size = WINDOW_TIME * h->samplerate * h->channels;
+		h->win = malloc(h->win_size * 4);
+		h->win_len = 0;
+		h->win_write = 0;
+	}
+
+	/* Target position in decoded samples */
+	target = (uint64_t) pos * h->samplerate * h->channels + h->trim_delay;
+
+	if(h->win_len > 0 && target >= h->win_end - h->win_len &&
+	   target <= h->win_end)
+	{
+		/* Position is in decoded window: replay from it */
+		h->replay_pos = target;
+		h->replay = 1;
+	}
+	else
+	{
+		/* Move demuxer before position to prime decoder */
+		preroll = pos > PREROLL_TIME ? PREROLL_TIME : pos;
+		new_pos = demux_set_pos(h->demux, pos - preroll);
+		if(new_pos > pos)
+			new_pos = pos;
+		h->pcm_remaining = 0;
+
+		/* Drop samples until position */
+		h->dec_pos = new_pos == 0 ? 0 :
+			     (uint64_t) new_pos * h->samplerate * h->channels +
+			     h->trim_delay;
+		h->trim_skip = target - h->dec_pos;
+		h->replay = 0;
+		h->win_end = 0;
+		h->win_len = 0;
+	}
+
 	/* Set output position */
-	pos = demux_set_pos(h->demux, pos);
 	h->pcm_pos = 0;
 	h->pcm_pos_off = pos * 1000;
-	h->pcm_remaining = 0;
+	h->end = 0;
 
 	/* Notify new position */
 	if(h->event_cb != NULL)
@@ -165,6 +261,24 @@ unsigned long file_set_pos(struct file_handle *h, unsigned long pos)
 	return pos;
 }
 
+unsigned long file_get_seek_latency(struct file_handle *h)
+{
+	unsigned long latency;
+
+	if(h == NULL)
+		return 0;
+
+	/* Lock stream access */
+	pthread_mutex_lock(&h->mutex);
+
+	latency = h->seek_latency;
+
+	/* Unlock stream access */
+	pthread_mutex_unlock(&h->mutex);
+
+	return latency;
+}
+
 unsigned long file_get_pos(struct file_handle *h)
 {
 	uint64_t pos;
@@ -207,11 +321,99 @@ int file_get_status(struct file_handle *h)
 	return FILE_OPENED;
 }
 
+static void file_window_add(struct file_handle *h,
+			    const unsigned char *buffer, unsigned long samples)
+{
+	unsigned long count = samples;
+	unsigned long len;
+
+	/* Samples are not following window: restart it */
+	if(h->win_end != h->dec_pos)
+	{
+		h->win_len = 0;
+		h->win_end = h->dec_pos;
+	}
+
+	/* Keep only end of samples */
+	if(samples > h->win_size)
+	{
+		buffer += (samples - h->win_size) * 4;
+		samples = h->win_size;
+	}
+
+	/* Copy samples in ring */
+	len = h->win_size - h->win_write;
+	if(len > samples)
+		len = samples;
+	memcpy(&h->win[h->win_write * 4], buffer, len * 4);
+	memcpy(h->win, buffer + (len * 4), (samples - len) * 4);
+	h->win_write = (h->win_write + samples) % h->win_size;
+
+	/* Update window */
+	h->win_len += samples;
+	if(h->win_len > h->win_size)
+		h->win_len = h->win_size;
+	h->win_end = h->dec_pos + count;
+}
+
+static int file_window_read(struct file_handle *h, unsigned char *buffer,
+			    size_t size)
+{
+	unsigned long pos, len;
+
+	/* Get samples to replay */
+	if(size > h->win_end - h->replay_pos)
+		size = h->win_end - h->replay_pos;
+
+	/* Get position in ring */
+	pos = (h->win_write + h->win_size - (h->win_end - h->replay_pos)) %
+	      h->win_size;
+
+	/* Copy samples from ring */
+	len = h->win_size - pos;
+	if(len > size)
+		len = size;
+	memcpy(buffer, &h->win[pos * 4], len * 4);
+	memcpy(buffer + (len * 4), h->win, (size - len) * 4);
+	h->replay_pos += size;
+
+	return size;
+}
+
+static int file_trim(struct file_handle *h, unsigned char *buffer,
+		     int samples)
+{
+	uint64_t skip;
+
+	/* Skip encoder delay */
+	if(h->trim_skip > 0)
+	{
+		skip = h->trim_skip < samples ? h->trim_skip : samples;
+		memmove(buffer, buffer + (skip * 4), (samples - skip) * 4);
+		h->trim_skip -= skip;
+		h->dec_pos += skip;
+		samples -= skip;
+	}
+
+	/* Remove padding */
+	if(h->trim_end > 0 && h->dec_pos + samples > h->trim_end)
+		samples = h->trim_end > h->dec_pos ? h->trim_end - h->dec_pos :
+						     0;
+
+	/* Keep samples in decoded window */
+	if(h->win != NULL && samples > 0)
+		file_window_add(h, buffer, samples);
+	h->dec_pos += samples;
+
+	return samples;
+}
+
 int file_read(void *user_data, unsigned char *buffer, size_t size,
 	      struct a_format *fmt)
 {
 	struct file_handle *h = (struct file_handle *) user_data;
 	struct decoder_info info;
+	struct timeval now;
 	unsigned char *frame = NULL;
 	int total_samples = 0;
 	ssize_t len = 0;
@@ -223,8 +425,23 @@ int file_read(void *user_data, unsigned char *buffer, size_t size,
 	/* Lock stream access */
 	pthread_mutex_lock(&h->mutex);
 
+	/* Replay samples from decoded window after a seek */
+	if(h->replay)
+	{
+		if(h->replay_pos < h->win_end)
+		{
+			total_samples = file_window_read(h, buffer, size);
+			goto end;
+		}
+		h->replay = 0;
+	}
+
+	/* End of stream reached before padding */
+	if(h->trim_end > 0 && h->dec_pos >= h->trim_end)
+		len = -1;
+
 	/* Process remaining pcm data */
-	if(h->pcm_remaining > 0)
+	if(h->pcm_remaining > 0 && len >= 0)
 	{
 		/* Get remaining pcm data from decoder */
 		samples = decoder_decode(h->dec, NULL, 0, buffer, size, &info);
@@ -246,14 +463,20 @@ int file_read(void *user_data, unsigned char *buffer, size_t size,
 			h->pcm_pos = 0;
 			h->samplerate = info.samplerate;
 			h->channels = info.channels;
+
+			/* Drop decoded window */
+			free(h->win);
+			h->win = NULL;
+			h->win_len = 0;
+			h->win_end = 0;
 		}
 
 		h->pcm_remaining -= samples;
-		total_samples += samples;
+		total_samples += file_trim(h, buffer, samples);
 	}
 
 	/* Fill output buffer */
-	while(total_samples < size)
+	while(total_samples < size && len >= 0)
 	{
 		/* Get frame */
 		len = demux_get_frame(h->demux, &frame);
@@ -308,12 +531,28 @@ int file_read(void *user_data, unsigned char *buffer, size_t size,
 			break;
 		}
 
-		/* Update samples returned */
-		total_samples += samples;
+		/* Update samples returned without delay and padding */
+		total_samples += file_trim(h, &buffer[total_samples * 4],
+					   samples);
+		if(h->trim_end > 0 && h->dec_pos >= h->trim_end)
+		{
+			len = -1;
+			break;
+		}
 	}
 
+end:
 	h->pcm_pos += total_samples;
 
+	/* Calculate seek latency */
+	if(total_samples > 0 && h->seek_time.tv_sec != 0)
+	{
+		gettimeofday(&now, NULL);
+		h->seek_latency = (now.tv_sec - h->seek_time.tv_sec) * 1000000 +
+				  now.tv_usec - h->seek_time.tv_usec;
+		h->seek_time.tv_sec = 0;
+	}
+
 	/* Unlock stream access */
 	pthread_mutex_unlock(&h->mutex);
 
@@ -372,6 +611,10 @@ void file_close(struct file_handle *h)
 	if(h->demux != NULL)
 		demux_close(h->demux);
 
+	/* Free decoded window */
+	if(h->win != NULL)
+		free(h->win);
+
 	/* Free handle */
 	free(h);
 }
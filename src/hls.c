@@ -0,0 +1,838 @@
+/*
+ * hls.c - An HTTP Live Streaming (HLS) client
+ *
+ * Copyright (c) 2014   A. Dilly
+ *
+ * AirCat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * AirCat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "http.h"
+#include "hls.h"
+
+/**
+ * Download settings:
+ *  HLS_JOBS: count of segments downloaded in parallel.
+ *  HLS_PREFETCH: count of segments downloaded before they are read.
+ *  HLS_LIVE_START: count of segments from end of a live playlist to start.
+ *  HLS_MAX_ERRORS: count of consecutive playlist errors before end of stream.
+ *  HLS_SEGMENT_RETRIES: count of retries of a segment before it is skipped.
+ *  HLS_PLAYLIST_SIZE: maximum size of a playlist.
+ *  HLS_SEGMENT_SIZE: maximum size of a segment.
+ *  READ_TIMEOUT: timeout of a read on HTTP connection (in ms).
+ *  BLOCK_SIZE: size of a read on HTTP connection.
+ * A slow segment download doesn't stop playback while the next prefetched
+ * segments are available. A download which lasts more than a target duration
+ * fails: a segment is downloaded again before it is skipped and a playlist
+ * is loaded again on next refresh.
+ */
+#define HLS_JOBS 2
+#define HLS_PREFETCH 4
+#define HLS_LIVE_START 3
+#define HLS_MAX_ERRORS 5
+#define HLS_SEGMENT_RETRIES 1
+#define HLS_PLAYLIST_SIZE (1 << 20)
+#define HLS_SEGMENT_SIZE (16 << 20)
+#define READ_TIMEOUT 500
+#define BLOCK_SIZE 8192
+
+/**
+ * MPEG Transport Stream settings
+ */
+#define TS_PACKET_SIZE 188
+#define TS_SYNC_BYTE 0x47
+
+/**
+ * Download status of a segment
+ */
+enum hls_segment_state {
+	HLS_SEGMENT_WAIT,	/*!< Segment is not yet downloaded */
+	HLS_SEGMENT_LOADING,	/*!< Segment is downloading */
+	HLS_SEGMENT_READY,	/*!< Segment audio frames are available */
+	HLS_SEGMENT_ERROR	/*!< Segment download has failed */
+};
+
+/**
+ * Media segment
+ */
+struct hls_segment {
+	uint64_t seq;			/*!< Media sequence number */
+	char *url;			/*!< Segment URL */
+	enum hls_segment_state state;	/*!< Download status */
+	int retries;			/*!< Count of failed downloads */
+	unsigned char *data;		/*!< Audio frames of segment */
+	size_t len;			/*!< Length of audio frames */
+	size_t pos;			/*!< Read position in audio frames */
+	struct hls_segment *next;	/*!< Next segment in playlist */
+};
+
+struct hls_handle {
+	/* Media playlist */
+	char *url;			/*!< Media playlist URL */
+	unsigned long bandwidth;	/*!< Variant bandwidth (in b/s) */
+	unsigned long target;		/*!< Target duration (in s) */
+	uint64_t next_seq;		/*!< Next sequence number to add */
+	int is_started;			/*!< First playlist has been loaded */
+	int is_end;			/*!< No more segment will be added */
+	/* Segments to play (first is read) */
+	struct hls_segment *segments;	/*!< First segment in queue */
+	struct hls_segment *last;	/*!< Last segment in queue */
+	/* Threads */
+	pthread_t thread;		/*!< Playlist refresh thread */
+	pthread_t workers[HLS_JOBS];	/*!< Segment download threads */
+	int worker_count;		/*!< Count of started workers */
+	int use_thread;			/*!< Playlist thread is started */
+	int stop;			/*!< Stop signal for threads */
+	pthread_mutex_t mutex;		/*!< Mutex for queue and status */
+	pthread_cond_t cond;		/*!< Queue or segment status changed */
+};
+
+static void *hls_thread(void *user_data);
+static void *hls_worker(void *user_data);
+
+int hls_is_playlist(const char *content_type)
+{
+	const char *types[] = {
+		"application/vnd.apple.mpegurl",
+		"application/x-mpegurl",
+		"audio/mpegurl",
+		"audio/x-mpegurl",
+		NULL
+	};
+	int i;
+
+	if(content_type == NULL)
+		return 0;
+
+	/* Check content type */
+	for(i = 0; types[i] != NULL; i++)
+		if(strncasecmp(content_type, types[i], strlen(types[i])) == 0)
+			return 1;
+
+	return 0;
+}
+
+static char *hls_resolve_url(const char *base, const char *uri)
+{
+	const char *p;
+	char *url;
+	int len;
+
+	/* Absolute URL */
+	if(strstr(uri, "://") != NULL)
+		return strdup(uri);
+
+	if(*uri == '/')
+	{
+		/* Keep scheme and host of base URL */
+		p = strstr(base, "://");
+		p = p != NULL ? strchr(p + 3, '/') : NULL;
+		len = p != NULL ? p - base : strlen(base);
+	}
+	else
+	{
+		/* Keep base URL until last path separator (before query) */
+		p = strchr(base, '?');
+		len = p != NULL ? p - base : strlen(base);
+		while(len > 0 && base[len-1] != '/')
+			len--;
+	}
+
+	/* Concatenate URL */
+	if(asprintf(&url, "%.*s%s", len, base, uri) < 0)
+		return NULL;
+
+	return url;
+}
+
+static inline uint64_t hls_get_time(void)
+{
+	struct timespec ts;
+
+	/* Get monotonic time (in ms) */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static unsigned char *hls_fetch(struct hls_handle *h, struct http_handle *http,
+				const char *url, size_t max_size, size_t *len)
+{
+	unsigned char *buffer = NULL, *p;
+	uint64_t deadline;
+	size_t size = 0;
+	ssize_t ret;
+
+	*len = 0;
+
+	/* Download must end within a target duration */
+	pthread_mutex_lock(&h->mutex);
+	deadline = hls_get_time() + h->target * 1000;
+	pthread_mutex_unlock(&h->mutex);
+
+	/* Send request */
+	if(http_get(http, url) != 200)
+		return NULL;
+
+	/* Read until end of response */
+	while(!h->stop)
+	{
+		/* Grow buffer */
+		if(size - *len < BLOCK_SIZE)
+		{
+			if(size >= max_size)
+				goto error;
+			size += BLOCK_SIZE * 8;
+			p = realloc(buffer, size + 1);
+			if(p == NULL)
+				goto error;
+			buffer = p;
+		}
+
+		/* Read next data */
+		ret = http_read_timeout(http, buffer + *len, BLOCK_SIZE,
+					READ_TIMEOUT);
+		if(ret < 0)
+			break;
+		*len += ret;
+
+		/* Download is too slow or stalled: drop connection */
+		if(hls_get_time() >= deadline)
+		{
+			http_close_connection(http);
+			goto error;
+		}
+	}
+	if(h->stop || buffer == NULL)
+		goto error;
+
+	/* Terminate for playlist parsing */
+	buffer[*len] = '\0';
+
+	return buffer;
+
+error:
+	if(buffer != NULL)
+		free(buffer);
+	*len = 0;
+	return NULL;
+}
+
+static int hls_parse_master(struct hls_handle *h, char *playlist)
+{
+	unsigned long bandwidth = 0;
+	int is_variant = 0;
+	char *line, *next, *p;
+
+	/* Find first variant stream */
+	for(line = playlist; line != NULL; line = next)
+	{
+		/* Split line */
+		next = strpbrk(line, "\r\n");
+		if(next != NULL)
+			*next++ = '\0';
+
+		if(strncmp(line, "#EXT-X-STREAM-INF:", 18) == 0)
+		{
+			/* Get bandwidth of variant */
+			p = strstr(line, "BANDWIDTH=");
+			if(p != NULL)
+				bandwidth = strtoul(p + 10, NULL, 10);
+			is_variant = 1;
+		}
+		else if(is_variant && *line != '#' && *line != '\0')
+		{
+			/* Play variant stream */
+			p = hls_resolve_url(h->url, line);
+			if(p == NULL)
+				return -1;
+			free(h->url);
+			h->url = p;
+			h->bandwidth = bandwidth;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int hls_load_playlist(struct hls_handle *h, struct http_handle *http)
+{
+	struct hls_segment *first = NULL, *last = NULL, *s;
+	unsigned long target = 0, count = 0;
+	uint64_t seq = 0, start;
+	char *playlist = NULL;
+	char *line, *next;
+	int is_end = 0;
+	int added = 0;
+	int redirect;
+	size_t len;
+
+	/* Get media playlist */
+	for(redirect = 0; redirect < 2; redirect++)
+	{
+		/* Download playlist */
+		playlist = (char *) hls_fetch(h, http, h->url,
+					      HLS_PLAYLIST_SIZE, &len);
+		if(playlist == NULL || strncmp(playlist, "#EXTM3U", 7) != 0)
+			goto error;
+
+		/* A master playlist gives URL of media playlist */
+		if(strstr(playlist, "#EXT-X-STREAM-INF:") == NULL)
+			break;
+		if(hls_parse_master(h, playlist) <= 0)
+			goto error;
+		free(playlist);
+		playlist = NULL;
+	}
+	if(playlist == NULL)
+		goto error;
+
+	/* Parse media playlist */
+	for(line = playlist; line != NULL; line = next)
+	{
+		/* Split line */
+		next = strpbrk(line, "\r\n");
+		if(next != NULL)
+			*next++ = '\0';
+
+		/* Parse tags */
+		if(strncmp(line, "#EXT-X-TARGETDURATION:", 22) == 0)
+			target = strtoul(line + 22, NULL, 10);
+		else if(strncmp(line, "#EXT-X-MEDIA-SEQUENCE:", 22) == 0)
+			seq = strtoull(line + 22, NULL, 10);
+		else if(strncmp(line, "#EXT-X-ENDLIST", 14) == 0)
+			is_end = 1;
+		if(*line == '#' || *line == '\0')
+			continue;
+
+		/* Add a new segment */
+		s = calloc(1, sizeof(struct hls_segment));
+		if(s == NULL)
+			continue;
+		s->seq = seq + count++;
+		s->url = hls_resolve_url(h->url, line);
+		if(s->url == NULL)
+		{
+			free(s);
+			continue;
+		}
+		if(last != NULL)
+			last->next = s;
+		else
+			first = s;
+		last = s;
+	}
+	free(playlist);
+
+	/* Lock queue access */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Start live stream near its end */
+	if(!h->is_started)
+	{
+		start = seq;
+		if(!is_end && count > HLS_LIVE_START)
+			start = seq + count - HLS_LIVE_START;
+		h->next_seq = start;
+		h->is_started = 1;
+	}
+
+	/* Segments have expired before they were added */
+	if(h->next_seq < seq)
+		h->next_seq = seq;
+
+	/* Add new segments to queue */
+	while(first != NULL)
+	{
+		s = first;
+		first = s->next;
+		s->next = NULL;
+
+		/* Segment already added */
+		if(s->seq < h->next_seq)
+		{
+			free(s->url);
+			free(s);
+			continue;
+		}
+
+		/* Append segment */
+		if(h->last != NULL)
+			h->last->next = s;
+		else
+			h->segments = s;
+		h->last = s;
+		h->next_seq = s->seq + 1;
+		added++;
+	}
+
+	/* Update playlist status */
+	if(target > 0)
+		h->target = target;
+	h->is_end = is_end;
+
+	/* Notify workers and reader */
+	pthread_cond_broadcast(&h->cond);
+
+	/* Unlock queue access */
+	pthread_mutex_unlock(&h->mutex);
+
+	return added;
+
+error:
+	if(playlist != NULL)
+		free(playlist);
+	return -1;
+}
+
+int hls_open(struct hls_handle **handle, const char *url)
+{
+	struct http_handle *http;
+	struct hls_handle *h;
+	int i;
+
+	/* Allocate structure */
+	*handle = calloc(1, sizeof(struct hls_handle));
+	if(*handle == NULL)
+		return -1;
+	h = *handle;
+
+	/* Init structure */
+	h->url = strdup(url);
+	h->target = 10;
+	pthread_mutex_init(&h->mutex, NULL);
+	pthread_cond_init(&h->cond, NULL);
+	if(h->url == NULL)
+		goto error;
+
+	/* Load first playlist */
+	if(http_open(&http, 1) != 0)
+		goto error;
+	http_set_option(http, HTTP_FOLLOW_REDIRECT, NULL, 1);
+	if(hls_load_playlist(h, http) < 0 || h->segments == NULL)
+	{
+		http_close(http);
+		goto error;
+	}
+	http_close(http);
+
+	/* Start playlist refresh thread */
+	if(pthread_create(&h->thread, NULL, hls_thread, h) != 0)
+		goto error;
+	h->use_thread = 1;
+
+	/* Start download workers */
+	for(i = 0; i < HLS_JOBS; i++)
+	{
+		if(pthread_create(&h->workers[i], NULL, hls_worker, h) != 0)
+			break;
+		h->worker_count++;
+	}
+	if(h->worker_count == 0)
+		goto error;
+
+	return 0;
+
+error:
+	hls_close(h);
+	*handle = NULL;
+	return -1;
+}
+
+unsigned long hls_get_bandwidth(struct hls_handle *h)
+{
+	return h->bandwidth;
+}
+
+static void hls_wait(struct hls_handle *h, unsigned long ms)
+{
+	struct timespec ts;
+
+	/* Calculate absolute time */
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000;
+	if(ts.tv_nsec >= 1000000000)
+	{
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	/* Wait a change or timeout */
+	pthread_cond_timedwait(&h->cond, &h->mutex, &ts);
+}
+
+static void *hls_thread(void *user_data)
+{
+	struct hls_handle *h = user_data;
+	struct http_handle *http;
+	unsigned long delay;
+	int errors = 0;
+	int added = 1;
+
+	/* Open HTTP client */
+	if(http_open(&http, 1) != 0)
+		return NULL;
+	http_set_option(http, HTTP_FOLLOW_REDIRECT, NULL, 1);
+
+	/* Lock queue access */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Refresh live playlist */
+	while(!h->stop && !h->is_end)
+	{
+		/* Wait target duration or half if playlist has not changed */
+		delay = h->target * 1000;
+		if(added == 0)
+			delay /= 2;
+		hls_wait(h, delay);
+		if(h->stop)
+			break;
+
+		/* Unlock queue access */
+		pthread_mutex_unlock(&h->mutex);
+
+		/* Reload playlist */
+		added = hls_load_playlist(h, http);
+		errors = added < 0 ? errors + 1 : 0;
+
+		/* Lock queue access */
+		pthread_mutex_lock(&h->mutex);
+
+		/* Too many errors: end of stream */
+		if(errors >= HLS_MAX_ERRORS)
+		{
+			h->is_end = 1;
+			pthread_cond_broadcast(&h->cond);
+		}
+	}
+
+	/* Unlock queue access */
+	pthread_mutex_unlock(&h->mutex);
+
+	/* Close HTTP client */
+	http_close(http);
+
+	return NULL;
+}
+
+static size_t hls_skip_id3(unsigned char *data, size_t len)
+{
+	size_t pos = 0, size;
+
+	/* Skip ID3 tags before packed audio (timestamp) */
+	while(len - pos >= 10 && memcmp(data + pos, "ID3", 3) == 0)
+	{
+		size = ((data[pos+6] & 0x7F) << 21) |
+		       ((data[pos+7] & 0x7F) << 14) |
+		       ((data[pos+8] & 0x7F) << 7) | (data[pos+9] & 0x7F);
+		size += (data[pos+5] & 0x10) ? 20 : 10;
+		if(size > len - pos)
+			return len;
+		pos += size;
+	}
+
+	return pos;
+}
+
+static size_t hls_demux_ts(unsigned char *data, size_t len)
+{
+	unsigned int pid, pmt_pid = 0, audio_pid = 0;
+	unsigned char *p, *end, *sec;
+	size_t out = 0, pos;
+	unsigned int n;
+
+	/* Extract audio PES payloads: data is overwritten */
+	for(pos = 0; pos + TS_PACKET_SIZE <= len; pos += TS_PACKET_SIZE)
+	{
+		p = data + pos;
+		end = p + TS_PACKET_SIZE;
+		if(p[0] != TS_SYNC_BYTE)
+			continue;
+		pid = ((p[1] & 0x1F) << 8) | p[2];
+
+		/* Skip adaptation field */
+		if(!(p[3] & 0x10))
+			continue;
+		sec = p + 4;
+		if(p[3] & 0x20)
+			sec += 1 + sec[0];
+		if(sec >= end)
+			continue;
+
+		if(pid == 0 || (pmt_pid != 0 && pid == pmt_pid))
+		{
+			/* Only parse sections starting in packet */
+			if(!(p[1] & 0x40))
+				continue;
+			sec += 1 + sec[0];
+			if(sec + 12 > end)
+				continue;
+			n = ((sec[1] & 0x0F) << 8) | sec[2];
+			if(sec + 3 + n < end)
+				end = sec + 3 + n;
+			end -= 4;
+
+			if(pid == 0)
+			{
+				/* PAT: get PID of first program map table */
+				for(sec += 8; sec + 4 <= end; sec += 4)
+				{
+					if(((sec[0] << 8) | sec[1]) == 0)
+						continue;
+					pmt_pid = ((sec[2] & 0x1F) << 8) |
+						  sec[3];
+					break;
+				}
+			}
+			else
+			{
+				/* PMT: get PID of first ADTS or MPEG audio */
+				n = ((sec[10] & 0x0F) << 8) | sec[11];
+				for(sec += 12 + n; sec + 5 <= end && !audio_pid;
+				    sec += 5 + (((sec[3] & 0x0F) << 8) | sec[4]))
+				{
+					if(sec[0] == 0x0F || sec[0] == 0x03 ||
+					   sec[0] == 0x04)
+						audio_pid = ((sec[1] & 0x1F)
+							     << 8) | sec[2];
+				}
+			}
+			continue;
+		}
+
+		/* Not audio */
+		if(audio_pid == 0 || pid != audio_pid)
+			continue;
+
+		/* Skip PES header on first packet */
+		if(p[1] & 0x40)
+		{
+			if(sec + 9 > end || sec[0] != 0 || sec[1] != 0 ||
+			   sec[2] != 1)
+				continue;
+			sec += 9 + sec[8];
+			if(sec >= end)
+				continue;
+		}
+
+		/* Copy payload */
+		memmove(data + out, sec, end - sec);
+		out += end - sec;
+	}
+
+	return out;
+}
+
+static size_t hls_extract_audio(unsigned char *data, size_t len)
+{
+	size_t pos;
+
+	/* MPEG Transport Stream */
+	if(len >= TS_PACKET_SIZE && data[0] == TS_SYNC_BYTE &&
+	   (len < TS_PACKET_SIZE * 2 || data[TS_PACKET_SIZE] == TS_SYNC_BYTE))
+		return hls_demux_ts(data, len);
+
+	/* Packed audio: remove ID3 tags */
+	pos = hls_skip_id3(data, len);
+	memmove(data, data + pos, len - pos);
+
+	return len - pos;
+}
+
+static void *hls_worker(void *user_data)
+{
+	struct hls_handle *h = user_data;
+	struct http_handle *http;
+	struct hls_segment *s;
+	unsigned char *data;
+	size_t len;
+	int i;
+
+	/* Open HTTP client */
+	if(http_open(&http, 1) != 0)
+		return NULL;
+	http_set_option(http, HTTP_FOLLOW_REDIRECT, NULL, 1);
+
+	/* Lock queue access */
+	pthread_mutex_lock(&h->mutex);
+
+	while(!h->stop)
+	{
+		/* Get next segment to download in prefetch window */
+		for(s = h->segments, i = 0; s != NULL && i < HLS_PREFETCH;
+		    s = s->next, i++)
+		{
+			if(s->state == HLS_SEGMENT_WAIT)
+				break;
+		}
+		if(s == NULL || i >= HLS_PREFETCH)
+		{
+			/* Wait new segments or read */
+			pthread_cond_wait(&h->cond, &h->mutex);
+			continue;
+		}
+		s->state = HLS_SEGMENT_LOADING;
+
+		/* Unlock queue access */
+		pthread_mutex_unlock(&h->mutex);
+
+		/* Download segment and extract audio frames */
+		data = hls_fetch(h, http, s->url, HLS_SEGMENT_SIZE, &len);
+		if(data != NULL)
+			len = hls_extract_audio(data, len);
+
+		/* Lock queue access */
+		pthread_mutex_lock(&h->mutex);
+
+		/* Update segment: it can't be removed while loading */
+		s->data = data;
+		s->len = len;
+		s->state = data != NULL ? HLS_SEGMENT_READY :
+					  HLS_SEGMENT_ERROR;
+
+		/* Download failed: try again before segment is skipped */
+		if(data == NULL && s->retries < HLS_SEGMENT_RETRIES)
+		{
+			s->retries++;
+			s->state = HLS_SEGMENT_WAIT;
+		}
+
+		/* Notify reader */
+		pthread_cond_broadcast(&h->cond);
+	}
+
+	/* Unlock queue access */
+	pthread_mutex_unlock(&h->mutex);
+
+	/* Close HTTP client */
+	http_close(http);
+
+	return NULL;
+}
+
+static void hls_free_segment(struct hls_segment *s)
+{
+	if(s->data != NULL)
+		free(s->data);
+	free(s->url);
+	free(s);
+}
+
+ssize_t hls_read_timeout(struct hls_handle *h, unsigned char *buffer,
+			 size_t size, long timeout)
+{
+	struct hls_segment *s;
+	ssize_t len = 0;
+	size_t count;
+	int waited = 0;
+
+	/* Lock queue access */
+	pthread_mutex_lock(&h->mutex);
+
+	while(size > 0)
+	{
+		s = h->segments;
+
+		/* Segment is not available */
+		if(s == NULL || s->state == HLS_SEGMENT_WAIT ||
+		   s->state == HLS_SEGMENT_LOADING)
+		{
+			/* End of stream */
+			if(s == NULL && h->is_end)
+			{
+				if(len == 0)
+					len = -1;
+				break;
+			}
+
+			/* Wait once for next segment */
+			if(len > 0 || waited || timeout <= 0)
+				break;
+			hls_wait(h, timeout);
+			waited = 1;
+			continue;
+		}
+
+		/* Copy audio frames */
+		if(s->state == HLS_SEGMENT_READY)
+		{
+			count = s->len - s->pos;
+			if(count > size)
+				count = size;
+			memcpy(buffer, s->data + s->pos, count);
+			s->pos += count;
+			buffer += count;
+			size -= count;
+			len += count;
+			if(s->pos < s->len)
+				break;
+		}
+
+		/* Remove segment read or failed */
+		h->segments = s->next;
+		if(h->segments == NULL)
+			h->last = NULL;
+		hls_free_segment(s);
+
+		/* A slot is free in prefetch window */
+		pthread_cond_broadcast(&h->cond);
+	}
+
+	/* Unlock queue access */
+	pthread_mutex_unlock(&h->mutex);
+
+	return len;
+}
+
+void hls_close(struct hls_handle *h)
+{
+	struct hls_segment *s;
+	int i;
+
+	if(h == NULL)
+		return;
+
+	/* Stop all threads */
+	pthread_mutex_lock(&h->mutex);
+	h->stop = 1;
+	pthread_cond_broadcast(&h->cond);
+	pthread_mutex_unlock(&h->mutex);
+	if(h->use_thread)
+		pthread_join(h->thread, NULL);
+	for(i = 0; i < h->worker_count; i++)
+		pthread_join(h->workers[i], NULL);
+
+	/* Free segments */
+	while(h->segments != NULL)
+	{
+		s = h->segments;
+		h->segments = s->next;
+		hls_free_segment(s);
+	}
+
+	/* Free structure */
+	if(h->url != NULL)
+		free(h->url);
+	pthread_cond_destroy(&h->cond);
+	pthread_mutex_destroy(&h->mutex);
+	free(h);
+}
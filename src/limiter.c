@@ -0,0 +1,377 @@
+/*
+ * limiter.c - A look-ahead soft limiter for mixer output
+ *
+ * Copyright (c) 2014   A. Dilly
+ *
+ * AirCat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * AirCat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "limiter.h"
+#include "sample.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/**
+ * Limiter settings:
+ *  LOOKAHEAD_TIME: delay of output used to reduce gain before a peak (in ms).
+ *  RELEASE_TIME: time constant of gain recovery after a peak (in ms).
+ *  GAIN_SHIFT: fixed point precision of gains applied on integer samples.
+ */
+#define LOOKAHEAD_TIME 2
+#define RELEASE_TIME 100
+#define GAIN_SHIFT 24
+
+struct limiter_handle {
+	/* Format */
+	unsigned char channels;
+	const struct sample_ops *ops;
+	/* Threshold (linear) */
+	float threshold;
+	/* Envelope: hold target, remaining hold frames, current gain and slope
+	 * of current attack.
+	 */
+	float target;
+	size_t hold;
+	float gain;
+	float step;
+	float release;
+	/* Delay line followed by input frames (look-ahead frames) */
+	unsigned char *buffer;
+	size_t lookahead;
+	/* Peak and gain of each frame of a block */
+	float *peaks;
+	int32_t *gains;
+	size_t size;
+};
+
+int limiter_open(struct limiter_handle **handle, unsigned long samplerate,
+		 unsigned char channels, double threshold)
+{
+	struct limiter_handle *h;
+
+	if(samplerate == 0 || channels == 0)
+		return -1;
+
+	/* Allocate structure */
+	*handle = malloc(sizeof(struct limiter_handle));
+	if(*handle == NULL)
+		return -1;
+	h = *handle;
+
+	/* Init structure */
+	h->channels = channels;
+	h->ops = sample_get_pipeline();
+	h->release = 1.0 - exp(-1000.0 / (RELEASE_TIME * (double) samplerate));
+	h->lookahead = samplerate * LOOKAHEAD_TIME / 1000;
+	if(h->lookahead == 0)
+		h->lookahead = 1;
+	h->buffer = NULL;
+	h->peaks = NULL;
+	h->gains = NULL;
+	h->size = 0;
+	limiter_set_threshold(h, threshold);
+
+	/* Allocate delay line */
+	h->buffer = malloc(h->lookahead * channels * 4);
+	if(h->buffer == NULL)
+	{
+		free(h);
+		return -1;
+	}
+	limiter_reset(h);
+
+	return 0;
+}
+
+void limiter_set_threshold(struct limiter_handle *h, double threshold)
+{
+	if(h == NULL)
+		return;
+
+	if(threshold > 0.0)
+		threshold = 0.0;
+	h->threshold = pow(10.0, threshold / 20.0);
+}
+
+void limiter_reset(struct limiter_handle *h)
+{
+	if(h == NULL)
+		return;
+
+	/* Clear envelope */
+	h->target = 1.0f;
+	h->hold = 0;
+	h->gain = 1.0f;
+	h->step = 0.0f;
+
+	/* Clear delay line */
+	memset(h->buffer, 0, h->lookahead * h->channels * 4);
+}
+
+/* Kernels use compare and select instead of branches and have a stereo
+ * version with a fixed stride, so they are vectorised by compiler when SIMD
+ * is available (SSE, NEON) and stay cheap on ARMv6 which has none for 32-bit
+ * samples.
+ */
+static inline float limiter_max(float a, float b)
+{
+	return a > b ? a : b;
+}
+
+static inline float limiter_clip_float(float x)
+{
+	x = x > 1.0f ? 1.0f : x;
+	return x < -1.0f ? -1.0f : x;
+}
+
+static inline int32_t limiter_clip_s32(int64_t x)
+{
+	x = x > 0x7FFFFFFFLL ? 0x7FFFFFFFLL : x;
+	return (int32_t) (x < -0x80000000LL ? -0x80000000LL : x);
+}
+
+static void limiter_peaks(struct limiter_handle *h, const unsigned char *in,
+			  size_t frames)
+{
+	const int32_t *p_s32 = (const int32_t *) in;
+	const float *p_float = (const float *) in;
+	const float scale = LIMITER_HEADROOM / 2147483648.0f;
+	unsigned char c = h->channels;
+	float peak;
+	size_t i;
+	int j;
+
+	/* Get maximum level of each frame with make-up gain applied */
+	if(h->ops->format == SAMPLE_FLOAT && c == 2)
+	{
+		for(i = 0; i < frames; i++)
+			h->peaks[i] = limiter_max(fabsf(p_float[2 * i]),
+						  fabsf(p_float[2 * i + 1])) *
+				      LIMITER_HEADROOM;
+	}
+	else if(h->ops->format == SAMPLE_FLOAT)
+	{
+		for(i = 0; i < frames; i++, p_float += c)
+		{
+			peak = 0.0f;
+			for(j = 0; j < c; j++)
+				peak = limiter_max(peak, fabsf(p_float[j]));
+			h->peaks[i] = peak * LIMITER_HEADROOM;
+		}
+	}
+	else if(c == 2)
+	{
+		for(i = 0; i < frames; i++)
+			h->peaks[i] = limiter_max(
+					      fabsf((float) p_s32[2 * i]),
+					      fabsf((float) p_s32[2 * i + 1])) *
+				      scale;
+	}
+	else
+	{
+		for(i = 0; i < frames; i++, p_s32 += c)
+		{
+			peak = 0.0f;
+			for(j = 0; j < c; j++)
+				peak = limiter_max(peak,
+						   fabsf((float) p_s32[j]));
+			h->peaks[i] = peak * scale;
+		}
+	}
+}
+
+static void limiter_envelope(struct limiter_handle *h, size_t frames)
+{
+	float target = h->target;
+	float gain = h->gain;
+	float step = h->step;
+	float req, s;
+	size_t hold = h->hold;
+	size_t i;
+
+	for(i = 0; i < frames; i++)
+	{
+		/* Gain required for newest frame */
+		req = h->peaks[i] > h->threshold ?
+					    h->threshold / h->peaks[i] : 1.0f;
+
+		/* Hold lowest gain during look-ahead time, then release */
+		if(req < target)
+		{
+			target = req;
+			hold = h->lookahead;
+		}
+		else if(hold > 0)
+			hold--;
+		else
+			target += (1.0f - target) * h->release;
+
+		/* Attack: gain reaches target before frame is output, the
+		 * steepest slope is kept when a lower target comes.
+		 */
+		if(target < gain)
+		{
+			s = (target - gain) / h->lookahead;
+			if(s < step)
+				step = s;
+			gain += step;
+			if(gain <= target)
+			{
+				gain = target;
+				step = 0.0f;
+			}
+		}
+		else
+		{
+			gain = target;
+			step = 0.0f;
+		}
+
+		/* Fixed point gain with make-up gain */
+		h->gains[i] = (int32_t) (gain * (LIMITER_HEADROOM <<
+						 GAIN_SHIFT));
+	}
+
+	h->target = target;
+	h->gain = gain;
+	h->step = step;
+	h->hold = hold;
+}
+
+static void limiter_apply(struct limiter_handle *h, unsigned char *out,
+			  const unsigned char *in, size_t frames)
+{
+	const int32_t *in_s32 = (const int32_t *) in;
+	const float *in_float = (const float *) in;
+	int32_t *out_s32 = (int32_t *) out;
+	float *out_float = (float *) out;
+	const float scale = 1.0f / (1 << GAIN_SHIFT);
+	unsigned char c = h->channels;
+	int64_t g;
+	float gf;
+	size_t i;
+	int j;
+
+	/* A 32x32->64 multiply is a single instruction on ARMv6 */
+	if(h->ops->format == SAMPLE_FLOAT && c == 2)
+	{
+		for(i = 0; i < frames; i++)
+		{
+			gf = h->gains[i] * scale;
+			out_float[2 * i] = limiter_clip_float(in_float[2 * i] *
+							      gf);
+			out_float[2 * i + 1] = limiter_clip_float(
+						       in_float[2 * i + 1] * gf);
+		}
+	}
+	else if(h->ops->format == SAMPLE_FLOAT)
+	{
+		for(i = 0; i < frames; i++, in_float += c, out_float += c)
+		{
+			gf = h->gains[i] * scale;
+			for(j = 0; j < c; j++)
+				out_float[j] = limiter_clip_float(in_float[j] *
+								  gf);
+		}
+	}
+	else if(c == 2)
+	{
+		for(i = 0; i < frames; i++)
+		{
+			g = h->gains[i];
+			out_s32[2 * i] = limiter_clip_s32(
+					 (in_s32[2 * i] * g) >> GAIN_SHIFT);
+			out_s32[2 * i + 1] = limiter_clip_s32(
+					 (in_s32[2 * i + 1] * g) >> GAIN_SHIFT);
+		}
+	}
+	else
+	{
+		for(i = 0; i < frames; i++, in_s32 += c, out_s32 += c)
+		{
+			g = h->gains[i];
+			for(j = 0; j < c; j++)
+				out_s32[j] = limiter_clip_s32(
+					     (in_s32[j] * g) >> GAIN_SHIFT);
+		}
+	}
+}
+
+int limiter_process(struct limiter_handle *h, unsigned char *buffer,
+		    size_t frames)
+{
+	size_t delay;
+	void *p;
+
+	if(h == NULL || frames == 0)
+		return 0;
+
+	/* Grow block buffers */
+	if(frames > h->size)
+	{
+		p = realloc(h->buffer, (h->lookahead + frames) * h->channels * 4);
+		if(p == NULL)
+			return -1;
+		h->buffer = p;
+		p = realloc(h->peaks, frames * sizeof(float));
+		if(p == NULL)
+			return -1;
+		h->peaks = p;
+		p = realloc(h->gains, frames * sizeof(int32_t));
+		if(p == NULL)
+			return -1;
+		h->gains = p;
+		h->size = frames;
+	}
+	delay = h->lookahead * h->channels * 4;
+
+	/* Append input frames to delay line */
+	memcpy(h->buffer + delay, buffer, frames * h->channels * 4);
+
+	/* Calculate gains from newest frames */
+	limiter_peaks(h, buffer, frames);
+	limiter_envelope(h, frames);
+
+	/* Apply gains on delayed frames */
+	limiter_apply(h, buffer, h->buffer, frames);
+
+	/* Keep last frames in delay line */
+	memmove(h->buffer, h->buffer + frames * h->channels * 4, delay);
+
+	return 0;
+}
+
+void limiter_close(struct limiter_handle *h)
+{
+	if(h == NULL)
+		return;
+
+	/* Free buffers */
+	if(h->buffer != NULL)
+		free(h->buffer);
+	if(h->peaks != NULL)
+		free(h->peaks);
+	if(h->gains != NULL)
+		free(h->gains);
+
+	free(h);
+}
+
@@ -0,0 +1,722 @@
+/*
+ * loop.c - A shared event loop for file descriptors and timers
+ *
+ * Copyright (c) 2014   A. Dilly
+ *
+ * AirCat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * AirCat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "loop.h"
+
+#define LOOP_MAX_EVENTS 32
+/* Initial size of timer heap */
+#define LOOP_HEAP_SIZE 16
+
+struct loop_fd {
+	/* Loop handle */
+	struct loop_handle *h;
+	/* File descriptor and events */
+	int fd;
+	int events;
+	/* Callback */
+	loop_fd_cb cb;
+	void *user_data;
+	/* Removed: freed by loop thread */
+	int removed;
+	/* Next file descriptor */
+	struct loop_fd *next;
+};
+
+struct loop_timer {
+	/* Loop handle */
+	struct loop_handle *h;
+	/* Next expiration and period (in ms) */
+	uint64_t deadline;
+	unsigned long period;
+	/* Position in heap (-1 if timer is disarmed) */
+	int index;
+	/* Callback */
+	loop_timer_cb cb;
+	void *user_data;
+	/* Timer list */
+	struct loop_timer *prev;
+	struct loop_timer *next;
+};
+
+struct loop_handle {
+	/* Epoll, wake up and timer file descriptors */
+	int epoll;
+	int wake;
+	int tfd;
+	/* File descriptors and timers */
+	struct loop_fd *fds;
+	struct loop_timer *timers;
+	/* Min-heap of armed timers sorted by deadline */
+	struct loop_timer **heap;
+	int heap_count;
+	int heap_size;
+	/* Deadline on which timer file descriptor is armed (0 if disarmed) */
+	uint64_t tfd_deadline;
+	/* Loop state */
+	int running;
+	volatile sig_atomic_t stop;
+	/* Recursive mutex held while callbacks are called */
+	pthread_mutex_t mutex;
+};
+
+static uint64_t loop_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int loop_open(struct loop_handle **handle)
+{
+	struct epoll_event ev;
+	pthread_mutexattr_t attr;
+	struct loop_handle *h;
+
+	/* Allocate structure */
+	*handle = malloc(sizeof(struct loop_handle));
+	if(*handle == NULL)
+		return -1;
+	h = *handle;
+
+	/* Init structure */
+	h->fds = NULL;
+	h->timers = NULL;
+	h->heap = NULL;
+	h->heap_count = 0;
+	h->heap_size = 0;
+	h->tfd_deadline = 0;
+	h->running = 0;
+	h->stop = 0;
+	h->wake = -1;
+	h->tfd = -1;
+
+	/* Create epoll instance */
+	h->epoll = epoll_create1(EPOLL_CLOEXEC);
+	if(h->epoll < 0)
+		goto error;
+
+	/* Create wake up event */
+	h->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(h->wake < 0)
+		goto error;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if(epoll_ctl(h->epoll, EPOLL_CTL_ADD, h->wake, &ev) != 0)
+		goto error;
+
+	/* Create timer file descriptor armed on first timer of heap */
+	h->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(h->tfd < 0)
+		goto error;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = &h->tfd;
+	if(epoll_ctl(h->epoll, EPOLL_CTL_ADD, h->tfd, &ev) != 0)
+		goto error;
+
+	/* Init recursive mutex: callbacks can use loop functions */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&h->mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	return 0;
+
+error:
+	if(h->tfd >= 0)
+		close(h->tfd);
+	if(h->wake >= 0)
+		close(h->wake);
+	if(h->epoll >= 0)
+		close(h->epoll);
+	free(h);
+	*handle = NULL;
+	return -1;
+}
+
+static inline void loop_heap_set(struct loop_handle *h, int i,
+				 struct loop_timer *t)
+{
+	h->heap[i] = t;
+	t->index = i;
+}
+
+static void loop_heap_up(struct loop_handle *h, int i)
+{
+	struct loop_timer *t = h->heap[i];
+	int parent;
+
+	/* Move timer up until its parent expires before */
+	while(i > 0)
+	{
+		parent = (i - 1) / 2;
+		if(h->heap[parent]->deadline <= t->deadline)
+			break;
+		loop_heap_set(h, i, h->heap[parent]);
+		i = parent;
+	}
+	loop_heap_set(h, i, t);
+}
+
+static void loop_heap_down(struct loop_handle *h, int i)
+{
+	struct loop_timer *t = h->heap[i];
+	int child;
+
+	/* Move timer down until its children expire after */
+	while((child = 2 * i + 1) < h->heap_count)
+	{
+		if(child + 1 < h->heap_count &&
+		   h->heap[child+1]->deadline < h->heap[child]->deadline)
+			child++;
+		if(t->deadline <= h->heap[child]->deadline)
+			break;
+		loop_heap_set(h, i, h->heap[child]);
+		i = child;
+	}
+	loop_heap_set(h, i, t);
+}
+
+static int loop_heap_push(struct loop_handle *h, struct loop_timer *t)
+{
+	struct loop_timer **heap;
+	int size;
+
+	/* Grow heap */
+	if(h->heap_count == h->heap_size)
+	{
+		size = h->heap_size == 0 ? LOOP_HEAP_SIZE : h->heap_size * 2;
+		heap = realloc(h->heap, size * sizeof(struct loop_timer *));
+		if(heap == NULL)
+			return -1;
+		h->heap = heap;
+		h->heap_size = size;
+	}
+
+	/* Add at end and move up */
+	loop_heap_set(h, h->heap_count++, t);
+	loop_heap_up(h, t->index);
+
+	return 0;
+}
+
+static void loop_heap_remove(struct loop_handle *h, struct loop_timer *t)
+{
+	struct loop_timer *last;
+	int i = t->index;
+
+	if(i < 0)
+		return;
+	t->index = -1;
+
+	/* Replace by last timer and restore heap order */
+	last = h->heap[--h->heap_count];
+	if(last == t)
+		return;
+	loop_heap_set(h, i, last);
+	if(i > 0 && h->heap[(i - 1) / 2]->deadline > last->deadline)
+		loop_heap_up(h, i);
+	else
+		loop_heap_down(h, i);
+}
+
+static void loop_update_tfd(struct loop_handle *h)
+{
+	struct itimerspec its;
+	uint64_t deadline;
+
+	/* Get first expiration */
+	deadline = h->heap_count > 0 ? h->heap[0]->deadline : 0;
+	if(deadline == h->tfd_deadline)
+		return;
+
+	/* Arm timer file descriptor on absolute time or disarm it: a deadline
+	 * of 0 would disarm timer, so 1 ns is used for timers already expired.
+	 */
+	memset(&its, 0, sizeof(its));
+	if(deadline > 0)
+	{
+		its.it_value.tv_sec = deadline / 1000;
+		its.it_value.tv_nsec = (deadline % 1000) * 1000000;
+		if(its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+			its.it_value.tv_nsec = 1;
+	}
+	if(timerfd_settime(h->tfd, TFD_TIMER_ABSTIME, &its, NULL) == 0)
+		h->tfd_deadline = deadline;
+}
+
+static void loop_process_timers(struct loop_handle *h)
+{
+	struct loop_timer *t;
+	uint64_t now;
+	int count;
+
+	/* Only timers expired now are processed: a timer armed again with a
+	 * null timeout from its callback is processed on next iteration.
+	 */
+	now = loop_now();
+	count = h->heap_count;
+
+	/* Timer file descriptor is disarmed once expired */
+	if(h->tfd_deadline <= now)
+		h->tfd_deadline = 0;
+
+	while(count-- > 0 && h->heap_count > 0 && h->heap[0]->deadline <= now)
+	{
+		t = h->heap[0];
+
+		/* Prepare next expiration */
+		if(t->period > 0)
+		{
+			t->deadline += t->period;
+			if(t->deadline <= now)
+				t->deadline = now + t->period;
+			loop_heap_down(h, 0);
+		}
+		else
+			loop_heap_remove(h, t);
+
+		/* Call callback: timer can be freed in it */
+		t->cb(t->user_data);
+	}
+
+	/* Arm timer file descriptor on next expiration */
+	loop_update_tfd(h);
+}
+
+static void loop_collect(struct loop_handle *h)
+{
+	struct loop_fd **fp, *f;
+
+	/* Free removed file descriptors */
+	for(fp = &h->fds; *fp != NULL;)
+	{
+		f = *fp;
+		if(f->removed)
+		{
+			*fp = f->next;
+			free(f);
+		}
+		else
+			fp = &f->next;
+	}
+}
+
+static inline int loop_get_events(uint32_t ev)
+{
+	int events = 0;
+
+	if(ev & EPOLLIN)
+		events |= LOOP_READ;
+	if(ev & EPOLLOUT)
+		events |= LOOP_WRITE;
+	if(ev & EPOLLERR)
+		events |= LOOP_ERROR;
+	if(ev & EPOLLHUP)
+		events |= LOOP_HANGUP;
+
+	return events;
+}
+
+int loop_run(struct loop_handle *h)
+{
+	struct epoll_event events[LOOP_MAX_EVENTS];
+	struct loop_fd *f;
+	uint64_t v;
+	int count;
+	int i;
+
+	if(h == NULL)
+		return -1;
+
+	/* Loop is running */
+	pthread_mutex_lock(&h->mutex);
+	h->running = 1;
+	pthread_mutex_unlock(&h->mutex);
+
+	while(!h->stop)
+	{
+		/* Wait for events: timers expire through timer file descriptor */
+		count = epoll_wait(h->epoll, events, LOOP_MAX_EVENTS, -1);
+		if(count < 0)
+		{
+			if(errno != EINTR)
+				break;
+			count = 0;
+		}
+
+		/* Lock loop */
+		pthread_mutex_lock(&h->mutex);
+
+		/* Process events on file descriptors */
+		for(i = 0; i < count; i++)
+		{
+			f = events[i].data.ptr;
+
+			/* Wake up event */
+			if(f == NULL)
+			{
+				if(read(h->wake, &v, sizeof(v)) < 0)
+					continue;
+				continue;
+			}
+
+			/* Timer event: timers are processed below */
+			if((void *) f == &h->tfd)
+			{
+				if(read(h->tfd, &v, sizeof(v)) < 0)
+					continue;
+				continue;
+			}
+
+			/* File descriptor removed by a previous callback */
+			if(f->removed)
+				continue;
+
+			f->cb(f->user_data, f->fd,
+			      loop_get_events(events[i].events));
+		}
+
+		/* Process timers */
+		loop_process_timers(h);
+
+		/* Free removed file descriptors */
+		loop_collect(h);
+
+		/* Unlock loop */
+		pthread_mutex_unlock(&h->mutex);
+	}
+
+	/* Loop is stopped */
+	pthread_mutex_lock(&h->mutex);
+	h->running = 0;
+	h->stop = 0;
+	pthread_mutex_unlock(&h->mutex);
+
+	return 0;
+}
+
+void loop_break(struct loop_handle *h)
+{
+	uint64_t v = 1;
+
+	if(h == NULL)
+		return;
+
+	/* Only async-signal-safe calls here */
+	h->stop = 1;
+	if(write(h->wake, &v, sizeof(v)) < 0)
+		return;
+}
+
+void loop_lock(struct loop_handle *h)
+{
+	if(h == NULL)
+		return;
+
+	pthread_mutex_lock(&h->mutex);
+}
+
+void loop_unlock(struct loop_handle *h)
+{
+	if(h == NULL)
+		return;
+
+	pthread_mutex_unlock(&h->mutex);
+}
+
+void loop_close(struct loop_handle *h)
+{
+	struct loop_timer *t;
+	struct loop_fd *f;
+
+	if(h == NULL)
+		return;
+
+	/* Free file descriptors */
+	while(h->fds != NULL)
+	{
+		f = h->fds;
+		h->fds = f->next;
+		free(f);
+	}
+
+	/* Free timers */
+	while(h->timers != NULL)
+	{
+		t = h->timers;
+		h->timers = t->next;
+		free(t);
+	}
+	if(h->heap != NULL)
+		free(h->heap);
+
+	/* Close epoll */
+	close(h->tfd);
+	close(h->wake);
+	close(h->epoll);
+
+	/* Destroy mutex */
+	pthread_mutex_destroy(&h->mutex);
+
+	free(h);
+}
+
+struct loop_fd *loop_add_fd(struct loop_handle *h, int fd, int events,
+			    loop_fd_cb cb, void *user_data)
+{
+	struct epoll_event ev;
+	struct loop_fd *f;
+
+	if(h == NULL || fd < 0 || cb == NULL)
+		return NULL;
+
+	/* Allocate file descriptor */
+	f = malloc(sizeof(struct loop_fd));
+	if(f == NULL)
+		return NULL;
+
+	/* Init file descriptor */
+	f->h = h;
+	f->fd = fd;
+	f->events = events;
+	f->cb = cb;
+	f->user_data = user_data;
+	f->removed = 0;
+
+	/* Prepare epoll event */
+	memset(&ev, 0, sizeof(ev));
+	ev.events = (events & LOOP_READ ? EPOLLIN : 0) |
+		    (events & LOOP_WRITE ? EPOLLOUT : 0);
+	ev.data.ptr = f;
+
+	/* Lock loop */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Add to epoll */
+	if(epoll_ctl(h->epoll, EPOLL_CTL_ADD, fd, &ev) != 0)
+	{
+		pthread_mutex_unlock(&h->mutex);
+		free(f);
+		return NULL;
+	}
+
+	/* Add to list */
+	f->next = h->fds;
+	h->fds = f;
+
+	/* Unlock loop */
+	pthread_mutex_unlock(&h->mutex);
+
+	return f;
+}
+
+int loop_set_fd(struct loop_fd *f, int events)
+{
+	struct epoll_event ev;
+	int ret = 0;
+
+	if(f == NULL)
+		return -1;
+
+	/* Lock loop */
+	pthread_mutex_lock(&f->h->mutex);
+
+	/* Update events */
+	if(f->events != events)
+	{
+		memset(&ev, 0, sizeof(ev));
+		ev.events = (events & LOOP_READ ? EPOLLIN : 0) |
+			    (events & LOOP_WRITE ? EPOLLOUT : 0);
+		ev.data.ptr = f;
+		ret = epoll_ctl(f->h->epoll, EPOLL_CTL_MOD, f->fd, &ev);
+		if(ret == 0)
+			f->events = events;
+	}
+
+	/* Unlock loop */
+	pthread_mutex_unlock(&f->h->mutex);
+
+	return ret;
+}
+
+void loop_remove_fd(struct loop_fd *f)
+{
+	struct loop_handle *h;
+
+	if(f == NULL)
+		return;
+	h = f->h;
+
+	/* Lock loop */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Remove from epoll: structure is freed by loop */
+	epoll_ctl(h->epoll, EPOLL_CTL_DEL, f->fd, NULL);
+	f->removed = 1;
+
+	/* Free it now if loop is not running */
+	if(!h->running)
+		loop_collect(h);
+
+	/* Unlock loop */
+	pthread_mutex_unlock(&h->mutex);
+}
+
+static int loop_arm_timer(struct loop_timer *t, long timeout,
+			  unsigned long period)
+{
+	struct loop_handle *h = t->h;
+
+	/* Disarm timer */
+	t->period = period;
+	if(timeout < 0)
+	{
+		loop_heap_remove(h, t);
+		loop_update_tfd(h);
+		return 0;
+	}
+
+	/* Update deadline and position in heap */
+	t->deadline = loop_now() + timeout;
+	if(t->index < 0)
+	{
+		if(loop_heap_push(h, t) != 0)
+			return -1;
+	}
+	else
+	{
+		loop_heap_up(h, t->index);
+		loop_heap_down(h, t->index);
+	}
+
+	/* Timer file descriptor is armed on first expiration: loop doesn't
+	 * need to be woken up.
+	 */
+	loop_update_tfd(h);
+
+	return 0;
+}
+
+struct loop_timer *loop_add_timer(struct loop_handle *h, long timeout,
+				  unsigned long period, loop_timer_cb cb,
+				  void *user_data)
+{
+	struct loop_timer *t;
+
+	if(h == NULL || cb == NULL)
+		return NULL;
+
+	/* Allocate timer */
+	t = malloc(sizeof(struct loop_timer));
+	if(t == NULL)
+		return NULL;
+
+	/* Init timer */
+	t->h = h;
+	t->cb = cb;
+	t->user_data = user_data;
+	t->index = -1;
+
+	/* Lock loop */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Arm timer */
+	if(loop_arm_timer(t, timeout, period) != 0)
+	{
+		pthread_mutex_unlock(&h->mutex);
+		free(t);
+		return NULL;
+	}
+
+	/* Add to list */
+	t->prev = NULL;
+	t->next = h->timers;
+	if(h->timers != NULL)
+		h->timers->prev = t;
+	h->timers = t;
+
+	/* Unlock loop */
+	pthread_mutex_unlock(&h->mutex);
+
+	return t;
+}
+
+int loop_set_timer(struct loop_timer *t, long timeout, unsigned long period)
+{
+	int ret;
+
+	if(t == NULL)
+		return -1;
+
+	/* Lock loop */
+	pthread_mutex_lock(&t->h->mutex);
+
+	/* Update timer */
+	ret = loop_arm_timer(t, timeout, period);
+
+	/* Unlock loop */
+	pthread_mutex_unlock(&t->h->mutex);
+
+	return ret;
+}
+
+void loop_remove_timer(struct loop_timer *t)
+{
+	struct loop_handle *h;
+
+	if(t == NULL)
+		return;
+	h = t->h;
+
+	/* Lock loop */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Remove from heap and list: timers are not referenced by loop once
+	 * their callback is called, so it is freed now.
+	 */
+	loop_heap_remove(h, t);
+	loop_update_tfd(h);
+	if(t->prev != NULL)
+		t->prev->next = t->next;
+	else
+		h->timers = t->next;
+	if(t->next != NULL)
+		t->next->prev = t->prev;
+	free(t);
+
+	/* Unlock loop */
+	pthread_mutex_unlock(&h->mutex);
+}
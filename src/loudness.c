@@ -0,0 +1,339 @@
+/*
+ * loudness.c - An EBU R128 loudness meter
+ *
+ * Copyright (c) 2014   A. Dilly
+ *
+ * AirCat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * AirCat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "loudness.h"
+#include "sample.h"
+#include "file.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/**
+ * Loudness settings:
+ *  STEP_TIME: time between two gating blocks (in ms).
+ *  STEPS_PER_BLOCK: count of steps in a gating block (400 ms).
+ *  BLOCK_ALLOC_SIZE: count of blocks allocated at once.
+ *  RELATIVE_GATE: relative gate under ungated loudness (in LU).
+ *  SCAN_SIZE: size of buffer used to decode files (in samples).
+ *  SCAN_MAX_EMPTY: maximum consecutive empty reads before analysis fails.
+ */
+#define STEP_TIME 100
+#define STEPS_PER_BLOCK 4
+#define BLOCK_ALLOC_SIZE 1024
+#define RELATIVE_GATE 10.0
+#define SCAN_SIZE 8192
+#define SCAN_MAX_EMPTY 100
+
+#define MAX_CHANNELS 8
+
+/* Convert mean square to loudness */
+#define LOUDNESS(z) (-0.691 + 10.0 * log10(z))
+
+struct loudness_filter {
+	double b[3];
+	double a[3];
+};
+
+struct loudness_handle {
+	/* Stream format */
+	unsigned long samplerate;
+	unsigned char channels;
+	/* K-weighting filters: pre-filter (shelving) and RLB filter */
+	struct loudness_filter pre;
+	struct loudness_filter rlb;
+	double state[MAX_CHANNELS][4];
+	double weight[MAX_CHANNELS];
+	/* Current step */
+	unsigned long step_len;
+	unsigned long step_pos;
+	double step_sum;
+	/* Last steps energy */
+	double steps[STEPS_PER_BLOCK];
+	unsigned long step_count;
+	/* Gating blocks energy */
+	double *blocks;
+	unsigned long block_len;
+	unsigned long block_alloc;
+};
+
+int loudness_open(struct loudness_handle **handle, unsigned long samplerate,
+		  unsigned char channels)
+{
+	struct loudness_handle *h;
+	double f0, g, q, k, vh, vb, a0;
+	int i;
+
+	if(samplerate == 0 || channels == 0 || channels > MAX_CHANNELS)
+		return -1;
+
+	/* Allocate handle */
+	*handle = calloc(1, sizeof(struct loudness_handle));
+	if(*handle == NULL)
+		return -1;
+	h = *handle;
+
+	/* Init structure */
+	h->samplerate = samplerate;
+	h->channels = channels;
+	h->step_len = samplerate * STEP_TIME / 1000;
+
+	/* Calculate pre-filter coefficients for samplerate */
+	f0 = 1681.974450955533;
+	g = 3.999843853973347;
+	q = 0.7071752369554196;
+	k = tan(M_PI * f0 / samplerate);
+	vh = pow(10.0, g / 20.0);
+	vb = pow(vh, 0.4996667741545416);
+	a0 = 1.0 + k / q + k * k;
+	h->pre.b[0] = (vh + vb * k / q + k * k) / a0;
+	h->pre.b[1] = 2.0 * (k * k - vh) / a0;
+	h->pre.b[2] = (vh - vb * k / q + k * k) / a0;
+	h->pre.a[0] = 1.0;
+	h->pre.a[1] = 2.0 * (k * k - 1.0) / a0;
+	h->pre.a[2] = (1.0 - k / q + k * k) / a0;
+
+	/* Calculate RLB filter coefficients for samplerate */
+	f0 = 38.13547087602444;
+	q = 0.5003270373238773;
+	k = tan(M_PI * f0 / samplerate);
+	a0 = 1.0 + k / q + k * k;
+	h->rlb.b[0] = 1.0;
+	h->rlb.b[1] = -2.0;
+	h->rlb.b[2] = 1.0;
+	h->rlb.a[0] = 1.0;
+	h->rlb.a[1] = 2.0 * (k * k - 1.0) / a0;
+	h->rlb.a[2] = (1.0 - k / q + k * k) / a0;
+
+	/* Set channel weights: surround channels are amplified and LFE is
+	 * ignored for 5.1 streams.
+	 */
+	for(i = 0; i < channels; i++)
+	{
+		if(channels == 6 && i == 3)
+			h->weight[i] = 0.0;
+		else if(channels >= 5 && i >= channels - 2)
+			h->weight[i] = 1.41;
+		else
+			h->weight[i] = 1.0;
+	}
+
+	return 0;
+}
+
+static inline double loudness_filter(struct loudness_handle *h, double x,
+				     double *s)
+{
+	double y;
+
+	/* Pre-filter (direct form II) */
+	y = x - h->pre.a[1] * s[0] - h->pre.a[2] * s[1];
+	x = h->pre.b[0] * y + h->pre.b[1] * s[0] + h->pre.b[2] * s[1];
+	s[1] = s[0];
+	s[0] = y;
+
+	/* RLB filter (direct form II) */
+	y = x - h->rlb.a[1] * s[2] - h->rlb.a[2] * s[3];
+	x = h->rlb.b[0] * y + h->rlb.b[1] * s[2] + h->rlb.b[2] * s[3];
+	s[3] = s[2];
+	s[2] = y;
+
+	return x;
+}
+
+static void loudness_add_block(struct loudness_handle *h)
+{
+	double *blocks;
+	double sum = 0;
+	int i;
+
+	/* Save step energy */
+	h->steps[h->step_count % STEPS_PER_BLOCK] = h->step_sum;
+	h->step_count++;
+	h->step_sum = 0;
+	h->step_pos = 0;
+
+	/* Not enough steps for a block */
+	if(h->step_count < STEPS_PER_BLOCK)
+		return;
+
+	/* Add more space to block list */
+	if(h->block_len == h->block_alloc)
+	{
+		blocks = realloc(h->blocks, (h->block_alloc + BLOCK_ALLOC_SIZE) *
+				 sizeof(double));
+		if(blocks == NULL)
+			return;
+		h->blocks = blocks;
+		h->block_alloc += BLOCK_ALLOC_SIZE;
+	}
+
+	/* Calculate mean square of block (overlap of 75%) */
+	for(i = 0; i < STEPS_PER_BLOCK; i++)
+		sum += h->steps[i];
+	h->blocks[h->block_len++] = sum / (h->step_len * STEPS_PER_BLOCK);
+}
+
+void loudness_add(struct loudness_handle *h, const unsigned char *buffer,
+		  size_t size)
+{
+	const float *p_float = (const float *) buffer;
+	const int32_t *p_s32 = (const int32_t *) buffer;
+	int is_float = sample_get_format() == SAMPLE_FLOAT;
+	double x;
+	size_t i;
+	int c;
+
+	if(h == NULL || buffer == NULL)
+		return;
+
+	/* Process all frames */
+	for(i = 0; i + h->channels <= size; i += h->channels)
+	{
+		/* Sum weighted energy of all channels */
+		for(c = 0; c < h->channels; c++)
+		{
+			x = is_float ? p_float[i+c] :
+				       p_s32[i+c] / 2147483648.0;
+			x = loudness_filter(h, x, h->state[c]);
+			h->step_sum += h->weight[c] * x * x;
+		}
+
+		/* Step is complete */
+		if(++h->step_pos >= h->step_len)
+			loudness_add_block(h);
+	}
+}
+
+double loudness_get(struct loudness_handle *h)
+{
+	double abs_gate, rel_gate;
+	double sum = 0;
+	unsigned long count = 0;
+	unsigned long i;
+
+	if(h == NULL)
+		return LOUDNESS_SILENCE;
+
+	/* Absolute gate: -70 LUFS */
+	abs_gate = pow(10.0, (LOUDNESS_SILENCE + 0.691) / 10.0);
+	for(i = 0; i < h->block_len; i++)
+	{
+		if(h->blocks[i] > abs_gate)
+		{
+			sum += h->blocks[i];
+			count++;
+		}
+	}
+	if(count == 0)
+		return LOUDNESS_SILENCE;
+
+	/* Relative gate: 10 LU under absolute gated loudness */
+	rel_gate = sum / count * pow(10.0, -RELATIVE_GATE / 10.0);
+	if(rel_gate < abs_gate)
+		rel_gate = abs_gate;
+
+	/* Calculate integrated loudness */
+	sum = 0;
+	count = 0;
+	for(i = 0; i < h->block_len; i++)
+	{
+		if(h->blocks[i] > rel_gate)
+		{
+			sum += h->blocks[i];
+			count++;
+		}
+	}
+	if(count == 0)
+		return LOUDNESS_SILENCE;
+
+	return LOUDNESS(sum / count);
+}
+
+int loudness_scan_file(const char *uri, double *loudness,
+		       unsigned long *duration)
+{
+	struct loudness_handle *h = NULL;
+	struct file_handle *file = NULL;
+	unsigned char *buffer = NULL;
+	uint64_t total = 0;
+	int empty = 0;
+	int ret = -1;
+	int samples;
+
+	/* Open file: decoding is done as fast as possible */
+	if(file_open(&file, uri) != 0)
+		goto end;
+
+	/* Open loudness meter */
+	if(loudness_open(&h, file_get_samplerate(file),
+			 file_get_channels(file)) != 0)
+		goto end;
+
+	/* Allocate buffer */
+	buffer = malloc(SCAN_SIZE * 4);
+	if(buffer == NULL)
+		goto end;
+
+	/* Decode all file */
+	while((samples = file_read(file, buffer, SCAN_SIZE, NULL)) >= 0)
+	{
+		/* Wait data from network: stop if no sample comes */
+		if(samples == 0)
+		{
+			if(++empty >= SCAN_MAX_EMPTY)
+				goto end;
+			usleep(10000);
+			continue;
+		}
+		empty = 0;
+
+		loudness_add(h, buffer, samples);
+		total += samples;
+	}
+
+	/* Get loudness and duration */
+	*loudness = loudness_get(h);
+	*duration = total * 1000 / h->samplerate / h->channels;
+	ret = 0;
+
+end:
+	if(buffer != NULL)
+		free(buffer);
+	loudness_close(h);
+	file_close(file);
+
+	return ret;
+}
+
+void loudness_close(struct loudness_handle *h)
+{
+	if(h == NULL)
+		return;
+
+	if(h->blocks != NULL)
+		free(h->blocks);
+	free(h);
+}
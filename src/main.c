@@ -26,8 +26,10 @@
 #include "config_file.h"
 #include "timers.h"
 #include "avahi.h"
+#include "loop.h"
 #include "httpd.h"
 #include "fs.h"
+#include "sample.h"
 
 #include "modules.h"
 
@@ -52,6 +54,7 @@
 #endif
 
 /* Common modules */
+static struct loop_handle *loop = NULL;
 static struct outputs_handle *outputs = NULL;
 static struct avahi_handle *avahi = NULL;
 static struct httpd_handle *httpd = NULL;
@@ -66,13 +69,13 @@ struct url_table config_urls[];
 /* Program args */
 static char *config_file = NULL;	/* Alternative configuration file */
 static int verbose = 0;			/* Verbosity */
-static int stop_signal = 0;		/* Stop signal */
 
 static void print_usage(const char *name)
 {
 	printf("Usage: %s [OPTIONS]\n"
 		"\n"
 		"Options:\n"
+		"-b      --benchmark          Benchmark sample formats and exit\n"
 		"-c      --config=FILE        Use FILE as configuration file\n"
 		"-h      --help               Print this usage and exit\n"
 		"-v      --verbose            Active verbose output\n"
@@ -93,10 +96,11 @@ static void parse_opt(int argc, char * const argv[])
 	while(1)
 	{
 		int option_index = 0;
-		static const char *short_options = "c:hv";
+		static const char *short_options = "bc:hv";
 		static struct option long_options[] =
 		{
 			{"version",      no_argument,        0, 0},
+			{"benchmark",    no_argument,        0, 'b'},
 			{"config",       required_argument,  0, 'c'},
 			{"help",         no_argument,        0, 'h'},
 			{"verbose",      no_argument,        0, 'v'},
@@ -122,6 +126,11 @@ static void parse_opt(int argc, char * const argv[])
 						break;
 				}
 				break;
+			case 'b':
+				/* Benchmark */
+				sample_benchmark();
+				exit(EXIT_SUCCESS);
+				break;
 			case 'c':
 				/* Config file */
 				config_file = strdup(optarg);
@@ -147,15 +156,27 @@ void signal_handler(int signum)
 	if(signum == SIGINT || signum == SIGTERM)
 	{
 		printf("Received Stop signal...\n");
-		stop_signal = 1;
+		loop_break(loop);
 	}
 }
 
+static void stdin_cb(void *user_data, int fd, int events)
+{
+	/* Stop on an input on stdin (only for test purpose) */
+	loop_break(loop);
+}
+
+static void refresh_cb(void *user_data)
+{
+	/* Open or close modules after a change of enabled status */
+	modules_refresh(modules, httpd, avahi, outputs, events, timers);
+}
+
 int main(int argc, char* argv[])
 {
-	struct timeval timeout;
+	struct loop_timer *refresh;
+	struct loop_fd *input;
 	struct json *cfg;
-	fd_set fds;
 
 	/* Parse options */
 	parse_opt(argc, argv);
@@ -170,18 +191,25 @@ int main(int argc, char* argv[])
 	/* Open configuration */
 	config_open(&config, config_file);
 
+	/* Open event loop */
+	if(loop_open(&loop) != 0)
+	{
+		fprintf(stderr, "Failed to open event loop!\n");
+		return EXIT_FAILURE;
+	}
+
 	/* Setup signal handler */
 	signal(SIGINT, signal_handler);
 	signal(SIGTERM, signal_handler);
 
 	/* Open Avahi Client */
-	avahi_open(&avahi);
+	avahi_open(&avahi, loop);
 
 	/* Open event module */
 	events_open(&events);
 
 	/* Open timer module */
-	timers_open(&timers);
+	timers_open(&timers, loop);
 
 	/* Get Output configuration from file */
 	cfg = config_get_json(config, "output");
@@ -205,7 +233,7 @@ int main(int argc, char* argv[])
 	cfg = config_get_json(config, "modules");
 
 	/* Open Modules */
-	modules_open(&modules, cfg, MODULES_PATH, MODULES_USER_PATH);
+	modules_open(&modules, loop, cfg, MODULES_PATH, MODULES_USER_PATH);
 
 	/* Free Modules configuration */
 	json_free(cfg);
@@ -227,25 +255,21 @@ int main(int argc, char* argv[])
 	timers_start(timers);
 
 	/* Wait an input on stdin (only for test purpose) */
-	while(!stop_signal)
-	{
-		FD_ZERO(&fds);
-		FD_SET(0, &fds); 
-		timeout.tv_sec = 0;
-		timeout.tv_usec = 100000;
+	input = loop_add_fd(loop, 0, LOOP_READ, stdin_cb, NULL);
 
-		if(select(1, &fds, NULL, NULL, &timeout) < 0)
-			break;
+	/* Refresh modules only when requested (timer is armed by modules) */
+	refresh = loop_add_timer(loop, -1, 0, refresh_cb, NULL);
+	modules_set_refresh(modules, refresh);
 
-		if(FD_ISSET(0, &fds))
-			break;
-
-		/* Iterate Avahi client */
-		avahi_loop(avahi, 100);
+	/* Run event loop until stop signal */
+	loop_run(loop);
 
-		/* Refresh modules */
-		modules_refresh(modules, httpd, avahi, outputs, events, timers);
-	}
+	/* Remove stdin and modules refresh from loop */
+	if(input != NULL)
+		loop_remove_fd(input);
+	modules_set_refresh(modules, NULL);
+	if(refresh != NULL)
+		loop_remove_timer(refresh);
 
 	/* Unregister all timer events */
 	timers_stop(timers);
@@ -271,6 +295,9 @@ int main(int argc, char* argv[])
 	/* Close Avahi Client */
 	avahi_close(avahi);
 
+	/* Close event loop */
+	loop_close(loop);
+
 	/* Save configuration */
 	config_save(config);
 
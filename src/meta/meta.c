@@ -18,19 +18,35 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "meta.h"
+#include "demux.h"
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
-#ifndef HAVE_TAGLIB
+#ifdef HAVE_TAGLIB
+#include "meta_taglib.h"
+#endif
+
 struct meta *meta_parse(const char *filename, int options)
 {
+	struct meta *m;
+
+	/* Use native parsers of demuxers: only headers and tags are read */
+	m = demux_probe(filename, options);
+	if(m != NULL)
+		return m;
+
+#ifdef HAVE_TAGLIB
+	/* Fallback on TagLib for other formats */
+	return meta_taglib_parse(filename, options);
+#else
 	return NULL;
-}
 #endif
+}
 
 #define FREE_STRING(str) if(str != NULL) free(str);
 
@@ -50,6 +50,7 @@
 #include <taglib/attachedpictureframe.h>
 
 #include "meta_taglib_file.h"
+#include "meta_taglib.h"
 #include "meta.h"
 
 #define COPY_STRING(d, s) d = ::strdup(s.toCString())
@@ -214,11 +215,11 @@ static void tag_read_from_mp4(MP4::Tag *tag, struct meta *m, int options)
 	}
 }
 
-struct meta *meta_parse(const char *filename, int options)
+struct meta *meta_taglib_parse(const char *filename, int options)
 {
 	AudioProperties *prop;
 	struct meta *m = NULL;
-	File *file;
+	File *file = NULL;
 	Tag *tag;
 
 #if (TAGLIB_MAJOR_VERSION >= 1) &&  (TAGLIB_MINOR_VERSION >= 9)
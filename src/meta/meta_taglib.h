@@ -0,0 +1,37 @@
+/*
+ * meta_taglib.h - An Audio File format parser and tag extractor (based on
+ *                 taglib)
+ *
+ * Copyright (c) 2014   A. Dilly
+ *
+ * AirCat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * AirCat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _META_TAGLIB_H
+#define _META_TAGLIB_H
+
+#include "meta.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Parse file with TagLib (slower than demux_probe() but more formats) */
+struct meta *meta_taglib_parse(const char *filename, int options);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -16,6 +16,8 @@
  * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+
 #include "meta_taglib_file.h"
 
 #define BUFFER_SIZE 8192
@@ -23,11 +25,38 @@
 #if (TAGLIB_MAJOR_VERSION >= 1) &&  (TAGLIB_MINOR_VERSION >= 9)
 
 MetaTaglibFile::MetaTaglibFile(const std::string& openFileName,
-                               bool openReadOnly)
+                               bool openReadOnly, TagLib::uint blockSize,
+                               TagLib::uint blockCount)
 {
     /* Init values */
     isReadOnly = true;
     fileName = openFileName;
+    position = 0;
+    fileLength = -1;
+    useCounter = 0;
+
+    /* Choose block size: bigger blocks on network filesystems */
+    if(blockSize == 0)
+    {
+        if(fileName.find("://") != std::string::npos)
+            blockSize = META_TAGLIB_NET_BLOCK_SIZE;
+        else
+            blockSize = META_TAGLIB_BLOCK_SIZE;
+    }
+    if(blockCount == 0)
+        blockCount = 1;
+    this->blockSize = blockSize;
+    this->blockCount = blockCount;
+
+    /* Allocate block cache: data are allocated on first use */
+    blocks = new Block[blockCount];
+    for(TagLib::uint i = 0; i < blockCount; i++)
+    {
+        blocks[i].offset = -1;
+        blocks[i].length = 0;
+        blocks[i].lastUse = 0;
+        blocks[i].data = NULL;
+    }
 
     /* Open file */
     file = fs_open(fileName.c_str(), O_RDONLY, 0);
@@ -35,6 +64,11 @@ MetaTaglibFile::MetaTaglibFile(const std::string& openFileName,
 
 MetaTaglibFile::~MetaTaglibFile()
 {
+    /* Free block cache */
+    for(TagLib::uint i = 0; i < blockCount; i++)
+        delete[] blocks[i].data;
+    delete[] blocks;
+
     /* Close file */
     fs_close(file);
 }
@@ -44,20 +78,122 @@ TagLib::FileName MetaTaglibFile::name() const
     return fileName.c_str();
 }
 
+MetaTaglibFile::Block *MetaTaglibFile::getBlock(long offset)
+{
+    Block *block = &blocks[0];
+    ssize_t len;
+
+    /* Get block offset */
+    offset -= offset % blockSize;
+
+    /* Find block in cache or least recently used slot */
+    for(TagLib::uint i = 0; i < blockCount; i++)
+    {
+        if(blocks[i].offset == offset)
+        {
+            blocks[i].lastUse = ++useCounter;
+            return &blocks[i];
+        }
+        if(blocks[i].lastUse < block->lastUse)
+            block = &blocks[i];
+    }
+
+    /* Allocate block data */
+    if(block->data == NULL)
+        block->data = new char[blockSize];
+
+    /* Load block with one large read */
+    block->offset = -1;
+    block->length = 0;
+    if(fs_lseek(file, offset, SEEK_SET) != offset)
+        return NULL;
+    while(block->length < (long) blockSize)
+    {
+        len = fs_read(file, block->data + block->length,
+                      blockSize - block->length);
+        if(len <= 0)
+            break;
+        block->length += len;
+    }
+    if(block->length == 0)
+        return NULL;
+
+    /* Update block */
+    block->offset = offset;
+    block->lastUse = ++useCounter;
+
+    return block;
+}
+
+void MetaTaglibFile::invalidate()
+{
+    for(TagLib::uint i = 0; i < blockCount; i++)
+    {
+        blocks[i].offset = -1;
+        blocks[i].length = 0;
+        blocks[i].lastUse = 0;
+    }
+}
+
 TagLib::ByteVector MetaTaglibFile::readBlock(TagLib::ulong length)
 {
+    TagLib::ulong count = 0;
+    Block *block;
+    long pos, len;
+    ssize_t size;
+
     if(!isOpen() || length == 0)
         return TagLib::ByteVector::null;
 
-    const TagLib::ulong streamLength =
-            static_cast<TagLib::ulong>(MetaTaglibFile::length());
-    if(length > bufferSize() && length > streamLength)
-    length = streamLength;
+    /* Limit read to end of stream */
+    const long streamLength = MetaTaglibFile::length();
+    if(streamLength >= 0)
+    {
+        if(position >= streamLength)
+            return TagLib::ByteVector::null;
+        if(length > static_cast<TagLib::ulong>(streamLength - position))
+            length = streamLength - position;
+    }
 
     TagLib::ByteVector buffer(static_cast<TagLib::uint>(length));
 
-    const size_t count = fs_read(file, buffer.data(), buffer.size());
+    /* Big reads (pictures, audio data) bypass the block cache */
+    if(length >= blockSize)
+    {
+        if(fs_lseek(file, position, SEEK_SET) != position)
+            return TagLib::ByteVector::null;
+        while(count < length)
+        {
+            size = fs_read(file, buffer.data() + count, length - count);
+            if(size <= 0)
+                break;
+            count += size;
+        }
+    }
+    else
+    {
+        /* Copy data from cached blocks */
+        while(count < length)
+        {
+            block = getBlock(position + count);
+            if(block == NULL)
+                break;
+
+            /* Copy available data in block */
+            pos = position + count - block->offset;
+            if(pos >= block->length)
+                break;
+            len = block->length - pos;
+            if(static_cast<TagLib::ulong>(len) > length - count)
+                len = length - count;
+            memcpy(buffer.data() + count, block->data + pos, len);
+            count += len;
+        }
+    }
+
+    /* Update position */
     buffer.resize(static_cast<TagLib::uint>(count));
+    position += count;
 
     return buffer;
 }
@@ -90,26 +226,24 @@ bool MetaTaglibFile::isOpen() const
 
 void MetaTaglibFile::seek(long offset, TagLib::IOStream::Position p)
 {
-    int whence;
-
-    /* Get whence */
+    /* Only update position: file is read by blocks in readBlock() */
     switch(p)
     {
         case Beginning:
-            whence = SEEK_SET;
+            position = offset;
             break;
         case Current:
-            whence = SEEK_CUR;
+            position += offset;
             break;
         case End:
-            whence = SEEK_END;
+            position = length() + offset;
             break;
         default:
             return;
     }
 
-    /* Seek in file */
-    fs_lseek(file, offset, whence);
+    if(position < 0)
+        position = 0;
 }
 
 void MetaTaglibFile::clear()
@@ -120,25 +254,34 @@ void MetaTaglibFile::clear()
 long MetaTaglibFile::tell() const
 {
     /* Get current position */
-    return fs_lseek(file, 0 , SEEK_CUR);
+    return position;
 }
 
 long MetaTaglibFile::length()
 {
     struct stat st;
 
+    /* Length is cached: only one stat on network filesystems */
+    if(fileLength >= 0)
+        return fileLength;
+
     /* Stat file to get its length */
     if(fs_fstat(file, &st) != 0)
         return -1;
 
     /* Get size */
-    return st.st_size;
+    fileLength = st.st_size;
+    return fileLength;
 }
 
 void MetaTaglibFile::truncate(long length)
 {
     /* Truncate file */
     fs_ftruncate(file, length);
+
+    /* Drop cache and length */
+    invalidate();
+    fileLength = -1;
 }
 
 TagLib::uint MetaTaglibFile::bufferSize()
@@ -29,14 +29,29 @@ extern "C" {
 	#include "fs.h"
 }
 
+/* Default block size for local files and network files (URL) */
+#define META_TAGLIB_BLOCK_SIZE 16384
+#define META_TAGLIB_NET_BLOCK_SIZE 65536
+
+/* Default count of blocks kept in cache */
+#define META_TAGLIB_BLOCK_COUNT 4
+
 class MetaTaglibFile : public TagLib::IOStream
 {
   public:
     /*!
      * Construct a File object and opens the \a file.  \a file should be a
      * be a C-string in the local file system encoding.
+     *
+     * Reads are done by blocks of \a blockSize bytes and the last
+     * \a blockCount blocks are kept in memory (LRU), so the many small
+     * seek/read done by TagLib result in a few large reads, which is useful
+     * on network filesystems. If \a blockSize is 0, a default size is chosen
+     * from the file URL.
      */
-    MetaTaglibFile(const std::string& openFileName, bool openReadOnly = true);
+    MetaTaglibFile(const std::string& openFileName, bool openReadOnly = true,
+                   TagLib::uint blockSize = 0,
+                   TagLib::uint blockCount = META_TAGLIB_BLOCK_COUNT);
 
     /*!
      * Destroys this FileStream instance.
@@ -129,9 +144,35 @@ class MetaTaglibFile : public TagLib::IOStream
     static TagLib::uint bufferSize();
 
   private:
+    struct Block {
+        long offset;
+        long length;
+        unsigned long lastUse;
+        char *data;
+    };
+
+    /*!
+     * Returns the cached block containing \a offset, loading it in the least
+     * recently used slot if needed, or NULL on error / end of file.
+     */
+    Block *getBlock(long offset);
+
+    /*!
+     * Drop all cached blocks.
+     */
+    void invalidate();
+
     struct fs_file *file;
     std::string fileName;
     bool isReadOnly;
+    /* Block cache */
+    Block *blocks;
+    TagLib::uint blockSize;
+    TagLib::uint blockCount;
+    unsigned long useCounter;
+    /* Virtual position and cached length */
+    long position;
+    long fileLength;
 };
 
 #endif
@@ -31,6 +31,9 @@
 
 #define FREE_STRING(s) if(s != NULL) free(s);
 
+/* Delay before a new refresh when a module can't be closed yet (in ms) */
+#define MODULES_REFRESH_RETRY 100
+
 struct module_list {
 	/* Module properties */
 	char *id;
@@ -55,12 +58,16 @@ struct modules_handle {
 	int module_count;
 	struct module_list *list;
 	struct json *configs;
+	/* Event loop used by modules */
+	struct loop_handle *loop;
+	/* Loop timer armed to refresh modules */
+	struct loop_timer *refresh;
 	/* Thread safe */
 	pthread_mutex_t mutex;
 };
 
-int modules_open(struct modules_handle **handle, struct json *config,
-		 const char *path, const char *mod_path)
+int modules_open(struct modules_handle **handle, struct loop_handle *loop,
+		 struct json *config, const char *path, const char *mod_path)
 {
 	struct modules_handle *h;
 	struct module_list *l;
@@ -84,6 +91,8 @@ int modules_open(struct modules_handle **handle, struct json *config,
 	h->list = NULL;
 	h->module_count = 0;
 	h->configs = NULL;
+	h->loop = loop;
+	h->refresh = NULL;
 
 	/* Open directory */
 	dir = opendir(path);
@@ -156,12 +165,39 @@ int modules_open(struct modules_handle **handle, struct json *config,
 	return 0;
 }
 
+static void modules_request_refresh(struct modules_handle *h,
+				    long timeout)
+{
+	/* Arm refresh timer: it must not be armed with modules access locked
+	 * since its callback locks loop before modules access.
+	 */
+	loop_lock(h->loop);
+	if(h->refresh != NULL)
+		loop_set_timer(h->refresh, timeout, 0);
+	loop_unlock(h->loop);
+}
+
+void modules_set_refresh(struct modules_handle *h, struct loop_timer *refresh)
+{
+	if(h == NULL)
+		return;
+
+	loop_lock(h->loop);
+	h->refresh = refresh;
+	loop_unlock(h->loop);
+}
+
 int modules_set_config(struct modules_handle *h, struct json *cfg,
 		       const char *name)
 {
 	struct module_list *l;
 	struct json *c;
 
+	/* Lock event loop before modules access: modules driven by loop lock it
+	 * in their set_config() and close().
+	 */
+	loop_lock(h->loop);
+
 	/* Lock modules access */
 	pthread_mutex_lock(&h->mutex);
 
@@ -199,6 +235,11 @@ int modules_set_config(struct modules_handle *h, struct json *cfg,
 
 	/* Unlock modules access */
 	pthread_mutex_unlock(&h->mutex);
+	loop_unlock(h->loop);
+
+	/* Open or close modules */
+	if(cfg != NULL)
+		modules_request_refresh(h, 0);
 
 	return 0;
 }
@@ -304,12 +345,14 @@ void modules_refresh(struct modules_handle *h, struct httpd_handle *httpd,
 	struct module_attr attr;
 	struct module_list *l;
 	struct json *cfg;
+	int retry = 0;
 	int ret;
 
 	if(h == NULL)
 		return;
 
-	/* Lock modules access */
+	/* Lock event loop and modules access */
+	loop_lock(h->loop);
 	pthread_mutex_lock(&h->mutex);
 
 	for(l = h->list; l != NULL; l = l->next)
@@ -323,6 +366,7 @@ void modules_refresh(struct modules_handle *h, struct httpd_handle *httpd,
 				 * next refresh call.
 				 * Keeps the module in disabling status.
 				 */
+				retry = 1;
 				continue;
 			}
 
@@ -333,6 +377,10 @@ void modules_refresh(struct modules_handle *h, struct httpd_handle *httpd,
 				json_add(h->configs, l->id, cfg);
 			}
 
+			/* Close timer: no more event is called on module */
+			if(l->timer != NULL)
+				timer_close(l->timer);
+
 			/*Close the module */
 			if(l->mod->close != NULL && l->handle != NULL)
 				l->mod->close(l->handle);
@@ -342,10 +390,6 @@ void modules_refresh(struct modules_handle *h, struct httpd_handle *httpd,
 			if(l->db != NULL)
 				db_close(l->db);
 
-			/* Close timer */
-			if(l->timer != NULL)
-				timer_close(l->timer);
-
 			/* Close event */
 			if(l->event != NULL)
 				event_close(l->event);
@@ -380,6 +424,7 @@ void modules_refresh(struct modules_handle *h, struct httpd_handle *httpd,
 			attr.event = l->event;
 			attr.timer = l->timer;
 			attr.avahi = avahi;
+			attr.loop = h->loop;
 			attr.db = l->db;
 
 			/* Get module configuration from file */
@@ -413,6 +458,13 @@ void modules_refresh(struct modules_handle *h, struct httpd_handle *httpd,
 	/* Unlock modules access */
 	pthread_mutex_unlock(&h->mutex);
 
+	/* Some modules are still opened: refresh later */
+	if(retry)
+		modules_request_refresh(h, MODULES_REFRESH_RETRY);
+
+	/* Unlock event loop */
+	loop_unlock(h->loop);
+
 }
 
 void modules_close(struct modules_handle *h)
@@ -482,6 +534,9 @@ static int modules_httpd_enable(void *user_data, struct httpd_req *req,
 			/* Unlock modules access */
 			pthread_mutex_unlock(&h->mutex);
 
+			/* Open or close module */
+			modules_request_refresh(h, 0);
+
 			return 200;
 		}
 	}
@@ -515,6 +570,9 @@ static int modules_httpd_disable(void *user_data, struct httpd_req *req,
 			/* Unlock modules access */
 			pthread_mutex_unlock(&h->mutex);
 
+			/* Open or close module */
+			modules_request_refresh(h, 0);
+
 			return 200;
 		}
 	}
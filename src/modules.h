@@ -23,13 +23,14 @@
 #include "events.h"
 #include "timers.h"
 #include "module.h"
+#include "loop.h"
 
 struct modules_handle;
 extern struct url_table modules_urls[];
 
 /* Basic functions */
-int modules_open(struct modules_handle **handle, struct json *config,
-		 const char *path, const char *mod_path);
+int modules_open(struct modules_handle **handle, struct loop_handle *loop,
+		 struct json *config, const char *path, const char *mod_path);
 void modules_close(struct modules_handle *h);
 
 /* Modules config */
@@ -41,6 +42,11 @@ struct json *modules_get_config(struct modules_handle *h, const char *name);
 char **modules_list_modules(struct modules_handle *h, int *count);
 void modules_free_list(char **list, int count);
 
+/* Set loop timer armed when modules must be opened or closed: its callback
+ * must call modules_refresh().
+ */
+void modules_set_refresh(struct modules_handle *h, struct loop_timer *refresh);
+
 /* Open or close modules with enabled flag */
 void modules_refresh(struct modules_handle *h, struct httpd_handle *httpd, 
 		     struct avahi_handle *avahi, struct outputs_handle *outputs,
@@ -0,0 +1,225 @@
+/*
+ * mpeg_sync.c - MPEG audio (MP3) and ADTS (AAC) frame synchronization
+ *
+ * Copyright (c) 2014   A. Dilly
+ *
+ * AirCat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * AirCat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpeg_sync.h"
+
+static const unsigned short mp3_bitrates[2][3][16] = {
+	{ /* MPEG-1 */
+		{0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384,
+		 416, 448, 0},
+		{0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320,
+		 384, 0},
+		{0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256,
+		 320, 0}
+	},
+	{ /* MPEG-2 LSF, MPEG-2.5 */
+		{0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224,
+		 256, 0},
+		{0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160,
+		 0},
+		{0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160,
+		 0}
+	}
+};
+
+static const unsigned int mp3_samplerates[3][4] = {
+	{44100, 48000, 32000, 0},
+	{22050, 24000, 16000, 0},
+	{11025, 12000, 8000, 0}
+};
+
+static const unsigned short mp3_samples[2][3] = {
+	{384, 1152, 1152},
+	{384, 1152, 576}
+};
+
+/**
+ * MPEG version from the 2 version bits of header: 0: MPEG 1, 1: MPEG 2,
+ * 2: MPEG 2.5 and -1 for reserved value.
+ */
+static const signed char mp3_versions[4] = {2, -1, 1, 0};
+
+static const unsigned int adts_samplerates[16] = {
+	96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000,
+	11025, 8000, 7350, 0, 0, 0
+};
+
+int mpeg_sync_parse_mp3(const unsigned char *buffer, size_t len,
+			struct mpeg_frame *f)
+{
+	int mpeg, layer, br, sr, mp;
+
+	if(len < MP3_HEADER_SIZE)
+		return -1;
+
+	/* Check syncword */
+	if(buffer[0] != 0xFF || (buffer[1] & 0xE0) != 0xE0)
+		return -1;
+
+	/* Get MPEG version and layer */
+	mpeg = mp3_versions[(buffer[1] >> 3) & 0x03];
+	layer = 3 - ((buffer[1] >> 1) & 0x03);
+	if(mpeg < 0 || layer == 3)
+		return -1;
+	mp = mpeg > 0 ? 1 : 0;
+
+	/* Get bitrate and samplerate */
+	br = mp3_bitrates[mp][layer][(buffer[2] >> 4) & 0x0F];
+	sr = mp3_samplerates[mpeg][(buffer[2] >> 2) & 0x03];
+	if(br == 0 || sr == 0)
+		return -1;
+
+	/* Fill frame properties */
+	f->mpeg = mpeg;
+	f->layer = layer;
+	f->bitrate = br;
+	f->samplerate = sr;
+	f->padding = (buffer[2] >> 1) & 0x01;
+	f->channels = ((buffer[3] >> 6) & 0x03) == 0x03 ? 1 : 2;
+	f->samples = mp3_samples[mp][layer];
+
+	/* Calculate frame length */
+	if(layer == 0)
+	{
+		/* Layer I */
+		f->length = ((12 * br * 1000 / sr) + f->padding) * 4;
+	}
+	else if(mpeg > 0 && layer == 2)
+	{
+		/* MPEG 2 and 2.5 in layer III */
+		f->length = (72 * br * 1000 / sr) + f->padding;
+	}
+	else
+	{
+		/* Layer II or III */
+		f->length = (144 * br * 1000 / sr) + f->padding;
+	}
+
+	return 0;
+}
+
+int mpeg_sync_parse_adts(const unsigned char *buffer, size_t len,
+			 struct mpeg_frame *f)
+{
+	unsigned int length;
+	unsigned int sr;
+
+	if(len < ADTS_HEADER_SIZE)
+		return -1;
+
+	/* Check syncword and layer */
+	if(buffer[0] != 0xFF || (buffer[1] & 0xF6) != 0xF0)
+		return -1;
+
+	/* Get samplerate */
+	sr = adts_samplerates[(buffer[2] >> 2) & 0x0F];
+	if(sr == 0)
+		return -1;
+
+	/* Get frame length: header is 9 bytes long with CRC */
+	length = ((buffer[3] & 0x03) << 11) | (buffer[4] << 3) |
+		 (buffer[5] >> 5);
+	if(length < ((buffer[1] & 0x01) ? 7 : 9))
+		return -1;
+
+	/* Fill frame properties */
+	f->mpeg = (buffer[1] >> 3) & 0x01;
+	f->layer = buffer[2] >> 6;
+	f->bitrate = 0;
+	f->samplerate = sr;
+	f->padding = 0;
+	f->channels = ((buffer[2] & 0x01) << 2) | (buffer[3] >> 6);
+	f->samples = ((buffer[6] & 0x03) + 1) * 1024;
+	f->length = length;
+
+	return 0;
+}
+
+static inline int mpeg_sync_is_same(const struct mpeg_frame *a,
+				    const struct mpeg_frame *b)
+{
+	/* Bitrate and padding can change between two frames */
+	return a->mpeg == b->mpeg && a->layer == b->layer &&
+	       a->samplerate == b->samplerate;
+}
+
+ssize_t mpeg_sync_find(const unsigned char *buffer, size_t len,
+		       enum mpeg_sync_type type, int count,
+		       struct mpeg_frame *f)
+{
+	int (*parse)(const unsigned char *, size_t, struct mpeg_frame *);
+	struct mpeg_frame first, frame;
+	const unsigned char *p;
+	size_t header_size;
+	size_t pos, next;
+	int n;
+
+	/* Select frame parser */
+	if(type == MPEG_SYNC_ADTS)
+	{
+		parse = mpeg_sync_parse_adts;
+		header_size = ADTS_HEADER_SIZE;
+	}
+	else
+	{
+		parse = mpeg_sync_parse_mp3;
+		header_size = MP3_HEADER_SIZE;
+	}
+
+	/* Find candidates on first byte of syncword */
+	for(pos = 0; pos + header_size <= len; pos++)
+	{
+		p = memchr(buffer + pos, 0xFF, len - header_size - pos + 1);
+		if(p == NULL)
+			break;
+		pos = p - buffer;
+
+		/* Check frame header */
+		if(parse(p, len - pos, &first) != 0)
+			continue;
+
+		/* Check next frames */
+		next = pos + first.length;
+		for(n = 1; n < count; n++)
+		{
+			/* End of buffer reached */
+			if(next + header_size > len)
+				break;
+
+			/* Not the same stream */
+			if(parse(buffer + next, len - next, &frame) != 0 ||
+			   !mpeg_sync_is_same(&first, &frame))
+				break;
+			next += frame.length;
+		}
+
+		/* Enough frames or at least one more before end of buffer */
+		if(n >= count || (n > 1 && next + header_size > len))
+		{
+			if(f != NULL)
+				memcpy(f, &first, sizeof(struct mpeg_frame));
+			return pos;
+		}
+	}
+
+	return -1;
+}
+
@@ -16,17 +16,27 @@
  * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <math.h>
+#include <time.h>
 
 #include <asoundlib.h>
 
 #include "output_alsa.h"
 #include "output.h"
 
+#include "abuffer.h"
+#include "sample.h"
 #include "resample.h"
+#include "limiter.h"
 #include "cache.h"
 
 #ifdef HAVE_CONFIG_H
@@ -41,15 +51,19 @@
 /* Maximum time before stopping PCM output (default: 5s) */
 #define MAX_SILENCE 5
 
-#ifdef USE_FLOAT
- 	#define ALSA_FORMAT SND_PCM_FORMAT_FLOAT
-#else
-	#define ALSA_FORMAT SND_PCM_FORMAT_S32
-#endif
+/* ALSA formats for sample formats */
+static const snd_pcm_format_t output_alsa_formats[] = {
+	[SAMPLE_S16] = SND_PCM_FORMAT_S16,
+	[SAMPLE_S32] = SND_PCM_FORMAT_S32,
+	[SAMPLE_FLOAT] = SND_PCM_FORMAT_FLOAT,
+};
 
 struct output_stream {
 	/* Resample object */
 	struct resample_handle *res;
+	/* Input is read with buffer descriptors */
+	int get;
+	int use_cache_thread;
 	/* Format */
 	unsigned long samplerate;
 	unsigned char channels;
@@ -60,6 +74,9 @@ struct output_stream {
 	int abort;
 	/* Stream volume */
 	unsigned int volume;
+	/* Volume ramp: final volume and remaining samples */
+	unsigned int fade_volume;
+	uint64_t fade_len;
 	/* Stream cache */
 	struct cache_handle *cache;
 	unsigned long delay;
@@ -72,13 +89,33 @@ struct output_stream {
 };
 
 struct output {
-	/* ALSA output */
+	/* ALSA output and its device name */
 	snd_pcm_t *alsa;
+	char *device;
 	/* Format */
 	unsigned long samplerate;
 	unsigned char channels;
+	enum sample_format format;
+	/* Kernels of pipeline sample format */
+	const struct sample_ops *ops;
 	/* General volume */
 	unsigned int volume;
+	/* Hardware mixer element for general volume */
+	snd_mixer_t *mixer;
+	snd_mixer_elem_t *mixer_elem;
+	int mixer_db;
+	long mixer_min;
+	long mixer_max;
+	/* Soft limiter on mixed streams */
+	struct limiter_handle *limiter;
+	/* Dither on conversion to 16-bit output */
+	int dither;
+	struct sample_dither dither_state;
+	/* Tap on mixed samples */
+	output_tap_cb tap;
+	void *tap_data;
+	/* Delay of PCM measured before mixing (in us) */
+	unsigned long delay;
 	/* Thread objects */
 	pthread_t thread;
 	pthread_mutex_t mutex;
@@ -87,11 +124,17 @@ struct output {
 	struct output_stream *streams;
 };
 
+/* Count of opened outputs: ALSA global configuration is shared by all */
+static int output_alsa_count = 0;
+
 static void *output_alsa_thread(void *user_data);
+int output_alsa_set_volume(struct output *h, unsigned int volume);
 
 int output_alsa_open(struct output **handle, unsigned long samplerate,
-		     unsigned char channels, unsigned int latency)
+		     unsigned char channels, unsigned int latency,
+		     enum sample_format format, const char *device, int cpu)
 {
+	cpu_set_t cpus;
 	struct output *h;
 	int ret;
 
@@ -108,10 +151,22 @@ int output_alsa_open(struct output **handle, unsigned long samplerate,
 	/* Copy input and output format */
 	h->samplerate = samplerate;
 	h->channels = channels;
+	h->format = format;
+	h->ops = sample_get_pipeline();
 	h->volume = OUTPUT_VOLUME_MAX;
+	h->mixer = NULL;
+	h->mixer_elem = NULL;
+	h->limiter = NULL;
+	h->dither = 0;
+	memset(&h->dither_state, 0, sizeof(struct sample_dither));
+	h->tap = NULL;
+	h->tap_data = NULL;
+	h->delay = 0;
+	h->device = strdup(device != NULL ? device : "default");
+	__atomic_add_fetch(&output_alsa_count, 1, __ATOMIC_RELAXED);
 
 	/* Open alsa device */
-	if(snd_pcm_open(&h->alsa, "default", SND_PCM_STREAM_PLAYBACK, 0) < 0)
+	if(snd_pcm_open(&h->alsa, h->device, SND_PCM_STREAM_PLAYBACK, 0) < 0)
 		return -1;
 
 	/* Set latency to default */
@@ -119,7 +174,7 @@ int output_alsa_open(struct output **handle, unsigned long samplerate,
 		latency = MIN_LATENCY;
 
 	/* Set parameters for output */
-	ret = snd_pcm_set_params(h->alsa, ALSA_FORMAT,
+	ret = snd_pcm_set_params(h->alsa, output_alsa_formats[h->format],
 				 SND_PCM_ACCESS_RW_INTERLEAVED, h->channels,
 				 h->samplerate, 1, latency*1000);
 	if(ret < 0)
@@ -132,15 +187,171 @@ int output_alsa_open(struct output **handle, unsigned long samplerate,
 	if(pthread_create(&h->thread, NULL, output_alsa_thread, h) != 0)
 		return -1;
 
+	/* Pin mixer thread on a CPU core */
+	if(cpu >= 0)
+	{
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		if(pthread_setaffinity_np(h->thread, sizeof(cpu_set_t),
+					  &cpus) != 0)
+			fprintf(stderr, "Failed to pin ALSA thread on CPU %d\n",
+				cpu);
+	}
+
 	return 0;
 }
 
+static void output_alsa_close_mixer(struct output *h)
+{
+	if(h->mixer != NULL)
+		snd_mixer_close(h->mixer);
+	h->mixer = NULL;
+	h->mixer_elem = NULL;
+}
+
+int output_alsa_set_mixer(struct output *h, const char *control)
+{
+	snd_mixer_selem_id_t *sid;
+	char ctl[32];
+	char *p;
+
+	/* Close previous mixer */
+	output_alsa_close_mixer(h);
+	if(control == NULL || *control == '\0')
+		return -1;
+
+	/* Get control device of card: "hw:X" for "hw:X,Y" or "plughw:X,Y" */
+	p = strchr(h->device, ':');
+	if(p != NULL && strncmp(h->device, "default", 7) != 0)
+		snprintf(ctl, sizeof(ctl), "hw:%.*s", (int) strcspn(p + 1, ","),
+			 p + 1);
+	else
+		snprintf(ctl, sizeof(ctl), "%s", h->device);
+
+	/* Open mixer of device */
+	if(snd_mixer_open(&h->mixer, 0) < 0)
+	{
+		h->mixer = NULL;
+		return -1;
+	}
+	if(snd_mixer_attach(h->mixer, ctl) < 0 ||
+	   snd_mixer_selem_register(h->mixer, NULL, NULL) < 0 ||
+	   snd_mixer_load(h->mixer) < 0)
+		goto error;
+
+	/* Find mixer element */
+	snd_mixer_selem_id_alloca(&sid);
+	snd_mixer_selem_id_set_index(sid, 0);
+	snd_mixer_selem_id_set_name(sid, control);
+	h->mixer_elem = snd_mixer_find_selem(h->mixer, sid);
+	if(h->mixer_elem == NULL ||
+	   !snd_mixer_selem_has_playback_volume(h->mixer_elem))
+		goto error;
+
+	/* Get range in dB (or raw range if not available) */
+	h->mixer_db = snd_mixer_selem_get_playback_dB_range(h->mixer_elem,
+							    &h->mixer_min,
+							    &h->mixer_max) == 0 &&
+		      h->mixer_min < h->mixer_max;
+	if(!h->mixer_db &&
+	   snd_mixer_selem_get_playback_volume_range(h->mixer_elem,
+						     &h->mixer_min,
+						     &h->mixer_max) < 0)
+		goto error;
+
+	/* Apply current volume */
+	output_alsa_set_volume(h, h->volume);
+
+	return 0;
+
+error:
+	output_alsa_close_mixer(h);
+	return -1;
+}
+
 int output_alsa_set_volume(struct output *h, unsigned int volume)
 {
+	long value;
+	double db;
+
 	pthread_mutex_lock(&h->mutex);
 	h->volume = volume;
 	pthread_mutex_unlock(&h->mutex);
 
+	if(h->mixer_elem == NULL)
+		return 0;
+
+	/* Set hardware volume */
+	if(h->mixer_db)
+	{
+		/* Map volume to dB (in 0.01 dB) under maximum of element */
+		db = volume > 0 ? 2000.0 * log10((double) volume /
+						 OUTPUT_VOLUME_MAX) : -1e9;
+		value = h->mixer_max + (long) db;
+		if(value < h->mixer_min)
+			value = h->mixer_min;
+		snd_mixer_selem_set_playback_dB_all(h->mixer_elem, value, -1);
+	}
+	else
+	{
+		value = h->mixer_min + (h->mixer_max - h->mixer_min) *
+			(int64_t) volume / OUTPUT_VOLUME_MAX;
+		snd_mixer_selem_set_playback_volume_all(h->mixer_elem, value);
+	}
+
+	/* Mute when volume is 0 */
+	if(snd_mixer_selem_has_playback_switch(h->mixer_elem))
+		snd_mixer_selem_set_playback_switch_all(h->mixer_elem,
+							volume > 0);
+
+	return 0;
+}
+
+int output_alsa_set_limiter(struct output *h, int enable, double threshold)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&h->mutex);
+
+	if(!enable)
+	{
+		/* Disable limiter */
+		limiter_close(h->limiter);
+		h->limiter = NULL;
+	}
+	else if(h->limiter != NULL)
+	{
+		/* Update threshold */
+		limiter_set_threshold(h->limiter, threshold);
+	}
+	else if(limiter_open(&h->limiter, h->samplerate, h->channels,
+			     threshold) != 0)
+	{
+		h->limiter = NULL;
+		ret = -1;
+	}
+
+	pthread_mutex_unlock(&h->mutex);
+
+	return ret;
+}
+
+int output_alsa_set_dither(struct output *h, int enable)
+{
+	pthread_mutex_lock(&h->mutex);
+	h->dither = enable;
+	pthread_mutex_unlock(&h->mutex);
+
+	return 0;
+}
+
+int output_alsa_set_tap(struct output *h, output_tap_cb cb, void *user_data)
+{
+	pthread_mutex_lock(&h->mutex);
+	h->tap = cb;
+	h->tap_data = user_data;
+	pthread_mutex_unlock(&h->mutex);
+
 	return 0;
 }
 
@@ -155,13 +366,14 @@ unsigned int output_alsa_get_volume(struct output *h)
 	return volume;
 }
 
-struct output_stream *output_alsa_add_stream(struct output *h,
-					     unsigned long samplerate,
-					     unsigned char channels,
-					     unsigned long cache,
-					     int use_cache_thread,
-					     a_read_cb input_callback,
-					     void *user_data)
+static struct output_stream *output_alsa_new_stream(struct output *h,
+						   unsigned long samplerate,
+						   unsigned char channels,
+						   unsigned long cache,
+						   int use_cache_thread,
+						   a_read_cb input_callback,
+						   a_get_cb get_callback,
+						   void *user_data)
 {
 	struct output_stream *s;
 	a_write_cb out = NULL;
@@ -175,17 +387,31 @@ struct output_stream *output_alsa_add_stream(struct output *h,
 	s->samplerate = samplerate;
 	s->channels = channels;
 	s->res = NULL;
+	s->get = get_callback != NULL;
+	s->use_cache_thread = use_cache_thread;
 	s->is_playing = 0;
 	s->end_of_stream = 0;
 	s->played = 0;
 	s->abort = 0;
 	s->volume = OUTPUT_VOLUME_MAX;
+	s->fade_volume = OUTPUT_VOLUME_MAX;
+	s->fade_len = 0;
 	s->cache = NULL;
 	s->delay = cache;
 	s->event_cb = NULL;
 	s->event_ud = NULL;
 	s->buffering = 0;
 
+	/* Open resample/mixer filter with buffer descriptors */
+	if(get_callback != NULL)
+	{
+		if(resample_open_get(&s->res, samplerate, channels,
+				     h->samplerate, h->channels, get_callback,
+				     user_data) != 0)
+			goto error;
+		goto cache;
+	}
+
 	/* Add cache for write() */
 	if(input_callback == NULL)
 	{
@@ -202,8 +428,9 @@ struct output_stream *output_alsa_add_stream(struct output *h,
 			 h->channels, input_callback, out, user_data) != 0)
 		goto error;
 
+cache:
 	/* Add cache for read() */
-	if(input_callback != NULL)
+	if(input_callback != NULL || get_callback != NULL)
 	{
 		/* Open a new cache */
 		if(cache_open(&s->cache, cache, h->samplerate, h->channels,
@@ -223,6 +450,32 @@ error:
 	return NULL;
 }
 
+struct output_stream *output_alsa_add_stream(struct output *h,
+					     unsigned long samplerate,
+					     unsigned char channels,
+					     unsigned long cache,
+					     int use_cache_thread,
+					     a_read_cb input_callback,
+					     void *user_data)
+{
+	return output_alsa_new_stream(h, samplerate, channels, cache,
+				      use_cache_thread, input_callback, NULL,
+				      user_data);
+}
+
+struct output_stream *output_alsa_add_stream_get(struct output *h,
+						 unsigned long samplerate,
+						 unsigned char channels,
+						 unsigned long cache,
+						 int use_cache_thread,
+						 a_get_cb get_callback,
+						 void *user_data)
+{
+	return output_alsa_new_stream(h, samplerate, channels, cache,
+				      use_cache_thread, NULL, get_callback,
+				      user_data);
+}
+
 int output_alsa_play_stream(struct output *h, struct output_stream *s)
 {
 	pthread_mutex_lock(&h->mutex);
@@ -288,6 +541,23 @@ int output_alsa_set_volume_stream(struct output *h, struct output_stream *s,
 {
 	pthread_mutex_lock(&h->mutex);
 	s->volume = volume;
+	s->fade_len = 0;
+	pthread_mutex_unlock(&h->mutex);
+
+	return 0;
+}
+
+int output_alsa_fade_stream(struct output *h, struct output_stream *s,
+			    unsigned int volume, unsigned long duration)
+{
+	pthread_mutex_lock(&h->mutex);
+
+	/* Set volume ramp: applied on each block in mixer */
+	s->fade_volume = volume;
+	s->fade_len = (uint64_t) duration * h->samplerate * h->channels / 1000;
+	if(s->fade_len == 0)
+		s->volume = volume;
+
 	pthread_mutex_unlock(&h->mutex);
 
 	return 0;
@@ -359,6 +629,13 @@ unsigned long output_alsa_get_status_stream(struct output *h,
 		case OUTPUT_STREAM_CACHE_DELAY:
 			ret = cache_delay(s->cache);
 			break;
+		case OUTPUT_STREAM_LATENCY:
+			/* PCM delay when mixing starts, cache and resampler */
+			ret = __atomic_load_n(&h->delay, __ATOMIC_RELAXED);
+			if(s->cache != NULL)
+				ret += cache_delay(s->cache) * 1000;
+			ret += resample_delay(s->res) * 1000;
+			break;
 		default:
 			ret = 0;
 	}
@@ -471,74 +748,19 @@ int output_alsa_remove_stream(struct output *h, struct output_stream *s)
 	return 0;
 }
 
-#ifdef USE_FLOAT
-static inline float output_alsa_vol(float x, unsigned int v)
-{
-	return x * (v * 1.0 / OUTPUT_VOLUME_MAX);
-}
-
-static inline float output_alsa_add(float a, float b)
-{
-	float sum;
-
-	sum = a + b;
-
-	if(sum > 1.0)
-		sum = 1.0;
-	else if(sum < -1.0)
-		sum = -1.0;
-
-	return sum;
-}
-#else
-static inline int32_t output_alsa_vol(int32_t x, unsigned int v)
-{
-	int64_t value;
-
-	value = ((int64_t)x * v) / OUTPUT_VOLUME_MAX;
-
-	return (int32_t) value;
-}
-
-static inline int32_t output_alsa_add(int32_t a, int32_t b)
-{
-	int64_t sum;
-
-	sum = (int64_t)a + (int64_t)b;
-
-	/* Introduce some distorsion */
-	/*if(a > 0 && b > 0)
-		sum -= (int64_t)a * (int64_t)b / 0x7FFFFFFFLL;
-	else if(a < 0 && b < 0)
-		sum -= (int64_t)a * (int64_t)b / -0x80000000LL;*/
-
-	if(sum > 0x7FFFFFFFLL)
-		sum = 0x7FFFFFFFLL;
-	else if(sum < -0x80000000LL)
-		sum = -0x80000000LL;
-
-	return (int32_t) sum;
-}
-#endif
-
 static int output_alsa_mix_streams(struct output *h, unsigned char *in_buffer,
-				   unsigned char *out_buffer, size_t len)
+				   unsigned char *out_buffer, size_t len,
+				   unsigned char **out, struct abuffer **out_buf)
 {
 	struct output_stream *s;
 	struct a_format fmt = A_FORMAT_INIT;
-#ifdef USE_FLOAT
-	float *p_in = (float*) in_buffer;
-	float *p_out = (float*) out_buffer;
-	float sample;
-#else
-	int32_t *p_in = (int32_t*) in_buffer;
-	int32_t *p_out = (int32_t*) out_buffer;
-	int32_t sample;
-#endif
+	struct abuffer *b, *direct_buf = NULL;
+	unsigned char *direct = NULL;
+	unsigned char *p_in;
+	unsigned int volume;
 	int out_size = 0;
 	int first = 1;
 	int in_size;
-	int i;
 
 	pthread_mutex_lock(&h->mutex);
 	for(s = h->streams; s != NULL; s = s->next)
@@ -546,8 +768,24 @@ static int output_alsa_mix_streams(struct output *h, unsigned char *in_buffer,
 		if(!s->is_playing || s->end_of_stream)
 			continue;
 
-		/* Get input data */
-		in_size = cache_read(s->cache, in_buffer, len, &fmt);
+		/* Samples of previous stream are still in input buffer */
+		if(direct == in_buffer)
+		{
+			memcpy(out_buffer, in_buffer, out_size * 4);
+			abuffer_count_copy(out_size);
+			direct = NULL;
+		}
+
+		/* Get input data: without cache, samples are mixed directly from
+		 * buffer descriptor returned by input.
+		 */
+		b = NULL;
+		if(s->get && s->delay == 0 && !s->use_cache_thread &&
+		   cache_delay(s->cache) == 0)
+			in_size = resample_get(s->res, &b, len);
+		else
+			in_size = cache_read(s->cache, in_buffer, len, &fmt);
+		p_in = b != NULL ? b->data : in_buffer;
 		if(in_size <= 0)
 		{
 			if(in_size < 0)
@@ -595,40 +833,119 @@ static int output_alsa_mix_streams(struct output *h, unsigned char *in_buffer,
 		/* Update played value (in ms) */
 		s->played += in_size;
 
+		/* Update volume ramp: same gain is used for whole block */
+		if(s->fade_len > in_size)
+		{
+			s->volume += ((int64_t) s->fade_volume - s->volume) *
+				     in_size / (int64_t) s->fade_len;
+			s->fade_len -= in_size;
+		}
+		else if(s->fade_len > 0)
+		{
+			s->volume = s->fade_volume;
+			s->fade_len = 0;
+		}
+
+		/* Keep headroom for limiter */
+		volume = s->volume;
+		if(h->limiter != NULL)
+			volume /= LIMITER_HEADROOM;
+
 		/* Add it to output buffer */
 		if(first)
 		{
 			first = 0;
-			for(i = 0; i < in_size; i++)
+
+			/* Unity gain: samples are used directly for output.
+			 * When enabled, limiter is never bypassed since its
+			 * delay line would add or drop samples on each switch.
+			 */
+			if(volume == OUTPUT_VOLUME_MAX && h->limiter == NULL)
 			{
-				sample = output_alsa_vol(p_in[i], s->volume);
-				p_out[i] = sample;
+				direct = p_in;
+				direct_buf = abuffer_ref(b);
 			}
+			else
+				h->ops->gain(out_buffer, p_in, in_size, volume);
 		}
 		else
 		{
-			/* Add it to output buffer */
-			for(i = 0; i < in_size; i++)
+			/* Copy samples of first stream */
+			if(direct != NULL)
 			{
-				sample = output_alsa_vol(p_in[i], s->volume);
-				p_out[i] = output_alsa_add(p_out[i], sample);
+				memcpy(out_buffer, direct, out_size * 4);
+				abuffer_count_copy(out_size);
+				abuffer_unref(direct_buf);
+				direct_buf = NULL;
+				direct = NULL;
 			}
+
+			/* Add it to output buffer */
+			h->ops->mix(out_buffer, p_in, in_size, volume);
 		}
 
 		/* Update out_size */
 		if(out_size < in_size);
 			out_size = in_size;
+
+		/* Release input buffer */
+		abuffer_unref(b);
 	}
+
+	/* Limit output samples */
+	if(h->limiter != NULL && out_size > 0)
+		limiter_process(h->limiter, out_buffer, out_size / h->channels);
 	pthread_mutex_unlock(&h->mutex);
 
+	/* Return output samples */
+	*out = direct != NULL ? direct : out_buffer;
+	*out_buf = direct_buf;
+
 	return out_size;
 }
 
+static unsigned long output_alsa_get_delay(struct output *h)
+{
+	snd_pcm_sframes_t frames;
+
+	/* Get frames queued in PCM before next written frame */
+	if(snd_pcm_delay(h->alsa, &frames) < 0 || frames < 0)
+		return 0;
+
+	return (uint64_t) frames * 1000000 / h->samplerate;
+}
+
+static void output_alsa_tap(struct output *h, const unsigned char *buffer,
+			    size_t frames)
+{
+	struct a_format fmt;
+	struct timespec now;
+	uint64_t time;
+
+	pthread_mutex_lock(&h->mutex);
+
+	if(h->tap != NULL)
+	{
+		/* Get time at which first frame will be played */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		time = (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000 +
+		       output_alsa_get_delay(h);
+
+		/* Pass mixed frames to tap */
+		fmt.samplerate = h->samplerate;
+		fmt.channels = h->channels;
+		h->tap(h->tap_data, buffer, frames, &fmt, time);
+	}
+
+	pthread_mutex_unlock(&h->mutex);
+}
+
 static void *output_alsa_thread(void *user_data)
 {
 	struct output *h = (struct output *) user_data;
 	snd_pcm_sframes_t frames;
-	unsigned char *in_buffer, *out_buffer;
+	unsigned char *in_buffer, *out_buffer, *out;
+	struct abuffer *out_buf;
 	int in_size = BUFFER_SIZE;
 	int out_size = 0;
 	time_t start = 0;
@@ -648,8 +965,13 @@ static void *output_alsa_thread(void *user_data)
 	/* Wait end signal */
 	while(!h->stop)
 	{
+		/* Measure delay of samples mixed now */
+		__atomic_store_n(&h->delay, stopped ? 0 : output_alsa_get_delay(h),
+				 __ATOMIC_RELAXED);
+
 		out_size = output_alsa_mix_streams(h, in_buffer, out_buffer,
-						   in_size) / h->channels;
+						   in_size, &out, &out_buf) /
+			   h->channels;
 		if(out_size == 0)
 		{
 			/* ALSA PCM is stopped */
@@ -677,6 +999,7 @@ static void *output_alsa_thread(void *user_data)
 			/* Fill with zero */
 			memset(out_buffer, 0, in_size * 4);
 			out_size = in_size / h->channels;
+			out = out_buffer;
 		}
 		else if(stopped)
 		{
@@ -686,8 +1009,34 @@ static void *output_alsa_thread(void *user_data)
 			start = 0;
 		}
 
+		/* Pass mixed frames to tap before conversion */
+		if(h->tap != NULL)
+			output_alsa_tap(h, out, out_size);
+
+		/* Convert to output format: dither is used when samples are
+		 * reduced to 16-bit.
+		 */
+		if(h->format == SAMPLE_S16 && h->dither)
+		{
+			sample_dither_s16(out_buffer, out, h->ops->format,
+					  out_size, h->channels,
+					  &h->dither_state);
+			out = out_buffer;
+		}
+		else if(h->format != h->ops->format)
+		{
+			sample_convert(out_buffer, h->format, out,
+				       h->ops->format, out_size * h->channels);
+			out = out_buffer;
+		}
+
 		/* Play pcm sample */
-		frames = snd_pcm_writei(h->alsa, out_buffer, out_size);
+		frames = snd_pcm_writei(h->alsa, out, out_size);
+		if(frames > 0)
+			abuffer_count_output(frames * h->channels);
+
+		/* Release samples of stream */
+		abuffer_unref(out_buf);
 
 		/* Try again to send frames */
 		if (frames < 0)
@@ -736,12 +1085,19 @@ int output_alsa_close(struct output *h)
 		output_alsa_free_stream(s);
 	}
 
+	/* Close mixer and limiter */
+	output_alsa_close_mixer(h);
+	limiter_close(h->limiter);
+
 	/* Close alsa */
 	if(h->alsa != NULL)
 		snd_pcm_close(h->alsa);
+	if(h->device != NULL)
+		free(h->device);
 
-	/* Free ALSA config */
-	snd_config_update_free_global();
+	/* Free ALSA config when last output is closed */
+	if(__atomic_sub_fetch(&output_alsa_count, 1, __ATOMIC_ACQ_REL) == 0)
+		snd_config_update_free_global();
 
 	/* Free structure */
 	free(h);
@@ -753,13 +1109,19 @@ struct output_module output_alsa = {
 	.open = (void*) &output_alsa_open,
 	.set_volume = (void*) &output_alsa_set_volume,
 	.get_volume = (void*) &output_alsa_get_volume,
+	.set_mixer = (void*) &output_alsa_set_mixer,
+	.set_limiter = (void*) &output_alsa_set_limiter,
+	.set_dither = (void*) &output_alsa_set_dither,
+	.set_tap = (void*) &output_alsa_set_tap,
 	.add_stream = (void*) &output_alsa_add_stream,
+	.add_stream_get = (void*) &output_alsa_add_stream_get,
 	.play_stream = (void*) &output_alsa_play_stream,
 	.pause_stream = (void*) &output_alsa_pause_stream,
 	.flush_stream = (void*) &output_alsa_flush_stream,
 	.write_stream = (void*) &output_alsa_write_stream,
 	.set_volume_stream = (void*) &output_alsa_set_volume_stream,
 	.get_volume_stream = (void*) &output_alsa_get_volume_stream,
+	.fade_stream = (void*) &output_alsa_fade_stream,
 	.set_cache_stream = (void*) &output_alsa_set_cache_stream,
 	.get_status_stream = (void*) &output_alsa_get_status_stream,
 	.set_stream_event_cb = (void*) &output_alsa_set_stream_event_cb,
@@ -23,10 +23,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <pthread.h>
 
 #include "outputs.h"
 #include "output_alsa.h"
+#include "recorder.h"
+#include "limiter.h"
 #include "utils.h"
 
 #define FREE_STRING(s) if(s != NULL) free(s);
@@ -44,6 +47,15 @@
 /* Output ID length */
 #define OUTPUTS_ID_SIZE 10
 
+/* Name of default zone */
+#define DEFAULT_ZONE "default"
+
+/* Default path for stream recording */
+#define DEFAULT_RECORD_PATH "/tmp"
+
+/* Size of a sample in stream (in bytes) */
+#define SAMPLE_SIZE 4
+
 struct output_stream_handle {
 	/* Stream properties */
 	char id[OUTPUTS_ID_SIZE+1];
@@ -54,10 +66,17 @@ struct output_stream_handle {
 	int cache;
 	int use_cache_thread;
 	void *input_callback;
+	void *get_callback;
 	void *user_data;
 	/* Stream status */
 	int is_playing;
 	unsigned long played;
+	/* Stream recording */
+	struct recorder_handle *recorder;
+	pthread_mutex_t rec_mutex;
+	uint64_t rec_dropped;
+	/* Zone where stream is played */
+	struct outputs_zone *zone;
 	/* Next stream in list */
 	struct output_stream_handle *next;
 	/* Output stream module handle */
@@ -90,27 +109,127 @@ struct output_list {
 	struct output_list *next;
 };
 
-struct outputs_handle {
-	/* Output module list */
-	int output_count;
-	struct output_list *list;
+struct outputs_zone {
+	/* Zone name, ALSA device and CPU core of mixer thread (-1 for any) */
+	char *name;
+	char *device;
+	int cpu;
 	/* Current output module */
 	void *handle;
 	struct output_module *mod;
 	struct output_list *current;
-	struct output_handle *handles;
 	/* Configuration */
 	unsigned long samplerate;
 	unsigned char channels;
 	unsigned int latency;
+	enum sample_format format;
 	unsigned int volume;
+	/* Hardware mixer control used for global volume: when available,
+	 * global volume is not applied in software on streams.
+	 */
+	char *mixer;
+	int hw_volume;
+	/* Soft limiter on mixed streams and dither on 16-bit output */
+	int limiter;
+	double limiter_threshold;
+	int dither;
+	/* Bit-perfect mode: output is opened at native format of stream when
+	 * only one stream is available, resampling and DSP are bypassed and
+	 * software volume is only applied when not at unity.
+	 */
+	int bitperfect;
+	int bitperfect_active;
+	/* Tap on mixed samples */
+	output_tap_cb tap;
+	void *tap_data;
+	/* Current format of output module */
+	unsigned long out_samplerate;
+	unsigned char out_channels;
+	/* Outputs associated handle */
+	struct outputs_handle *outputs;
+	/* Next zone in list */
+	struct outputs_zone *next;
+};
+
+struct outputs_handle {
+	/* Output module list */
+	int output_count;
+	struct output_list *list;
+	/* Zone list: first zone is the default zone */
+	struct outputs_zone *zones;
+	struct output_handle *handles;
+	/* Configuration */
+	char *record_path;
 	/* Mutex for thread-safe */
 	pthread_mutex_t mutex;
 };
 
 static int output_reset_volume_stream(struct outputs_handle *h,
+				      struct outputs_zone *zone,
 				      struct output_handle *handle,
 				      struct output_stream_handle *stream);
+static void outputs_set_dsp(struct outputs_zone *z);
+static void *output_add_module_stream(struct outputs_zone *z,
+				      struct output_stream_handle *s);
+
+static struct outputs_zone *outputs_zone_new(struct outputs_handle *h,
+					     const char *name)
+{
+	struct outputs_zone *z, **lz;
+
+	/* Allocate zone */
+	z = malloc(sizeof(struct outputs_zone));
+	if(z == NULL)
+		return NULL;
+
+	/* Init zone */
+	z->name = strdup(name);
+	z->device = NULL;
+	z->cpu = -1;
+	z->mod = NULL;
+	z->current = NULL;
+	z->handle = NULL;
+	z->samplerate = 0;
+	z->channels = 0;
+	z->latency = 0;
+	z->format = sample_get_format();
+	z->volume = OUTPUT_VOLUME_MAX;
+	z->mixer = NULL;
+	z->hw_volume = 0;
+	z->limiter = 0;
+	z->limiter_threshold = LIMITER_THRESHOLD;
+	z->dither = 0;
+	z->bitperfect = 0;
+	z->bitperfect_active = 0;
+	z->tap = NULL;
+	z->tap_data = NULL;
+	z->out_samplerate = 0;
+	z->out_channels = 0;
+	z->outputs = h;
+	z->next = NULL;
+
+	/* Add zone at end of list */
+	for(lz = &h->zones; *lz != NULL; lz = &(*lz)->next);
+	*lz = z;
+
+	return z;
+}
+
+static struct outputs_zone *outputs_find_zone(struct outputs_handle *h,
+					      const char *name)
+{
+	struct outputs_zone *z;
+
+	if(name == NULL)
+		return h->zones;
+
+	/* Look for zone name */
+	for(z = h->zones; z != NULL; z = z->next)
+		if(strcmp(z->name, name) == 0)
+			return z;
+
+	return NULL;
+}
 
 int outputs_open(struct outputs_handle **handle, struct json *config)
 {
@@ -119,8 +238,16 @@ int outputs_open(struct outputs_handle **handle, struct json *config)
 		{"alsa", "ALSA", "ALSA audio output.", &output_alsa, NULL},
 	};
 	struct output_list *l;
+	int format = -1;
 	int i;
 
+	/* Set pipeline sample format: it cannot be changed after startup */
+	if(config != NULL)
+		format = sample_parse_format(json_get_string(config, "pipeline"));
+	if(format >= 0 && sample_set_format(format) != 0)
+		fprintf(stderr, "Sample format %s not supported in pipeline\n",
+			sample_format_name(format));
+
 	/* Allocate structure */
 	*handle = malloc(sizeof(struct outputs_handle));
 	if(*handle == NULL)
@@ -130,13 +257,16 @@ int outputs_open(struct outputs_handle **handle, struct json *config)
 	/* Init structure */
 	h->list = NULL;
 	h->output_count = 0;
-	h->mod = NULL;
-	h->current = NULL;
-	h->handle = NULL;
+	h->zones = NULL;
 	h->handles = NULL;
-	h->samplerate = 0;
-	h->channels = 0;
-	h->latency = 0;
+	h->record_path = NULL;
+
+	/* Create default zone */
+	if(outputs_zone_new(h, DEFAULT_ZONE) == NULL)
+	{
+		free(h);
+		return -1;
+	}
 
 	/* Create output list */
 	for(i = 0; i < sizeof(list)/sizeof(struct output_list); i++)
@@ -181,145 +311,425 @@ static struct output_list *outputs_find_module(struct outputs_handle *h,
 	return NULL;
 }
 
-static void outputs_reload(struct outputs_handle *h, struct output_list *new,
-			   unsigned long samplerate, unsigned char channels,
-			   unsigned int latency)
+static int outputs_get_format(struct outputs_zone *z,
+			      unsigned long *samplerate,
+			      unsigned char *channels)
 {
-	struct output_stream_handle *stream;
+	struct output_stream_handle *stream = NULL, *s;
 	struct output_handle *handle;
+	int count = 0;
 
-	/* Update value */
-	h->samplerate = samplerate;
-	h->channels = channels;
-	h->latency = latency;
+	/* Use configured format */
+	*samplerate = z->samplerate;
+	*channels = z->channels;
 
-	/* Close previous output module */
-	if(h->current != NULL && h->mod != NULL && h->handle != NULL)
+	if(!z->bitperfect)
+		return 0;
+
+	/* Count streams of zone */
+	for(handle = z->outputs->handles; handle != NULL; handle = handle->next)
 	{
-		/* Abort all streams */
-		for(handle = h->handles; handle != NULL;
-		    handle = handle->next)
+		for(s = handle->streams; s != NULL; s = s->next)
 		{
-			for(stream = handle->streams; stream != NULL;
-			    stream = stream->next)
-			{
-				/* Abort stream and save played status */
-				if(h->mod->abort_stream != NULL)
-					stream->played = h->mod->abort_stream(
-							        h->handle,
-							        stream->stream);
-			}
+			if(s->zone != z)
+				continue;
+			stream = s;
+			count++;
 		}
+	}
+
+	/* Only one stream: use its native format */
+	if(count != 1 || stream->samplerate == 0 || stream->channels == 0)
+		return 0;
+	*samplerate = stream->samplerate;
+	*channels = stream->channels;
+
+	return 1;
+}
+
+static void outputs_zone_attach(struct outputs_zone *z,
+				struct output_handle *handle,
+				struct output_stream_handle *stream)
+{
+	/* Add stream */
+	stream->zone = z;
+	stream->stream = output_add_module_stream(z, stream);
+
+	/* Reset volume */
+	output_reset_volume_stream(z->outputs, z, handle, stream);
+
+	/* Restore played status */
+	if(z->mod->restore_stream != NULL)
+		z->mod->restore_stream(z->handle, stream->stream,
+				       stream->played);
+
+	/* Play stream */
+	if(stream->stream != NULL && stream->is_playing)
+		z->mod->play_stream(z->handle, stream->stream);
+}
 
-		/* Close output */
-		h->mod->close(h->handle);
-		h->handle = NULL;
-		h->current = NULL;
-		h->mod = NULL;
+static void outputs_zone_abort(struct outputs_zone *z)
+{
+	struct output_stream_handle *stream;
+	struct output_handle *handle;
+
+	if(z->current == NULL || z->mod == NULL || z->handle == NULL)
+		return;
+
+	/* Abort all streams */
+	for(handle = z->outputs->handles; handle != NULL;
+	    handle = handle->next)
+	{
+		for(stream = handle->streams; stream != NULL;
+		    stream = stream->next)
+		{
+			if(stream->zone != z)
+				continue;
+
+			/* Abort stream and save played status */
+			if(z->mod->abort_stream != NULL)
+				stream->played = z->mod->abort_stream(
+							z->handle,
+							stream->stream);
+			stream->stream = NULL;
+		}
 	}
 
+	/* Close output */
+	z->mod->close(z->handle);
+	z->handle = NULL;
+	z->current = NULL;
+	z->mod = NULL;
+}
+
+static void outputs_reload(struct outputs_zone *z, struct output_list *new,
+			   unsigned long samplerate, unsigned char channels,
+			   unsigned int latency, enum sample_format format)
+{
+	struct output_stream_handle *stream;
+	struct output_handle *handle;
+
+	/* Update value */
+	z->samplerate = samplerate;
+	z->channels = channels;
+	z->latency = latency;
+	z->format = format;
+
+	/* Close previous output module */
+	outputs_zone_abort(z);
+
 	/* Open new output module and reload all streams */
 	if(new != NULL)
 	{
-		h->current = new;
-		h->mod = h->current->mod;
+		z->current = new;
+		z->mod = z->current->mod;
+
+		/* Get output format */
+		z->bitperfect_active = outputs_get_format(z,
+							  &z->out_samplerate,
+							  &z->out_channels);
 
-		/* Open output module */
-		if(h->mod->open(&h->handle, h->samplerate, h->channels,
-				h->latency) != 0)
+		/* Open output module on zone device */
+		if(z->mod->open(&z->handle, z->out_samplerate, z->out_channels,
+				z->latency, z->format, z->device, z->cpu) != 0)
 		{
-			h->mod->close(h->handle);
-			h->handle = NULL;
+			z->mod->close(z->handle);
+			z->handle = NULL;
 			return;
 		}
 
-		/* Reload streams */
-		for(handle = h->handles; handle != NULL;
+		/* Set hardware mixer and global volume */
+		z->hw_volume = z->mod->set_mixer != NULL && z->mixer != NULL &&
+			       z->mod->set_mixer(z->handle, z->mixer) == 0;
+		z->mod->set_volume(z->handle, z->volume);
+
+		/* Set limiter and dither */
+		outputs_set_dsp(z);
+
+		/* Set tap on mixed samples */
+		if(z->tap != NULL && z->mod->set_tap != NULL)
+			z->mod->set_tap(z->handle, z->tap, z->tap_data);
+
+		/* Reload streams of zone */
+		for(handle = z->outputs->handles; handle != NULL;
 		    handle = handle->next)
 		{
 			for(stream = handle->streams; stream != NULL;
 			    stream = stream->next)
 			{
-				/* Add stream */
-				stream->stream = h->mod->add_stream(h->handle,
-						       stream->samplerate,
-						       stream->channels,
-						       stream->cache,
-						       stream->use_cache_thread,
-						       stream->input_callback,
-						       stream->user_data);
-
-				/* Reset volume */
-				output_reset_volume_stream(h, handle, stream);
-
-				/* Restore played status */
-				if(h->mod->restore_stream != NULL)
-					h->mod->restore_stream(h->handle,
-							       stream->stream,
-							       stream->played);
-
-				/* Play stream */
-				if(stream->stream != NULL && stream->is_playing)
-					h->mod->play_stream(h->handle,
-							    stream->stream);
+				if(stream->zone == z)
+					outputs_zone_attach(z, handle, stream);
 			}
 		}
 	}
 }
 
-int outputs_set_config(struct outputs_handle *h, struct json *cfg)
+static void outputs_zone_free(struct outputs_handle *h, struct outputs_zone *z)
+{
+	struct outputs_zone **lz, *def = h->zones;
+	struct output_stream_handle *stream;
+	struct output_handle *handle;
+
+	/* Remove zone from list */
+	for(lz = &h->zones; *lz != NULL; lz = &(*lz)->next)
+	{
+		if(*lz == z)
+		{
+			*lz = z->next;
+			break;
+		}
+	}
+
+	/* Close output module */
+	outputs_zone_abort(z);
+
+	/* Move streams to default zone */
+	for(handle = h->handles; handle != NULL; handle = handle->next)
+	{
+		for(stream = handle->streams; stream != NULL;
+		    stream = stream->next)
+		{
+			if(stream->zone != z)
+				continue;
+			stream->zone = def;
+			if(def != z && def->mod != NULL && def->handle != NULL)
+				outputs_zone_attach(def, handle, stream);
+		}
+	}
+
+	/* Free zone */
+	FREE_STRING(z->name);
+	FREE_STRING(z->device);
+	FREE_STRING(z->mixer);
+	free(z);
+}
+
+static void outputs_set_dsp(struct outputs_zone *z)
+{
+	if(z->mod == NULL || z->handle == NULL)
+		return;
+
+	/* Samples are not modified in bit-perfect mode */
+	if(z->mod->set_limiter != NULL)
+		z->mod->set_limiter(z->handle,
+				    z->limiter && !z->bitperfect_active,
+				    z->limiter_threshold);
+	if(z->mod->set_dither != NULL)
+		z->mod->set_dither(z->handle,
+				   z->dither && !z->bitperfect_active);
+}
+
+static void outputs_check_bitperfect(struct outputs_zone *z)
+{
+	unsigned long samplerate;
+	unsigned char channels;
+	int active;
+
+	if(z->current == NULL || (!z->bitperfect && !z->bitperfect_active))
+		return;
+
+	/* Reopen output module when format changes */
+	active = outputs_get_format(z, &samplerate, &channels);
+	if(samplerate != z->out_samplerate || channels != z->out_channels)
+	{
+		outputs_reload(z, z->current, z->samplerate, z->channels,
+			       z->latency, z->format);
+	}
+	else if(active != z->bitperfect_active)
+	{
+		/* Same format: only bypass or restore volume and DSP */
+		z->bitperfect_active = active;
+		output_reset_volume_stream(z->outputs, z, NULL, NULL);
+		outputs_set_dsp(z);
+	}
+}
+
+static int outputs_string_changed(char **str, const char *value)
+{
+	/* Empty string is same as no value */
+	if(value != NULL && *value == '\0')
+		value = NULL;
+	if(value == NULL ? *str == NULL :
+	   *str != NULL && strcmp(value, *str) == 0)
+		return 0;
+
+	/* Replace string */
+	FREE_STRING(*str);
+	*str = value != NULL ? strdup(value) : NULL;
+
+	return 1;
+}
+
+static void outputs_zone_set_config(struct outputs_zone *z,
+				    struct json *cfg)
 {
 	struct output_list *current = NULL;
 	unsigned long samplerate = 0;
 	unsigned char channels = 0;
 	unsigned int latency = 0;
+	const char *device = NULL;
+	const char *mixer = NULL;
 	const char *id;
-
-	if(h == NULL)
-		return -1;
-
-	/* Lock output access */
-	pthread_mutex_lock(&h->mutex);
+	int format = -1;
+	int bitperfect = 0;
+	int cpu = -1;
+	int reload = 0;
 
 	/* Free all configuration */
-	current = NULL;
-	samplerate = 0;
-	channels = 0;
-	latency = 0;
-	h->volume = OUTPUT_VOLUME_MAX;
+	z->volume = OUTPUT_VOLUME_MAX;
+	z->limiter = 0;
+	z->limiter_threshold = LIMITER_THRESHOLD;
+	z->dither = 0;
 
 	/* Get configuration */
 	if(cfg != NULL)
 	{
 		id = json_get_string(cfg, "name");
-		current = outputs_find_module(h, id);
+		current = outputs_find_module(z->outputs, id);
 		samplerate = json_get_int(cfg, "samplerate");
 		channels = json_get_int(cfg, "channels");
 		latency = json_get_int(cfg, "latency");
-		h->volume = json_has_key(cfg, "volume") ?
+		z->volume = json_has_key(cfg, "volume") ?
 						   json_get_int(cfg, "volume") :
 						   OUTPUT_VOLUME_MAX;
+		format = sample_parse_format(json_get_string(cfg, "format"));
+		bitperfect = json_get_bool(cfg, "bitperfect");
+		mixer = json_get_string(cfg, "mixer");
+		z->limiter = json_get_bool(cfg, "limiter");
+		z->limiter_threshold = json_has_key(cfg, "limiter_threshold") ?
+				  json_get_double(cfg, "limiter_threshold") :
+				  LIMITER_THRESHOLD;
+		z->dither = json_get_bool(cfg, "dither");
+		device = json_get_string(cfg, "device");
+		if(json_has_key(cfg, "cpu"))
+			cpu = json_get_int(cfg, "cpu");
 	}
 
 	/* Set default values */
 	if(current == NULL)
 	{
 		/* Choose ALSA as defaut module */
-		current = outputs_find_module(h, "alsa");
+		current = outputs_find_module(z->outputs, "alsa");
 	}
 	if(samplerate == 0)
 		samplerate = 44100;
 	if(channels == 0)
 		channels = 2;
-	if(h->volume > OUTPUT_VOLUME_MAX)
-		h->volume = OUTPUT_VOLUME_MAX;
+	if(z->volume > OUTPUT_VOLUME_MAX)
+		z->volume = OUTPUT_VOLUME_MAX;
 	if(latency == 0 || latency > MAX_LATENCY)
 		latency = DEFAULT_LATENCY;
+	if(format < 0)
+		format = sample_get_format();
+	if(cpu < 0)
+		cpu = -1;
+
+	/* Update device and CPU of mixer thread */
+	reload = outputs_string_changed(&z->device, device);
+	if(cpu != z->cpu)
+	{
+		z->cpu = cpu;
+		reload = 1;
+	}
+
+	/* Update hardware mixer control */
+	if(outputs_string_changed(&z->mixer, mixer))
+	{
+		/* Set it on current output */
+		if(z->mod != NULL && z->handle != NULL &&
+		   z->mod->set_mixer != NULL)
+			z->hw_volume = z->mod->set_mixer(z->handle,
+							 z->mixer) == 0;
+	}
 
 	/* Reload output */
-	if(current != h->current || samplerate != h->samplerate ||
-	   channels != h->channels || latency != h->latency)
-		outputs_reload(h, current, samplerate, channels, latency);
+	if(reload || current != z->current || samplerate != z->samplerate ||
+	   channels != z->channels || latency != z->latency ||
+	   format != z->format)
+	{
+		z->bitperfect = bitperfect;
+		outputs_reload(z, current, samplerate, channels, latency,
+			       format);
+	}
+	else if(bitperfect != z->bitperfect)
+	{
+		z->bitperfect = bitperfect;
+		outputs_check_bitperfect(z);
+	}
+
+	/* Apply global volume, limiter and dither */
+	if(z->mod != NULL && z->handle != NULL)
+		z->mod->set_volume(z->handle, z->volume);
+	output_reset_volume_stream(z->outputs, z, NULL, NULL);
+	outputs_set_dsp(z);
+}
+
+int outputs_set_config(struct outputs_handle *h, struct json *cfg)
+{
+	struct outputs_zone *z, *next;
+	const char *record_path = NULL;
+	struct json *zones = NULL, *tmp;
+	const char *name;
+	int i, count = 0;
+
+	if(h == NULL)
+		return -1;
+
+	/* Lock output access */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Get configuration */
+	if(cfg != NULL)
+	{
+		record_path = json_get_string(cfg, "record_path");
+		zones = json_get(cfg, "zones");
+		if(zones != NULL)
+			count = json_array_length(zones);
+	}
+
+	/* Set default values */
+	if(record_path == NULL || *record_path == '\0')
+		record_path = DEFAULT_RECORD_PATH;
+
+	/* Update record path */
+	FREE_STRING(h->record_path);
+	h->record_path = strdup(record_path);
+
+	/* Remove zones which are not in configuration anymore */
+	for(z = h->zones->next; z != NULL; z = next)
+	{
+		next = z->next;
+		for(i = 0; i < count; i++)
+		{
+			name = json_get_string(json_array_get(zones, i),
+					       "zone");
+			if(name != NULL && strcmp(name, z->name) == 0)
+				break;
+		}
+		if(i == count)
+			outputs_zone_free(h, z);
+	}
+
+	/* Configure default zone from root of configuration */
+	outputs_zone_set_config(h->zones, cfg);
+
+	/* Add or update other zones */
+	for(i = 0; i < count; i++)
+	{
+		tmp = json_array_get(zones, i);
+		name = json_get_string(tmp, "zone");
+		if(name == NULL || *name == '\0')
+			continue;
+
+		/* Get or create zone */
+		z = outputs_find_zone(h, name);
+		if(z == h->zones)
+			continue;
+		if(z == NULL)
+			z = outputs_zone_new(h, name);
+		if(z != NULL)
+			outputs_zone_set_config(z, tmp);
+	}
 
 	/* Unlock output access */
 	pthread_mutex_unlock(&h->mutex);
@@ -327,11 +737,31 @@ int outputs_set_config(struct outputs_handle *h, struct json *cfg)
 	return 0;
 }
 
-struct json *outputs_get_config(struct outputs_handle *h)
+static void outputs_zone_get_config(struct outputs_zone *z, struct json *cfg)
 {
-	struct json *cfg;
 	char *name = NULL;
 
+	if(z->current != NULL)
+		name = z->current->id;
+	json_set_string(cfg, "id", name);
+	json_set_string(cfg, "device", z->device);
+	json_set_int(cfg, "cpu", z->cpu);
+	json_set_int(cfg, "samplerate", z->samplerate);
+	json_set_int(cfg, "channels", z->channels);
+	json_set_string(cfg, "format", sample_format_name(z->format));
+	json_set_bool(cfg, "bitperfect", z->bitperfect);
+	json_set_int(cfg, "volume", z->volume);
+	json_set_string(cfg, "mixer", z->mixer);
+	json_set_bool(cfg, "limiter", z->limiter);
+	json_set_double(cfg, "limiter_threshold", z->limiter_threshold);
+	json_set_bool(cfg, "dither", z->dither);
+}
+
+struct json *outputs_get_config(struct outputs_handle *h)
+{
+	struct outputs_zone *z;
+	struct json *cfg, *zones, *tmp;
+
 	if(h == NULL)
 		return NULL;
 
@@ -343,13 +773,28 @@ struct json *outputs_get_config(struct outputs_handle *h)
 	/* Lock output access */
 	pthread_mutex_lock(&h->mutex);
 
-	/* Fill configuration */
-	if(h->current != NULL)
-		name = h->current->id;
-	json_set_string(cfg, "id", name);
-	json_set_int(cfg, "samplerate", h->samplerate);
-	json_set_int(cfg, "channels", h->channels);
-	json_set_int(cfg, "volume", h->volume);
+	/* Fill configuration of default zone */
+	outputs_zone_get_config(h->zones, cfg);
+	json_set_string(cfg, "pipeline",
+			sample_format_name(sample_get_format()));
+	json_set_string(cfg, "record_path", h->record_path);
+
+	/* Fill configuration of other zones */
+	zones = json_new_array();
+	if(zones != NULL)
+	{
+		for(z = h->zones->next; z != NULL; z = z->next)
+		{
+			tmp = json_new();
+			if(tmp == NULL)
+				continue;
+			json_set_string(tmp, "zone", z->name);
+			outputs_zone_get_config(z, tmp);
+			if(json_array_add(zones, tmp) != 0)
+				json_free(tmp);
+		}
+		json_add(cfg, "zones", zones);
+	}
 
 	/* Unlock output access */
 	pthread_mutex_unlock(&h->mutex);
@@ -359,6 +804,7 @@ struct json *outputs_get_config(struct outputs_handle *h)
 
 int outputs_set_volume(struct outputs_handle *h, unsigned int volume)
 {
+	struct outputs_zone *z;
 	int ret = -1;
 
 	if(h == NULL)
@@ -367,9 +813,15 @@ int outputs_set_volume(struct outputs_handle *h, unsigned int volume)
 	/* Lock output access */
 	pthread_mutex_lock(&h->mutex);
 
-	if(h->current != NULL && h->mod != NULL && h->handle != NULL)
-		ret = h->mod->set_volume(h->handle, volume);
-	h->volume = volume;
+	/* Set volume of default zone */
+	z = h->zones;
+	if(z->current != NULL && z->mod != NULL && z->handle != NULL)
+		ret = z->mod->set_volume(z->handle, volume);
+	z->volume = volume;
+
+	/* Update streams if volume is not done by hardware */
+	if(!z->hw_volume)
+		output_reset_volume_stream(h, z, NULL, NULL);
 
 	/* Unlock output access */
 	pthread_mutex_unlock(&h->mutex);
@@ -378,6 +830,7 @@ int outputs_set_volume(struct outputs_handle *h, unsigned int volume)
 }
 unsigned int outputs_get_volue(struct outputs_handle *h)
 {
+	struct outputs_zone *z;
 	unsigned int vol = 0;
 
 	if(h == NULL)
@@ -386,8 +839,10 @@ unsigned int outputs_get_volue(struct outputs_handle *h)
 	/* Lock output access */
 	pthread_mutex_lock(&h->mutex);
 
-	if(h->current != NULL && h->mod != NULL && h->handle != NULL)
-		vol = h->mod->get_volume(h->handle);
+	/* Get volume of default zone */
+	z = h->zones;
+	if(z->current != NULL && z->mod != NULL && z->handle != NULL)
+		vol = z->mod->get_volume(z->handle);
 
 	/* Unlock output access */
 	pthread_mutex_unlock(&h->mutex);
@@ -398,6 +853,7 @@ unsigned int outputs_get_volue(struct outputs_handle *h)
 void outputs_close(struct outputs_handle *h)
 {
 	struct output_handle *handle;
+	struct outputs_zone *z;
 	struct output_list *l;
 
 	if(h == NULL)
@@ -412,9 +868,12 @@ void outputs_close(struct outputs_handle *h)
 		output_close(handle);
 	}
 
-	/* Close output */
-	if(h->current != NULL && h->mod != NULL && h->handle != NULL)
-		h->mod->close(h->handle);
+	/* Close all zones */
+	while(h->zones != NULL)
+	{
+		z = h->zones;
+		outputs_zone_free(h, z);
+	}
 
 	/* Free output list */
 	while(h->list != NULL)
@@ -431,6 +890,9 @@ void outputs_close(struct outputs_handle *h)
 		free(l);
 	}
 
+	/* Free record path */
+	FREE_STRING(h->record_path);
+
 	free(h);
 }
 
@@ -474,30 +936,111 @@ int output_open(struct output_handle **handle, struct outputs_handle *outputs,
 	return 0;
 }
 
-struct output_stream_handle *output_add_stream(struct output_handle *h,
-					       const char *name,
-					       unsigned long samplerate,
-					       unsigned char channels,
-					       unsigned long cache,
-					       int use_cache_thread,
-					       a_read_cb input_callback,
-					       void *user_data)
+static void output_record_samples(struct output_stream_handle *s,
+				  const unsigned char *buffer, int samples)
+{
+	if(samples <= 0 || s->recorder == NULL)
+		return;
+
+	/* Never wait while recording is started or stopped: samples are lost
+	 * and counted as dropped by next recorder.
+	 */
+	if(pthread_mutex_trylock(&s->rec_mutex) != 0)
+	{
+		s->rec_dropped += samples * SAMPLE_SIZE;
+		return;
+	}
+
+	/* Write samples to recorder */
+	if(s->recorder != NULL)
+	{
+		recorder_add_dropped(s->recorder, s->rec_dropped);
+		recorder_write(s->recorder, buffer, samples * SAMPLE_SIZE);
+	}
+	s->rec_dropped = 0;
+
+	pthread_mutex_unlock(&s->rec_mutex);
+}
+
+static int output_read_stream(void *user_data, unsigned char *buffer,
+			      size_t size, struct a_format *fmt)
+{
+	struct output_stream_handle *s = user_data;
+	int samples;
+
+	/* Read samples from stream input */
+	if(s->get_callback != NULL)
+		samples = abuffer_read(s->get_callback, s->user_data, buffer,
+				       size, fmt);
+	else
+		samples = ((a_read_cb) s->input_callback)(s->user_data, buffer,
+							  size, fmt);
+
+	/* Record samples */
+	output_record_samples(s, buffer, samples);
+
+	return samples;
+}
+
+static int output_get_stream(void *user_data, struct abuffer **buffer,
+			     size_t size)
+{
+	struct output_stream_handle *s = user_data;
+	int samples;
+
+	/* Get samples from stream input */
+	samples = ((a_get_cb) s->get_callback)(s->user_data, buffer, size);
+
+	/* Record samples */
+	output_record_samples(s, (*buffer)->data, samples);
+
+	return samples;
+}
+
+static void *output_add_module_stream(struct outputs_zone *z,
+				      struct output_stream_handle *s)
+{
+	/* Use buffer descriptors if supported by output module, input is read
+	 * through stream handle for recording.
+	 */
+	if(s->get_callback != NULL && z->mod->add_stream_get != NULL)
+		return z->mod->add_stream_get(z->handle, s->samplerate,
+					      s->channels, s->cache,
+					      s->use_cache_thread,
+					      &output_get_stream, s);
+
+	return z->mod->add_stream(z->handle, s->samplerate, s->channels,
+				  s->cache, s->use_cache_thread,
+				  s->input_callback != NULL ||
+				  s->get_callback != NULL ?
+					&output_read_stream : NULL, s);
+}
+
+static struct output_stream_handle *output_new_stream(struct output_handle *h,
+						     const char *name,
+						     const char *zone,
+						     unsigned long samplerate,
+						     unsigned char channels,
+						     unsigned long cache,
+						     int use_cache_thread,
+						     a_read_cb input_callback,
+						     a_get_cb get_callback,
+						     void *user_data)
 {
 	struct output_stream_handle *s = NULL;
 	struct output_stream *stream;
+	struct outputs_zone *z;
 
 	/* Lock output access */
 	pthread_mutex_lock(h->mutex);
 
-	/* Check output module */
-	if(h == NULL || h->outputs->mod == NULL)
-		goto end;
+	/* Get zone (default zone if not found) */
+	z = outputs_find_zone(h->outputs, zone);
+	if(z == NULL)
+		z = h->outputs->zones;
 
-	/* Add stream to output module */
-	stream = h->outputs->mod->add_stream(h->outputs->handle, samplerate,
-					     channels, cache, use_cache_thread,
-					     input_callback, user_data);
-	if(stream == NULL)
+	/* Check output module */
+	if(h == NULL || z->mod == NULL)
 		goto end;
 
 	/* Alloc stream structure */
@@ -506,26 +1049,46 @@ struct output_stream_handle *output_add_stream(struct output_handle *h,
 		goto end;
 
 	/* Fill handle */
-	random_string(s->id, OUTPUTS_ID_SIZE);
-	s->name = name ? strdup(name) : NULL;
 	s->samplerate = samplerate;
 	s->channels = channels;
 	s->cache = cache;
 	s->use_cache_thread = use_cache_thread;
 	s->input_callback = input_callback;
+	s->get_callback = get_callback;
 	s->user_data = user_data;
+	s->recorder = NULL;
+	s->rec_dropped = 0;
+	s->zone = z;
+	pthread_mutex_init(&s->rec_mutex, NULL);
+
+	/* Add stream to output module of zone */
+	stream = output_add_module_stream(z, s);
+	if(stream == NULL)
+	{
+		pthread_mutex_destroy(&s->rec_mutex);
+		free(s);
+		s = NULL;
+		goto end;
+	}
+
+	/* Fill handle */
+	random_string(s->id, OUTPUTS_ID_SIZE);
+	s->name = name ? strdup(name) : NULL;
 	s->stream = stream;
 	s->is_playing = 0;
 	s->played = 0;
 	s->volume = OUTPUT_VOLUME_MAX;
 
 	/* Reset volume */
-	output_reset_volume_stream(h->outputs, h, s);
+	output_reset_volume_stream(h->outputs, NULL, h, s);
 
 	/* Add stream to stream list */
 	s->next = h->streams;
 	h->streams = s;
 
+	/* Switch from bit-perfect to mixing or to new stream format */
+	outputs_check_bitperfect(z);
+
 end:
 	/* Unlock output access */
 	pthread_mutex_unlock(h->mutex);
@@ -533,6 +1096,36 @@ end:
 	return s;
 }
 
+struct output_stream_handle *output_add_stream(struct output_handle *h,
+					       const char *name,
+					       const char *zone,
+					       unsigned long samplerate,
+					       unsigned char channels,
+					       unsigned long cache,
+					       int use_cache_thread,
+					       a_read_cb input_callback,
+					       void *user_data)
+{
+	return output_new_stream(h, name, zone, samplerate, channels, cache,
+				 use_cache_thread, input_callback, NULL,
+				 user_data);
+}
+
+struct output_stream_handle *output_add_stream_get(struct output_handle *h,
+						   const char *name,
+						   const char *zone,
+						   unsigned long samplerate,
+						   unsigned char channels,
+						   unsigned long cache,
+						   int use_cache_thread,
+						   a_get_cb get_callback,
+						   void *user_data)
+{
+	return output_new_stream(h, name, zone, samplerate, channels, cache,
+				 use_cache_thread, NULL, get_callback,
+				 user_data);
+}
+
 void output_remove_stream(struct output_handle *h,
 			  struct output_stream_handle *s)
 {
@@ -558,12 +1151,21 @@ void output_remove_stream(struct output_handle *h,
 			lp = &l->next;
 	}
 
-	/* Remove stream from output module */
-	h->outputs->mod->remove_stream(h->outputs->handle, s->stream);
+	/* Remove stream from output module of zone */
+	if(s->zone->mod != NULL && s->zone->handle != NULL &&
+	   s->stream != NULL)
+		s->zone->mod->remove_stream(s->zone->handle, s->stream);
+
+	/* Switch to bit-perfect if only one stream remains */
+	outputs_check_bitperfect(s->zone);
 
 	/* Unlock output access */
 	pthread_mutex_unlock(h->mutex);
 
+	/* Stop recording */
+	recorder_close(s->recorder);
+	pthread_mutex_destroy(&s->rec_mutex);
+
 	/* Free stream name */
 	free(s->name);
 
@@ -585,7 +1187,36 @@ int output_set_volume(struct output_handle *h, unsigned int volume)
 	h->volume = volume;
 
 	/* Reload volume for all streams */
-	output_reset_volume_stream(h->outputs, h, NULL);
+	output_reset_volume_stream(h->outputs, NULL, h, NULL);
+
+	/* Unlock output access */
+	pthread_mutex_unlock(h->mutex);
+
+	return ret;
+}
+
+int output_set_tap(struct output_handle *h, const char *zone, output_tap_cb cb,
+		   void *user_data)
+{
+	struct outputs_zone *z;
+	int ret = 0;
+
+	if(h == NULL)
+		return -1;
+
+	/* Lock output access */
+	pthread_mutex_lock(h->mutex);
+
+	/* Find zone */
+	z = outputs_find_zone(h->outputs, zone);
+	if(z == NULL)
+		z = h->outputs->zones;
+
+	/* Set tap on zone and its output module */
+	z->tap = cb;
+	z->tap_data = user_data;
+	if(z->mod != NULL && z->handle != NULL && z->mod->set_tap != NULL)
+		ret = z->mod->set_tap(z->handle, cb, user_data);
 
 	/* Unlock output access */
 	pthread_mutex_unlock(h->mutex);
@@ -667,12 +1298,12 @@ int output_play_stream(struct output_handle *h, struct output_stream_handle *s)
 	/* Lock output access */
 	pthread_mutex_lock(h->mutex);
 
-	/* Check output module */
-	if(h->outputs != NULL && h->outputs->mod != NULL &&
-	   h->outputs->handle != NULL && s->stream != NULL)
+	/* Check output module of zone */
+	if(s->zone->mod != NULL && s->zone->handle != NULL &&
+	   s->stream != NULL)
 	{
 		/* Play stream */
-		ret = h->outputs->mod->play_stream(h->outputs->handle,
+		ret = s->zone->mod->play_stream(s->zone->handle,
 						   s->stream);
 	}
 	s->is_playing = 1;
@@ -693,12 +1324,12 @@ int output_pause_stream(struct output_handle *h, struct output_stream_handle *s)
 	/* Lock output access */
 	pthread_mutex_lock(h->mutex);
 
-	/* Check output module */
-	if(h->outputs != NULL && h->outputs->mod != NULL &&
-	   h->outputs->handle != NULL && s->stream != NULL)
+	/* Check output module of zone */
+	if(s->zone->mod != NULL && s->zone->handle != NULL &&
+	   s->stream != NULL)
 	{
 		/* Pause stream */
-		ret = h->outputs->mod->pause_stream(h->outputs->handle,
+		ret = s->zone->mod->pause_stream(s->zone->handle,
 						    s->stream);
 	}
 	s->is_playing = 0;
@@ -718,12 +1349,12 @@ void output_flush_stream(struct output_handle *h,
 	/* Lock output access */
 	pthread_mutex_lock(h->mutex);
 
-	/* Check output module */
-	if(h->outputs != NULL && h->outputs->mod != NULL &&
-	   h->outputs->handle != NULL && s->stream != NULL)
+	/* Check output module of zone */
+	if(s->zone->mod != NULL && s->zone->handle != NULL &&
+	   s->stream != NULL)
 	{
 		/* Flush stream */
-		h->outputs->mod->flush_stream(h->outputs->handle, s->stream);
+		s->zone->mod->flush_stream(s->zone->handle, s->stream);
 	}
 
 	/* Unlock output access */
@@ -743,12 +1374,12 @@ ssize_t output_write_stream(struct output_handle *h,
 	/* Lock output access */
 	pthread_mutex_lock(h->mutex);
 
-	/* Check output module */
-	if(h->outputs != NULL && h->outputs->mod != NULL &&
-	   h->outputs->handle != NULL && s->stream != NULL)
+	/* Check output module of zone */
+	if(s->zone->mod != NULL && s->zone->handle != NULL &&
+	   s->stream != NULL)
 	{
 		/* Flush stream */
-		ret = h->outputs->mod->write_stream(h->outputs->handle,
+		ret = s->zone->mod->write_stream(s->zone->handle,
 						    s->stream, buffer, size,
 						    fmt);
 	}
@@ -759,15 +1390,51 @@ ssize_t output_write_stream(struct output_handle *h,
 	return ret;
 }
 
+static struct recorder_handle *output_swap_recorder(
+					      struct output_stream_handle *s,
+					      struct recorder_handle *rec)
+{
+	struct recorder_handle *old;
+
+	/* Replace recorder */
+	pthread_mutex_lock(&s->rec_mutex);
+	old = s->recorder;
+	s->recorder = rec;
+	pthread_mutex_unlock(&s->rec_mutex);
+
+	return old;
+}
+
+int output_record_stream(struct output_handle *h,
+			 struct output_stream_handle *s, const char *file)
+{
+	struct recorder_handle *rec = NULL;
+
+	if(h == NULL || s == NULL)
+		return -1;
+
+	/* Open a new recorder for PCM samples */
+	if(file != NULL &&
+	   recorder_open(&rec, file, s->samplerate, s->channels) != 0)
+		return -1;
+
+	/* Replace recorder and close previous one */
+	recorder_close(output_swap_recorder(s, rec));
+
+	return 0;
+}
+
 static int output_reset_volume_stream(struct outputs_handle *h,
+				      struct outputs_zone *zone,
 				      struct output_handle *handle,
 				      struct output_stream_handle *stream)
 {
 	struct output_stream_handle *s;
 	struct output_handle *l;
+	struct outputs_zone *z;
 	unsigned long vol;
 
-	if(h == NULL || h->mod == NULL || h->handle == NULL)
+	if(h == NULL)
 		return -1;
 
 	for(l = (handle == NULL ? h->handles : handle); l != NULL;
@@ -776,15 +1443,23 @@ static int output_reset_volume_stream(struct outputs_handle *h,
 		for(s = (stream == NULL ? l->streams : stream); s != NULL;
 		    s = stream == NULL ? s->next : NULL)
 		{
-			if(s->stream == NULL)
+			/* Check zone of stream */
+			z = s->zone;
+			if(s->stream == NULL || (zone != NULL && z != zone) ||
+			   z->mod == NULL || z->handle == NULL)
 				continue;
 
-			/* Calculate volume */
+			/* Calculate volume: global volume of zone is applied
+			 * by hardware mixer if available. In bit-perfect mode,
+			 * samples are unchanged only when software volume is
+			 * at unity, otherwise it is still applied.
+			 */
 			vol = s->volume * l->volume / OUTPUT_VOLUME_MAX;
-			vol = vol * h->volume / OUTPUT_VOLUME_MAX;
+			if(!z->hw_volume)
+				vol = vol * z->volume / OUTPUT_VOLUME_MAX;
 
 			/* Set stream volume */
-			h->mod->set_volume_stream(h->handle, s->stream, vol);
+			z->mod->set_volume_stream(z->handle, s->stream, vol);
 		}
 	}
 
@@ -807,7 +1482,49 @@ int output_set_volume_stream(struct output_handle *h,
 	s->volume = volume;
 
 	/* Set stream volume */
-	ret = output_reset_volume_stream(h->outputs, h, s);
+	ret = output_reset_volume_stream(h->outputs, NULL, h, s);
+
+	/* Unlock output access */
+	pthread_mutex_unlock(h->mutex);
+
+	return ret;
+}
+
+int output_fade_stream(struct output_handle *h, struct output_stream_handle *s,
+		       unsigned int volume, unsigned long duration)
+{
+	struct outputs_zone *o;
+	unsigned long vol;
+	int ret = -1;
+
+	if(h == NULL || s == NULL)
+		return -1;
+
+	/* Lock output access */
+	pthread_mutex_lock(h->mutex);
+
+	/* Set final volume */
+	s->volume = volume;
+
+	/* Check output module of zone */
+	o = s->zone;
+	if(o->mod != NULL && o->handle != NULL && s->stream != NULL)
+	{
+		/* Calculate final volume */
+		vol = s->volume * h->volume / OUTPUT_VOLUME_MAX;
+		if(!o->hw_volume)
+			vol = vol * o->volume / OUTPUT_VOLUME_MAX;
+
+		/* Fade stream volume or set it directly if not supported:
+		 * software volume is kept in bit-perfect mode.
+		 */
+		if(o->mod->fade_stream != NULL)
+			ret = o->mod->fade_stream(o->handle, s->stream, vol,
+						  duration);
+		else
+			ret = o->mod->set_volume_stream(o->handle, s->stream,
+							vol);
+	}
 
 	/* Unlock output access */
 	pthread_mutex_unlock(h->mutex);
@@ -826,12 +1543,12 @@ unsigned int output_get_volume_stream(struct output_handle *h,
 	/* Lock output access */
 	pthread_mutex_lock(h->mutex);
 
-	/* Check output module */
-	if(h->outputs != NULL && h->outputs->mod != NULL &&
-	   h->outputs->handle != NULL && s->stream != NULL)
+	/* Check output module of zone */
+	if(s->zone->mod != NULL && s->zone->handle != NULL &&
+	   s->stream != NULL)
 	{
 		/* Get stream volume */
-		ret = h->outputs->mod->get_volume_stream(h->outputs->handle,
+		ret = s->zone->mod->get_volume_stream(s->zone->handle,
 							 s->stream);
 	}
 	s->volume = ret;
@@ -853,12 +1570,12 @@ int output_set_cache_stream(struct output_handle *h,
 	/* Lock output access */
 	pthread_mutex_lock(h->mutex);
 
-	/* Check output module */
-	if(h->outputs != NULL && h->outputs->mod != NULL &&
-	   h->outputs->handle != NULL && s->stream != NULL)
+	/* Check output module of zone */
+	if(s->zone->mod != NULL && s->zone->handle != NULL &&
+	   s->stream != NULL)
 	{
 		/* Set new cache volume */
-		ret = h->outputs->mod->set_cache_stream(h->outputs->handle,
+		ret = s->zone->mod->set_cache_stream(s->zone->handle,
 							s->stream, cache);
 	}
 
@@ -880,12 +1597,12 @@ unsigned long output_get_status_stream(struct output_handle *h,
 	/* Lock output access */
 	pthread_mutex_lock(h->mutex);
 
-	/* Check output module */
-	if(h->outputs != NULL && h->outputs->mod != NULL &&
-	   h->outputs->handle != NULL && s->stream != NULL)
+	/* Check output module of zone */
+	if(s->zone->mod != NULL && s->zone->handle != NULL &&
+	   s->stream != NULL)
 	{
 		/* Get stream status */
-		ret = h->outputs->mod->get_status_stream(h->outputs->handle,
+		ret = s->zone->mod->get_status_stream(s->zone->handle,
 							 s->stream, key);
 	}
 
@@ -907,12 +1624,12 @@ int output_set_stream_event_cb(struct output_handle *h,
 	/* Lock output access */
 	pthread_mutex_lock(h->mutex);
 
-	/* Check output module */
-	if(h->outputs != NULL && h->outputs->mod != NULL &&
-	   h->outputs->handle != NULL && s->stream != NULL)
+	/* Check output module of zone */
+	if(s->zone->mod != NULL && s->zone->handle != NULL &&
+	   s->stream != NULL)
 	{
 		/* Set stream event callback */
-		ret = h->outputs->mod->set_stream_event_cb(h->outputs->handle,
+		ret = s->zone->mod->set_stream_event_cb(s->zone->handle,
 							   s->stream, cb,
 							   user_data);
 	}
@@ -999,8 +1716,8 @@ static int outputs_httpd_volume(void *user_data, struct httpd_req *req,
 		/* Check URL */
 		if(req->resource == NULL || *req->resource == '\0')
 		{
-			/* Add volume */
-			json_set_int(json, "volume", h->volume);
+			/* Add volume of default zone */
+			json_set_int(json, "volume", h->zones->volume);
 		}
 		else
 		{
@@ -1053,9 +1770,10 @@ static int outputs_httpd_volume(void *user_data, struct httpd_req *req,
 		/* Check URL */
 		if(is_master)
 		{
-			if(h->mod != NULL && h->handle != NULL)
-				h->mod->set_volume(h->handle, vol);
-			h->volume = vol;
+			if(h->zones->mod != NULL && h->zones->handle != NULL)
+				h->zones->mod->set_volume(h->zones->handle,
+							  vol);
+			h->zones->volume = vol;
 		}
 		else
 		{
@@ -1069,7 +1787,7 @@ static int outputs_httpd_volume(void *user_data, struct httpd_req *req,
 					s->volume = vol;
 			}
 		}
-		output_reset_volume_stream(h, handle, s);
+		output_reset_volume_stream(h, NULL, handle, s);
 
 		/* Unlock output access */
 		pthread_mutex_unlock(&h->mutex);
@@ -1078,27 +1796,70 @@ static int outputs_httpd_volume(void *user_data, struct httpd_req *req,
 	return 200;
 }
 
-static int outputs_httpd_status(void *user_data, struct httpd_req *req,
+static int outputs_httpd_record(void *user_data, struct httpd_req *req,
 				struct httpd_res **res)
 {
 	struct outputs_handle *h = user_data;
-	struct json *root, *list, *list2, *tmp, *tmp2;
-	struct output_stream_handle *s;
-	struct output_handle *l;
+	struct output_stream_handle *s = NULL;
+	struct output_handle *handle = NULL;
+	struct recorder_handle *rec = NULL, *old = NULL;
+	char file[PATH_MAX];
+	char date[20];
+	time_t now;
 	char *str;
+	int ret = 0;
 
-	/* Create a new object */
-	root = json_new();
+	/* Get start or stop at end of URL */
+	str = strrchr(req->resource, '/');
+	if(str == NULL || (str[1] != '0' && str[1] != '1'))
+		return 400;
 
 	/* Lock output access */
 	pthread_mutex_lock(&h->mutex);
 
+	/* Get stream from url */
+	if(outputs_find_stream_from_url(h, req->resource, &handle, &s, 0) != 0
+	   || s == NULL)
+	{
+		pthread_mutex_unlock(&h->mutex);
+		return 404;
+	}
+
+	if(str[1] == '1')
+	{
+		/* Generate file name from stream and date */
+		now = time(NULL);
+		strftime(date, sizeof(date), "%Y%m%d-%H%M%S", localtime(&now));
+		snprintf(file, sizeof(file), "%s/aircat-%s-%s.wav",
+			 h->record_path, s->id, date);
+
+		/* Open a new recorder for PCM samples */
+		ret = recorder_open(&rec, file, s->samplerate, s->channels);
+	}
+
+	/* Start or stop recording */
+	if(ret == 0)
+		old = output_swap_recorder(s, rec);
+
+	/* Unlock output access */
+	pthread_mutex_unlock(&h->mutex);
+
+	/* Close previous recorder: writer thread is not joined with output
+	 * access locked.
+	 */
+	recorder_close(old);
+
+	return ret == 0 ? 200 : 500;
+}
+
+static void outputs_zone_get_status(struct outputs_zone *z, struct json *root)
+{
 	/* Get output configuration */
-	if(h->current != NULL)
+	if(z->current != NULL)
 	{
-		json_set_string(root, "id", h->current->id);
-		json_set_string(root, "name", h->current->name);
-		json_set_string(root, "description", h->current->description);
+		json_set_string(root, "id", z->current->id);
+		json_set_string(root, "name", z->current->name);
+		json_set_string(root, "description", z->current->description);
 	}
 	else
 	{
@@ -1106,9 +1867,63 @@ static int outputs_httpd_status(void *user_data, struct httpd_req *req,
 		json_set_string(root, "name", NO_NAME);
 		json_set_string(root, "description", NO_DESCRIPTION);
 	}
-	json_set_int(root, "samplerate", h->samplerate);
-	json_set_int(root, "channels", h->channels);
-	json_set_int(root, "volume", h->volume);
+	json_set_string(root, "zone", z->name);
+	json_set_string(root, "device", z->device);
+	json_set_int(root, "cpu", z->cpu);
+	json_set_int(root, "samplerate", z->samplerate);
+	json_set_int(root, "channels", z->channels);
+	json_set_string(root, "format", sample_format_name(z->format));
+	json_set_string(root, "pipeline",
+			sample_format_name(sample_get_format()));
+	json_set_bool(root, "bitperfect", z->bitperfect_active);
+	json_set_int(root, "out_samplerate", z->out_samplerate);
+	json_set_int(root, "out_channels", z->out_channels);
+	json_set_int(root, "volume", z->volume);
+	json_set_bool(root, "hw_volume", z->hw_volume);
+}
+
+static int outputs_httpd_status(void *user_data, struct httpd_req *req,
+				struct httpd_res **res)
+{
+	struct outputs_handle *h = user_data;
+	struct json *root, *list, *list2, *tmp, *tmp2;
+	struct output_stream_handle *s;
+	struct output_handle *l;
+	struct outputs_zone *z;
+	uint64_t copied, output;
+	char *str;
+
+	/* Create a new object */
+	root = json_new();
+
+	/* Lock output access */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Get status of default zone */
+	outputs_zone_get_status(h->zones, root);
+
+	/* Get status of all zones */
+	list = json_new_array();
+	if(list != NULL)
+	{
+		for(z = h->zones; z != NULL; z = z->next)
+		{
+			tmp = json_new();
+			if(tmp == NULL)
+				continue;
+			outputs_zone_get_status(z, tmp);
+			if(json_array_add(list, tmp) != 0)
+				json_free(tmp);
+		}
+		json_add(root, "zones", list);
+	}
+
+	/* Get bytes copied between stages for each output sample */
+	abuffer_get_stats(&copied, &output);
+	json_set_int64(root, "copied", copied);
+	json_set_int64(root, "output", output);
+	json_set_double(root, "copy_per_sample",
+			output > 0 ? (double) copied / output : 0.0);
 
 	/* Create a new JSON array */
 	list = json_new_array();
@@ -1141,6 +1956,9 @@ static int outputs_httpd_status(void *user_data, struct httpd_req *req,
 				json_set_int(tmp2, "samplerate", s->samplerate);
 				json_set_int(tmp2, "channels", s->channels);
 				json_set_int(tmp2, "volume", s->volume);
+				json_set_string(tmp2, "zone", s->zone->name);
+				json_set_int(tmp2, "recording",
+					     s->recorder != NULL);
 
 				/* Add object to array */
 				if(json_array_add(list2, tmp2) != 0)
@@ -1238,6 +2056,7 @@ static int outputs_httpd_list(void *user_data, struct httpd_req *req,
 #define HTTPD_PG HTTPD_GET | HTTPD_PUT
 struct url_table outputs_urls[] = {
 	{"/volume", HTTPD_EXT_URL, HTTPD_PG , 0, &outputs_httpd_volume},
+	{"/record/", HTTPD_EXT_URL, HTTPD_PUT, 0, &outputs_httpd_record},
 	{"/status", 0,             HTTPD_GET, 0, &outputs_httpd_status},
 	{"/list",   0,             HTTPD_GET, 0, &outputs_httpd_list},
 	{0, 0, 0, 0}
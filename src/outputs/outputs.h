@@ -22,18 +22,27 @@
 #include "httpd.h"
 #include "output.h"
 #include "json.h"
+#include "sample.h"
 
 struct output_module {
-	int (*open)(void **, unsigned long, unsigned char, unsigned int);
+	int (*open)(void **, unsigned long, unsigned char, unsigned int,
+		    enum sample_format, const char *, int);
 	int (*set_volume)(void *, unsigned int);
 	unsigned int (*get_volume)(void *);
+	int (*set_mixer)(void *, const char *);
+	int (*set_limiter)(void *, int, double);
+	int (*set_dither)(void *, int);
+	int (*set_tap)(void *, output_tap_cb, void *);
 	void *(*add_stream)(void *, unsigned long, unsigned char, unsigned long,
 			    int, a_read_cb, void *);
+	void *(*add_stream_get)(void *, unsigned long, unsigned char,
+				unsigned long, int, a_get_cb, void *);
 	int (*play_stream)(void *, void *);
 	int (*pause_stream)(void *, void *);
 	void (*flush_stream)(void *, void *);
 	int (*set_volume_stream)(void *, void *, unsigned int);
 	unsigned int (*get_volume_stream)(void *, void *);
+	int (*fade_stream)(void *, void *, unsigned int, unsigned long);
 	int (*set_cache_stream)(void *, void *, unsigned long);
 	unsigned long (*get_status_stream)(void *, void *,
 					   enum output_stream_key);
@@ -0,0 +1,303 @@
+/*
+ * recorder.c - A non-blocking stream recorder
+ *
+ * Copyright (c) 2014   A. Dilly
+ *
+ * AirCat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * AirCat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "recorder.h"
+#include "sample.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/**
+ * Recorder settings:
+ *  QUEUE_SIZE: size of queue between writers and writer thread (must be a
+ *              power of 2).
+ *  WRITE_SIZE: maximum size written in file at once.
+ *  THREAD_TIMEOUT: wait time of writer thread when queue is empty (in ms).
+ *  WAV_HEADER_SIZE: size of WAV header added for PCM samples.
+ * The queue can hold about 3s of PCM samples at 44.1kHz.
+ */
+#define QUEUE_SIZE (1 << 20)
+#define WRITE_SIZE 65536
+#define THREAD_TIMEOUT 50
+#define WAV_HEADER_SIZE 44
+
+/**
+ * Sample format of pipeline: IEEE float (3) or PCM (1)
+ */
+#define WAV_FORMAT (sample_get_format() == SAMPLE_FLOAT ? 3 : 1)
+#define WAV_BITS 32
+
+struct recorder_handle {
+	/* Output file */
+	int fd;
+	int is_wav;
+	unsigned long samplerate;
+	unsigned char channels;
+	uint64_t size;
+	uint64_t dropped;
+	/* Lock-free queue: write position is only updated by writer and read
+	 * position by writer thread.
+	 */
+	unsigned char *queue;
+	uint64_t write;
+	uint64_t read;
+	/* Writer thread */
+	pthread_t thread;
+	int stop;
+};
+
+static void *recorder_thread(void *user_data);
+
+static inline void recorder_put_le(unsigned char *p, uint32_t v, int len)
+{
+	/* Write value in little endian */
+	while(len-- > 0)
+	{
+		*p++ = v & 0xFF;
+		v >>= 8;
+	}
+}
+
+static int recorder_write_wav_header(int fd, unsigned long samplerate,
+				     unsigned char channels, uint64_t size)
+{
+	unsigned char header[WAV_HEADER_SIZE];
+	unsigned int align = channels * WAV_BITS / 8;
+
+	/* Size is limited to 4GB */
+	if(size > UINT32_MAX - WAV_HEADER_SIZE)
+		size = UINT32_MAX - WAV_HEADER_SIZE;
+
+	/* RIFF chunk */
+	memcpy(header, "RIFF", 4);
+	recorder_put_le(header + 4, size + WAV_HEADER_SIZE - 8, 4);
+	memcpy(header + 8, "WAVE", 4);
+
+	/* Format chunk */
+	memcpy(header + 12, "fmt ", 4);
+	recorder_put_le(header + 16, 16, 4);
+	recorder_put_le(header + 20, WAV_FORMAT, 2);
+	recorder_put_le(header + 22, channels, 2);
+	recorder_put_le(header + 24, samplerate, 4);
+	recorder_put_le(header + 28, samplerate * align, 4);
+	recorder_put_le(header + 32, align, 2);
+	recorder_put_le(header + 34, WAV_BITS, 2);
+
+	/* Data chunk */
+	memcpy(header + 36, "data", 4);
+	recorder_put_le(header + 40, size, 4);
+
+	/* Write header at beginning of file */
+	if(pwrite(fd, header, WAV_HEADER_SIZE, 0) != WAV_HEADER_SIZE)
+		return -1;
+
+	return 0;
+}
+
+int recorder_open(struct recorder_handle **handle, const char *file,
+		  unsigned long samplerate, unsigned char channels)
+{
+	struct recorder_handle *h;
+
+	if(file == NULL)
+		return -1;
+
+	/* Allocate structure */
+	*handle = malloc(sizeof(struct recorder_handle));
+	if(*handle == NULL)
+		return -1;
+	h = *handle;
+
+	/* Init structure */
+	memset(h, 0, sizeof(struct recorder_handle));
+	h->fd = -1;
+	h->is_wav = samplerate > 0;
+	h->samplerate = samplerate;
+	h->channels = channels;
+
+	/* Allocate queue */
+	h->queue = malloc(QUEUE_SIZE);
+	if(h->queue == NULL)
+		goto error;
+
+	/* Open file */
+	h->fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(h->fd < 0)
+		goto error;
+
+	/* Write a WAV header: sizes are updated on close */
+	if(h->is_wav)
+	{
+		if(recorder_write_wav_header(h->fd, samplerate, channels, 0)
+		   != 0)
+			goto error;
+		lseek(h->fd, WAV_HEADER_SIZE, SEEK_SET);
+	}
+
+	/* Start writer thread */
+	if(pthread_create(&h->thread, NULL, recorder_thread, h) != 0)
+		goto error;
+
+	return 0;
+
+error:
+	if(h->fd >= 0)
+		close(h->fd);
+	if(h->queue != NULL)
+		free(h->queue);
+	free(h);
+	*handle = NULL;
+	return -1;
+}
+
+size_t recorder_write(struct recorder_handle *h, const unsigned char *buffer,
+		      size_t size)
+{
+	uint64_t read;
+	size_t pos, len, count;
+
+	if(h == NULL || size == 0)
+		return 0;
+
+	/* Get free space in queue */
+	read = __atomic_load_n(&h->read, __ATOMIC_ACQUIRE);
+	if(size > QUEUE_SIZE - (h->write - read))
+	{
+		/* Queue is full: drop data */
+		__atomic_add_fetch(&h->dropped, size, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	/* Copy data to queue */
+	for(count = 0; count < size; count += len)
+	{
+		pos = (h->write + count) & (QUEUE_SIZE - 1);
+		len = size - count;
+		if(len > QUEUE_SIZE - pos)
+			len = QUEUE_SIZE - pos;
+		memcpy(h->queue + pos, buffer + count, len);
+	}
+
+	/* Publish data to writer thread */
+	__atomic_store_n(&h->write, h->write + size, __ATOMIC_RELEASE);
+
+	return size;
+}
+
+uint64_t recorder_get_size(struct recorder_handle *h)
+{
+	if(h == NULL)
+		return 0;
+
+	return __atomic_load_n(&h->size, __ATOMIC_RELAXED);
+}
+
+uint64_t recorder_get_dropped(struct recorder_handle *h)
+{
+	if(h == NULL)
+		return 0;
+
+	return __atomic_load_n(&h->dropped, __ATOMIC_RELAXED);
+}
+
+void recorder_add_dropped(struct recorder_handle *h, uint64_t size)
+{
+	if(h == NULL || size == 0)
+		return;
+
+	__atomic_add_fetch(&h->dropped, size, __ATOMIC_RELAXED);
+}
+
+static void *recorder_thread(void *user_data)
+{
+	struct recorder_handle *h = user_data;
+	uint64_t end;
+	size_t pos, len;
+	ssize_t ret;
+	int stop;
+
+	while(1)
+	{
+		/* Get stop signal before queue status to flush all data */
+		stop = __atomic_load_n(&h->stop, __ATOMIC_ACQUIRE);
+		end = __atomic_load_n(&h->write, __ATOMIC_ACQUIRE);
+
+		/* Queue is empty */
+		if(end == h->read)
+		{
+			if(stop)
+				break;
+			usleep(THREAD_TIMEOUT * 1000);
+			continue;
+		}
+
+		/* Get data until end of queue */
+		pos = h->read & (QUEUE_SIZE - 1);
+		len = end - h->read;
+		if(len > QUEUE_SIZE - pos)
+			len = QUEUE_SIZE - pos;
+		if(len > WRITE_SIZE)
+			len = WRITE_SIZE;
+
+		/* Write to file directly from queue */
+		ret = write(h->fd, h->queue + pos, len);
+		if(ret <= 0)
+		{
+			/* Disk error: drop data */
+			__atomic_add_fetch(&h->dropped, len, __ATOMIC_RELAXED);
+			ret = len;
+		}
+		else
+			__atomic_add_fetch(&h->size, ret, __ATOMIC_RELAXED);
+
+		/* Release space in queue */
+		__atomic_store_n(&h->read, h->read + ret, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+void recorder_close(struct recorder_handle *h)
+{
+	if(h == NULL)
+		return;
+
+	/* Stop writer thread when queue is empty */
+	__atomic_store_n(&h->stop, 1, __ATOMIC_RELEASE);
+	pthread_join(h->thread, NULL);
+
+	/* Update WAV header with data size */
+	if(h->is_wav)
+		recorder_write_wav_header(h->fd, h->samplerate, h->channels,
+					  h->size);
+
+	/* Close file */
+	close(h->fd);
+
+	/* Free queue */
+	free(h->queue);
+	free(h);
+}
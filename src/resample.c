@@ -25,6 +25,8 @@
 #include <soxr.h>
 
 #include "resample.h"
+#include "abuffer.h"
+#include "sample.h"
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -49,6 +51,13 @@ struct resample_handle {
 	a_read_cb input_callback;
 	a_write_cb output_callback;
 	void *user_data;
+	/* Input buffer descriptors: pending is a buffer not yet consumed */
+	a_get_cb get_callback;
+	void *get_user;
+	struct abuffer *pending;
+	size_t pending_pos;
+	/* Output buffer descriptors */
+	struct abuffer *pool;
 	/* Input buffer */
 	unsigned char *in_buffer;
 	size_t in_size;
@@ -62,14 +71,8 @@ struct resample_handle {
 	size_t tmp_len;
 	/* Mutex for read()/write() calls */
 	pthread_mutex_t mutex;
-	/* Mixing table: inspired from remix effect from sox */
-	struct {
-		unsigned num_in_channels;
-		struct in_spec {
-			unsigned channel_num;
-			float   multiplier;
-		} * in_specs;
-	} * out_specs;
+	/* Kernels of pipeline sample format */
+	const struct sample_ops *ops;
 };
 
 static int resample_init(struct resample_handle *h);
@@ -105,6 +108,7 @@ int resample_open(struct resample_handle **handle, unsigned long in_samplerate,
 	h->out_samplerate = out_samplerate;
 	h->out_channels = out_channels;
 	h->fmt_has_changed = 0;
+	h->ops = sample_get_pipeline();
 
 	/* Allocate input buffer */
 	h->in_len = 0;
@@ -129,10 +133,63 @@ int resample_open(struct resample_handle **handle, unsigned long in_samplerate,
 	return resample_init(h);
 }
 
+static int resample_get_input(void *user_data, unsigned char *buffer,
+			      size_t size, struct a_format *fmt)
+{
+	struct resample_handle *h = (struct resample_handle *) user_data;
+	struct abuffer *b;
+	int len;
+
+	/* Get next input buffer */
+	if(h->pending == NULL)
+	{
+		len = h->get_callback(h->get_user, &h->pending, size);
+		if(len <= 0)
+			return len;
+		h->pending_pos = 0;
+	}
+	b = h->pending;
+
+	/* Copy samples in input buffer */
+	len = b->len - h->pending_pos;
+	if(len > size)
+		len = size;
+	memcpy(buffer, &b->data[h->pending_pos*4], len * 4);
+	abuffer_count_copy(len);
+	format_cpy(fmt, &b->fmt);
+
+	/* Release buffer when fully consumed */
+	h->pending_pos += len;
+	if(h->pending_pos >= b->len)
+	{
+		abuffer_unref(b);
+		h->pending = NULL;
+	}
+
+	return len;
+}
+
+int resample_open_get(struct resample_handle **handle,
+		      unsigned long in_samplerate, unsigned char in_channels,
+		      unsigned long out_samplerate, unsigned char out_channels,
+		      a_get_cb input_callback, void *user_data)
+{
+	/* Open resampler with an input adapter for buffer descriptors */
+	if(resample_open(handle, in_samplerate, in_channels, out_samplerate,
+			 out_channels, &resample_get_input, NULL, NULL) != 0)
+		return -1;
+
+	/* Set input callback */
+	(*handle)->user_data = *handle;
+	(*handle)->get_callback = input_callback;
+	(*handle)->get_user = user_data;
+
+	return 0;
+}
+
 static int resample_init(struct resample_handle *h)
 {
 	soxr_io_spec_t io_spec;
-	int i, j;
 
 	/* Alloc a second buffer for in channel < out_channel */
 	if(h->in_channels < h->out_channels)
@@ -143,58 +200,11 @@ static int resample_init(struct resample_handle *h)
 			return -1;
 	}
 
-	/* Prepapre values for down/up-mixing */
-	if(h->in_channels != h->out_channels)
-	{
-		h->out_specs = malloc(h->out_channels * sizeof(*h->out_specs));
-		if(h->out_specs == NULL)
-			return -1;
-	}
-
-	/* Calculate coeff for down/up-mixing: inspired from remix effect from
-	 * sox library.
-	 */
-	if(h->in_channels > h->out_channels)
-	{
-		/* Down-mixing */
-		/* FIXME: for channels > 2 needs to add center on L and R */
-		for(i = 0; i < h->out_channels; i++)
-		{
-			unsigned in_per_out = (h->in_channels +
-					       h->out_channels - 1 - i) /
-					      h->out_channels;
-			h->out_specs[i].in_specs = malloc(in_per_out * 
-					     sizeof(*h->out_specs[i].in_specs));
-			h->out_specs[i].num_in_channels = in_per_out;
-
-			for (j = 0; j < in_per_out; ++j)
-			{
-				h->out_specs[i].in_specs[j].channel_num = j *
-							     h->out_channels +
-							     i;
-				h->out_specs[i].in_specs[j].multiplier = 1. /
-								     in_per_out;
-			}
-		}
-	}
-	else if(h->in_channels < h->out_channels)
-	{
-		/* Up-mixing */
-		for(i = 0; i < h->out_channels; i++)
-		{
-			h->out_specs[i].in_specs = malloc(
-					      sizeof(h->out_specs[i].in_specs));
-			h->out_specs[i].in_specs[0].channel_num = i %
-							       h->in_channels;
-		}
-	}
-
 	/* Set inout and output format */
-#ifdef USE_FLOAT
-	io_spec = soxr_io_spec(SOXR_FLOAT32_I, SOXR_FLOAT32_I);
-#else
-	io_spec = soxr_io_spec(SOXR_INT32_I, SOXR_INT32_I);
-#endif
+	if(h->ops->format == SAMPLE_FLOAT)
+		io_spec = soxr_io_spec(SOXR_FLOAT32_I, SOXR_FLOAT32_I);
+	else
+		io_spec = soxr_io_spec(SOXR_INT32_I, SOXR_INT32_I);
 
 	/* Create converter */
 	h->soxr = soxr_create((double)h->in_samplerate,
@@ -214,86 +224,20 @@ static void resample_free(struct resample_handle *h)
 		soxr_delete(h->soxr);
 	h->soxr = NULL;
 
-	/* Free specs for down/up-mixing */
-	if(h->out_specs != NULL)
-	{
-		int i;
-		for(i = 0; i < h->out_channels; i++)
-			if(h->out_specs[i].in_specs != NULL)
-				free(h->out_specs[i].in_specs);
-		free(h->out_specs);
-	}
-	h->out_specs = NULL;
-
 	/* Free buffer */
 	if(h->out_buffer != NULL)
 		free(h->out_buffer);
 	h->out_buffer = NULL;
 }
 
-static int resample_down_mix(struct resample_handle *h, unsigned char *buffer,
-			     size_t len, unsigned char in_channels,
-			     unsigned char out_channels)
-{
-#ifdef USE_FLOAT
-	float sample = 0;
-	float *p_in = (float*) buffer;
-	float *p_out = (float*) buffer;
-#else
-	int32_t sample = 0;
-	int32_t *p_in = (int32_t*) buffer;
-	int32_t *p_out = (int32_t*) buffer;
-
-#endif
-	size_t i, j, k;
-
-	if(len <= 0)
-		return 0;
-
-	/* Down-mixing channels: inspired from remix effect from sox  */
-	for(i = len; i--; p_in += in_channels)
-	{
-		for(j = 0; j < h->out_channels; j++)
-		{
-			sample = 0;
-			for(k = 0; k < h->out_specs[j].num_in_channels; k++)
-			{
-				sample +=
-				   p_in[h->out_specs[j].in_specs[k].channel_num]
-				   * h->out_specs[j].in_specs[k].multiplier;
-			}
-			*(p_out++) = sample;
-		}
-	}
-
-	return len * out_channels / in_channels;
-}
-
-static int resample_up_mix(struct resample_handle *h, unsigned char *in_buffer,
-			   unsigned char *out_buffer, size_t len,
-			   unsigned char in_channels,
-			   unsigned char out_channels)
+static int resample_down_mix(struct resample_handle *h,
+			     unsigned char *buffer, size_t len)
 {
-#ifdef USE_FLOAT
-	float *p_in = (float*) in_buffer;
-	float *p_out = (float*) out_buffer;
-#else
-	int32_t *p_in = (int32_t*) in_buffer;
-	int32_t *p_out = (int32_t*) out_buffer;
-#endif
-	int i, j;
-
-	/* Up-mixing channels: inspired from remix effect from sox */
-	for(i = len; i--; p_in += in_channels)
-	{
-		for(j = 0; j < out_channels; j++)
-		{
-			*(p_out++) = 
-			  p_in[h->out_specs[j].in_specs[0].channel_num];
-		}
-	}
+	/* Down-mixing channels: inspired from remix effect from sox */
+	h->ops->down_mix(buffer, len / h->in_channels, h->in_channels,
+			 h->out_channels);
 
-	return len *out_channels / in_channels;
+	return len * h->out_channels / h->in_channels;
 }
 
 static int resample_process(struct resample_handle *h, unsigned char *buffer,
@@ -347,8 +291,7 @@ done:
 			{
 				len = resample_down_mix(h,
 						     &h->in_buffer[h->in_len*4],
-						     len, h->in_channels,
-						     h->out_channels);
+						     len);
 			}
 			h->in_len += len;
 		}
@@ -377,6 +320,7 @@ flush:
 			memmove(h->in_buffer,
 				&h->in_buffer[in_consumed*in_scale],
 				h->in_len * 4);
+			abuffer_count_copy(h->in_len);
 		}
 
 		/* Audio format has changed and engine is flushed */
@@ -410,10 +354,9 @@ flush:
 		/* Up-mixing channels: inspired from remix effect from sox */
 		if(out_samples > 0 && h->in_channels < h->out_channels)
 		{
-			resample_up_mix(h, h->out_buffer,
-					&buffer[total_size * 4],
-					out_samples * h->in_channels,
-					h->in_channels, h->out_channels);
+			h->ops->up_mix(&buffer[total_size * 4], h->out_buffer,
+				       out_samples, h->in_channels,
+				       h->out_channels);
 		}
 
 		/* Update total size */
@@ -427,6 +370,47 @@ flush:
 	return total_size;
 }
 
+static inline int resample_can_bypass(struct resample_handle *h)
+{
+	/* No conversion is needed and engine is empty */
+	return h->in_samplerate == h->out_samplerate &&
+	       h->in_channels == h->out_channels && h->in_len == 0 &&
+	       h->fmt_has_changed == 0 && soxr_delay(h->soxr) == 0;
+}
+
+static int resample_bypass(struct resample_handle *h, unsigned char *buffer,
+			   size_t size, struct a_format *fmt)
+{
+	struct a_format in_fmt = A_FORMAT_INIT;
+	int len;
+
+	/* Limit to input buffer size in case of format change */
+	if(size > h->in_size)
+		size = h->in_size;
+
+	/* Read samples directly in output buffer */
+	len = h->input_callback(h->user_data, buffer, size, &in_fmt);
+	if(len <= 0)
+		return len;
+
+	/* Format has changed: process samples with new format */
+	if((in_fmt.samplerate != 0 && in_fmt.samplerate != h->in_samplerate) ||
+	   (in_fmt.channels != 0 && in_fmt.channels != h->in_channels))
+	{
+		memcpy(h->in_buffer, buffer, len * 4);
+		h->fmt_has_changed = len;
+		h->new_samplerate = in_fmt.samplerate;
+		h->new_channels = in_fmt.channels;
+		return resample_process(h, buffer, size, fmt);
+	}
+
+	/* Fill format */
+	fmt->samplerate = h->out_samplerate;
+	fmt->channels = h->out_channels;
+
+	return len;
+}
+
 int resample_read(void *user_data, unsigned char *buffer, size_t size,
 		  struct a_format *fmt)
 {
@@ -439,10 +423,18 @@ int resample_read(void *user_data, unsigned char *buffer, size_t size,
 	/* Lock buffer access */
 	pthread_mutex_lock(&h->mutex);
 
-	/* Input data are provided by input_callback */
-	if(h->input_callback != NULL)
+	/* Input data are provided by input_callback: samples are passed
+	 * through without conversion when possible (bit-perfect).
+	 */
+	if(h->input_callback != NULL && resample_can_bypass(h))
+	{
+		size = resample_bypass(h, buffer, size, fmt);
+	}
+	else if(h->input_callback != NULL)
 	{
 		size = resample_process(h, buffer, size, fmt);
+		if((int) size > 0)
+			abuffer_count_copy(size);
 	}
 	else
 	{
@@ -462,6 +454,65 @@ int resample_read(void *user_data, unsigned char *buffer, size_t size,
 	return size;
 }
 
+int resample_get(void *user_data, struct abuffer **buffer, size_t size)
+{
+	struct resample_handle *h = (struct resample_handle *) user_data;
+	struct abuffer *b;
+	int len = 0;
+
+	/* get() needs a buffer descriptor input */
+	if(h == NULL || h->get_callback == NULL)
+		return -1;
+
+	/* Lock buffer access */
+	pthread_mutex_lock(&h->mutex);
+
+	/* No conversion is needed: pass input buffer through */
+	if(h->pending == NULL && resample_can_bypass(h))
+	{
+		len = h->get_callback(h->get_user, &b, size);
+		if(len <= 0)
+			goto end;
+
+		/* Same format: return input buffer untouched */
+		if((b->fmt.samplerate == 0 ||
+		    b->fmt.samplerate == h->in_samplerate) &&
+		   (b->fmt.channels == 0 || b->fmt.channels == h->in_channels))
+		{
+			*buffer = b;
+			goto end;
+		}
+
+		/* Format has changed: buffer is processed below */
+		h->pending = b;
+		h->pending_pos = 0;
+	}
+
+	/* Get a free output buffer */
+	b = abuffer_get_writable(&h->pool, size);
+	if(b == NULL)
+	{
+		len = 0;
+		goto end;
+	}
+
+	/* Convert samples */
+	len = resample_process(h, b->data, size, &b->fmt);
+	if(len <= 0)
+		goto end;
+	b->len = len;
+	abuffer_count_copy(len);
+
+	/* Return a new reference on output buffer */
+	*buffer = abuffer_ref(b);
+
+end:
+	/* Unlock buffer access */
+	pthread_mutex_unlock(&h->mutex);
+
+	return len;
+}
+
 ssize_t resample_write(void *user_data, const unsigned char *buffer,
 		       size_t size, struct a_format *fmt)
 {
@@ -506,8 +557,7 @@ ssize_t resample_write(void *user_data, const unsigned char *buffer,
 		{
 			len = resample_down_mix(h,
 					       &h->in_buffer[h->in_len*4],
-					       len, h->in_channels,
-					       h->out_channels);
+					       len);
 		}
 		h->in_len += len;
 	}
@@ -559,6 +609,13 @@ unsigned long resample_delay(struct resample_handle *h)
 			 h->new_channels;
 	}
 
+	/* Add pending input buffer */
+	if(h->pending != NULL)
+	{
+		delay += (h->pending->len - h->pending_pos) * 1000 /
+			 h->in_samplerate / h->in_channels;
+	}
+
 	/* Unlock buffer access */
 	pthread_mutex_unlock(&h->mutex);
 
@@ -577,6 +634,10 @@ void resample_flush(struct resample_handle *h)
 	h->in_len = 0;
 	h->tmp_len = 0;
 
+	/* Release pending input buffer */
+	abuffer_unref(h->pending);
+	h->pending = NULL;
+
 	/* Reset resample/mixer engine */
 	resample_free(h);
 	if(h->fmt_has_changed > 0)
@@ -603,6 +664,10 @@ int resample_close(struct resample_handle *h)
 	if(h->tmp_buffer != NULL)
 		free(h->tmp_buffer);
 
+	/* Release buffer descriptors */
+	abuffer_unref(h->pending);
+	abuffer_unref(h->pool);
+
 	/* Free input buffer */
 	if(h->in_buffer != NULL)
 		free(h->in_buffer);
@@ -73,6 +73,9 @@ struct rtp_handle {
 	/* RTCP socket */
 	int rtcp_sock;
 	struct sockaddr_in rtcp_addr;
+	/* Sockets in event loop: NULL if packets are received in rtp_read() */
+	struct loop_fd *fd;
+	struct loop_fd *rtcp_fd;
 	/* Session values */
 	uint32_t ssrc;
 	uint8_t payload;
@@ -108,9 +111,13 @@ struct rtp_handle {
 	pthread_mutex_t mutex;
 };
 
+static void rtp_sock_cb(void *user_data, int fd, int events);
+static void rtp_rtcp_sock_cb(void *user_data, int fd, int events);
+
 int rtp_open(struct rtp_handle **handle, struct rtp_attr *attr)
 {
 	struct sockaddr_in addr;
+	struct ip_mreq mreq;
 	struct rtp_handle *h;
 	struct rtp_packet *p;
 	int opt, i;
@@ -130,6 +137,8 @@ int rtp_open(struct rtp_handle **handle, struct rtp_attr *attr)
 	/* Init structure */
 	h->port = attr->port;
 	h->rtcp_sock = -1;
+	h->fd = NULL;
+	h->rtcp_fd = NULL;
 	h->ssrc = attr->ssrc;
 	h->payload = attr->payload;
 	h->max_packet_size = attr->max_packet_size;
@@ -222,6 +231,15 @@ int rtp_open(struct rtp_handle **handle, struct rtp_attr *attr)
 	}
 #endif
 
+	/* Share port with other receivers of multicast group */
+	if(attr->group != NULL)
+	{
+		opt = 1;
+		if(setsockopt(h->sock, SOL_SOCKET, SO_REUSEADDR, &opt,
+			      sizeof(opt)) < 0)
+			return -1;
+	}
+
 	/* Bind */
 	memset(&addr, 0, sizeof(addr));
 	addr.sin_family = AF_INET;
@@ -230,6 +248,17 @@ int rtp_open(struct rtp_handle **handle, struct rtp_attr *attr)
 	if(bind(h->sock, (struct sockaddr *) &addr, sizeof(addr)) != 0)
 		return -1;
 
+	/* Join multicast group */
+	if(attr->group != NULL)
+	{
+		memset(&mreq, 0, sizeof(mreq));
+		memcpy(&mreq.imr_multiaddr, attr->group, 4);
+		mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+		if(setsockopt(h->sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+			      sizeof(mreq)) < 0)
+			return -1;
+	}
+
 	/* Open RTCP socket */
 	if(attr->rtcp_port != 0)
 	{
@@ -244,7 +273,7 @@ int rtp_open(struct rtp_handle **handle, struct rtp_attr *attr)
 		{
 			/* Open socket */
 			if((h->rtcp_sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
-				return 0;
+				goto end;
 
 			/* Force socket to bind */
 			opt = 1;
@@ -253,7 +282,7 @@ int rtp_open(struct rtp_handle **handle, struct rtp_attr *attr)
 			{
 				close(h->rtcp_sock);
 				h->rtcp_sock = -1;
-				return 0;
+				goto end;
 			}
 
 			/* Bind */
@@ -266,11 +295,25 @@ int rtp_open(struct rtp_handle **handle, struct rtp_attr *attr)
 			{
 				close(h->rtcp_sock);
 				h->rtcp_sock = -1;
-				return 0;
+				goto end;
 			}
 		}
 	}
 
+end:
+	/* Receive packets from event loop */
+	if(attr->loop != NULL)
+	{
+		h->fd = loop_add_fd(attr->loop, h->sock, LOOP_READ,
+				    rtp_sock_cb, h);
+		if(h->fd == NULL)
+			return -1;
+		if(h->rtcp_sock >= 0)
+			h->rtcp_fd = loop_add_fd(attr->loop, h->rtcp_sock,
+						 LOOP_READ, rtp_rtcp_sock_cb,
+						 h);
+	}
+
 	return 0;
 }
 
@@ -644,6 +687,48 @@ static ssize_t rtp_get(struct rtp_handle *h, unsigned char *buffer, size_t size)
 	return len;
 }
 
+static void rtp_recv_packet(struct rtp_handle *h)
+{
+	unsigned char packet[MAX_RTP_PACKET_SIZE];
+	ssize_t len;
+
+	/* Lock buffer access */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Get next packet from RTP socket */
+	len = rtp_recv(h, packet, MAX_RTP_PACKET_SIZE);
+	if(len <= 0)
+		goto end;
+
+	/* Drop packet after a flush */
+	if(h->drop_count > 0)
+	{
+		h->drop_count--;
+		goto end;
+	}
+
+	/* Add packet to jitter buffer */
+	_rtp_put(h, packet, len);
+
+end:
+	/* Unlock buffer access */
+	pthread_mutex_unlock(&h->mutex);
+}
+
+static void rtp_sock_cb(void *user_data, int fd, int events)
+{
+	if(events & LOOP_READ)
+		rtp_recv_packet(user_data);
+}
+
+static void rtp_rtcp_sock_cb(void *user_data, int fd, int events)
+{
+	unsigned char packet[MAX_RTP_PACKET_SIZE];
+
+	if(events & LOOP_READ)
+		rtp_recv_rtcp(user_data, packet, MAX_RTP_PACKET_SIZE);
+}
+
 ssize_t rtp_read(struct rtp_handle *h, unsigned char *buffer, size_t size)
 {
 	unsigned char packet[MAX_RTP_PACKET_SIZE];
@@ -656,9 +741,9 @@ ssize_t rtp_read(struct rtp_handle *h, unsigned char *buffer, size_t size)
 	if(h == NULL)
 		return -1;
 
-	/* Empty UDP queue and fill RTP packet queue */
+	/* Empty UDP queue and fill RTP packet queue if no event loop */
 	max_sock = h->sock > h->rtcp_sock ? h->sock + 1 : h->rtcp_sock + 1;
-	for(i = 0; i < MAX_RTP_RCV; i++)
+	for(i = 0; h->fd == NULL && i < MAX_RTP_RCV; i++)
 	{
 		/* Init sockets */
 		FD_ZERO(&readfs);
@@ -677,30 +762,9 @@ ssize_t rtp_read(struct rtp_handle *h, unsigned char *buffer, size_t size)
 			rtp_recv_rtcp(h, packet, MAX_RTP_PACKET_SIZE);
 		}
 
-		/* Lock buffer access */
-		pthread_mutex_lock(&h->mutex);
-
 		/* Packets are available on RTP socket */
 		if(FD_ISSET(h->sock, &readfs))
-		{
-			/* Get next packet from RTP socket */
-			len = rtp_recv(h, packet, MAX_RTP_PACKET_SIZE);
-			if(len <= 0)
-				goto next;
-
-			/* Drop packet after a flush */
-			if(h->drop_count > 0)
-			{
-				h->drop_count--;
-				goto next;
-			}
-
-			/* Add packet to jitter buffer */
-			_rtp_put(h, packet, len);
-		}
-next:
-		/* Unlock buffer access */
-		pthread_mutex_unlock(&h->mutex);
+			rtp_recv_packet(h);
 	}
 
 	/* Just receive packets */
@@ -875,6 +939,10 @@ int rtp_close(struct rtp_handle *h)
 	if(h == NULL)
 		return 0;
 
+	/* Remove sockets from event loop */
+	loop_remove_fd(h->fd);
+	loop_remove_fd(h->rtcp_fd);
+
 	/* Free pool */
 	while(h->pool != NULL)
 	{
@@ -895,9 +963,11 @@ int rtp_close(struct rtp_handle *h)
 		free(p);
 	}
 
-	/* Close socket */
+	/* Close sockets */
 	if(h->sock > 0)
 		close(h->sock);
+	if(h->rtcp_sock > 0)
+		close(h->rtcp_sock);
 
 	free(h);
 
@@ -22,7 +22,6 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <poll.h>
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -39,10 +38,18 @@
 #endif
 
 #include "utils.h"
+#include "loop.h"
 #include "rtsp.h"
 
+/* Maximum size of a request header and of a body chunk passed to callback */
 #define BUFFER_SIZE 8192
+/* Initial size of input buffer: it grows up to twice BUFFER_SIZE */
+#define IN_BUFFER_SIZE 1024
+/* Initial size of response header buffer */
+#define RESP_BUFFER_SIZE 256
 #define REQUEST_STRING_LENGTH 32
+/* Maximum headers indexed in a request */
+#define MAX_HEADERS 32
 
 #define min(x,y) x <= y ? x : y
 
@@ -54,49 +61,77 @@ enum {
 };
 
 struct rtsp_header {
+	/* Hash of lower case name */
+	unsigned int hash;
 	char *name;
 	char *value;
-	struct rtsp_header *next;
+};
+
+struct rtsp_server {
+	/* RTSP handle */
+	struct rtsp_handle *h;
+	/* Listening socket and port */
+	int sock;
+	unsigned int port;
+	struct loop_fd *fd;
+	/* Connected users */
+	int users;
+	/* User data passed to callbacks for its clients */
+	void *user_data;
+	/* Next element */
+	struct rtsp_server *next;
 };
 
 struct rtsp_client {
+	/* Server which accepted client */
+	struct rtsp_server *server;
 	/* Socket fd */
 	int sock;
-	struct pollfd *poll_entry;
+	struct loop_fd *fd;
 	struct sockaddr_in addr;
 	/* IP Address */
 	unsigned char server_ip[4];
 	unsigned char ip[4];
 	unsigned int server_port;
 	unsigned int port;
+	/* Client name (resolved on first call to rtsp_get_name()) */
 	char *name;
-	/* Header buffer */
-	char req_buffer[BUFFER_SIZE];
-	size_t req_len;
-	/* Packet buffer */
-	unsigned char in_buffer[BUFFER_SIZE];
+	int name_resolved;
+	/* Input buffer: requests are parsed in place and a request stays at
+	 * same address until its response is prepared.
+	 */
+	char *in_buffer;
+	size_t in_size;
 	size_t in_len;
+	/* Start of current request, end of header search and body start */
+	size_t in_pos;
+	size_t in_scan;
+	size_t in_body;
+	/* Body bytes not yet passed to read callback */
 	size_t in_content_len;
 	/* Response header buffer */
 	char *resp_buffer;
 	size_t resp_len;
+	size_t resp_size;
 	/* Response packet buffer */
 	unsigned char *packet_buffer;
 	size_t packet_len;
-	/* Buffer pointers */
+	/* Send buffer pointers */
 	char *buffer_ptr;
 	char *buffer_end;
 	/* RTSP status */
 	int state;
 	/* RTSP variables */
-	unsigned int seq;
 	int request;
 	char request_string[REQUEST_STRING_LENGTH];
 	char *url;
-	struct rtsp_header *headers;
+	/* Headers of current request */
+	struct rtsp_header headers[MAX_HEADERS];
+	int header_count;
 	/* User data */
 	void *user_data;
-	/* Next element */
+	/* Client list */
+	struct rtsp_client *prev;
 	struct rtsp_client *next;
 #ifdef HAVE_OPENSSL
 	/* Digest auth */
@@ -105,47 +140,48 @@ struct rtsp_client {
 };
 
 struct rtsp_handle {
-	int sock;
-	int users;
+	/* Event loop */
+	struct loop_handle *loop;
+	/* Listening servers: maximum users is for each server */
+	struct rtsp_server *servers;
+	int server_count;
 	int max_user;
 	int (*request_callback)(struct rtsp_client *, int, const char *,
 				void *);
 	int (*read_callback)(struct rtsp_client *, unsigned char *, size_t, int,
 			     void *);
 	int (*close_callback)(struct rtsp_client *, void *);
-	void *user_data;
-	struct pollfd *poll_table;
 	struct rtsp_client *clients;
 };
 
-static void rtsp_accept(struct rtsp_handle *h);
+static int rtsp_accept(struct rtsp_handle *h, struct rtsp_server *s);
 static int rtsp_handle_client(struct rtsp_handle *h, struct rtsp_client *c);
 static void rtsp_close_client(struct rtsp_handle *h, struct rtsp_client *c);
+static void rtsp_client_cb(void *user_data, int fd, int events);
 
-static void rtsp_accept(struct rtsp_handle *h)
+static int rtsp_accept(struct rtsp_handle *h, struct rtsp_server *s)
 {
 	struct rtsp_client *c = NULL;
 	struct sockaddr_in addr;
-	char hostname[1024];
-	char service[20];
 	socklen_t len;
 	int sock = -1;
 
 	/* Accept client */
 	len = sizeof(addr);
-	sock = accept(h->sock, (struct sockaddr *)&addr, &len);
+	sock = accept(s->sock, (struct sockaddr *)&addr, &len);
 	if(sock < 0)
-		return;
+		return -1;
 
 	/* Set as non blocking socket */
 	fcntl(sock, F_SETFL, O_NONBLOCK);
 
 	/* Too many users */
-	if(h->users >= h->max_user)
+	if(s->users >= h->max_user)
 	{
-		send(sock, "RTSP/1.0 503 Server too busy\r\n\r\n", 32, 0);
+		send(sock, "RTSP/1.0 503 Server too busy\r\n\r\n", 32,
+		     MSG_NOSIGNAL);
 		close(sock);
-		return;
+		return 0;
 	}
 
 	/* add a new connection */
@@ -153,72 +189,72 @@ static void rtsp_accept(struct rtsp_handle *h)
 	if(c == NULL)
 	{
 		close(sock);
-		return;
+		return 0;
 	}
 
-	/* Fill client structure */
+	/* Fill client structure: input buffer is allocated on first read */
 	memset(c, 0, sizeof(struct rtsp_client));
+	c->server = s;
 	c->sock = sock;
-	c->poll_entry = NULL;
-        c->state = RTSPSTATE_WAIT_REQUEST;
+	c->state = RTSPSTATE_WAIT_REQUEST;
 	c->addr = addr;
-	c->headers = NULL;
 	/* Get Client IP Address */
 	memcpy(c->ip, &addr.sin_addr, 4);
 	c->port = ntohs(addr.sin_port);
-	/* Get Client name and service */
-	hostname[0] = '\0';
-	getnameinfo((struct sockaddr*)&addr, sizeof(addr), hostname,
-		    sizeof(hostname), service, sizeof(service), 0);
-	c->name = hostname[0] != '\0' ? strdup(hostname) : NULL;
 	/* Get Server IP Address */
 	len = sizeof(addr);
 	getsockname(sock, (struct sockaddr*)&addr, &len);
 	memcpy(c->server_ip, &addr.sin_addr, 4);
 	c->server_port = ntohs(addr.sin_port);
-	/* Init buffer lens */
-	c->req_len = BUFFER_SIZE;
-	c->in_len = BUFFER_SIZE;
-	c->in_content_len = 0;
-	c->resp_len = 0;
-	c->packet_len = 0;
-	/* Init buffers */
-	c->resp_buffer = NULL;
-	c->packet_buffer = NULL;
-	c->buffer_ptr = c->req_buffer;
-	c->buffer_end = c->req_buffer + c->req_len;
-	/* User data */
-	c->user_data = NULL;
 
-	/* Update user number */
+	/* Wait for requests in loop */
+	c->fd = loop_add_fd(h->loop, sock, LOOP_READ, rtsp_client_cb, c);
+	if(c->fd == NULL)
+	{
+		free(c);
+		close(sock);
+		return 0;
+	}
+
+	/* Add client to list */
+	c->prev = NULL;
 	c->next = h->clients;
+	if(h->clients != NULL)
+		h->clients->prev = c;
 	h->clients = c;
-	h->users++;
+	s->users++;
 
-	return;
+	return 0;
 }
 
-static int rtsp_parse_request(struct rtsp_client *c)
+static unsigned int rtsp_hash(const char *name)
 {
-	struct rtsp_header *head;
-	char *p = NULL;
-	char *p_end = NULL;
-	char *name = NULL;
-	char *value = NULL;
+	unsigned int hash = 5381;
+	int ch;
 
-	/* Free headers from last request */
-	while(c->headers != NULL)
+	/* Case insensitive djb2 hash */
+	while(*name != '\0')
 	{
-		head = c->headers;
-		c->headers = head->next;
-		free(head);
+		ch = *name++;
+		if(ch >= 'A' && ch <= 'Z')
+			ch += 'a' - 'A';
+		hash = (hash * 33) ^ ch;
 	}
 
-	if(c->req_buffer == NULL)
-		return -1;
+	return hash;
+}
+
+static int rtsp_parse_request(struct rtsp_client *c, char *p, char *end)
+{
+	struct rtsp_header *head;
+	char *p_end;
+	char *value;
+
+	/* Terminate request */
+	*end = 0;
+	c->header_count = 0;
 
 	/* Read request command */
-	p = (char*) c->req_buffer;
 	p_end = strchr(p, ' ');
 	if(p_end == NULL)
 		return -1;
@@ -250,6 +286,7 @@ static int rtsp_parse_request(struct rtsp_client *c)
 
 	/* Copy request string */
 	strncpy(c->request_string, p, REQUEST_STRING_LENGTH);
+	c->request_string[REQUEST_STRING_LENGTH-1] = 0;
 
 	/* Read url */
 	p = p_end+1;
@@ -259,260 +296,302 @@ static int rtsp_parse_request(struct rtsp_client *c)
 	*p_end = 0;
 	c->url = p;
 
-	/* Read all lines until end of request */
-	name = p_end;
-	while(name < c->buffer_end)
-	{
-		/* Search next line */
-		while(name < c->buffer_end && *name != '\n')
-			name++;
-		name++;
+	/* Skip protocol version */
+	p = strchr(p_end+1, '\n');
+	if(p == NULL)
+		return -1;
+	p++;
 
-		/*  End of header */
-		if(name[0] == '\r' && name[1] == '\n')
-			break;
+	/* Index all header lines */
+	for(; p < end; p = p_end+1)
+	{
+		/* Find end of line */
+		p_end = strchr(p, '\n');
+		if(p_end == NULL)
+			p_end = end;
+		*p_end = 0;
+		if(p_end > p && p_end[-1] == '\r')
+			p_end[-1] = 0;
 
 		/* Get name */
-		p_end = strchr(name, ':');
-		if(p_end == NULL)
+		value = strchr(p, ':');
+		if(value == NULL)
 			continue;
-		*p_end = 0;
-		value = p_end+1;
+		*value++ = 0;
 		/* Skip all whitespace */
-		while(*value != 0 && *value == ' ')
+		while(*value == ' ')
 			value++;
-		/* Find end of string */
-		p_end = value;
-		while(*p_end != 0 && *p_end != '\r')
-			p_end++;
-		*p_end = 0;
 
-		/* Add name and value to list */
-		head = malloc(sizeof(struct rtsp_header));
-		if(head == NULL)
-			return -1;
-		head->name = name;
-		head->value = value;
-		head->next = c->headers;
-		c->headers = head;
+		/* Too many headers: ignore next ones */
+		if(c->header_count == MAX_HEADERS)
+			continue;
 
-		name = p_end+1;
+		/* Add name and value to index */
+		head = &c->headers[c->header_count++];
+		head->hash = rtsp_hash(p);
+		head->name = p;
+		head->value = value;
 	}
 
 	return 0;
 }
 
-static int rtsp_handle_client(struct rtsp_handle *h, struct rtsp_client *c)
+static int rtsp_read_client(struct rtsp_client *c)
 {
-	const char *ptr;
+	size_t size;
+	char *p;
 	int len;
 
-	/* Return error */
-	if(c->poll_entry->revents & (POLLERR | POLLHUP))
-		return -1;
+	/* Remove previous requests from buffer if none is in progress */
+	if(c->state == RTSPSTATE_WAIT_REQUEST && c->in_pos > 0)
+	{
+		memmove(c->in_buffer, c->in_buffer + c->in_pos,
+			c->in_len - c->in_pos);
+		c->in_len -= c->in_pos;
+		c->in_scan -= c->in_pos;
+		c->in_pos = 0;
+	}
 
-	switch(c->state)
+	/* Grow buffer if full: a request header and a body chunk fit in */
+	if(c->in_len == c->in_size)
 	{
-		case RTSPSTATE_WAIT_REQUEST:
+		if(c->in_size >= BUFFER_SIZE * 2)
+			return -1;
+		size = c->in_size == 0 ? IN_BUFFER_SIZE : c->in_size * 2;
+		if(size > BUFFER_SIZE * 2)
+			size = BUFFER_SIZE * 2;
+		p = realloc(c->in_buffer, size);
+		if(p == NULL)
+			return -1;
+		c->in_buffer = p;
+		c->in_size = size;
+	}
+
+	/* Read as much data as possible */
+	len = recv(c->sock, c->in_buffer + c->in_len, c->in_size - c->in_len,
+		   0);
+	if(len <= 0)
+	{
+		/* Peer closed connection */
+		if(len == 0)
+			return -1;
+		if(errno != EAGAIN && errno != EINTR)
+			return -1;
+		return 0;
+	}
+	c->in_len += len;
+
+	return len;
+}
+
+static void rtsp_prepare_reply(struct rtsp_client *c)
+{
+	if(c->resp_buffer == NULL)
+	{
+		/* No response from callback: send a bad request */
+		c->resp_buffer = strdup("RTSP/1.0 400 Bad Request\r\n\r\n");
+		c->resp_len = c->resp_buffer != NULL ?
+						      strlen(c->resp_buffer) : 0;
+		c->resp_size = c->resp_len;
+		if(c->packet_buffer != NULL)
 		{
-			/* Return if no event */
-			if(!(c->poll_entry->revents & POLLIN))
-				return 0;
-
-			/* Read data until end of request or end of reception */
-			while(1)
-			{
-				/* Read one byte */
-				len = recv(c->sock, c->buffer_ptr, 1, 0);
-				if(len <= 0)
-				{
-					if(errno != EAGAIN && errno != EINTR)
-						return -1;
-					/* Peer closed connection */
-					if(c->buffer_ptr == c->req_buffer)
-						return -1;
-					return 0;
-				}
-				c->buffer_ptr += len;
-
-				/* search for end of request. */
-				ptr = c->buffer_ptr;
-				if((ptr >= c->req_buffer + 2 &&
-				   !memcmp(ptr-2,"\n\n", 2)) ||
-				  (ptr >= c->req_buffer + 4 &&
-				   !memcmp(ptr-4, "\r\n\r\n", 4)))
-				{
-					/* Terminate string by '\0' */
-					*c->buffer_ptr = 0;
-
-					/* Reached end of request */
-					if(rtsp_parse_request(c) < 0)
-						return -1;
-
-					/* Look for CSeq header */
-					if(rtsp_get_header(c, "CSeq", 1)
-					    == NULL)
-						return -1;
-
-					/* Call callback function */
-					if(h->request_callback(c, c->request, 
-							       c->url,
-							       h->user_data)
-					    < 0)
-						return -1;
-
-					/* Prepare response */
-					ptr = rtsp_get_header(c,
-							      "Content-Length",
-							      1);
-					if(ptr == NULL || atol(ptr) == 0)
-					{
-						if(c->resp_buffer == NULL)
-						{
-							/* No response from 
-							 * callback: send a bad
-							 * request
-							 */
-							c->resp_buffer = strdup(
-							 "RTSP/1.0 400 "
-							 "Bad Request\r\n\r\n");
-							c->resp_len = strlen(
-								c->resp_buffer);
-							if(c->packet_buffer
-							    != NULL)
-							{
-								free(
-							      c->packet_buffer);
-								c->packet_buffer
-									 = NULL;
-								c->packet_len =
-									      0;
-							}
-						}
-						c->buffer_ptr = c->resp_buffer;
-						c->buffer_end = c->resp_buffer +
-								c->resp_len;
-						c->state = RTSPSTATE_SEND_REPLY;
-					}
-					else /* Read packet */
-					{
-						c->in_content_len = atol(ptr);
-						c->buffer_ptr = (char*)
-								   c->in_buffer;
-						c->buffer_end = (char*)
-						       c->in_buffer + c->in_len;
-						c->state =
-							  RTSPSTATE_WAIT_PACKET;
-					}
-					break;
-				}
-				else if(ptr >= c->buffer_end)
-				{
-					/* Too long request: close connection */
-					return -1;
-				}
-			}
-			break;
+			free(c->packet_buffer);
+			c->packet_buffer = NULL;
+			c->packet_len = 0;
 		}
-		case RTSPSTATE_WAIT_PACKET:
-		{
-			/* Return if no event */
-			if(!(c->poll_entry->revents & POLLIN))
-				return 0;
-
-			/* Read until end of buffer_size or content length */
-			len = min(c->buffer_end-c->buffer_ptr,
-				  c->in_content_len);
-			len = recv(c->sock, c->buffer_ptr, len, 0);
-			if(len <= 0)
-			{
-				if(errno != EAGAIN && errno != EINTR)
-					return -1;
-				return 0;
-			}
-			c->in_content_len -= len;
-			c->buffer_ptr += len;
-
-			/* End of stream or buffer is full */
-			if(c->in_content_len == 0 ||
-			   c->buffer_ptr == c->buffer_end)
-			{
-				/* Call read callback function */
-				if(h->read_callback != NULL)
-				{
-					if(h->read_callback(c, c->in_buffer,
-				     (unsigned char*)c->buffer_ptr-c->in_buffer,
-				     c->in_content_len == 0 ? 1:0, h->user_data)
-					    < 0)
-						return -1;
-				}
+	}
+	c->buffer_ptr = c->resp_buffer;
+	c->buffer_end = c->resp_buffer + c->resp_len;
+	c->state = RTSPSTATE_SEND_REPLY;
+}
 
-				/* Prepare response if end of stream */
-				if(c->in_content_len == 0)
-				{
-					if(c->resp_buffer == NULL)
-					{
-						/* No response from callback: 
-						 *   send a bad request
-						 */
-						c->resp_buffer = strdup(
-							 "RTSP/1.0 400 "
-							 "Bad Request\r\n\r\n");
-						c->resp_len = strlen(
-								c->resp_buffer);
-						if(c->packet_buffer != NULL)
-						{
-							free(c->packet_buffer);
-							c->packet_buffer = NULL;
-							c->packet_len = 0;
-						}
-					}
-					c->buffer_ptr = c->resp_buffer;
-					c->buffer_end = c->resp_buffer +
-							c->resp_len;
-					c->state = RTSPSTATE_SEND_REPLY;
-				}
-				else
-				{
-					c->buffer_ptr = (char*) c->in_buffer;
-				}
-			}
+static int rtsp_wait_request(struct rtsp_handle *h, struct rtsp_client *c)
+{
+	size_t size, len, i;
+	const char *ptr;
+	char *buf, *p;
+	int j;
+
+	buf = c->in_buffer;
+
+	/* Skip empty lines between requests */
+	while(c->in_pos < c->in_len &&
+	      (buf[c->in_pos] == '\r' || buf[c->in_pos] == '\n'))
+		c->in_pos++;
+	if(c->in_scan < c->in_pos)
+		c->in_scan = c->in_pos;
+
+	/* Search for end of request from last position */
+	for(i = c->in_scan; i < c->in_len; i++)
+	{
+		if(buf[i] != '\n')
+			continue;
+		if((i >= c->in_pos + 1 && buf[i-1] == '\n') ||
+		   (i >= c->in_pos + 3 && buf[i-1] == '\r' &&
+		    buf[i-2] == '\n' && buf[i-3] == '\r'))
 			break;
-		}
-		case RTSPSTATE_SEND_REPLY:
+	}
+	if(i == c->in_len)
+	{
+		/* Too long request: close connection */
+		if(c->in_len - c->in_pos >= BUFFER_SIZE)
+			return -1;
+
+		/* Wait for more data */
+		c->in_scan = c->in_len;
+		return 1;
+	}
+	len = i + 1 - c->in_pos;
+
+	/* Move request to start of buffer: it won't move until its end */
+	if(c->in_pos > 0)
+	{
+		memmove(buf, buf + c->in_pos, c->in_len - c->in_pos);
+		c->in_len -= c->in_pos;
+		c->in_pos = 0;
+	}
+
+	/* Parse and index request */
+	if(rtsp_parse_request(c, buf, buf + len - 1) < 0)
+		return -1;
+
+	/* Look for CSeq header */
+	if(rtsp_get_header(c, "CSeq", 1) == NULL)
+		return -1;
+
+	/* Get body length */
+	ptr = rtsp_get_header(c, "Content-Length", 1);
+	c->in_content_len = ptr != NULL ? strtoul(ptr, NULL, 10) : 0;
+	c->in_body = len;
+	c->in_scan = len;
+
+	/* Grow buffer to hold header and first body chunk: the request must
+	 * not be moved once callback has been called.
+	 */
+	size = len + (min(c->in_content_len, BUFFER_SIZE));
+	if(size > c->in_size)
+	{
+		p = malloc(size);
+		if(p == NULL)
+			return -1;
+		memcpy(p, buf, c->in_len);
+
+		/* Move index to new buffer */
+		c->url = p + (c->url - buf);
+		for(j = 0; j < c->header_count; j++)
 		{
-			/* Return if no event */
-			if(!(c->poll_entry->revents & POLLOUT))
-				return 0;
-
-			/* Send data */
-			len = send(c->sock, c->buffer_ptr,
-				   c->buffer_end - c->buffer_ptr, 0);
-			if(len < 0)
-			{
-				if(errno == EAGAIN || errno == EINTR)
-					return 0;
-				free(c->resp_buffer);
-				c->resp_buffer = NULL;
-				c->resp_len = 0;
+			c->headers[j].name = p + (c->headers[j].name - buf);
+			c->headers[j].value = p + (c->headers[j].value - buf);
+		}
+		free(buf);
+		c->in_buffer = p;
+		c->in_size = size;
+	}
 
-				if(c->packet_buffer != NULL)
-				{
-					free(c->packet_buffer);
-					c->packet_buffer = NULL;
-					c->packet_len = 0;
-				}
-				return -1;
-			}
+	/* Call callback function */
+	if(h->request_callback(c, c->request, c->url, c->server->user_data)
+	    < 0)
+		return -1;
+
+	/* Prepare response or read packet */
+	if(c->in_content_len == 0)
+	{
+		c->in_pos = c->in_body;
+		rtsp_prepare_reply(c);
+	}
+	else
+		c->state = RTSPSTATE_WAIT_PACKET;
+
+	return 0;
+}
+
+static int rtsp_wait_packet(struct rtsp_handle *h, struct rtsp_client *c)
+{
+	size_t len, avail;
+	int end;
+
+	/* Wait until a full chunk or end of body is received */
+	len = min(c->in_content_len, BUFFER_SIZE);
+	avail = c->in_len - c->in_body;
+	if(avail < len)
+		return 1;
+	end = len == c->in_content_len ? 1 : 0;
+
+	/* Call read callback function */
+	if(h->read_callback != NULL)
+	{
+		if(h->read_callback(c,
+				    (unsigned char*) c->in_buffer + c->in_body,
+				    len, end, c->server->user_data) < 0)
+			return -1;
+	}
+	c->in_content_len -= len;
+
+	/* Prepare response if end of body */
+	if(end)
+	{
+		c->in_pos = c->in_body + len;
+		rtsp_prepare_reply(c);
+	}
+	else
+	{
+		/* Remove chunk from buffer: request header doesn't move */
+		memmove(c->in_buffer + c->in_body,
+			c->in_buffer + c->in_body + len, avail - len);
+		c->in_len -= len;
+	}
+
+	return 0;
+}
+
+static int rtsp_send(struct rtsp_client *c)
+{
+	int len;
+
+	/* Send data */
+	len = send(c->sock, c->buffer_ptr, c->buffer_end - c->buffer_ptr,
+		   MSG_NOSIGNAL);
+	if(len < 0)
+	{
+		if(errno == EAGAIN || errno == EINTR)
+			return 1;
+		return -1;
+	}
+
+	/* Update buffer position */
+	c->buffer_ptr += len;
+
+	return c->buffer_ptr < c->buffer_end ? 1 : 0;
+}
+
+static int rtsp_handle_client(struct rtsp_handle *h, struct rtsp_client *c)
+{
+	int ret;
+
+	/* Process all complete requests in buffer (requests can be pipelined)
+	 * and send responses until more data is needed or socket is full.
+	 */
+	while(1)
+	{
+		switch(c->state)
+		{
+			case RTSPSTATE_WAIT_REQUEST:
+				ret = rtsp_wait_request(h, c);
+				break;
+			case RTSPSTATE_WAIT_PACKET:
+				ret = rtsp_wait_packet(h, c);
+				break;
+			case RTSPSTATE_SEND_REPLY:
+				/* Send response header */
+				ret = rtsp_send(c);
+				if(ret != 0)
+					break;
 
-			/* Update buffer position */
-			c->buffer_ptr += len;
-			if(c->buffer_ptr >= c->buffer_end)
-			{
 				/* Free response buffer */
 				free(c->resp_buffer);
 				c->resp_buffer = NULL;
 				c->resp_len = 0;
+				c->resp_size = 0;
 
 				if(c->packet_buffer != NULL)
 				{
@@ -523,89 +602,51 @@ static int rtsp_handle_client(struct rtsp_handle *h, struct rtsp_client *c)
 					c->state = RTSPSTATE_SEND_PACKET;
 				}
 				else
-				{
-					/* Wait for next request */
-					c->buffer_ptr = c->req_buffer;
-					c->buffer_end = c->req_buffer +
-							c->req_len;
 					c->state = RTSPSTATE_WAIT_REQUEST;
-				}
-			}
-			break;
-		}
-		case RTSPSTATE_SEND_PACKET:
-		{
-			/* Return if no event */
-			if(!(c->poll_entry->revents & POLLOUT))
-				return 0;
-
-			/* Send data */
-			len = send(c->sock, c->buffer_ptr,
-				   c->buffer_end - c->buffer_ptr, 0);
-			if(len < 0)
-			{
-				if(errno == EAGAIN || errno == EINTR)
-					return 0;
-
-				free(c->packet_buffer);
-				c->packet_buffer = NULL;
-				c->packet_len = 0;
-				return -1;
-			}
+				break;
+			case RTSPSTATE_SEND_PACKET:
+				/* Send response packet */
+				ret = rtsp_send(c);
+				if(ret != 0)
+					break;
 
-			/* Update buffer position */
-			c->buffer_ptr += len;
-			if(c->buffer_ptr >= c->buffer_end)
-			{
 				/* Free packet buffer */
 				free(c->packet_buffer);
 				c->packet_buffer = NULL;
 				c->packet_len = 0;
 
 				/* Wait for next request */
-				c->buffer_ptr = c->req_buffer;
-				c->buffer_end = c->req_buffer + c->req_len;
 				c->state = RTSPSTATE_WAIT_REQUEST;
-			}
-			break;
+				break;
+			default:
+				return -1;
 		}
-		default:
-			return -1;
+
+		/* Error or wait for next event */
+		if(ret != 0)
+			return ret < 0 ? -1 : 0;
 	}
 
 	return 0;
 }
 
-
 static void rtsp_close_client(struct rtsp_handle *h, struct rtsp_client *c)
 {
-	struct rtsp_client **cp, *c1;
-	struct rtsp_header *head;
-
 	/* Callback before closing client socket */
 	if(h->close_callback != NULL)
-		h->close_callback(c, h->user_data);
+		h->close_callback(c, c->server->user_data);
 
 	/* Remove client from list */
-	cp = &h->clients;
-	while((*cp) != NULL)
-	{
-		c1 = *cp;
-		if(c1 == c)
-			*cp = c->next;
-		else
-			cp = &c1->next;
-	}
+	if(c->prev != NULL)
+		c->prev->next = c->next;
+	else
+		h->clients = c->next;
+	if(c->next != NULL)
+		c->next->prev = c->prev;
 
-	/* Free header */
-	while(c->headers != NULL)
-	{
-		head = c->headers;
-		c->headers = head->next;
-		free(head);
-	}
-	
 	/* Free buffers */
+	if(c->in_buffer != NULL)
+		free(c->in_buffer);
 	if(c->resp_buffer != NULL)
 		free(c->resp_buffer);
 	if(c->packet_buffer != NULL)
@@ -614,26 +655,67 @@ static void rtsp_close_client(struct rtsp_handle *h, struct rtsp_client *c)
 		free(c->name);
 
 	/* Close client socket */
+	loop_remove_fd(c->fd);
 	if(c->sock >= 0)
 		close(c->sock);
 
+	/* Decrement user nb */
+	c->server->users--;
+
 	/* Free client structure */
 	free(c);
+}
 
-	/* Decrement user nb */
-	h->users--;
+static void rtsp_client_cb(void *user_data, int fd, int events)
+{
+	struct rtsp_client *c = user_data;
+	struct rtsp_handle *h = c->server->h;
+
+	/* Return error */
+	if(events & (LOOP_ERROR | LOOP_HANGUP))
+	{
+		rtsp_close_client(h, c);
+		return;
+	}
+
+	/* Read available data and handle all complete requests */
+	if(((events & LOOP_READ) && (c->state == RTSPSTATE_WAIT_REQUEST ||
+	    c->state == RTSPSTATE_WAIT_PACKET) && rtsp_read_client(c) < 0) ||
+	   rtsp_handle_client(h, c) < 0)
+	{
+		rtsp_close_client(h, c);
+		return;
+	}
+
+	/* Wait for next events depending on state */
+	switch(c->state)
+	{
+		case RTSPSTATE_SEND_REPLY:
+		case RTSPSTATE_SEND_PACKET:
+			loop_set_fd(c->fd, LOOP_WRITE);
+			break;
+		default:
+			loop_set_fd(c->fd, LOOP_READ);
+	}
+}
+
+static void rtsp_server_cb(void *user_data, int fd, int events)
+{
+	struct rtsp_server *s = user_data;
+
+	/* Accept all pending connections */
+	if(events & LOOP_READ)
+		while(rtsp_accept(s->h, s) == 0);
 }
 
-int rtsp_open(struct rtsp_handle **handle, unsigned int port,
-	      unsigned int max_user, void *callback, void *read_callback,
-	      void *close_callback, void *user_data)
+int rtsp_open(struct rtsp_handle **handle, struct loop_handle *loop,
+	      unsigned int port, unsigned int max_user, void *callback,
+	      void *read_callback, void *close_callback, void *user_data)
 {
 	struct rtsp_handle *h;
-	struct sockaddr_in addr;
-	int opt = 1;
 
-	/* Test request callback presence */
-	if(callback == NULL)
+	/* Test request callback and loop presence */
+	if(callback == NULL || loop == NULL)
 		return -1;
 
 	/* Allocate structure */
@@ -643,102 +725,132 @@ int rtsp_open(struct rtsp_handle **handle, unsigned int port,
 	h = *handle;
 
 	/* Init variables */
-	h->sock = -1;
-	h->users = 0;
+	h->loop = loop;
+	h->servers = NULL;
+	h->server_count = 0;
 	h->max_user = max_user;
 	h->request_callback = callback;
 	h->read_callback = read_callback;
 	h->close_callback = close_callback;
-	h->user_data = user_data;
 	h->clients = NULL;
 
-	/* Prepare poll table */
-	h->poll_table = malloc((max_user+1)*sizeof(*h->poll_table));
-	if(h->poll_table == NULL)
+	/* Open first server: no server is opened if port is 0 */
+	if(port != 0)
+		return rtsp_add_port(h, port, user_data);
+
+	return 0;
+}
+
+int rtsp_add_port(struct rtsp_handle *h, unsigned int port, void *user_data)
+{
+	struct rtsp_server *s;
+	struct sockaddr_in addr;
+	int opt = 1;
+
+	if(h == NULL)
 		return -1;
 
-	/* Open socket */
-	if((h->sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+	/* Allocate server */
+	s = malloc(sizeof(struct rtsp_server));
+	if(s == NULL)
 		return -1;
+	s->h = h;
+	s->port = port;
+	s->fd = NULL;
+	s->users = 0;
+	s->user_data = user_data;
+
+	/* Open socket */
+	if((s->sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		goto error;
 
 	/* Force socket to bind */
-	if(setsockopt(h->sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
-		return -1;
+	if(setsockopt(s->sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+		goto error;
 
 	/* Bind */
 	memset(&addr, 0, sizeof(addr));
 	addr.sin_family = AF_INET;
 	addr.sin_port = htons(port);
 	addr.sin_addr.s_addr = htonl(INADDR_ANY);
-	if(bind(h->sock, (struct sockaddr *) &addr, sizeof(addr)) != 0)
-		return -1;
+	if(bind(s->sock, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+		goto error;
 
 	/* Listen */
-	if(listen(h->sock, 5) != 0)
-		return -1;
+	if(listen(s->sock, SOMAXCONN) != 0)
+		goto error;
+
+	/* Set as non blocking socket: all pending connections are accepted */
+	fcntl(s->sock, F_SETFL, O_NONBLOCK);
+
+	/* Lock loop: callbacks use server list */
+	loop_lock(h->loop);
+
+	/* Wait for connections in loop */
+	s->fd = loop_add_fd(h->loop, s->sock, LOOP_READ, rtsp_server_cb, s);
+	if(s->fd == NULL)
+	{
+		loop_unlock(h->loop);
+		goto error;
+	}
+
+	/* Add server to list */
+	s->next = h->servers;
+	h->servers = s;
+	h->server_count++;
+
+	/* Unlock loop */
+	loop_unlock(h->loop);
 
 	return 0;
+
+error:
+	if(s->sock >= 0)
+		close(s->sock);
+	free(s);
+	return -1;
 }
 
-int rtsp_loop(struct rtsp_handle *h, unsigned int timeout)
+int rtsp_remove_port(struct rtsp_handle *h, unsigned int port)
 {
-	struct pollfd *poll_entry;
+	struct rtsp_server **sp, *s;
 	struct rtsp_client *c, *c_next;
-	int ret;
 
-	if(h == NULL || h->sock == -1)
+	if(h == NULL)
 		return -1;
 
-	poll_entry = h->poll_table;
-
-	/* Add server socket to poll table */
-	poll_entry->fd = h->sock;
-	poll_entry->events = POLLIN;
-	poll_entry++;
+	/* Lock loop */
+	loop_lock(h->loop);
 
-	/* Fill poll table */
-	c = h->clients;
-	while (c != NULL)
+	/* Find server */
+	for(sp = &h->servers; *sp != NULL && (*sp)->port != port;
+	    sp = &(*sp)->next);
+	s = *sp;
+	if(s == NULL)
 	{
-		switch(c->state)
-		{
-			case RTSPSTATE_SEND_REPLY:
-			case RTSPSTATE_SEND_PACKET:
-				c->poll_entry = poll_entry;
-				poll_entry->fd = c->sock;
-				poll_entry->events = POLLOUT;
-				poll_entry++;
-				break;
-			case RTSPSTATE_WAIT_REQUEST:
-			case RTSPSTATE_WAIT_PACKET:
-				c->poll_entry = poll_entry;
-				poll_entry->fd = c->sock;
-				poll_entry->events = POLLIN;
-				poll_entry++;
-				break;
-			default:
-				c->poll_entry = NULL;
-				break;
-		}
-		c = c->next;
+		loop_unlock(h->loop);
+		return -1;
 	}
 
-	/* Wait for an event with a timeout (in ms) */
-	ret = poll(h->poll_table, poll_entry - h->poll_table, timeout);
-	if(ret <= 0)
-		return ret;
-
-	/* Handle events */
+	/* Close its clients */
 	for(c = h->clients; c != NULL; c = c_next)
 	{
 		c_next = c->next;
-		if(rtsp_handle_client(h, c) < 0)
+		if(c->server == s)
 			rtsp_close_client(h, c);
 	}
 
-	/* Check for new connection */
-	if(h->poll_table->revents & POLLIN)
-		rtsp_accept(h);
+	/* Remove server from list */
+	*sp = s->next;
+	h->server_count--;
+
+	/* Close socket and free server */
+	loop_remove_fd(s->fd);
+	close(s->sock);
+	free(s);
+
+	/* Unlock loop */
+	loop_unlock(h->loop);
 
 	return 0;
 }
@@ -746,10 +858,11 @@ int rtsp_loop(struct rtsp_handle *h, unsigned int timeout)
 const char *rtsp_get_header(struct rtsp_client *c, const char *name,
 			    int case_sensitive)
 {
-	struct rtsp_header *header;
 	int (*_strcmp)(const char*, const char*);
+	unsigned int hash;
+	int i;
 
-	if(c == NULL)
+	if(c == NULL || name == NULL)
 		return NULL;
 
 	if(case_sensitive)
@@ -757,12 +870,13 @@ const char *rtsp_get_header(struct rtsp_client *c, const char *name,
 	else
 		_strcmp = &strcasecmp;
 
-	header = c->headers;
-	while(header != NULL)
+	/* Compare names only if hashes match */
+	hash = rtsp_hash(name);
+	for(i = 0; i < c->header_count; i++)
 	{
-		if(_strcmp(name, header->name) == 0)
-			return header->value;
-		header = header->next;
+		if(c->headers[i].hash == hash &&
+		   _strcmp(name, c->headers[i].name) == 0)
+			return c->headers[i].value;
 	}
 
 	return NULL;
@@ -784,8 +898,25 @@ unsigned int rtsp_get_port(struct rtsp_client *c)
 
 const char *rtsp_get_name(struct rtsp_client *c)
 {
+	char hostname[1024];
+	char service[20];
+
 	if(c == NULL)
 		return NULL;
+
+	/* Resolve name on first call only: a lookup is not done for each
+	 * connection since it blocks loop.
+	 */
+	if(!c->name_resolved)
+	{
+		hostname[0] = '\0';
+		getnameinfo((struct sockaddr*)&c->addr, sizeof(c->addr),
+			    hostname, sizeof(hostname), service,
+			    sizeof(service), 0);
+		c->name = hostname[0] != '\0' ? strdup(hostname) : NULL;
+		c->name_resolved = 1;
+	}
+
 	return c->name;
 }
 
@@ -825,17 +956,27 @@ void rtsp_set_user_data(struct rtsp_client *c, void *user_data)
 int rtsp_create_response(struct rtsp_client *c, unsigned int code,
 			 const char *value)
 {
-	if(c == NULL)
+	size_t len;
+
+	if(c == NULL || value == NULL)
 		return -1;
 
 	if(c->resp_buffer != NULL)
 		free(c->resp_buffer);
 
-	c->resp_buffer = malloc(BUFFER_SIZE);
-
-	sprintf(c->resp_buffer, "RTSP/1.0 %d %s\r\n\r\n", code, value);
+	/* Allocate response buffer */
+	len = strlen(value) + 20;
+	c->resp_size = len > RESP_BUFFER_SIZE ? len : RESP_BUFFER_SIZE;
+	c->resp_buffer = malloc(c->resp_size);
+	if(c->resp_buffer == NULL)
+	{
+		c->resp_len = 0;
+		c->resp_size = 0;
+		return -1;
+	}
 
-	c->resp_len = strlen(c->resp_buffer);
+	c->resp_len = sprintf(c->resp_buffer, "RTSP/1.0 %d %s\r\n\r\n", code,
+			      value);
 
 	return 0;
 }
@@ -843,43 +984,49 @@ int rtsp_create_response(struct rtsp_client *c, unsigned int code,
 int rtsp_add_response(struct rtsp_client *c, const char *name,
 		      const char *value)
 {
-	int len;
+	size_t len, size;
 	char *p;
 
-	if(c == NULL)
+	if(c == NULL || name == NULL || value == NULL)
 		return -1;
 
 	if(c->resp_buffer == NULL)
 		return -1;
 
-	len = c->resp_len-2;
-	c->resp_len += strlen(name)+strlen(value)+4;
+	/* Response length with new entry */
+	len = c->resp_len + strlen(name) + strlen(value) + 4;
 
 	/* Reallocate more space */
-	if(c->resp_len >= BUFFER_SIZE)
+	if(len >= c->resp_size)
 	{
-		p = realloc(c->resp_buffer, c->resp_len);
+		size = c->resp_size * 2;
+		if(size <= len)
+			size = len + 1;
+		p = realloc(c->resp_buffer, size);
 		if(p == NULL)
-		{
-			free(c->resp_buffer);
-			c->resp_len = 0;
 			return -1;
-		}
+		c->resp_buffer = p;
+		c->resp_size = size;
 	}
 
 	/* Add entry to response */
-	sprintf(&c->resp_buffer[len], "%s: %s\r\n\r\n", name, value);
+	sprintf(&c->resp_buffer[c->resp_len-2], "%s: %s\r\n\r\n", name, value);
+	c->resp_len = len;
 
 	return 0;
 }
 
 int rtsp_set_response(struct rtsp_client *c, char *str)
 {
-	if(c == NULL)
+	if(c == NULL || str == NULL)
 		return -1;
 
+	if(c->resp_buffer != NULL)
+		free(c->resp_buffer);
+
 	c->resp_buffer = str;
 	c->resp_len = strlen(str);
+	c->resp_size = c->resp_len + 1;
 	return 0;
 }
 
@@ -1155,21 +1302,20 @@ int rtsp_close(struct rtsp_handle *h)
 
 	if(h == NULL)
 		return 0;
-	
+
+	/* Lock loop */
+	loop_lock(h->loop);
+
 	/* Close all clients and free it*/
 	while(h->clients != NULL)
 		rtsp_close_client(h, h->clients);
 
-	/* Close socket */
-	if(h->sock != -1)
-	{
-		close(h->sock);
-	}
-	h->sock = -1;
+	/* Close servers */
+	while(h->servers != NULL)
+		rtsp_remove_port(h, h->servers->port);
 
-	/* Free poll table */
-	if(h->poll_table != NULL)
-		free(h->poll_table);
+	/* Unlock loop */
+	loop_unlock(h->loop);
 
 	/* Free structure */
 	free(h);
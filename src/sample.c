@@ -0,0 +1,507 @@
+/*
+ * sample.c - PCM sample formats and processing kernels
+ *
+ * Copyright (c) 2014   A. Dilly
+ *
+ * AirCat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * AirCat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with AirCat.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+
+#include "sample.h"
+#include "output.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/**
+ * Benchmark settings:
+ *  BENCH_SIZE: size of a block processed by kernels (in samples).
+ *  BENCH_LOOPS: count of blocks processed for each kernel.
+ */
+#define BENCH_SIZE 4096
+#define BENCH_LOOPS 10000
+
+/* Volume and saturated addition for each format */
+static inline int16_t s16_vol(int16_t x, unsigned int v)
+{
+	return (int16_t) (((int32_t) x * v) / OUTPUT_VOLUME_MAX);
+}
+
+static inline int16_t s16_add(int16_t a, int16_t b)
+{
+	int32_t sum;
+
+	sum = (int32_t) a + (int32_t) b;
+
+	if(sum > 0x7FFF)
+		sum = 0x7FFF;
+	else if(sum < -0x8000)
+		sum = -0x8000;
+
+	return (int16_t) sum;
+}
+
+static inline int32_t s32_vol(int32_t x, unsigned int v)
+{
+	return (int32_t) (((int64_t) x * v) / OUTPUT_VOLUME_MAX);
+}
+
+static inline int32_t s32_add(int32_t a, int32_t b)
+{
+	int64_t sum;
+
+	sum = (int64_t) a + (int64_t) b;
+
+	if(sum > 0x7FFFFFFFLL)
+		sum = 0x7FFFFFFFLL;
+	else if(sum < -0x80000000LL)
+		sum = -0x80000000LL;
+
+	return (int32_t) sum;
+}
+
+static inline float float_vol(float x, unsigned int v)
+{
+	return x * (v * 1.0f / OUTPUT_VOLUME_MAX);
+}
+
+static inline float float_add(float a, float b)
+{
+	float sum;
+
+	sum = a + b;
+
+	if(sum > 1.0f)
+		sum = 1.0f;
+	else if(sum < -1.0f)
+		sum = -1.0f;
+
+	return sum;
+}
+
+/* Instantiate gain, mix and up/down-mix kernels for a format: down-mixing is
+ * inspired from remix effect from sox.
+ */
+#define SAMPLE_KERNELS(name, type, acc_type) \
+static void sample_gain_##name(unsigned char *out, const unsigned char *in, \
+			       size_t len, unsigned int volume) \
+{ \
+	const type *p_in = (const type *) in; \
+	type *p_out = (type *) out; \
+	size_t i; \
+\
+	for(i = 0; i < len; i++) \
+		p_out[i] = name##_vol(p_in[i], volume); \
+} \
+\
+static void sample_mix_##name(unsigned char *out, const unsigned char *in, \
+			      size_t len, unsigned int volume) \
+{ \
+	const type *p_in = (const type *) in; \
+	type *p_out = (type *) out; \
+	size_t i; \
+\
+	for(i = 0; i < len; i++) \
+		p_out[i] = name##_add(p_out[i], name##_vol(p_in[i], volume)); \
+} \
+\
+static void sample_down_mix_##name(unsigned char *buffer, size_t frames, \
+				   unsigned char in_channels, \
+				   unsigned char out_channels) \
+{ \
+	const type *p_in = (const type *) buffer; \
+	type *p_out = (type *) buffer; \
+	acc_type sum; \
+	unsigned int j, k, count; \
+	size_t i; \
+\
+	for(i = 0; i < frames; i++, p_in += in_channels) \
+	{ \
+		for(j = 0; j < out_channels; j++) \
+		{ \
+			sum = 0; \
+			for(k = j, count = 0; k < in_channels; \
+			    k += out_channels, count++) \
+				sum += p_in[k]; \
+			*(p_out++) = sum / (acc_type) count; \
+		} \
+	} \
+} \
+\
+static void sample_up_mix_##name(unsigned char *out, const unsigned char *in, \
+				 size_t frames, unsigned char in_channels, \
+				 unsigned char out_channels) \
+{ \
+	const type *p_in = (const type *) in; \
+	type *p_out = (type *) out; \
+	unsigned int j; \
+	size_t i; \
+\
+	for(i = 0; i < frames; i++, p_in += in_channels) \
+		for(j = 0; j < out_channels; j++) \
+			*(p_out++) = p_in[j % in_channels]; \
+}
+
+SAMPLE_KERNELS(s16, int16_t, int32_t)
+SAMPLE_KERNELS(s32, int32_t, int64_t)
+SAMPLE_KERNELS(float, float, float)
+
+/* Conversions: when output samples are wider than input, conversion is done
+ * from the end to allow in place processing.
+ */
+static void sample_copy(unsigned char *out, const unsigned char *in,
+			size_t len)
+{
+	if(out != in)
+		memmove(out, in, len * 4);
+}
+
+static inline int32_t sample_float_to_s32(float x)
+{
+	if(x >= 1.0f)
+		return 0x7FFFFFFF;
+	else if(x <= -1.0f)
+		return -0x7FFFFFFF - 1;
+	return (int32_t) ((double) x * 2147483648.0);
+}
+
+static void sample_s16_from_s32(unsigned char *out, const unsigned char *in,
+				size_t len)
+{
+	const int32_t *p_in = (const int32_t *) in;
+	int16_t *p_out = (int16_t *) out;
+	size_t i;
+
+	for(i = 0; i < len; i++)
+		p_out[i] = p_in[i] >> 16;
+}
+
+static void sample_s16_to_s32(unsigned char *out, const unsigned char *in,
+			      size_t len)
+{
+	const int16_t *p_in = (const int16_t *) in;
+	int32_t *p_out = (int32_t *) out;
+
+	while(len--)
+		p_out[len] = (int32_t) p_in[len] * 65536;
+}
+
+static void sample_s16_from_float(unsigned char *out, const unsigned char *in,
+				  size_t len)
+{
+	const float *p_in = (const float *) in;
+	int16_t *p_out = (int16_t *) out;
+	size_t i;
+
+	for(i = 0; i < len; i++)
+		p_out[i] = sample_float_to_s32(p_in[i]) >> 16;
+}
+
+static void sample_s16_to_float(unsigned char *out, const unsigned char *in,
+				size_t len)
+{
+	const int16_t *p_in = (const int16_t *) in;
+	float *p_out = (float *) out;
+
+	while(len--)
+		p_out[len] = p_in[len] / 32768.0f;
+}
+
+static void sample_s32_from_float(unsigned char *out, const unsigned char *in,
+				  size_t len)
+{
+	const float *p_in = (const float *) in;
+	int32_t *p_out = (int32_t *) out;
+	size_t i;
+
+	for(i = 0; i < len; i++)
+		p_out[i] = sample_float_to_s32(p_in[i]);
+}
+
+static void sample_s32_to_float(unsigned char *out, const unsigned char *in,
+				size_t len)
+{
+	const int32_t *p_in = (const int32_t *) in;
+	float *p_out = (float *) out;
+	size_t i;
+
+	for(i = 0; i < len; i++)
+		p_out[i] = p_in[i] / 2147483648.0f;
+}
+
+static const struct sample_ops sample_ops[] = {
+	[SAMPLE_S16] = {
+		.format = SAMPLE_S16,
+		.size = 2,
+		.from_s32 = &sample_s16_from_s32,
+		.to_s32 = &sample_s16_to_s32,
+		.from_float = &sample_s16_from_float,
+		.to_float = &sample_s16_to_float,
+		.gain = &sample_gain_s16,
+		.mix = &sample_mix_s16,
+		.down_mix = &sample_down_mix_s16,
+		.up_mix = &sample_up_mix_s16,
+	},
+	[SAMPLE_S32] = {
+		.format = SAMPLE_S32,
+		.size = 4,
+		.from_s32 = &sample_copy,
+		.to_s32 = &sample_copy,
+		.from_float = &sample_s32_from_float,
+		.to_float = &sample_s32_to_float,
+		.gain = &sample_gain_s32,
+		.mix = &sample_mix_s32,
+		.down_mix = &sample_down_mix_s32,
+		.up_mix = &sample_up_mix_s32,
+	},
+	[SAMPLE_FLOAT] = {
+		.format = SAMPLE_FLOAT,
+		.size = 4,
+		.from_s32 = &sample_s32_to_float,
+		.to_s32 = &sample_s32_from_float,
+		.from_float = &sample_copy,
+		.to_float = &sample_copy,
+		.gain = &sample_gain_float,
+		.mix = &sample_mix_float,
+		.down_mix = &sample_down_mix_float,
+		.up_mix = &sample_up_mix_float,
+	},
+};
+
+static const char *sample_names[] = {
+	[SAMPLE_S16] = "s16",
+	[SAMPLE_S32] = "s32",
+	[SAMPLE_FLOAT] = "float",
+};
+
+/* Pipeline format */
+static const struct sample_ops *sample_pipeline = &sample_ops[SAMPLE_S32];
+
+const struct sample_ops *sample_get_ops(enum sample_format format)
+{
+	if(format > SAMPLE_FLOAT)
+		return NULL;
+
+	return &sample_ops[format];
+}
+
+int sample_set_format(enum sample_format format)
+{
+	/* Pipeline uses 4 bytes per sample */
+	if(format != SAMPLE_S32 && format != SAMPLE_FLOAT)
+		return -1;
+
+	sample_pipeline = &sample_ops[format];
+
+	return 0;
+}
+
+enum sample_format sample_get_format(void)
+{
+	return sample_pipeline->format;
+}
+
+const struct sample_ops *sample_get_pipeline(void)
+{
+	return sample_pipeline;
+}
+
+void sample_from_s32(unsigned char *buffer, size_t len)
+{
+	if(sample_pipeline->format != SAMPLE_S32)
+		sample_pipeline->from_s32(buffer, buffer, len);
+}
+
+void sample_convert(unsigned char *out, enum sample_format out_format,
+		    const unsigned char *in, enum sample_format in_format,
+		    size_t len)
+{
+	/* Same format */
+	if(out_format == in_format)
+	{
+		if(out != in)
+			memmove(out, in, len * sample_ops[in_format].size);
+		return;
+	}
+
+	/* Use 32-bit integer or float as pivot */
+	if(in_format == SAMPLE_S32)
+		sample_ops[out_format].from_s32(out, in, len);
+	else if(in_format == SAMPLE_FLOAT)
+		sample_ops[out_format].from_float(out, in, len);
+	else if(out_format == SAMPLE_S32)
+		sample_ops[in_format].to_s32(out, in, len);
+	else
+		sample_ops[in_format].to_float(out, in, len);
+}
+
+void sample_dither_s16(unsigned char *out, const unsigned char *in,
+		       enum sample_format in_format, size_t frames,
+		       unsigned char channels, struct sample_dither *d)
+{
+	const int32_t *p_s32 = (const int32_t *) in;
+	const float *p_float = (const float *) in;
+	int16_t *p_out = (int16_t *) out;
+	uint32_t seed = d->seed;
+	float scale, x, v, *e;
+	uint32_t r;
+	int32_t y;
+	size_t i;
+	int j;
+
+	if(in_format != SAMPLE_S32 && in_format != SAMPLE_FLOAT)
+	{
+		sample_convert(out, SAMPLE_S16, in, in_format,
+			       frames * channels);
+		return;
+	}
+	scale = in_format == SAMPLE_S32 ? 1.0f / 65536.0f : 32768.0f;
+
+	for(i = 0; i < frames; i++)
+	{
+		for(j = 0; j < channels; j++, p_s32++, p_float++, p_out++)
+		{
+			/* Get sample in output LSB unit */
+			x = (in_format == SAMPLE_S32 ? (float) *p_s32 :
+						       *p_float) * scale;
+
+			/* Subtract previous quantization error */
+			e = &d->error[j & (SAMPLE_DITHER_CHANNELS - 1)];
+			v = x - *e;
+
+			/* TPDF noise of +/-1 LSB from two uniform values: each
+			 * one is taken from high bits of its own LCG step,
+			 * since low bits of a LCG have short periods.
+			 */
+			seed = seed * 1664525 + 1013904223;
+			r = seed >> 16;
+			seed = seed * 1664525 + 1013904223;
+			x = ((int32_t) r - (int32_t) (seed >> 16)) / 65536.0f;
+
+			/* Round and keep error (cleared on saturation) */
+			y = (int32_t) (v + x + 32768.5f) - 32768;
+			if(y > 0x7FFF || y < -0x8000)
+			{
+				y = y > 0 ? 0x7FFF : -0x8000;
+				*e = 0.0f;
+			}
+			else
+				*e = y - v;
+			*p_out = y;
+		}
+	}
+
+	d->seed = seed;
+}
+
+int sample_parse_format(const char *name)
+{
+	int i;
+
+	if(name == NULL)
+		return -1;
+
+	for(i = 0; i < sizeof(sample_names) / sizeof(char *); i++)
+		if(strcmp(name, sample_names[i]) == 0)
+			return i;
+
+	return -1;
+}
+
+const char *sample_format_name(enum sample_format format)
+{
+	if(format > SAMPLE_FLOAT)
+		return NULL;
+
+	return sample_names[format];
+}
+
+static double sample_time(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) +
+	       (now.tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+/* Get throughput of a kernel (in Msamples/s) */
+#define SAMPLE_BENCH(result, call) do { \
+	struct timespec start; \
+	int loop; \
+	clock_gettime(CLOCK_MONOTONIC, &start); \
+	for(loop = 0; loop < BENCH_LOOPS; loop++) \
+		call; \
+	result = BENCH_SIZE * (double) BENCH_LOOPS / sample_time(&start) / \
+		 1000000.0; \
+} while(0)
+
+void sample_benchmark(void)
+{
+	const struct sample_ops *ops;
+	unsigned char *in, *out;
+	float *ref;
+	double gain, mix, down, up, conv;
+	int f, i;
+
+	/* Allocate buffers */
+	in = malloc(BENCH_SIZE * 4);
+	out = malloc(BENCH_SIZE * 4);
+	ref = malloc(BENCH_SIZE * sizeof(float));
+	if(in == NULL || out == NULL || ref == NULL)
+		goto end;
+
+	/* Generate a stereo 1 kHz sine at 44.1 kHz */
+	for(i = 0; i < BENCH_SIZE; i++)
+		ref[i] = 0.5f * sinf(2.0f * M_PI * 1000.0f * (i / 2) / 44100.0f);
+
+	printf("Sample format benchmark (Msamples/s, blocks of %d samples):\n",
+	       BENCH_SIZE);
+	printf("%-6s %10s %10s %10s %10s %10s\n", "format", "gain", "mix",
+	       "down-mix", "up-mix", "to-float");
+
+	for(f = SAMPLE_S16; f <= SAMPLE_FLOAT; f++)
+	{
+		ops = &sample_ops[f];
+
+		/* Prepare input */
+		ops->from_float(in, (unsigned char *) ref, BENCH_SIZE);
+		ops->gain(out, in, BENCH_SIZE, OUTPUT_VOLUME_MAX);
+
+		/* Run kernels */
+		SAMPLE_BENCH(gain, ops->gain(out, in, BENCH_SIZE, 40000));
+		SAMPLE_BENCH(mix, ops->mix(out, in, BENCH_SIZE, 40000));
+		SAMPLE_BENCH(down, ops->down_mix(out, BENCH_SIZE / 2, 2, 1));
+		SAMPLE_BENCH(up, ops->up_mix(out, in, BENCH_SIZE / 2, 1, 2));
+		SAMPLE_BENCH(conv, ops->to_float(out, in, BENCH_SIZE));
+
+		printf("%-6s %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+		       sample_names[f], gain, mix, down, up, conv);
+	}
+
+end:
+	if(in != NULL)
+		free(in);
+	if(out != NULL)
+		free(out);
+	if(ref != NULL)
+		free(ref);
+}
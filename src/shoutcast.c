@@ -20,12 +20,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 
 #include "http.h"
+#include "hls.h"
 #include "decoder.h"
+#include "mpeg_sync.h"
 #include "shoutcast.h"
+#include "recorder.h"
 #include "vring.h"
 
 #ifdef HAVE_CONFIG_H
@@ -53,11 +60,13 @@
  *  SYNC_TOTAL_TIMEOUT: total timeout for synchronization (must be a multiple 
  *                      of SYNC_TIMEOUT. This value is in s).
  *  SYNC_TIMEOUT: timeout for HTTP read (in ms).
+ *  SYNC_FRAMES: count of consecutive frames to check for synchronization.
  */
 #define MP3_SYNC_SIZE (2881 * 2) + 3
 #define AAC_SYNC_SIZE MAX_RW_SIZE
 #define SYNC_TOTAL_TIMEOUT 5
 #define SYNC_TIMEOUT 1
+#define SYNC_FRAMES 4
 
 /**
  * All synchronize size must be lower or equal to minimum cache length
@@ -72,13 +81,51 @@
 #define THREAD_TIMEOUT 100
 
 /**
- * Pause buffer settings:
- *  BLOCK_SIZE: basic block size.
- *  CHECK_POOL: pool is check every CHECK_POOL seconds and only two block are 
- *              kept. Others are freed.
+ * Time-shift buffer settings:
+ *  DEFAULT_TIMESHIFT: Default duration kept in time-shift buffer (in s).
+ *  TIMESHIFT_FILE: Template of temporary file used when buffer is mapped on a
+ *                  file (tmpfs or disk).
+ *  BLOCK_SIZE: Maximum size read from HTTP stream at once.
+ * The time-shift buffer is allocated once and keeps last received seconds of
+ * stream (without metadata): it is used for pause, skip and rewind.
  */
+#define DEFAULT_TIMESHIFT 120
+#define TIMESHIFT_FILE "aircat-timeshift-XXXXXX"
 #define BLOCK_SIZE 8192
-#define CHECK_POOL 30
+
+/**
+ * Reconnection settings:
+ *  RECONNECT_DELAY: delay before first reconnection attempt (in ms).
+ *  RECONNECT_MAX_DELAY: maximum delay between two attempts (in ms).
+ *  RECONNECT_TRIES: count of attempts before end of stream.
+ * The delay is doubled after each failed attempt. Cached data is still played
+ * during reconnection and new stream is spliced on its first frame.
+ */
+#define RECONNECT_DELAY 500
+#define RECONNECT_MAX_DELAY 30000
+#define RECONNECT_TRIES 8
+
+/**
+ * Adaptive bitrate settings:
+ *  ABR_PERIOD: duration of a throughput measure (in ms).
+ *  ABR_LOW_FILLING: data buffered ahead of decoder under which cache is under
+ *                   pressure (in % of cache size).
+ *  ABR_HIGH_FILLING: data buffered ahead of decoder over which cache has
+ *                    headroom (in % of cache size).
+ *  ABR_LOW_RATE: throughput under which stream is too slow (in % of bitrate).
+ *  ABR_LOW_PERIODS: consecutive periods under pressure before a step down.
+ *  ABR_UP_DELAY: delay with headroom before a step up (in ms).
+ *  ABR_MAX_UP_DELAY: maximum delay before a step up (in ms).
+ * The step up delay is doubled after each step down to avoid oscillation
+ * between two bitrates.
+ */
+#define ABR_PERIOD 2000
+#define ABR_LOW_FILLING 50
+#define ABR_HIGH_FILLING 90
+#define ABR_LOW_RATE 90
+#define ABR_LOW_PERIODS 2
+#define ABR_UP_DELAY 30000
+#define ABR_MAX_UP_DELAY 600000
 
 /**
  * State of metadata demultiplexing in stream
@@ -90,12 +137,11 @@ enum shout_state {
 };
 
 /**
- * Shoutcast data cache: used for metadata cache and pause buffer
+ * Shoutcast metadata cache
  */
 struct shout_data {
 	struct shout_data *next;	/*!< Next data block in cache */
-	size_t remaining;		/*!< Remaining bytes before next
-					     data block */
+	uint64_t pos;			/*!< Position of metadata in stream */
 	char data[0];			/*!< Data block */
 };
 
@@ -105,6 +151,29 @@ struct shout_data {
 struct shout_handle {
 	/* HTTP Client */
 	struct http_handle *http;	/*!< HTTP client handler */
+	char *url;			/*!< Stream URL */
+	/* HLS client */
+	struct hls_handle *hls;		/*!< HLS client when URL is a playlist */
+	/* Reconnection */
+	int is_lost;			/*!< Connection to stream is lost */
+	int tries;			/*!< Failed reconnection attempts */
+	uint64_t lost_time;		/*!< Time of connection loss (in ms) */
+	uint64_t retry_time;		/*!< Time of next attempt (in ms) */
+	uint64_t splice;		/*!< Position of reconnected stream */
+	unsigned long reconnects;	/*!< Successful reconnections */
+	unsigned long gap;		/*!< Total duration of losses (in ms) */
+	/* Adaptive bitrate */
+	struct shout_variant *variants;	/*!< Streams sorted by bitrate */
+	unsigned int variant_count;	/*!< Count of streams */
+	unsigned int variant;		/*!< Index of current stream */
+	uint64_t abr_time;		/*!< Start of measure period (in ms) */
+	size_t abr_bytes;		/*!< Bytes received during period */
+	unsigned long throughput;	/*!< Last throughput measured (kb/s) */
+	int abr_low;			/*!< Consecutive periods under pressure */
+	int abr_underrun;		/*!< Cache has been empty during period */
+	uint64_t abr_up_time;		/*!< Time of next step up (in ms) */
+	unsigned long abr_up_delay;	/*!< Delay before a step up (in ms) */
+	unsigned long switches;		/*!< Bitrate switches */
 	/* Input ring buffer: cache */
 	struct vring_handle *ring;	/*!< Ring buffer cache */
 	unsigned long cache_len;	/*!< Cache size in seconds */
@@ -112,18 +181,17 @@ struct shout_handle {
 	int is_ready;			/*!< Flag for cache status */
 	struct shout_data *metas;	/*!< Metadata cache (first) */
 	struct shout_data *metas_last;	/*!< Last metadata in cache */
-	/* Pause buffer */
-	struct shout_data *pauses;	/*!< First block in pause buffer */
-	struct shout_data *pauses_last;	/*!< Last block in pause buffer */
-	struct shout_data *pool;	/*!< Current pause buffer block */
-	struct shout_data *pool_last;	/*!< Last pause buffer block in pool */
-	unsigned long pause_count;	/*!< Count of pause buffer block */
+	struct shout_data *metas_cur;	/*!< Metadata of played data */
+	/* Time-shift buffer */
+	unsigned char *ts_buffer;	/*!< Time-shift ring buffer */
+	size_t ts_size;			/*!< Size of time-shift buffer */
+	int ts_fd;			/*!< File mapped for time-shift buffer */
+	uint64_t ts_write;		/*!< Bytes written from HTTP stream */
+	uint64_t ts_read;		/*!< Bytes moved to cache */
+	uint64_t ts_play;		/*!< Bytes consumed by decoder */
 	int is_paused;			/*!< Stream is paused: buffering */
-	struct timeval start_pause;	/*!< Timestamp of pause start */
-	unsigned long pause_len;	/*!< Duration of pause buffer (ms) */
-	time_t last_pool_check;		/*!< Last pool check */
-	size_t skip_size;		/*!< Len to skip in pause buffer */
-	int end_pause;			/*!< End of stream during pause */
+	/* Recording */
+	struct recorder_handle *rec;	/*!< Recorder of received stream */
 	/* Metadata handling */
 	enum shout_state state;		/*!< State of stream demultiplexing */
 	unsigned int metaint;		/*!< Bytes between two meta data */
@@ -146,8 +214,7 @@ struct shout_handle {
 	shoutcast_event_cb event_cb;	/*!< Callback for event */
 	void *event_udata;		/*!< User data for event callback */
 	/* Synchrinzation */
-	ssize_t (*sync_fn)(struct shout_handle *, unsigned char *, size_t);
-					/*!< Callback for synchronization */
+	enum mpeg_sync_type sync_type;	/*!< Frame type for synchronization */
 	size_t sync_size;		/*!< Minimal size for synchronization */
 	int resync;			/*!< Stream must be synchronized */
 	/* Internal thread */
@@ -156,21 +223,47 @@ struct shout_handle {
 	pthread_t thread;		/*!< Internal thread */
 	pthread_mutex_t mutex;		/*!< Mutex for thread */
 	pthread_mutex_t meta_mutex;		/*!< Mutex for metadata */
-	pthread_mutex_t pause_mutex;		/*!< Mutex for pause buffer */
+	pthread_mutex_t pause_mutex;		/*!< Mutex for time-shift
+						     buffer */
 };
 
 static inline int shoutcast_sync(struct shout_handle *h);
-static ssize_t shoutcast_sync_mp3_stream(struct shout_handle *h,
-					 unsigned char *buffer, size_t in_len);
-static ssize_t shoutcast_sync_aac_stream(struct shout_handle *h,
-					 unsigned char *buffer, size_t in_len);
 static ssize_t shoutcast_fill_buffer(struct shout_handle *h,
 				     unsigned long timeout);
 static ssize_t shoutcast_get_buffer(struct shout_handle *h,
 				    unsigned char **buffer);
 static ssize_t shoutcast_forward_buffer(struct shout_handle *h, size_t size);
+static void shoutcast_seek_timeshift(struct shout_handle *h, uint64_t pos);
+static void shoutcast_update_meta(struct shout_handle *h);
 static void *shoutcast_thread(void *user_data);
 
+static inline uint64_t shoutcast_get_time(void)
+{
+	struct timeval tv;
+
+	/* Get current time (in ms) */
+	gettimeofday(&tv, NULL);
+	return ((uint64_t) tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+}
+
+static inline char *shoutcast_copy_header(struct http_handle *http,
+					  const char *name)
+{
+	char *p;
+
+	/* Copy value: HTTP header is freed on reconnection */
+	p = http_get_header(http, name, 0);
+	return p != NULL ? strdup(p) : NULL;
+}
+
+static inline size_t shoutcast_get_byterate(struct shout_handle *h)
+{
+	/* Calculate stream byterate (in B/s) */
+	if(h->info.bitrate > 0)
+		return h->info.bitrate * 125;
+	return DEFAULT_BITRATE * 125;
+}
+
 int shoutcast_open(struct shout_handle **handle, const char *url,
 		   unsigned long cache_size, int use_thread)
 {
@@ -194,6 +287,7 @@ int shoutcast_open(struct shout_handle **handle, const char *url,
 	h->cache_len = cache_size > 0 ? cache_size : DEFAULT_CACHE_SIZE;
 	h->state = SHOUT_DATA;
 	h->is_ready = 1;
+	h->ts_fd = -1;
 
 	/* Init thread mutex */
 	pthread_mutex_init(&h->mutex, NULL);
@@ -204,6 +298,7 @@ int shoutcast_open(struct shout_handle **handle, const char *url,
 	if(http_open(&h->http, 1) != 0)
 	{
 		shoutcast_close(h);
+		*handle = NULL;
 		return -1;
 	}
 
@@ -211,16 +306,39 @@ int shoutcast_open(struct shout_handle **handle, const char *url,
 	http_set_option(h->http, HTTP_EXTRA_HEADER, "Icy-MetaData: 1\r\n", 0);
 	http_set_option(h->http, HTTP_FOLLOW_REDIRECT, NULL, 1);
 
+	/* Copy URL for reconnection */
+	h->url = strdup(url);
+	if(h->url == NULL)
+		return -1;
+
 	/* Connect and get header from server */
 	code = http_get(h->http, url);
 	if(code != 200)
 		return -1;
 
+	/* HTTP Live Streaming: audio codec is found on synchronization */
+	p = http_get_header(h->http, "content-type", 0);
+	if(hls_is_playlist(p) ||
+	   (p == NULL && strstr(url, ".m3u8") != NULL))
+	{
+		/* Playlist is loaded again by HLS client */
+		http_close(h->http);
+		h->http = NULL;
+		if(hls_open(&h->hls, url) != 0)
+			return -1;
+
+		/* Get bitrate from variant stream */
+		h->info.bitrate = hls_get_bandwidth(h->hls) / 1000;
+		h->info.type = NONE_STREAM;
+		goto cache;
+	}
+
 	/* Fill info radio structure */
-	h->info.description = http_get_header(h->http, "icy-description", 0);
-	h->info.genre = http_get_header(h->http, "icy-genre", 0);
-	h->info.name = http_get_header(h->http, "icy-name", 0);
-	h->info.url = http_get_header(h->http, "icy-url", 0);
+	h->info.description = shoutcast_copy_header(h->http,
+						    "icy-description");
+	h->info.genre = shoutcast_copy_header(h->http, "icy-genre");
+	h->info.name = shoutcast_copy_header(h->http, "icy-name");
+	h->info.url = shoutcast_copy_header(h->http, "icy-url");
 	p = http_get_header(h->http, "icy-br", 0);
 	if(p != NULL)
 		h->info.bitrate = atoi(p);
@@ -260,6 +378,7 @@ int shoutcast_open(struct shout_handle **handle, const char *url,
 	h->metaint = h->info.metaint;
 	h->remaining = h->metaint;
 
+cache:
 	/* Calculate input buffer size */
 	h->cache_size = h->cache_len * 1000;
 	if(h->info.bitrate > 0)
@@ -271,10 +390,18 @@ int shoutcast_open(struct shout_handle **handle, const char *url,
 	if(vring_open(&h->ring, h->cache_size, MAX_RW_SIZE) != 0)
 		return -1;
 
+	/* Allocate default time-shift buffer */
+	if(shoutcast_set_timeshift(h, 0, NULL) != 0)
+		return -1;
+
 	/* Synchronize to first frame in stream */
 	if(shoutcast_sync(h) < 0)
 		return -1;
 
+	/* Get codec of HLS stream */
+	if(h->hls != NULL)
+		type = h->info.type == AAC_STREAM ? CODEC_AAC : CODEC_MP3;
+
 	/* Get data buffer */
 	len = shoutcast_get_buffer(h, &buffer);
 	if(len <= 0)
@@ -301,6 +428,7 @@ int shoutcast_open(struct shout_handle **handle, const char *url,
 
 static inline int shoutcast_sync(struct shout_handle *h)
 {
+	struct mpeg_frame frame;
 	unsigned char *buffer;
 	time_t now = time(NULL);
 	ssize_t len = 0;
@@ -310,12 +438,21 @@ static inline int shoutcast_sync(struct shout_handle *h)
 	{
 		case MPEG_STREAM:
 			h->sync_size = MP3_SYNC_SIZE;
-			h->sync_fn = shoutcast_sync_mp3_stream;
+			h->sync_type = MPEG_SYNC_MP3;
 			break;
 		case AAC_STREAM:
 			h->sync_size = AAC_SYNC_SIZE;
-			h->sync_fn = shoutcast_sync_aac_stream;
+			h->sync_type = MPEG_SYNC_ADTS;
 			break;
+		case NONE_STREAM:
+			/* Codec of HLS stream is found from first frames */
+			if(h->hls != NULL)
+			{
+				h->sync_size = AAC_SYNC_SIZE;
+				h->sync_type = MPEG_SYNC_ADTS;
+				break;
+			}
+			/* Fall through */
 		default:
 			return -1;
 	}
@@ -330,10 +467,28 @@ static inline int shoutcast_sync(struct shout_handle *h)
 		return -1;
 
 	/* Find first frame in stream */
-	len = h->sync_fn(h, buffer, len);
+	len = mpeg_sync_find(buffer, len, h->sync_type, SYNC_FRAMES, &frame);
+	if(len < 0 && h->info.type == NONE_STREAM)
+	{
+		/* Not ADTS: try MP3 */
+		h->sync_size = MP3_SYNC_SIZE;
+		h->sync_type = MPEG_SYNC_MP3;
+		len = shoutcast_get_buffer(h, &buffer);
+		len = mpeg_sync_find(buffer, len, h->sync_type, SYNC_FRAMES,
+				     &frame);
+	}
 	if(len < 0)
 		return -1;
 
+	/* Update stream type */
+	if(h->info.type == NONE_STREAM)
+		h->info.type = h->sync_type == MPEG_SYNC_ADTS ? AAC_STREAM :
+								MPEG_STREAM;
+
+	/* Get bitrate from first frame when icy-br is not available */
+	if(h->info.bitrate == 0)
+		h->info.bitrate = frame.bitrate;
+
 	/* Forward to first frame */
 	shoutcast_forward_buffer(h, len);
 
@@ -361,133 +516,6 @@ unsigned char shoutcast_get_channels(struct shout_handle *h)
 	return h->channels;
 }
 
-static ssize_t shoutcast_sync_mp3_stream(struct shout_handle *h,
-					 unsigned char *buffer, size_t in_len)
-{
-	unsigned int bitrates[2][3][15] = {
-		{ /* MPEG-1 */
-			{0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352,
-			 384, 416, 448},
-			{0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224,
-			 256, 320, 384},
-			{0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224,
-			 256, 320}
-		},
-		{ /* MPEG-2 LSF, MPEG-2.5 */
-			{0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176,
-			 192, 224, 256},
-			{0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128,
-			 144, 160},
-			{0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128,
-			 144, 160}
-		}
-	};
-	unsigned int samplerates[3][4] = {
-		{44100, 48000, 32000, 0},
-		{22050, 24000, 16000, 0},
-		{11025, 8000, 8000, 0}
-	};
-	int mp, mpeg, layer, padding;
-	unsigned long samplerate;
-	unsigned int bitrate;
-	int tmp, len, i;
-
-	/* Sync input buffer to first MP3 header */
-	for(i = 0; i < in_len - 3; i++)
-	{
-		if(buffer[i] == 0xFF && buffer[i+1] != 0xFF &&
-		   (buffer[i+1] & 0xE0) == 0xE0)
-		{
-			/* Get Mpeg version */
-			mpeg = 3 - ((buffer[i+1] >> 3) & 0x03);
-			mp = mpeg;
-			if(mpeg == 2)
-				continue;
-			if(mpeg == 3)
-			{
-				mpeg = 2;
-				mp = 1;
-			}
-
-			/* Get Layer */
-			layer = 3 - ((buffer[i+1] >> 1) & 0x03);
-			if(layer == 3)
-				continue;
-
-			/* Get bitrate */
-			tmp = (buffer[i+2] >> 4) & 0x0F;
-			if(tmp == 0 || tmp == 15)
-				continue;
-			bitrate = bitrates[mp][layer][tmp];
-
-			/* Get samplerate */
-			tmp = (buffer[i+2] >> 2) & 0x03;
-			if(tmp == 3)
-				continue;
-			samplerate = samplerates[mpeg][tmp];
-
-			/* Get padding */
-			padding = (buffer[i+2] >> 1) & 0x01;
-
-			/* Calculate length */
-			if(layer == 0)
-			{
-				/* Layer I */
-				len = ((12 * bitrate * 1000 / samplerate) +
-				       padding) * 4;
-			}
-			else if(mpeg > 0 && layer == 2)
-			{
-				/* MPEG 2 and 2.5 in layer III */
-				len = (72 * bitrate * 1000 / samplerate) +
-				      padding;
-			}
-			else
-			{
-				/* Layer II or III */
-				len = (144 * bitrate * 1000 / samplerate) +
-				      padding;
-			}
-
-			/* Check presence of next frame */
-			if(i + len + 2 > in_len || buffer[i+len] != 0xFF ||
-			   buffer[i+len+1] == 0xFF ||
-			   (buffer[i+len+1] & 0xE0) != 0xE0)
-				continue;
-
-			return i;
-		}
-	}
-
-	return -1;
-}
-
-static ssize_t shoutcast_sync_aac_stream(struct shout_handle *h,
-					 unsigned char *buffer, size_t in_len)
-{
-	int len, i;
-
-	/* Sync input buffer to first ADTS header */
-	for(i = 0; i < in_len - 5; i++)
-	{
-		if(buffer[i] == 0xFF && (buffer[i+1] & 0xF6) == 0xF0)
-		{
-			/* Get frame length */
-			len = ((buffer[i+3] & 0x3) << 11) | (buffer[i+4] << 3) |
-			      (buffer[i+5] >> 5);
-
-			/* Check next frame */
-			if(i + len + 2 > in_len || buffer[i+len] != 0xFF ||
-			   (buffer[i+len+1] & 0xF6) != 0xF0)
-				continue;
-
-			return i;
-		}
-	}
-
-	return -1;
-}
-
 static void *shoutcast_thread(void *user_data)
 {
 	struct shout_handle *h = user_data;
@@ -515,6 +543,7 @@ int shoutcast_read(void *user_data, unsigned char *buffer, size_t size,
 	struct decoder_info info;
 	unsigned char *in_buffer;
 	int total_samples = 0;
+	int spliced = 0;
 	ssize_t len = 0;
 	int samples;
 
@@ -565,7 +594,8 @@ int shoutcast_read(void *user_data, unsigned char *buffer, size_t size,
 		{
 			/* Not enough data or failed to synchronize */
 			if(len < h->sync_size ||
-			   (len = h->sync_fn(h, in_buffer, len)) < 0)
+			   (len = mpeg_sync_find(in_buffer, len, h->sync_type,
+						 SYNC_FRAMES, NULL)) < 0)
 			{
 				/* Unlock pause buffer access */
 				pthread_mutex_unlock(&h->pause_mutex);
@@ -581,6 +611,25 @@ int shoutcast_read(void *user_data, unsigned char *buffer, size_t size,
 			continue;
 		}
 
+		/* Splice point of a reconnection reached: synchronize */
+		if(h->splice > 0 && h->splice <= h->ts_play)
+		{
+			h->splice = 0;
+			h->resync = 1;
+
+			/* Unlock pause buffer access */
+			pthread_mutex_unlock(&h->pause_mutex);
+			continue;
+		}
+
+		/* Stop decoding at splice point */
+		spliced = 0;
+		if(h->splice > 0 && h->splice - h->ts_play < len)
+		{
+			len = h->splice - h->ts_play;
+			spliced = 1;
+		}
+
 		/* Decode next frame */
 		samples = decoder_decode(h->dec, in_buffer, len > 0 ? len : 0,
 					 &buffer[total_samples * 4],
@@ -590,9 +639,16 @@ int shoutcast_read(void *user_data, unsigned char *buffer, size_t size,
 			/* Forward used bytes in ring buffer */
 			if(len > 0 && info.used > 0)
 				shoutcast_forward_buffer(h, info.used);
+			/* Drop partial frame before splice point */
+			else if(spliced)
+				shoutcast_forward_buffer(h, len);
 
 			/* Unlock pause buffer access */
 			pthread_mutex_unlock(&h->pause_mutex);
+
+			/* Continue with reconnected stream */
+			if(spliced)
+				continue;
 			break;
 		}
 
@@ -653,6 +709,7 @@ const struct radio_info *shoutcast_get_info(struct shout_handle *h)
 	return &h->info;
 }
 
+
 char *shoutcast_get_metadata(struct shout_handle *h)
 {
 	char *str = NULL;
@@ -661,7 +718,9 @@ char *shoutcast_get_metadata(struct shout_handle *h)
 	pthread_mutex_lock(&h->meta_mutex);
 
 	/* Copy current metadata */
-	if(h->metas != NULL)
+	if(h->metas_cur != NULL)
+		str = strdup(h->metas_cur->data);
+	else if(h->metas != NULL)
 		str = strdup(h->metas->data);
 
 	/* Unlock meta string access */
@@ -689,11 +748,166 @@ int shoutcast_get_filling(struct shout_handle *h)
 	return 100;
 }
 
-int shoutcast_play(struct shout_handle *h)
+unsigned long shoutcast_get_reconnects(struct shout_handle *h)
+{
+	return h->reconnects;
+}
+
+static int shoutcast_variant_cmp(const void *a, const void *b)
+{
+	const struct shout_variant *va = a, *vb = b;
+
+	return (int) va->bitrate - (int) vb->bitrate;
+}
+
+static void shoutcast_free_variants(struct shout_variant *variants,
+				    unsigned int count)
+{
+	unsigned int i;
+
+	if(variants == NULL)
+		return;
+
+	for(i = 0; i < count; i++)
+		free((char *) variants[i].url);
+	free(variants);
+}
+
+int shoutcast_set_variants(struct shout_handle *h,
+			   const struct shout_variant *variants,
+			   unsigned int count)
+{
+	struct shout_variant *v = NULL, *old;
+	unsigned int i, n = 0, old_count;
+	unsigned int bitrate;
+	char *url;
+
+	if(h == NULL)
+		return -1;
+
+	/* Get current stream: URL is replaced by internal thread on switch
+	 * and bitrate comes from icy-br or from first frame in stream.
+	 */
+	pthread_mutex_lock(&h->pause_mutex);
+	url = strdup(h->url);
+	bitrate = h->info.bitrate;
+	pthread_mutex_unlock(&h->pause_mutex);
+	if(url == NULL)
+		return -1;
+
+	/* Use bitrate of matching stream when still unknown */
+	for(i = 0; i < count && bitrate == 0; i++)
+		if(variants[i].url != NULL &&
+		   strcmp(variants[i].url, url) == 0)
+			bitrate = variants[i].bitrate;
+
+	/* Copy streams with current one: a stream with unknown bitrate
+	 * cannot be ordered, so adaptation is disabled.
+	 */
+	if(count > 0 && h->hls == NULL && bitrate > 0)
+	{
+		v = malloc((count + 1) * sizeof(struct shout_variant));
+		if(v == NULL)
+		{
+			free(url);
+			return -1;
+		}
+		v[n].url = strdup(url);
+		v[n++].bitrate = bitrate;
+		for(i = 0; i < count; i++)
+		{
+			if(variants[i].url == NULL || variants[i].bitrate == 0 ||
+			   strcmp(variants[i].url, url) == 0)
+				continue;
+			v[n].url = strdup(variants[i].url);
+			v[n++].bitrate = variants[i].bitrate;
+		}
+		for(i = 0; i < n; i++)
+		{
+			if(v[i].url == NULL)
+			{
+				shoutcast_free_variants(v, n);
+				free(url);
+				return -1;
+			}
+		}
+
+		/* Sort streams by bitrate */
+		qsort(v, n, sizeof(struct shout_variant),
+		      shoutcast_variant_cmp);
+	}
+	free(url);
+
+	/* Lock pause buffer access */
+	pthread_mutex_lock(&h->pause_mutex);
+
+	/* Find current stream */
+	for(i = 0; i < n; i++)
+		if(strcmp(v[i].url, h->url) == 0)
+			break;
+
+	/* Current stream has been switched meanwhile */
+	if(i == n && n > 0)
+	{
+		pthread_mutex_unlock(&h->pause_mutex);
+		shoutcast_free_variants(v, n);
+		return -1;
+	}
+
+	/* Replace streams */
+	old = h->variants;
+	old_count = h->variant_count;
+	h->variants = v;
+	h->variant_count = n;
+	h->variant = i;
+
+	/* Restart measures */
+	h->abr_time = shoutcast_get_time();
+	h->abr_bytes = 0;
+	h->abr_low = 0;
+	h->abr_underrun = 0;
+	h->abr_up_delay = ABR_UP_DELAY;
+	h->abr_up_time = h->abr_time + h->abr_up_delay;
+
+	/* Unlock pause buffer access */
+	pthread_mutex_unlock(&h->pause_mutex);
+
+	/* Free previous streams */
+	shoutcast_free_variants(old, old_count);
+
+	return 0;
+}
+
+unsigned long shoutcast_get_throughput(struct shout_handle *h)
+{
+	return h->throughput;
+}
+
+unsigned long shoutcast_get_switches(struct shout_handle *h)
+{
+	return h->switches;
+}
+
+unsigned long shoutcast_get_gap(struct shout_handle *h)
 {
-	/* Update pause duration */
-	shoutcast_get_pause(h);
+	unsigned long gap;
+
+	/* Lock pause buffer access */
+	pthread_mutex_lock(&h->pause_mutex);
 
+	/* Get total duration of losses (with current one) */
+	gap = h->gap;
+	if(h->is_lost)
+		gap += shoutcast_get_time() - h->lost_time;
+
+	/* Unlock pause buffer access */
+	pthread_mutex_unlock(&h->pause_mutex);
+
+	return gap;
+}
+
+int shoutcast_play(struct shout_handle *h)
+{
 	/* Lock pause buffer access */
 	pthread_mutex_lock(&h->pause_mutex);
 
@@ -717,7 +931,6 @@ int shoutcast_pause(struct shout_handle *h)
 	{
 		h->is_paused = 1;
 		h->is_ready = 0;
-		gettimeofday(&h->start_pause, NULL);
 	}
 
 	/* Unlock pause buffer access */
@@ -726,25 +939,43 @@ int shoutcast_pause(struct shout_handle *h)
 	return 0;
 }
 
+static inline uint64_t shoutcast_get_timeshift_start(struct shout_handle *h)
+{
+	/* Get oldest position still available in time-shift buffer */
+	if(h->ts_write > h->ts_size)
+		return h->ts_write - h->ts_size;
+	return 0;
+}
+
 unsigned long shoutcast_get_pause(struct shout_handle *h)
 {
-	struct timeval now;
 	unsigned long len;
 
 	/* Lock pause buffer access */
 	pthread_mutex_lock(&h->pause_mutex);
 
-	if(h->is_paused && !h->end_pause)
-	{
-		/* Add current pause time */
-		gettimeofday(&now, NULL);
-		h->pause_len += ((now.tv_sec - h->start_pause.tv_sec) * 1000) +
-			     ((now.tv_usec - h->start_pause.tv_usec) / 1000);
-		memcpy(&h->start_pause, &now, sizeof(struct timeval));
-	}
+	/* Get duration of data waiting in time-shift buffer */
+	len = (h->ts_write - h->ts_read) * 1000 / shoutcast_get_byterate(h);
+
+	/* Unlock pause buffer access */
+	pthread_mutex_unlock(&h->pause_mutex);
+
+	return len;
+}
+
+unsigned long shoutcast_get_rewind(struct shout_handle *h)
+{
+	uint64_t start;
+	unsigned long len = 0;
+
+	/* Lock pause buffer access */
+	pthread_mutex_lock(&h->pause_mutex);
 
-	/* Copy len */
-	len = h->pause_len;
+	/* Get duration of played data still in time-shift buffer */
+	start = shoutcast_get_timeshift_start(h);
+	if(h->ts_play > start)
+		len = (h->ts_play - start) * 1000 /
+		      shoutcast_get_byterate(h);
 
 	/* Unlock pause buffer access */
 	pthread_mutex_unlock(&h->pause_mutex);
@@ -754,444 +985,371 @@ unsigned long shoutcast_get_pause(struct shout_handle *h)
 
 unsigned long shoutcast_skip(struct shout_handle *h, unsigned long skip)
 {
-	/* Update pause duration */
-	shoutcast_get_pause(h);
+	size_t rate = shoutcast_get_byterate(h);
+	uint64_t len, size;
 
 	/* Lock pause buffer access */
 	pthread_mutex_lock(&h->pause_mutex);
 
-	/* Update skip value */
-	if(h->pause_len < skip)
-		skip = h->pause_len;
-
-	/* Update skip size if pause buffer is bigger */
-	if(h->pause_len > 0)
+	/* Skip is limited to data not yet moved to cache */
+	size = h->ts_write - h->ts_read;
+	len = (uint64_t) skip * rate / 1000;
+	if(len > size)
 	{
-		h->skip_size += skip * (((h->pause_count + 1) * BLOCK_SIZE) -
-				h->skip_size) / h->pause_len;
-		h->pause_len -= skip;
-		h->is_ready = 0;
+		len = size;
+		skip = len * 1000 / rate;
 	}
 
+	/* Forward in time-shift buffer */
+	if(len > 0)
+		shoutcast_seek_timeshift(h, h->ts_play + len);
+
 	/* Unlock pause buffer access */
 	pthread_mutex_unlock(&h->pause_mutex);
 
 	return skip;
 }
 
-void shoutcast_reset(struct shout_handle *h)
+unsigned long shoutcast_rewind(struct shout_handle *h, unsigned long rewind)
 {
+	size_t rate = shoutcast_get_byterate(h);
+	uint64_t start, len, size = 0;
+
 	/* Lock pause buffer access */
 	pthread_mutex_lock(&h->pause_mutex);
 
-	/* Reset pause buffer */
-	h->skip_size = ~1L;
-	h->is_ready = 0;
+	/* Rewind is limited to played data still in time-shift buffer */
+	start = shoutcast_get_timeshift_start(h);
+	if(h->ts_play > start)
+		size = h->ts_play - start;
+	len = (uint64_t) rewind * rate / 1000;
+	if(len > size)
+	{
+		len = size;
+		rewind = len * 1000 / rate;
+	}
+
+	/* Go back in time-shift buffer */
+	if(len > 0)
+		shoutcast_seek_timeshift(h, h->ts_play - len);
 
 	/* Unlock pause buffer access */
 	pthread_mutex_unlock(&h->pause_mutex);
+
+	return rewind;
 }
 
-int shoutcast_set_event_cb(struct shout_handle *h, shoutcast_event_cb cb,
-			   void *user_data)
+void shoutcast_reset(struct shout_handle *h)
 {
-	/* Lock event access */
-	pthread_mutex_lock(&h->mutex);
-
-	/* Set event callback */
-	h->event_cb = cb;
-	h->event_udata = user_data;
+	/* Lock pause buffer access */
+	pthread_mutex_lock(&h->pause_mutex);
 
-	/* Unlock event access */
-	pthread_mutex_unlock(&h->mutex);
+	/* Go back to live stream */
+	shoutcast_seek_timeshift(h, h->ts_write);
 
-	return 0;
+	/* Unlock pause buffer access */
+	pthread_mutex_unlock(&h->pause_mutex);
 }
 
-int shoutcast_close(struct shout_handle *h)
+static void shoutcast_free_timeshift(unsigned char *buffer, size_t size,
+				     int fd)
 {
-	struct shout_data *m;
-
-	if(h == NULL)
-		return 0;
+	if(buffer == NULL)
+		return;
 
-	/* Stop internal thread */
-	if(h->use_thread)
+	/* Unmap file or free memory */
+	if(fd >= 0)
 	{
-		h->stop = 1;
-		pthread_join(h->thread, NULL);
+		munmap(buffer, size);
+		close(fd);
 	}
+	else
+		free(buffer);
+}
 
-	/* Close decoder */
-	if(h->dec != NULL)
-		decoder_close(h->dec);
+static void shoutcast_drop_timeshift(struct shout_handle *h)
+{
+	struct shout_data *m;
+	uint64_t start;
 
-	/* Close HTTP */
-	if(h->http != NULL)
-		http_close(h->http);
+	/* Get oldest position in time-shift buffer */
+	start = shoutcast_get_timeshift_start(h);
 
-	/* Close and free ring buffer */
-	if(h->ring != NULL)
-		vring_close(h->ring);
+	/* Data not moved to cache has been overwritten: go to oldest data */
+	if(h->ts_read < start)
+		shoutcast_seek_timeshift(h, start);
 
-	/* Free meta cache */
-	while(h->metas != NULL)
+	/* Lock meta string access */
+	pthread_mutex_lock(&h->meta_mutex);
+
+	/* Free metadata which are out of time-shift buffer */
+	while(h->metas != NULL && h->metas->next != NULL &&
+	      h->metas->next->pos <= start && h->metas != h->metas_cur)
 	{
 		m = h->metas;
 		h->metas = m->next;
 		free(m);
 	}
-	if(h->meta != NULL)
-		free(h->meta);
-
-	/* Free pause buffer */
-	while(h->pauses != NULL)
-	{
-		m = h->pauses;
-		h->pauses = m->next;
-		free(m);
-	}
-	while(h->pool != NULL)
-	{
-		m = h->pool;
-		h->pool = m->next;
-		free(m);
-	}
-
-	/* Free handler */
-	free(h);
 
-	return 0;
+	/* Unlock meta string access */
+	pthread_mutex_unlock(&h->meta_mutex);
 }
 
-static ssize_t shoutcast_read_stream(struct shout_handle *h,
-				     unsigned char *buffer, size_t size,
-				     unsigned long timeout, int skip)
+int shoutcast_set_timeshift(struct shout_handle *h, unsigned long len,
+			    const char *path)
 {
-	struct shout_data *b, *b2;
-	ssize_t len;
-	size_t pos;
-	size_t r_len = 0;
-	int eos = 0;
+	char file[PATH_MAX];
+	unsigned char *buffer;
+	uint64_t start, pos;
+	size_t size, count, o, n;
+	int fd = -1;
 
-	/* No pause has been performed */
-	if(buffer != NULL && h->pauses == NULL && h->pool == NULL)
-		return http_read_timeout(h->http, buffer, size, timeout);
+	if(h == NULL)
+		return -1;
 
-	/* Fill pause buffer */
-	do {
-		/* Skipping: do not retrieve data from HTTP stream */
-		if(skip)
-			break;
+	/* Calculate time-shift buffer size */
+	if(len == 0)
+		len = DEFAULT_TIMESHIFT;
+	size = len * shoutcast_get_byterate(h);
+	if(size < h->cache_size + BLOCK_SIZE)
+		size = h->cache_size + BLOCK_SIZE;
 
-		/* No block is ready for filling */
-		if(h->pool == NULL)
-		{
-			/* Allocate a block */
-			h->pool = malloc(sizeof(struct shout_data)+BLOCK_SIZE);
-			if(h->pool == NULL)
-				break;
-			h->pool->remaining = BLOCK_SIZE;
-			h->pool->next = NULL;
-			h->pool_last = h->pool;
-		}
+	/* Allocate time-shift buffer */
+	if(path != NULL && *path != '\0')
+	{
+		/* Create an anonymous file in path */
+		snprintf(file, sizeof(file), "%s/%s", path, TIMESHIFT_FILE);
+		fd = mkstemp(file);
+		if(fd < 0)
+			return -1;
+		unlink(file);
 
-		/* Get data from HTTP stream */
-		pos = BLOCK_SIZE - h->pool->remaining;
-		len = http_read_timeout(h->http,
-					(unsigned char*) h->pool->data + pos,
-					h->pool->remaining, 0);
-		if(len <= 0)
+		/* Reserve space and map file in memory */
+		if(posix_fallocate(fd, 0, size) != 0 ||
+		   (buffer = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				  MAP_SHARED, fd, 0)) == MAP_FAILED)
 		{
-			/* Sleep the timeout */
-			usleep(timeout*1000);
-
-			/* End of stream */
-			if(len < 0)
-				eos = 1;
-			break;
+			close(fd);
+			return -1;
 		}
+	}
+	else
+	{
+		/* Allocate in memory */
+		buffer = malloc(size);
+		if(buffer == NULL)
+			return -1;
+	}
 
-		/* Update remaining space in block */
-		h->pool->remaining -= len;
-		if(h->pool->remaining == 0)
-		{
-			/* Remove block from pool */
-			b = h->pool;
-			h->pool = b->next;
-			if(h->pool == NULL)
-				h->pool_last = NULL;
-
-			/* Add block to buffer pause */
-			if(h->pauses_last != NULL)
-				h->pauses_last->next = b;
-			else
-				h->pauses = b;
-			h->pauses_last = b;
-			b->remaining = BLOCK_SIZE;
-			b->next = NULL;
-			h->pause_count++;
-		}
-	} while(h->pool != NULL);
+	/* Lock pause buffer access */
+	pthread_mutex_lock(&h->pause_mutex);
 
-	/* Stream is paused: do not return data */
-	if(buffer == NULL)
-		return eos;
+	/* Get data to keep from previous buffer */
+	start = shoutcast_get_timeshift_start(h);
+	if(h->ts_write - start > size)
+		start = h->ts_write - size;
 
-	/* Skipping: flush pool */
-	if(skip && h->pool != NULL)
+	/* Copy data to new buffer */
+	for(pos = start; pos < h->ts_write; pos += count)
 	{
-		/* Some data are remaining */
-		if(h->pool->remaining < BLOCK_SIZE)
-		{
-			/* Remove from pool */
-			b = h->pool;
-			h->pool = b->next;
-			if(h->pool == NULL)
-				h->pool_last = NULL;
-
-			/* Add to pause buffer */
-			if(h->pauses_last != NULL)
-				h->pauses_last->next = b;
-			else
-				h->pauses = b;
-			h->pauses_last = b;
-
-			/* Move data to end of block */
-			len = BLOCK_SIZE - b->remaining;
-			memmove(b->data + b->remaining, b->data, len);
-			b->remaining = len;
-			b->next = NULL;
-			h->pause_count++;
-		}
-
-		/* Free all other blocks in pool */
-		while(h->pool != NULL)
-		{
-			b = h->pool;
-			h->pool = b->next;
-			free(b);
-		}
-		h->pool_last = NULL;
+		o = pos % h->ts_size;
+		n = pos % size;
+		count = h->ts_write - pos;
+		if(count > h->ts_size - o)
+			count = h->ts_size - o;
+		if(count > size - n)
+			count = size - n;
+		memcpy(buffer + n, h->ts_buffer + o, count);
 	}
 
-	/* Get data from pause buffer */
-	while(h->pauses != NULL && size > 0)
-	{
-		/* Copy data from pause buffer */
-		b = h->pauses;
-		pos = BLOCK_SIZE - b->remaining;
-		len = size > b->remaining ? b->remaining : size;
-		memcpy(buffer + r_len, b->data + pos, len);
-
-		/* Update block values */
-		b->remaining -= len;
-		r_len += len;
-		size -= len;
-
-		/* Block is empty: get next */
-		if(b->remaining == 0)
-		{
-			/* Remove block from pause buffer */
-			h->pauses = b->next;
-			if(h->pauses == NULL)
-				h->pauses_last = NULL;
-
-			/* Update block and set to pause block */
-			b->remaining = BLOCK_SIZE;
-			b->next = NULL;
-			if(!skip)
-			{
-				/* Add block to pool */
-				if(h->pool_last != NULL)
-					h->pool_last->next = b;
-				else
-					h->pool = b;
-				h->pool_last = b;
-			}
-			else
-				free(b);
-			h->pause_count--;
-
-			/* Check pool size */
-			if(h->last_pool_check + CHECK_POOL <= time(NULL) &&
-			   !skip)
-			{
-				/* Update last check pool timer */
-				h->last_pool_check = time(NULL);
+	/* Replace buffer */
+	shoutcast_free_timeshift(h->ts_buffer, h->ts_size, h->ts_fd);
+	h->ts_buffer = buffer;
+	h->ts_size = size;
+	h->ts_fd = fd;
 
-				/* Free all blocks which are useless */
-				if(h->pool != NULL && h->pool->next != NULL)
-				{
-					/* Keep only two block */
-					b = h->pool->next->next;
-					h->pool_last = h->pool->next;
-					h->pool_last->next = NULL;
-
-					/* Free all blocks */
-					while(b != NULL)
-					{
-						b2 = b;
-						b = b->next;
-						free(b2);
-					}
-				}
-			}
-		}
-	}
+	/* Update positions if buffer is smaller */
+	shoutcast_drop_timeshift(h);
 
-	/* End of stream */
-	if(eos && r_len == 0)
-		return -1;
+	/* Unlock pause buffer access */
+	pthread_mutex_unlock(&h->pause_mutex);
 
-	return r_len;
+	return 0;
 }
 
-static ssize_t shoutcast_fill_buffer(struct shout_handle *h,
-				     unsigned long timeout)
+struct recorder_handle *shoutcast_set_recorder(struct shout_handle *h,
+					       struct recorder_handle *rec)
 {
-	unsigned char *buffer;
-	int skip = 0;
-	ssize_t size;
-	ssize_t len;
+	struct recorder_handle *old;
 
 	/* Lock pause buffer access */
 	pthread_mutex_lock(&h->pause_mutex);
 
-	/* Skipping time in pause buffer */
-	if(h->skip_size > 0)
-		skip = 1;
+	/* Replace recorder */
+	old = h->rec;
+	h->rec = rec;
 
-	/* Copy current stream status */
-	if(h->is_paused && !skip)
-	{
-		/* Unlock pause buffer access */
-		pthread_mutex_unlock(&h->pause_mutex);
+	/* Unlock pause buffer access */
+	pthread_mutex_unlock(&h->pause_mutex);
 
-		/* Fill pause buffer */
-		len = shoutcast_read_stream(h, NULL, 0, timeout, 0);
+	return old;
+}
 
-		/* End of stream */
-		if(len != 0)
-		{
-			/* Update pause */
-			shoutcast_get_pause(h);
-			h->end_pause = 1;
-		}
+int shoutcast_set_event_cb(struct shout_handle *h, shoutcast_event_cb cb,
+			   void *user_data)
+{
+	/* Lock event access */
+	pthread_mutex_lock(&h->mutex);
 
-		return 0;
-	}
+	/* Set event callback */
+	h->event_cb = cb;
+	h->event_udata = user_data;
 
-	/* Unlock pause buffer access */
-	pthread_mutex_unlock(&h->pause_mutex);
+	/* Unlock event access */
+	pthread_mutex_unlock(&h->mutex);
 
-	/* Fill cache */
-	do
-	{
-		/* Lock pause buffer access */
-		pthread_mutex_lock(&h->pause_mutex);
+	return 0;
+}
 
-		/* Forward in cache */
-		while(h->skip_size > 0)
-		{
-			len = shoutcast_forward_buffer(h, h->skip_size);
-			if(len <= 0)
-				break;
-			h->skip_size -= len;
-		}
+int shoutcast_close(struct shout_handle *h)
+{
+	struct shout_data *m;
 
-		/* Unlock pause buffer access */
-		pthread_mutex_unlock(&h->pause_mutex);
+	if(h == NULL)
+		return 0;
 
-		/* Get buffer write */
-		size = vring_write(h->ring, &buffer);
-		if(size <= 0)
-		{
-			/* Lock pause buffer access */
-			pthread_mutex_lock(&h->pause_mutex);
+	/* Stop internal thread */
+	if(h->use_thread)
+	{
+		h->stop = 1;
+		pthread_join(h->thread, NULL);
+	}
 
-			/* Cache is full */
-			if(size == 0 && h->is_ready == 0 && !h->is_paused)
-			{
-				/* Lock event access */
-				pthread_mutex_lock(&h->mutex);
+	/* Close decoder */
+	if(h->dec != NULL)
+		decoder_close(h->dec);
 
-				/* Notify cache is ready */
-				if(h->event_cb != NULL)
-					h->event_cb(h->event_udata,
-						    SHOUT_EVENT_READY, NULL);
+	/* Close HTTP and HLS clients */
+	if(h->http != NULL)
+		http_close(h->http);
+	if(h->hls != NULL)
+		hls_close(h->hls);
 
-				/* Unlock event access */
-				pthread_mutex_unlock(&h->mutex);
+	/* Close and free ring buffer */
+	if(h->ring != NULL)
+		vring_close(h->ring);
 
-				/* Update cache status */
-				h->is_ready = 1;
-				if(skip)
-					h->resync = 1;
-			}
+	/* Free meta cache */
+	while(h->metas != NULL)
+	{
+		m = h->metas;
+		h->metas = m->next;
+		free(m);
+	}
+	if(h->meta != NULL)
+		free(h->meta);
 
-			/* Unlock pause buffer access */
-			pthread_mutex_unlock(&h->pause_mutex);
+	/* Free time-shift buffer */
+	shoutcast_free_timeshift(h->ts_buffer, h->ts_size, h->ts_fd);
+
+	/* Free radio info and URL */
+	if(h->info.description != NULL)
+		free(h->info.description);
+	if(h->info.genre != NULL)
+		free(h->info.genre);
+	if(h->info.name != NULL)
+		free(h->info.name);
+	if(h->info.url != NULL)
+		free(h->info.url);
+	if(h->url != NULL)
+		free(h->url);
+	shoutcast_free_variants(h->variants, h->variant_count);
 
-			/* Wait timeout */
-			usleep(timeout*1000);
-			break;
-		}
-		else if(h->remaining > 0 && size > h->remaining)
-			size = h->remaining;
+	/* Free handler */
+	free(h);
 
-		/* Read data from HTTP stream */
-		len = shoutcast_read_stream(h, buffer, size, timeout, skip);
-		if(len <= 0)
-		{
-			/* Lock pause buffer access */
-			pthread_mutex_lock(&h->pause_mutex);
+	return 0;
+}
 
-			/* Pause buffer is empty */
-			if(skip && h->pauses == NULL)
-			{
-				h->pause_len = 0;
-				h->skip_size = 0;
-				h->resync = 1;
-			}
+static void shoutcast_write_timeshift(struct shout_handle *h,
+				      unsigned char *buffer, size_t len)
+{
+	size_t pos, size;
 
-			/* Unlock pause buffer access */
-			pthread_mutex_unlock(&h->pause_mutex);
+	/* Copy data to time-shift buffer */
+	while(len > 0)
+	{
+		pos = h->ts_write % h->ts_size;
+		size = h->ts_size - pos;
+		if(size > len)
+			size = len;
+		memcpy(h->ts_buffer + pos, buffer, size);
+
+		/* Update position */
+		h->ts_write += size;
+		buffer += size;
+		len -= size;
+	}
+}
 
-			if(len < 0)
-				return -1;
+static size_t shoutcast_read_timeshift(struct shout_handle *h,
+				       unsigned char *buffer, size_t size)
+{
+	size_t pos;
 
-			break;
-		}
+	/* Get available data */
+	if(size > h->ts_write - h->ts_read)
+		size = h->ts_write - h->ts_read;
 
-		/* No meta data */
-		if(h->metaint == 0)
-			continue;
+	/* Copy data until end of time-shift buffer */
+	pos = h->ts_read % h->ts_size;
+	if(size > h->ts_size - pos)
+		size = h->ts_size - pos;
+	memcpy(buffer, h->ts_buffer + pos, size);
+
+	/* Update position */
+	h->ts_read += size;
+
+	return size;
+}
 
-		/* Update remaining length */
-		h->remaining -= len;
+static void shoutcast_demux_stream(struct shout_handle *h,
+				   unsigned char *buffer, size_t len)
+{
+	size_t size;
 
-		/* Process data */
+	/* Process data */
+	while(len > 0)
+	{
 		switch(h->state)
 		{
 			case SHOUT_DATA:
+				/* Stop at next meta data field */
+				size = len;
+				if(h->metaint > 0 && size > h->remaining)
+					size = h->remaining;
+
+				/* Copy to time-shift buffer */
+				shoutcast_write_timeshift(h, buffer, size);
+
+				/* Record stream as received */
+				if(h->rec != NULL)
+					recorder_write(h->rec, buffer, size);
+
+				/* No meta data */
+				if(h->metaint == 0)
+					break;
+
 				/* Meta data field reached */
+				h->remaining -= size;
 				if(h->remaining == 0)
-				{
-					h->remaining = 1;
 					h->state = SHOUT_META_LEN;
-				}
-
-				/* Forward in ring buffer */
-				vring_write_forward(h->ring, len);
 				break;
 			case SHOUT_META_LEN:
 				/* Set meta data size */
 				h->meta_size = buffer[0] * 16;
 				h->meta_len = 0;
-
-				/* Lock meta string access */
-				pthread_mutex_lock(&h->meta_mutex);
+				size = 1;
 
 				if(h->meta_size > 0)
 				{
@@ -1201,66 +1359,409 @@ static ssize_t shoutcast_fill_buffer(struct shout_handle *h,
 					/* Allocate a new meta */
 					h->meta = calloc(1,
 						     sizeof(struct shout_data) +
-						     h->meta_size);
+						     h->meta_size + 1);
 				}
 				else
 				{
 					h->remaining = h->metaint;
 					h->state = SHOUT_DATA;
-
-					/* Update bytes before next metadata */
-					if(h->metas_last != NULL)
-						h->metas_last->remaining +=
-								     h->metaint;
 				}
-
-				/* Unlock meta string access */
-				pthread_mutex_unlock(&h->meta_mutex);
-
 				break;
 			case SHOUT_META_DATA:
-				/* Lock meta string access */
-				pthread_mutex_lock(&h->meta_mutex);
-
 				/* Copy data to metadata */
+				size = len > h->remaining ? h->remaining : len;
 				if(h->meta != NULL)
-					memcpy(h->meta->data+h->meta_len, 
-					       buffer, len);
-				h->meta_len += len;
+					memcpy(h->meta->data + h->meta_len,
+					       buffer, size);
+				h->meta_len += size;
+				h->remaining -= size;
 
-				/* Meta data field end */
-				if(h->remaining == 0)
-				{
-					h->remaining = h->metaint;
-					h->state = SHOUT_DATA;
+				/* Meta data field not finished */
+				if(h->remaining > 0)
+					break;
+				h->remaining = h->metaint;
+				h->state = SHOUT_DATA;
 
-					/* Bad metadata */
-					if(h->meta == NULL)
-					{
-						/* Unlock meta string access */
-						pthread_mutex_unlock(
-								&h->meta_mutex);
-						break;
-					}
+				/* Bad metadata */
+				if(h->meta == NULL)
+					break;
 
-					/* Update remaining bytes */
-					h->meta->remaining = h->metaint;
+				/* Lock meta string access */
+				pthread_mutex_lock(&h->meta_mutex);
 
+				/* Same metadata: keep previous one */
+				if(h->metas_last != NULL &&
+				   strcmp(h->metas_last->data,
+					  h->meta->data) == 0)
+				{
+					free(h->meta);
+				}
+				else
+				{
 					/* Add meta to cache */
+					h->meta->pos = h->ts_write;
 					if(h->metas_last != NULL)
 						h->metas_last->next = h->meta;
 					else
 						h->metas = h->meta;
 					h->metas_last = h->meta;
-					h->meta = NULL;
 				}
+				h->meta = NULL;
 
 				/* Unlock meta string access */
 				pthread_mutex_unlock(&h->meta_mutex);
 
+				/* First metadata */
+				if(h->metas_cur == NULL)
+					shoutcast_update_meta(h);
 				break;
 		}
-	} while(!h->is_ready);
+
+		/* Go to next data */
+		buffer += size;
+		len -= size;
+	}
+
+	/* Drop oldest data */
+	shoutcast_drop_timeshift(h);
+}
+
+static struct http_handle *shoutcast_connect(struct shout_handle *h,
+					     const char *url, int *metaint)
+{
+	struct http_handle *http;
+	const char *type;
+	char *p;
+
+	/* Open a new HTTP client */
+	if(http_open(&http, 1) != 0)
+		return NULL;
+	http_set_option(http, HTTP_EXTRA_HEADER, "Icy-MetaData: 1\r\n", 0);
+	http_set_option(http, HTTP_FOLLOW_REDIRECT, NULL, 1);
+
+	/* Connect and check stream has same codec */
+	type = h->info.type == AAC_STREAM ? "audio/aac" : "audio/mpeg";
+	if(http_get(http, url) != 200 ||
+	   (p = http_get_header(http, "content-type", 0)) == NULL ||
+	   strncmp(p, type, strlen(type)) != 0)
+	{
+		http_close(http);
+		return NULL;
+	}
+
+	/* Get new metadata interval */
+	*metaint = 0;
+	p = http_get_header(http, "icy-metaint", 0);
+	if(p != NULL)
+		*metaint = atoi(p);
+
+	return http;
+}
+
+static void shoutcast_splice(struct shout_handle *h, struct http_handle *http,
+			     int metaint)
+{
+	/* Replace HTTP client */
+	http_close(h->http);
+	h->http = http;
+
+	/* Restart metadata demultiplexing */
+	if(h->meta != NULL)
+		free(h->meta);
+	h->meta = NULL;
+	h->metaint = metaint;
+	h->remaining = metaint;
+	h->state = SHOUT_DATA;
+
+	/* New stream is spliced after data already received */
+	if(h->ts_write > 0 && h->splice <= h->ts_play)
+		h->splice = h->ts_write;
+}
+
+static int shoutcast_reconnect(struct shout_handle *h)
+{
+	struct http_handle *http;
+	uint64_t now, delay;
+	int metaint;
+
+	/* Wait next attempt */
+	now = shoutcast_get_time();
+	if(now < h->retry_time)
+		return 0;
+
+	/* Too many attempts: end of stream */
+	if(h->tries >= RECONNECT_TRIES)
+		return -1;
+
+	/* Prepare next attempt with exponential backoff */
+	delay = (uint64_t) RECONNECT_DELAY << h->tries;
+	if(delay > RECONNECT_MAX_DELAY)
+		delay = RECONNECT_MAX_DELAY;
+	h->retry_time = now + delay;
+	h->tries++;
+
+	/* Connect to stream */
+	http = shoutcast_connect(h, h->url, &metaint);
+	if(http == NULL)
+		return 0;
+
+	/* Lock pause buffer access */
+	pthread_mutex_lock(&h->pause_mutex);
+
+	/* Splice new stream */
+	shoutcast_splice(h, http, metaint);
+
+	/* Update statistics */
+	h->gap += now - h->lost_time;
+	h->reconnects++;
+	h->is_lost = 0;
+
+	/* Unlock pause buffer access */
+	pthread_mutex_unlock(&h->pause_mutex);
+
+	return 0;
+}
+
+static void shoutcast_switch_variant(struct shout_handle *h, int step)
+{
+	struct http_handle *http;
+	unsigned int bitrate;
+	unsigned int next;
+	uint64_t now;
+	int metaint;
+	char *url;
+
+	/* Lock pause buffer access */
+	pthread_mutex_lock(&h->pause_mutex);
+
+	/* Get next stream */
+	next = h->variant + step;
+	if(next >= h->variant_count)
+	{
+		pthread_mutex_unlock(&h->pause_mutex);
+		return;
+	}
+	url = strdup(h->variants[next].url);
+	bitrate = h->variants[next].bitrate;
+
+	/* Unlock pause buffer access */
+	pthread_mutex_unlock(&h->pause_mutex);
+
+	if(url == NULL)
+		return;
+
+	/* Connect to new stream: current stream is played meanwhile */
+	http = shoutcast_connect(h, url, &metaint);
+	now = shoutcast_get_time();
+
+	/* Lock pause buffer access */
+	pthread_mutex_lock(&h->pause_mutex);
+
+	/* Variants have changed during connection */
+	if(next >= h->variant_count || strcmp(h->variants[next].url, url) != 0)
+	{
+		if(http != NULL)
+			http_close(http);
+		http = NULL;
+	}
+
+	if(http != NULL)
+	{
+		/* Splice new stream on its first frame */
+		shoutcast_splice(h, http, metaint);
+		free(h->url);
+		h->url = url;
+		url = NULL;
+		h->variant = next;
+		if(bitrate > 0)
+			h->info.bitrate = bitrate;
+		h->switches++;
+	}
+
+	/* Wait before next step up: longer after a step down */
+	if(step < 0)
+	{
+		h->abr_up_delay *= 2;
+		if(h->abr_up_delay > ABR_MAX_UP_DELAY)
+			h->abr_up_delay = ABR_MAX_UP_DELAY;
+	}
+	h->abr_up_time = now + h->abr_up_delay;
+
+	/* Restart measures */
+	h->abr_time = now;
+	h->abr_bytes = 0;
+	h->abr_low = 0;
+	h->abr_underrun = 0;
+
+	/* Unlock pause buffer access */
+	pthread_mutex_unlock(&h->pause_mutex);
+
+	if(url != NULL)
+		free(url);
+}
+
+static void shoutcast_adapt(struct shout_handle *h)
+{
+	unsigned long bitrate, filling;
+	uint64_t now, elapsed;
+	int step = 0;
+
+	/* Only one stream */
+	if(h->variant_count < 2)
+		return;
+
+	/* Wait end of measure period */
+	now = shoutcast_get_time();
+	elapsed = now - h->abr_time;
+	if(elapsed < ABR_PERIOD)
+		return;
+
+	/* Lock pause buffer access */
+	pthread_mutex_lock(&h->pause_mutex);
+
+	/* Calculate throughput (in kb/s) */
+	h->throughput = h->abr_bytes * 8 / elapsed;
+	h->abr_bytes = 0;
+	h->abr_time = now;
+
+	/* Get data buffered ahead of decoder (in %) */
+	filling = (h->ts_write - h->ts_play) * 100 / h->cache_size;
+	bitrate = shoutcast_get_byterate(h) / 125;
+
+	/* Paused stream: cache is not consumed */
+	if(!h->is_paused)
+	{
+		/* Cache underrun or stream too slow: step down */
+		if(h->abr_underrun || (filling < ABR_LOW_FILLING &&
+		   h->throughput * 100 < bitrate * ABR_LOW_RATE))
+		{
+			if(h->abr_underrun || ++h->abr_low >= ABR_LOW_PERIODS)
+				step = -1;
+		}
+		else
+		{
+			/* Headroom for long enough: step up */
+			h->abr_low = 0;
+			if(filling >= ABR_HIGH_FILLING &&
+			   now >= h->abr_up_time)
+				step = 1;
+		}
+	}
+	h->abr_underrun = 0;
+
+	/* Unlock pause buffer access */
+	pthread_mutex_unlock(&h->pause_mutex);
+
+	/* Switch stream at next frame boundary */
+	if(step < 0 && h->variant > 0)
+		shoutcast_switch_variant(h, -1);
+	else if(step > 0 && h->variant + 1 < h->variant_count)
+		shoutcast_switch_variant(h, 1);
+}
+
+static ssize_t shoutcast_fill_buffer(struct shout_handle *h,
+				     unsigned long timeout)
+{
+	unsigned char buffer[BLOCK_SIZE];
+	unsigned char *p;
+	ssize_t size;
+	ssize_t len;
+
+	/* Fill cache */
+	do
+	{
+		/* Read audio frames from HLS segments: no reconnection */
+		if(h->hls != NULL)
+			len = hls_read_timeout(h->hls, buffer, BLOCK_SIZE,
+					       timeout);
+		/* Read data from HTTP stream */
+		else if(!h->is_lost)
+		{
+			/* Adapt bitrate before reading next data */
+			shoutcast_adapt(h);
+
+			len = http_read_timeout(h->http, buffer, BLOCK_SIZE,
+						timeout);
+			if(len > 0)
+			{
+				/* Stream is alive: reset backoff */
+				h->tries = 0;
+				h->abr_bytes += len;
+			}
+			else if(len < 0)
+			{
+				/* Connection lost: first attempt is
+				 * immediate if stream was alive */
+				h->lost_time = shoutcast_get_time();
+				if(h->tries == 0)
+					h->retry_time = h->lost_time;
+				h->is_lost = 1;
+			}
+		}
+
+		/* Try to reconnect while cache is played */
+		if(h->is_lost)
+			len = shoutcast_reconnect(h);
+
+		/* Lock pause buffer access */
+		pthread_mutex_lock(&h->pause_mutex);
+
+		/* Demultiplex data in time-shift buffer */
+		if(len > 0)
+			shoutcast_demux_stream(h, buffer, len);
+
+		/* Move data from time-shift buffer to cache */
+		while(!h->is_paused)
+		{
+			/* Get buffer write */
+			size = vring_write(h->ring, &p);
+			if(size <= 0)
+			{
+				/* Cache is full */
+				if(size == 0 && h->is_ready == 0)
+				{
+					/* Lock event access */
+					pthread_mutex_lock(&h->mutex);
+
+					/* Notify cache is ready */
+					if(h->event_cb != NULL)
+						h->event_cb(h->event_udata,
+							    SHOUT_EVENT_READY,
+							    NULL);
+
+					/* Unlock event access */
+					pthread_mutex_unlock(&h->mutex);
+
+					/* Update cache status */
+					h->is_ready = 1;
+				}
+				break;
+			}
+
+			/* Copy data from time-shift buffer */
+			size = shoutcast_read_timeshift(h, p, size);
+			if(size == 0)
+				break;
+
+			/* Forward in ring buffer */
+			vring_write_forward(h->ring, size);
+		}
+
+		/* End of stream and time-shift buffer is empty */
+		if(len < 0 && h->ts_read == h->ts_write)
+		{
+			/* Unlock pause buffer access */
+			pthread_mutex_unlock(&h->pause_mutex);
+			return -1;
+		}
+
+		/* Unlock pause buffer access */
+		pthread_mutex_unlock(&h->pause_mutex);
+
+		/* Wait timeout at end of stream or during reconnection */
+		if(len < 0 || h->is_lost)
+			usleep(timeout*1000);
+	} while(!h->is_ready && len > 0);
 
 	return vring_get_length(h->ring);
 }
@@ -1285,6 +1786,10 @@ static ssize_t shoutcast_get_buffer(struct shout_handle *h,
 		/* Unlock event access */
 		pthread_mutex_unlock(&h->mutex);
 
+		/* Cache underrun for bitrate adaptation */
+		if(h->is_ready == 1)
+			h->abr_underrun = 1;
+
 		h->is_ready = 0;
 		len = 0;
 	}
@@ -1294,50 +1799,66 @@ static ssize_t shoutcast_get_buffer(struct shout_handle *h,
 
 static ssize_t shoutcast_forward_buffer(struct shout_handle *h, size_t size)
 {
-	struct shout_data *m;
 	ssize_t len;
 
 	/* Forward ring buffer */
 	len = vring_read_forward(h->ring, size);
+	if(len <= 0)
+		return len;
 
-	/* Lock meta string access */
-	pthread_mutex_lock(&h->meta_mutex);
+	/* Update played position and current metadata */
+	h->ts_play += len;
+	shoutcast_update_meta(h);
 
-	/* Update first meta */
-	while(h->metas != NULL && size >= h->metas->remaining)
-	{
-		/* Go to next meta */
-		size -= h->metas->remaining;
-		h->metas->remaining = 0;
+	return len;
+}
 
-		/* No more metadata in cache */
-		if(h->metas->next == NULL)
-			break;
+static void shoutcast_seek_timeshift(struct shout_handle *h, uint64_t pos)
+{
+	/* Flush cache */
+	vring_read_forward(h->ring, vring_get_length(h->ring));
+
+	/* Restart from new position */
+	h->ts_read = pos;
+	h->ts_play = pos;
+	h->is_ready = 0;
+	h->resync = 1;
+
+	/* Update current metadata */
+	shoutcast_update_meta(h);
+}
+
+static void shoutcast_update_meta(struct shout_handle *h)
+{
+	struct shout_data *m;
 
-		/* Get next metadata in cache */
+	/* Lock meta string access */
+	pthread_mutex_lock(&h->meta_mutex);
+
+	/* Find last metadata before played position */
+	m = h->metas_cur;
+	if(m == NULL || m->pos > h->ts_play)
 		m = h->metas;
-		h->metas = m->next;
-		free(m);
+	while(m != NULL && m->next != NULL && m->next->pos <= h->ts_play)
+		m = m->next;
+
+	/* Metadata has changed */
+	if(m != NULL && m != h->metas_cur)
+	{
+		h->metas_cur = m;
 
 		/* Lock event access */
 		pthread_mutex_lock(&h->mutex);
 
 		/* Notify new metadata */
 		if(h->event_cb != NULL)
-			h->event_cb(h->event_udata, SHOUT_EVENT_META,
-				    h->metas->data);
+			h->event_cb(h->event_udata, SHOUT_EVENT_META, m->data);
 
 		/* Unlock event access */
 		pthread_mutex_unlock(&h->mutex);
 	}
 
-	/* Update remaining bytes before next metadata */
-	if(h->metas != NULL && size < h->metas->remaining)
-		h->metas->remaining -= size;
-
 	/* Unlock meta string access */
 	pthread_mutex_unlock(&h->meta_mutex);
-
-	return len;
 }
 
@@ -19,12 +19,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <pthread.h>
 
 #include "timers.h"
 #include "utils.h"
+#include "loop.h"
 
 #define TIMER_ID_SIZE 10
+/* Maximum timeout of a loop timer for date events (in ms): date is checked
+ * again on expiration.
+ */
+#define TIMERS_MAX_TIMEOUT 86400000L
 
 struct timer_event {
 	/* Name */
@@ -37,6 +43,9 @@ struct timer_event {
 	time_t next_wakeup;
 	uint64_t time;
 	int enable;
+	/* Loop timer armed on next wake up */
+	struct timers_handle *timers;
+	struct loop_timer *timer;
 	/* Callback */
 	timer_event_cb cb;
 	void *user_data;
@@ -58,21 +67,23 @@ struct timer_handle {
 struct timers_handle {
 	/* Timer list */
 	struct timer_handle *timers;
-	/* Event thread */
-	pthread_t thread;
-	pthread_cond_t cond;
-	int running;
-	int stop;
+	/* Event loop and status */
+	struct loop_handle *loop;
+	int started;
 	/* Mutex used for timers access */
 	pthread_mutex_t mutex;
 };
 
-static void *timers_thread(void *user_data);
+static void timers_arm_event(struct timer_event *e);
+static void timers_arm_all(struct timers_handle *h);
 
-int timers_open(struct timers_handle **handle)
+int timers_open(struct timers_handle **handle, struct loop_handle *loop)
 {
 	struct timers_handle *h;
 
+	if(loop == NULL)
+		return -1;
+
 	/* Allocate handle */
 	*handle = malloc(sizeof(struct timers_handle));
 	if(*handle == NULL)
@@ -81,11 +92,10 @@ int timers_open(struct timers_handle **handle)
 
 	/* Init handle */
 	h->timers = NULL;
-	h->running = 0;
-	h->stop = 0;
+	h->loop = loop;
+	h->started = 0;
 
-	/* Init thread mutex and condition */
-	pthread_cond_init(&h->cond, NULL);
+	/* Init thread mutex */
 	pthread_mutex_init(&h->mutex, NULL);
 
 	return 0;
@@ -93,34 +103,24 @@ int timers_open(struct timers_handle **handle)
 
 int timers_start(struct timers_handle *h)
 {
-	if(h == NULL)
+	if(h == NULL || h->started)
 		return -1;
 
-	/* Thread already running */
-	if(h->running)
-		return -1;
-
-	/* Create thread */
-	if(pthread_create(&h->thread, NULL, timers_thread, h) != 0)
-		return -1;
-	h->running = 1;
+	/* Arm loop timers of all enabled events */
+	h->started = 1;
+	timers_arm_all(h);
 
 	return 0;
 }
 
 int timers_stop(struct timers_handle *h)
 {
-	if(h == NULL || h->running == 0)
+	if(h == NULL || !h->started)
 		return -1;
 
-	/* Send signal to stop thread */
-	h->stop = 1;
-	pthread_cond_signal(&h->cond);
-
-	/* Wait end of thread */
-	pthread_join(h->thread, NULL);
-	h->running = 0;
-	h->stop = 0;
+	/* Disarm loop timers: no event is called after */
+	h->started = 0;
+	timers_arm_all(h);
 
 	return 0;
 }
@@ -157,12 +157,13 @@ static inline time_t timers_calc_next_time(struct timer_event *e)
 
 static void timers_update_time(struct timer_event *e)
 {
-	/* Calculate next event */
+	/* Calculate next date: delays are handled by loop timer */
 	switch(e->type)
 	{
 		case TIMER_ONE_SHUT:
 		case TIMER_PERIODIC:
-			e->next_wakeup += e->time;
+		case TIMER_ONE_SHUT_MS:
+		case TIMER_PERIODIC_MS:
 			break;
 		case TIMER_DATE:
 			e->next_wakeup = e->time;
@@ -175,64 +176,114 @@ static void timers_update_time(struct timer_event *e)
 	}
 }
 
-static void *timers_thread(void *user_data)
+static long timers_to_ms(uint64_t value, unsigned long unit)
+{
+	/* Saturate to longest timeout of a loop timer (long is 32-bit on ARM) */
+	if(value > LONG_MAX / unit)
+		return LONG_MAX;
+	return (long) (value * unit);
+}
+
+static void timers_arm_event(struct timer_event *e)
+{
+	long timeout = -1;
+	unsigned long period = 0;
+	time_t now;
+
+	/* Disarm event if disabled or timers are stopped */
+	if(e->enable && e->timers->started)
+	{
+		switch(e->type)
+		{
+			case TIMER_ONE_SHUT:
+				timeout = timers_to_ms(e->time, 1000);
+				break;
+			case TIMER_PERIODIC:
+				timeout = period = timers_to_ms(e->time, 1000);
+				break;
+			case TIMER_ONE_SHUT_MS:
+				timeout = timers_to_ms(e->time, 1);
+				break;
+			case TIMER_PERIODIC_MS:
+				timeout = period = timers_to_ms(e->time, 1);
+				break;
+			case TIMER_DATE:
+			case TIMER_TIME:
+				/* Clamp in seconds before conversion to ms */
+				now = time(NULL);
+				timeout = 0;
+				if(e->next_wakeup - now >
+				   TIMERS_MAX_TIMEOUT / 1000)
+					timeout = TIMERS_MAX_TIMEOUT;
+				else if(e->next_wakeup > now)
+					timeout = (e->next_wakeup - now) * 1000;
+				break;
+			default:
+				break;
+		}
+	}
+
+	/* Arm loop timer */
+	loop_set_timer(e->timer, timeout, period);
+}
+
+static void timers_arm_all(struct timers_handle *h)
 {
-	pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-	struct timers_handle *h = user_data;
 	struct timer_handle *t;
 	struct timer_event *e;
-	struct timespec ts;
-	time_t now;
 
-	/* Lock condition */
-	pthread_mutex_lock(&mutex);
+	/* Lock loop before timers access: same order than in loop callback */
+	loop_lock(h->loop);
+	pthread_mutex_lock(&h->mutex);
 
-	/* Loop until stop signal */
-	while(!h->stop)
-	{
-		/* Get current time */
-		now = time(NULL);
+	/* Arm or disarm all events */
+	for(t = h->timers; t != NULL; t = t->next)
+		for(e = t->events; e != NULL; e = e->next)
+			timers_arm_event(e);
 
-		/* Lock timers access */
-		pthread_mutex_lock(&h->mutex);
+	/* Unlock timers access */
+	pthread_mutex_unlock(&h->mutex);
+	loop_unlock(h->loop);
+}
 
-		/* Process timers */
-		for(t = h->timers; t != NULL; t = t->next)
-		{
-			/* Process events */
-			for(e = t->events; e != NULL; e = e->next)
-			{
-				/* Check event */
-				if(e->enable && e->next_wakeup < now)
-				{
-					/* Do task */
-					e->cb(e->user_data);
-
-					/* Update event */
-					if(e->type == TIMER_ONE_SHUT ||
-					   e->type == TIMER_DATE)
-						e->enable = 0;
-					else
-						timers_update_time(e);
-				}
-			}
-		}
+static void timers_process(void *user_data)
+{
+	struct timer_event *e = user_data;
+	struct timers_handle *h = e->timers;
 
-		/* Unlock timers access */
+	/* Lock timers access */
+	pthread_mutex_lock(&h->mutex);
+
+	/* Date not reached after a maximum timeout */
+	if((e->type == TIMER_DATE || e->type == TIMER_TIME) &&
+	   e->next_wakeup > time(NULL))
+	{
+		timers_arm_event(e);
 		pthread_mutex_unlock(&h->mutex);
+		return;
+	}
 
-		/* Prepare sleep: 1 minute */
-		ts.tv_sec = now + 60;
-		ts.tv_nsec = 0;
+	/* Do task */
+	e->cb(e->user_data);
 
-		/* Sleep or wait stop signal */
-		pthread_cond_timedwait(&h->cond, &mutex, &ts);
+	/* Update event: periodic events are armed again by loop */
+	switch(e->type)
+	{
+		case TIMER_ONE_SHUT:
+		case TIMER_ONE_SHUT_MS:
+		case TIMER_DATE:
+			e->enable = 0;
+			break;
+		case TIMER_TIME:
+			timers_update_time(e);
+			timers_arm_event(e);
+			break;
+		default:
+			break;
 	}
 
-	/* Unlock condition */
-	pthread_mutex_unlock(&mutex);
-
-	return NULL;
+	/* Unlock timers access */
+	pthread_mutex_unlock(&h->mutex);
 }
 
 void timers_close(struct timers_handle *h)
@@ -249,14 +300,12 @@ void timers_close(struct timers_handle *h)
 	while(h->timers != NULL)
 	{
 		t = h->timers;
-		h->timers = t->next;
 
-		/* Free event */
+		/* Free events and remove timer from list */
 		timer_close(t);
 	}
 
-	/* Destroy mutex and cond */
-	pthread_cond_destroy(&h->cond);
+	/* Destroy mutex */
 	pthread_mutex_destroy(&h->mutex);
 
 	/* Free handle */
@@ -297,6 +346,7 @@ int timer_event_add(struct timer_handle *h, const char *name,
 		    int enable, enum timer_type type, uint64_t value,
 		    enum timer_day day)
 {
+	struct loop_handle *loop = h->timers->loop;
 	struct timer_event *e;
 
 	/* Check event */
@@ -321,6 +371,7 @@ int timer_event_add(struct timer_handle *h, const char *name,
 	e->time = value;
 	e->day = day;
 	e->next_wakeup = time(NULL);
+	e->timers = h->timers;
 
 	/* Disable event if date is passed */
 	if(type == TIMER_DATE && (e->time + 60) < e->next_wakeup)
@@ -330,27 +381,46 @@ int timer_event_add(struct timer_handle *h, const char *name,
 	if(e->enable)
 		timers_update_time(e);
 
-	/* Lock timers access */
+	/* Add a loop timer armed on next wake up */
+	e->timer = loop_add_timer(loop, -1, 0, timers_process, e);
+	if(e->timer == NULL)
+	{
+		if(e->name != NULL)
+			free(e->name);
+		if(e->description != NULL)
+			free(e->description);
+		free(e);
+		return -1;
+	}
+
+	/* Lock loop and timers access */
+	loop_lock(loop);
 	pthread_mutex_lock(&h->timers->mutex);
 
 	/* Add to list */
 	e->next = h->events;
 	h->events = e;
 
+	/* Arm event */
+	timers_arm_event(e);
+
 	/* Unlock timers access */
 	pthread_mutex_unlock(&h->timers->mutex);
+	loop_unlock(loop);
 
 	return 0;
 }
 
 int timer_event_enable(struct timer_handle *h, const char *id, int enable)
 {
+	struct loop_handle *loop = h->timers->loop;
 	struct timer_event *e;
 
-	/* Lock timers access */
+	/* Lock loop and timers access */
+	loop_lock(loop);
 	pthread_mutex_lock(&h->timers->mutex);
 
-	/* Find event and remove from list */
+	/* Find event */
 	for(e = h->events; e != NULL; e = e->next)
 	{
 		if(strcmp(e->id, id) == 0)
@@ -358,23 +428,29 @@ int timer_event_enable(struct timer_handle *h, const char *id, int enable)
 			/* Enable/Disable event */
 			e->enable = enable;
 
-			/* Update event */
+			/* Update event and its loop timer */
 			timers_update_time(e);
+			timers_arm_event(e);
 
 			/* Unlock timers access */
 			pthread_mutex_unlock(&h->timers->mutex);
+			loop_unlock(loop);
 			return 0;
 		}
 	}
 
 	/* Unlock timers access */
 	pthread_mutex_unlock(&h->timers->mutex);
+	loop_unlock(loop);
 
 	return -1;
 }
 
 static void timer_event_free(struct timer_event *e)
 {
+	/* Remove loop timer: event is not called anymore */
+	loop_remove_timer(e->timer);
+
 	/* Free strings */
 	if(e->name != NULL)
 		free(e->name);
@@ -387,45 +463,52 @@ static void timer_event_free(struct timer_event *e)
 
 int timer_event_remove(struct timer_handle *h, const char *id)
 {
+	struct loop_handle *loop = h->timers->loop;
 	struct timer_event **ep, *e = NULL;
 
-	/* Lock timers access */
+	/* Lock loop and timers access */
+	loop_lock(loop);
 	pthread_mutex_lock(&h->timers->mutex);
 
 	/* Find event and remove from list */
-	ep = &h->events;
-	while((*ep) != NULL)
+	for(ep = &h->events; *ep != NULL; ep = &(*ep)->next)
 	{
-		e = *ep;
-		if(strcmp(e->id, id) == 0)
+		if(strcmp((*ep)->id, id) == 0)
 		{
+			e = *ep;
 			*ep = e->next;
 			break;
 		}
-		else
-			ep = &e->next;
 	}
 
+	/* Free event */
+	if(e != NULL)
+		timer_event_free(e);
+
 	/* Unlock timers access */
 	pthread_mutex_unlock(&h->timers->mutex);
+	loop_unlock(loop);
 
 	/* Event not found */
 	if(e == NULL)
 		return -1;
 
-	/* Free event */
-	timer_event_free(e);
-
 	return 0;
 }
 
 void timer_close(struct timer_handle *h)
 {
 	struct timer_handle **tp, *t;
+	struct loop_handle *loop;
 	struct timer_event *e;
 
 	if(h == NULL)
 		return;
+	loop = h->timers->loop;
+
+	/* Lock loop and timers access */
+	loop_lock(loop);
+	pthread_mutex_lock(&h->timers->mutex);
 
 	/* Free events */
 	while(h->events != NULL)
@@ -437,13 +520,6 @@ void timer_close(struct timer_handle *h)
 		timer_event_free(e);
 	}
 
-	/* Free strings */
-	if(h->name != NULL)
-		free(h->name);
-
-	/* Lock timers access */
-	pthread_mutex_lock(&h->timers->mutex);
-
 	/* Remove from timer list */
 	tp = &h->timers->timers;
 	while((*tp) != NULL)
@@ -460,6 +536,11 @@ void timer_close(struct timer_handle *h)
 
 	/* Unlock timers access*/
 	pthread_mutex_unlock(&h->timers->mutex);
+	loop_unlock(loop);
+
+	/* Free strings */
+	if(h->name != NULL)
+		free(h->name);
 
 	/* Free handle */
 	free(h);
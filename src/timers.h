@@ -21,11 +21,13 @@
 
 #include "httpd.h"
 #include "timer.h"
+#include "loop.h"
 
 struct timers_handle;
 extern struct url_table timers_urls[];
 
-int timers_open(struct timers_handle **h);
+/* Events are called from loop */
+int timers_open(struct timers_handle **h, struct loop_handle *loop);
 int timers_start(struct timers_handle *h);
 int timers_stop(struct timers_handle *h);
 void timers_close(struct timers_handle *h);